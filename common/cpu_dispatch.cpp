@@ -30,12 +30,50 @@
         "=r" (c), "=r" (d) : "r" (f) : "%eax","%ecx","%edx");
 #endif
 
-static bool force_no_simd = false;
+/* 
+ * leaf 7 (structured extended features) needs ecx = 0 and gives ebx;
+ * cpuid overwrites eax and ecx too, so they are in/out operands
+ */
+#ifdef X86_64
+#define cpuid_leaf7(b, leaf, subleaf) \
+    __asm__ __volatile__("mov %%rbx, %%rsi; cpuid; xchg %%rbx, %%rsi": \
+        "=S" (b), "+a" (leaf), "+c" (subleaf) : : "%edx");
+#else
+#define cpuid_leaf7(b, leaf, subleaf) \
+    __asm__ __volatile__("mov %%ebx, %%esi; cpuid; xchg %%ebx, %%esi": \
+        "=S" (b), "+a" (leaf), "+c" (subleaf) : : "%edx");
+#endif
+
+/* highest standard cpuid leaf (ebx is saved by hand, as above) */
+#ifdef X86_64
+#define cpuid_max_leaf(a) \
+    __asm__ __volatile__("mov %%rbx, %%rsi; cpuid; mov %%rsi, %%rbx": \
+        "=a" (a) : "a" (0) : "%ecx","%edx","%esi");
+#else
+#define cpuid_max_leaf(a) \
+    __asm__ __volatile__("mov %%ebx, %%esi; cpuid; mov %%esi, %%ebx": \
+        "=a" (a) : "a" (0) : "%ecx","%edx","%esi");
+#endif
+
+/* which register state the OS saves on context switches (XCR0) */
+#define xgetbv0(lo) \
+    __asm__ __volatile__("xgetbv" : "=a" (lo) : "c" (0) : "%edx");
+
+/* XCR0: SSE and AVX state, then the AVX-512 opmask and upper ZMM state */
+#define XCR0_AVX 0x06
+#define XCR0_AVX512 0xe6
+
+static cpu_simd_level max_level = CPU_SIMD_AVX512;
 static bool cpuid_done = false;
 static int cpuid_ecx, cpuid_edx;
+static unsigned int cpuid7_ebx, xcr0;
 
-void cpu_force_no_simd( ) {
-    force_no_simd = true;
+void cpu_force_no_simd(bool force) {
+    max_level = force ? CPU_SIMD_NONE : CPU_SIMD_AVX512;
+}
+
+void cpu_limit_simd(cpu_simd_level level) {
+    max_level = level;
 }
 
 static void print_cpu_info( ) {
@@ -53,12 +91,36 @@ static void print_cpu_info( ) {
     if (cpu_sse41_available( )) {
         fprintf(stderr, "SSE41 ");
     }
+    if (cpu_avx2_available( )) {
+        fprintf(stderr, "AVX2 ");
+    }
+    if (cpu_avx512_available( )) {
+        fprintf(stderr, "AVX512 ");
+    }
     fprintf(stderr, "\n");
 }
 
 static void cpuid_init( ) {
+    unsigned int max_leaf, leaf, subleaf;
+
     if (!cpuid_done) {
         cpuid(0x1, cpuid_ecx, cpuid_edx);
+
+        cpuid_max_leaf(max_leaf);
+        if (max_leaf >= 7) {
+            leaf = 7;
+            subleaf = 0;
+            cpuid_leaf7(cpuid7_ebx, leaf, subleaf);
+        }
+
+        /* 
+         * the CPU having AVX is not enough: the OS must save the wider
+         * registers (OSXSAVE says XGETBV can be used to ask)
+         */
+        if (cpuid_ecx & 0x08000000) {
+            xgetbv0(xcr0);
+        }
+
         cpuid_done = true;
 
         print_cpu_info( );
@@ -68,7 +130,7 @@ static void cpuid_init( ) {
 bool cpu_sse2_available( ) {
     cpuid_init( );
 
-    if (force_no_simd) {
+    if (max_level == CPU_SIMD_NONE) {
         return false;
     } else if (cpuid_edx & 0x04000000) {
         return true;
@@ -80,7 +142,7 @@ bool cpu_sse2_available( ) {
 bool cpu_sse3_available( ) {
     cpuid_init( );
     
-    if (force_no_simd) {
+    if (max_level < CPU_SIMD_AVX2) {
         return false;
     } else if (cpuid_ecx & 0x00000001) {
         return true;
@@ -92,7 +154,7 @@ bool cpu_sse3_available( ) {
 bool cpu_ssse3_available( ) {
     cpuid_init( );
     
-    if (force_no_simd) {
+    if (max_level < CPU_SIMD_AVX2) {
         return false;
     } else if (cpuid_ecx & 0x00000200) {
         return true;
@@ -103,7 +165,7 @@ bool cpu_ssse3_available( ) {
 
 bool cpu_sse41_available( ) {
     cpuid_init( );
-    if (force_no_simd) {
+    if (max_level < CPU_SIMD_AVX2) {
         return false;
     } else if (cpuid_ecx & 0x00080000) {
         return true;
@@ -111,3 +173,42 @@ bool cpu_sse41_available( ) {
         return false;
     }
 }
+
+bool cpu_avx2_available( ) {
+    cpuid_init( );
+
+    if (max_level < CPU_SIMD_AVX2) {
+        return false;
+    } else if ((cpuid_ecx & 0x10000000) && (xcr0 & XCR0_AVX) == XCR0_AVX
+            && (cpuid7_ebx & 0x00000020)) {
+        return true;
+    } else {
+        return false;
+    }
+}
+
+/* AVX-512 F and BW (the byte and word instructions we need) */
+bool cpu_avx512_available( ) {
+    cpuid_init( );
+
+    if (max_level < CPU_SIMD_AVX512 || !cpu_avx2_available( )) {
+        return false;
+    } else if ((xcr0 & XCR0_AVX512) == XCR0_AVX512
+            && (cpuid7_ebx & 0x00010000) && (cpuid7_ebx & 0x40000000)) {
+        return true;
+    } else {
+        return false;
+    }
+}
+
+cpu_simd_level cpu_best_simd( ) {
+    if (cpu_avx512_available( )) {
+        return CPU_SIMD_AVX512;
+    } else if (cpu_avx2_available( )) {
+        return CPU_SIMD_AVX2;
+    } else if (cpu_sse2_available( )) {
+        return CPU_SIMD_SSE2;
+    } else {
+        return CPU_SIMD_NONE;
+    }
+}
@@ -20,10 +20,29 @@
 #ifndef _OPENREPLAY_CPU_DISPATCH_H
 #define _OPENREPLAY_CPU_DISPATCH_H
 
-void cpu_force_no_simd( );
+enum cpu_simd_level {
+    CPU_SIMD_NONE, CPU_SIMD_SSE2, CPU_SIMD_AVX2, CPU_SIMD_AVX512
+};
+
+/* 
+ * Routines are picked when frames are created, so frames made after
+ * cpu_force_no_simd(false) get the SIMD versions back.
+ */
+void cpu_force_no_simd(bool force = true);
+/* 
+ * use nothing past level, e.g. to compare the tiers; SSE3, SSSE3 and
+ * SSE4.1 count as past CPU_SIMD_SSE2
+ */
+void cpu_limit_simd(cpu_simd_level level);
+
 bool cpu_sse2_available( );
 bool cpu_sse3_available( );
 bool cpu_ssse3_available( );
 bool cpu_sse41_available( );
+/* these also check that the OS saves the AVX (or AVX-512) registers */
+bool cpu_avx2_available( );
+bool cpu_avx512_available( );
+/* the highest level available and allowed */
+cpu_simd_level cpu_best_simd( );
 
 #endif
@@ -21,6 +21,7 @@
 #include "v4l2_input.h"
 #include "posix_util.h"
 #include "thread.h"
+#include "scan_CbYCrY8422.h"
 
 #include <unistd.h>
 #include <fcntl.h>
@@ -29,60 +30,12 @@
 #include <sys/mman.h>
 #include <string.h>
 
-/* upscale a 640 pixel scanline to 1920 */
-static void upscale_scanline(uint8_t *dst_scanline, uint8_t *src_scanline) {
-    const coord_t offset = 0; /* offset within a scanline larger than 640 */
-    uint16_t y0, y1, cb0, cb1, cr0, cr1;
-    /* copy luma values */
-    for (coord_t i = 0; i < 640; i++) {
-        /* luma */
-        dst_scanline[6*i + 1] = src_scanline[2*(i + offset) + 1];
-    }
-
-    /* copy chroma values */
-    for (coord_t i = 0; i < 320; i++) {
-        dst_scanline[12*i + 0] = src_scanline[4*i + 2*offset]; /* Cb */
-        dst_scanline[12*i + 2] = src_scanline[4*i + 2*offset + 2]; /* Cr */
-    }
-
-    /* luma interpolation */
-    for (coord_t i = 0; i < 639; i++) {
-        y0 = dst_scanline[6*i + 1];
-        y1 = dst_scanline[6*i + 7];
-        dst_scanline[6*i + 3] = (2 * y0 + y1) / 3;
-        dst_scanline[6*i + 5] = (2 * y1 + y0) / 3;
-    }
-
-    /* chroma interpolation */
-    for (coord_t i = 0; i < 319; i++) {
-        /* Cb */
-        cb0 = dst_scanline[12 * i + 0];
-        cb1 = dst_scanline[12 * i + 12];
-
-        dst_scanline[12*i + 4] = (2 * cb0 + cb1) / 3;
-        dst_scanline[12*i + 8] = (2 * cb1 + cb0) / 3;
-
-        /* Cr */
-        cr0 = dst_scanline[12 * i + 2];
-        cr1 = dst_scanline[12 * i + 14];
-
-        dst_scanline[12*i +  6] = (2 * cr0 + cr1) / 3;
-        dst_scanline[12*i + 10] = (2 * cr1 + cr0) / 3;
-    }
-}
-
-/* interpolate a scanline between two other scanlines */
-void interpolate_scanline(uint8_t *dst, uint8_t *s1, uint8_t *s2, int interp) {
-    uint16_t i1, i2;
-    for (coord_t i = 0; i < 2*1920; i++) {
-        i1 = s1[i];
-        i2 = s2[i];
-        dst[i] = (i1 * (3 - interp) + i2 * interp) / 3;
-    }
-}
-
-/* upscale a 480i frame to 1080i in some sort of way */
+/* 
+ * upscale a 480i frame to 1080i: a center cut of 360 lines, each field 
+ * tripled in both directions with linear interpolation
+ */
 void do_upscale(RawFrame *out, uint8_t *in) {
+    const CbYCrY8422ScanLines *lines = CbYCrY8422_scan_lines_for_cpu( );
     coord_t offset = 480 / 2 - 180; /* where to start vertically */
 
     /* pass 1: up-scale all scanlines that are direct copies */
@@ -90,30 +43,25 @@ void do_upscale(RawFrame *out, uint8_t *in) {
         /* keep interlaced pairs together */
         uint8_t *even = in + 1280 * (2*i + offset);
         uint8_t *odd = even + 1280; 
-        upscale_scanline(out->scanline(6*i), even);
-        upscale_scanline(out->scanline(6*i + 1), odd);
+        lines->triple_linear(1280, even, out->scanline(6*i));
+        lines->triple_linear(1280, odd, out->scanline(6*i + 1));
     }
 
-    /* pass 2: interpolate scanlines in between */
+    /* pass 2: interpolate scanlines in between, within each field */
     for (coord_t i = 0; i < 179; i++) {
-        interpolate_scanline(out->scanline(6*i+2), /* dst. scanline */
-            out->scanline(6*i), out->scanline(6*i+6), /* source scanlines */
-            1 /* interpolant */
+        lines->blend_thirds(2*1920, 
+            out->scanline(6*i), out->scanline(6*i+6), /* sources */
+            out->scanline(6*i+2), out->scanline(6*i+4) /* dst. */
         );
-        interpolate_scanline(out->scanline(6*i+3), /* dst. scanline */
-            out->scanline(6*i+1), out->scanline(6*i+7), /* source scanlines */
-            1 /* interpolant */
+        lines->blend_thirds(2*1920, 
+            out->scanline(6*i+1), out->scanline(6*i+7), /* sources */
+            out->scanline(6*i+3), out->scanline(6*i+5) /* dst. */
         );
+    }
 
-        interpolate_scanline(out->scanline(6*i+4), /* dst. scanline */
-            out->scanline(6*i), out->scanline(6*i+6), /* source scanlines */
-            2 /* interpolant */
-        );
-        interpolate_scanline(out->scanline(6*i+5), /* dst. scanline */
-            out->scanline(6*i+1), out->scanline(6*i+7), /* source scanlines */
-            2 /* interpolant */
-        );
-            
+    /* nothing below the last scanline of each field to blend with */
+    for (coord_t i = 6*179 + 2; i < 1080; i++) {
+        memcpy(out->scanline(i), out->scanline(i - 2), 2*1920);
     }
 }
 
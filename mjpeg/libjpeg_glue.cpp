@@ -90,8 +90,9 @@ METHODDEF(void) mem_init_destination(j_compress_ptr cinfo) {
 }
 
 METHODDEF(boolean) mem_empty_output_buffer(j_compress_ptr cinfo) {
-    fprintf(stderr, "JPEG output buffer too small!\n");
-    ERREXIT(cinfo, JERR_OUT_OF_MEMORY);
+    /* callers may want to retry with less data, so say what happened */
+    UNUSED(cinfo);
+    throw JpegBufferFullException( );
     return FALSE;
 }
 
@@ -133,3 +134,101 @@ struct jpeg_error_mgr *jpeg_throw_on_error(struct jpeg_error_mgr *error_mgr) {
     return ret;
 }
 
+
+void jpeg_find_scan(const uint8_t *data, size_t size, size_t *sof,
+        size_t &sos, size_t &scan) {
+    size_t pos = 2, length;
+
+    if (sof != NULL) {
+        *sof = 0;
+    }
+
+    if (size < 2 || data[0] != 0xff || data[1] != 0xd8) {
+        throw std::runtime_error("JPEG image has no SOI marker");
+    }
+
+    while (pos + 4 <= size && data[pos] == 0xff) {
+        length = (data[pos + 2] << 8) | data[pos + 3];
+
+        if (data[pos + 1] == 0xc0 && sof != NULL) {
+            *sof = pos;
+        } else if (data[pos + 1] == 0xda && pos + 2 + length <= size) {
+            sos = pos;
+            scan = pos + 2 + length;
+            return;
+        }
+
+        pos += 2 + length;
+    }
+
+    throw std::runtime_error("JPEG image has no scan");
+}
+
+bool jpeg_has_tables(const uint8_t *data, size_t size) {
+    size_t pos = 2, length;
+
+    while (pos + 4 <= size && data[pos] == 0xff) {
+        if (data[pos + 1] == 0xdb || data[pos + 1] == 0xc4) {
+            return true;
+        } else if (data[pos + 1] == 0xda) {
+            return false;
+        }
+
+        length = (data[pos + 2] << 8) | data[pos + 3];
+        pos += 2 + length;
+    }
+
+    return false;
+}
+
+void jpeg_add_tables(const uint8_t *tables, size_t tables_size, 
+        const uint8_t *image, size_t image_size, std::string &out) {
+    if (tables_size < 4 || tables[0] != 0xff || tables[1] != 0xd8
+            || tables[tables_size - 2] != 0xff 
+            || tables[tables_size - 1] != 0xd9) {
+        throw std::runtime_error("bad tables-only JPEG");
+    }
+
+    if (image_size < 2 || image[0] != 0xff || image[1] != 0xd8) {
+        throw std::runtime_error("JPEG image has no SOI marker");
+    }
+
+    /* SOI and the tables from the one, the rest of the other */
+    out.assign((const char *) tables, tables_size - 2);
+    out.append((const char *) image + 2, image_size - 2);
+}
+
+size_t jpeg_image_length(const uint8_t *data, size_t size) {
+    size_t pos, length;
+    uint8_t marker;
+
+    if (size < 2 || data[0] != 0xff || data[1] != 0xd8) {
+        throw std::runtime_error("JPEG image has no SOI marker");
+    }
+
+    pos = 2;
+    while (pos + 2 <= size) {
+        if (data[pos] != 0xff) {
+            /* entropy-coded data */
+            pos++;
+            continue;
+        }
+
+        marker = data[pos + 1];
+        if (marker == 0x00 || marker == 0xff 
+                || (marker >= 0xd0 && marker <= 0xd7)) {
+            /* stuffed byte, fill or restart marker: still in the scan */
+            pos++;
+        } else if (marker == 0xd9) {
+            return pos + 2;
+        } else {
+            if (pos + 4 > size) {
+                break;
+            }
+            length = (data[pos + 2] << 8) | data[pos + 3];
+            pos += 2 + length;
+        }
+    }
+
+    throw std::runtime_error("JPEG image has no EOI marker");
+}
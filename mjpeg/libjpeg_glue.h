@@ -23,6 +23,16 @@
 #include <stdio.h>
 #include "jpeglib.h"
 #include <stdint.h>
+#include <exception>
+#include <string>
+
+/*
+ * Thrown when the buffer given to jpeg_mem_dest (or a buffer being
+ * assembled from several JPEG pieces) fills up.
+ */
+class JpegBufferFullException : public virtual std::exception {
+    const char *what() const throw() { return "JPEG output buffer too small"; }
+};
 
 /* 
  * Some simple routines to set up libjpeg to compress to and decompress from
@@ -37,4 +47,34 @@ GLOBAL(void) jpeg_mem_src(j_decompress_ptr cinfo, void *data, size_t len);
 GLOBAL(void) jpeg_mem_dest(j_compress_ptr cinfo, void *data, size_t *len);
 struct jpeg_error_mgr *jpeg_throw_on_error(struct jpeg_error_mgr *error_mgr);
 
+/*
+ * Walk the markers of a single-scan JPEG image in memory up to its SOS.
+ * Sets sos to the offset of the SOS marker and scan to where the 
+ * entropy-coded data starts, just past the SOS header. If sof is not
+ * NULL it is set to the offset of the SOF0 marker (or 0 if none).
+ * Throws std::runtime_error if there is no scan.
+ */
+void jpeg_find_scan(const uint8_t *data, size_t size, size_t *sof,
+        size_t &sos, size_t &scan);
+
+/* 
+ * True if the JPEG image in memory defines quantization or Huffman 
+ * tables ahead of its scan (false for an abbreviated image).
+ */
+bool jpeg_has_tables(const uint8_t *data, size_t size);
+
+/*
+ * Make a complete JPEG image from an abbreviated one and the tables-only
+ * JPEG (as from jpeg_write_tables) that goes with it.
+ */
+void jpeg_add_tables(const uint8_t *tables, size_t tables_size, 
+        const uint8_t *image, size_t image_size, std::string &out);
+
+/*
+ * Length of the JPEG image at the start of data, through its EOI marker.
+ * Used to split files of back-to-back images (M-JPEG). Throws 
+ * std::runtime_error if no complete image is found.
+ */
+size_t jpeg_image_length(const uint8_t *data, size_t size);
+
 #endif
@@ -0,0 +1,57 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ * 
+ * This file is part of openreplay.
+ * 
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "mjpeg_codec.h"
+#include "xmalloc.h"
+#include <string.h>
+#include <stdlib.h>
+
+Mjpeg422Band::Mjpeg422Band(coord_t maxw_) {
+    maxw = maxw_;
+    data = (uint8_t *) xmalloc(2 * maxw * MAX_LINES, 
+            "Mjpeg422Band", "band data");
+    set_width(maxw);
+}
+
+Mjpeg422Band::~Mjpeg422Band( ) {
+    free(data);
+}
+
+void Mjpeg422Band::set_width(coord_t w_) {
+    uint8_t *cb_data, *cr_data;
+
+    w = w_;
+    cb_data = data + w * MAX_LINES;
+    cr_data = cb_data + w / 2 * MAX_LINES;
+
+    for (int i = 0; i < MAX_LINES; i++) {
+        y[i] = data + i * w;
+        cb[i] = cb_data + i * (w / 2);
+        cr[i] = cr_data + i * (w / 2);
+    }
+}
+
+void Mjpeg422Band::repeat_line(unsigned int src, unsigned int end) {
+    for (unsigned int i = src + 1; i < end; i++) {
+        memcpy(y[i], y[src], w);
+        memcpy(cb[i], cb[src], w / 2);
+        memcpy(cr[i], cr[src], w / 2);
+    }
+}
@@ -24,57 +24,299 @@
 #include <stdio.h>
 #include "jpeglib.h"
 #include "raw_frame.h"
+#include "worker_pool.h"
 
 #include <string>
+#include <vector>
+
+/*
+ * A few lines of planar 4:2:2, enough for one MCU row. The codecs 
+ * stream through one of these between libjpeg and the packed frame,
+ * rather than going through whole-frame planes, so the planar data 
+ * stays in cache.
+ */
+class Mjpeg422Band {
+    public:
+        enum { MAX_LINES = 16 };
+
+        Mjpeg422Band(coord_t maxw);
+        ~Mjpeg422Band( );
+
+        /* lay out the lines for a width of up to maxw */
+        void set_width(coord_t w);
+
+        /* copy line src over the lines after it, up to line end - 1 */
+        void repeat_line(unsigned int src, unsigned int end);
+
+        /* each plane's lines follow one another, so the band is contiguous */
+        JSAMPROW y[MAX_LINES], cb[MAX_LINES], cr[MAX_LINES];
+
+    protected:
+        coord_t maxw, w;
+        uint8_t *data;
+};
 
 class Mjpeg422Encoder {
     public:
+        /*
+         * With threads > 1 the frame is cut into horizontal slices that
+         * are compressed in parallel and joined with restart markers 
+         * into one baseline JPEG, which any decoder can read.
+         */
         Mjpeg422Encoder(coord_t w_, coord_t h_, 
-                int qual = 70, size_t max_frame_size = 524288);
+                int qual = 70, size_t max_frame_size = 524288,
+                unsigned int threads = 1);
+        /* 
+         * Frames smaller than w x h are encoded at their own size (on the
+         * calling thread). Their width must be a multiple of 16.
+         */
         void encode(RawFrame *f);
         void encode_to(RawFrame *f, void *buf, size_t size);
         void *get_data(void) { return jpeg_data; }
         size_t get_data_size(void) { return jpeg_finished_size; }
 
+        /* 
+         * Encode each field of f as its own w x h/2 JPEG, the top field 
+         * (lines 0, 2, 4...) first, back to back in buf.
+         * get_data_size( ) is then the total.
+         */
+        void encode_fields_to(RawFrame *f, void *buf, size_t size);
+        size_t get_field_data_size(int field) { return field_sizes[field]; }
+
         void set_comment(const std::string &com);
 
+        /*
+         * Aim for frames of about target bytes. After each frame the 
+         * quality moves toward whatever gets there, between min_quality
+         * and the quality the encoder was made with. A frame that 
+         * overflows its buffer is encoded again at a lower quality 
+         * instead of being lost. target = 0 turns rate control off.
+         */
+        void set_rate_control(size_t target, int min_quality = 20);
+        int get_quality(void) { return quality; }
+
+        /*
+         * Leave the quantization and Huffman tables out of each JPEG
+         * (making "abbreviated" images). write_tables_to( ) writes them
+         * once as a tables-only JPEG, and returns its size. Rate control
+         * changes the tables, so it can't be combined with this.
+         */
+        void set_abbreviated(bool abbreviated);
+        size_t write_tables_to(void *buf, size_t size);
+
+        /*
+         * Also make a thumbnail 1/factor the size of each frame, taking
+         * every factor'th pixel of every factor'th line (as
+         * CbYCrY8422_scale_1_4 does) while the frame goes through the
+         * encoder, so it costs no extra pass over the frame. After
+         * encode_to( ) or encode_fields_to( ), encode_thumbnail_to( )
+         * compresses it and get_thumbnail( ) returns it as a new frame.
+         */
+        void enable_thumbnail(unsigned int factor, int thumb_quality);
+        void encode_thumbnail_to(void *buf, size_t size);
+        size_t get_thumbnail_size(void) { return thumb_size; }
+        RawFrame *get_thumbnail( );
+
         ~Mjpeg422Encoder( );
     protected:
-        void libjpeg_init( );
+        void libjpeg_init(jpeg_compress_struct *c, jpeg_error_mgr *e);
+        void compress(jpeg_compress_struct *c, Mjpeg422Band *b,
+                coord_t first_line, coord_t lines, coord_t line_step, 
+                bool with_comment);
+        void encode_rate_controlled(RawFrame *f, void *buf, size_t size,
+                bool fields);
+        void encode_frame(RawFrame *f, void *buf, size_t size);
+        void encode_fields(RawFrame *f, void *buf, size_t size);
+        void set_quality(int q);
+        void start_thumbnail( );
+        void sample_thumbnail(Mjpeg422Band *b, coord_t first_line, 
+                coord_t lines, coord_t line_step);
 
         coord_t w, h;
-        uint8_t *y_plane, *cb_plane, *cr_plane;
         uint8_t *jpeg_data;
 
         size_t jpeg_alloc_size, jpeg_finished_size;       
 
         struct jpeg_compress_struct cinfo;
         struct jpeg_error_mgr jerr;
+        Mjpeg422Band band;
 
-        JSAMPARRAY y_scans, cb_scans, cr_scans;
+        /* the frame being encoded */
+        RawFrame *frame;
+
+        size_t field_sizes[2];
 
         std::string comment;
 
         int quality;
+
+        /* rate control */
+        enum { RETRY_QUALITY_STEP = 15 };
+        int min_quality, max_quality;
+        size_t target_size;
+
+        bool abbreviated;
+
+        /* thumbnail planes, thumb_w x thumb_h for the current frame */
+        unsigned int thumb_factor;
+        coord_t thumb_w, thumb_h;
+        uint8_t *thumb_y, *thumb_cb, *thumb_cr;
+        size_t thumb_size;
+        struct jpeg_compress_struct thumb_cinfo;
+        struct jpeg_error_mgr thumb_jerr;
+
+        /* sliced encoding */
+        class SliceJob;
+        friend class SliceJob;
+        class FieldJob;
+        friend class FieldJob;
+
+        struct slice_compressor {
+            slice_compressor(coord_t w) : band(w) { }
+            struct jpeg_compress_struct cinfo;
+            struct jpeg_error_mgr jerr;
+            Mjpeg422Band band;
+        };
+
+        struct slice {
+            uint8_t *data;
+            size_t size;
+        };
+
+        void run_pool(WorkerPool::Job *job, unsigned int n);
+        void encode_slices(void *buf, size_t &size);
+        void encode_slice(unsigned int n, unsigned int thread);
+        void encode_field(unsigned int n, unsigned int thread);
+        void compress_field(jpeg_compress_struct *c, Mjpeg422Band *b,
+                unsigned int n);
+
+        WorkerPool *pool;
+        /* one per pool thread */
+        std::vector<slice_compressor *> compressors;
+        std::vector<slice> slices;
+        coord_t slice_lines;
+        /* 
+         * set by a slice or field that overflowed its buffer; pool 
+         * threads set it at once, so only use __atomic builtins on it
+         */
+        bool slice_overflow;
 };
 
 class Mjpeg422Decoder {
     public:
-        Mjpeg422Decoder(coord_t maxw_, coord_t maxh_);
+        /*
+         * With threads > 1, images with restart markers at MCU row 
+         * boundaries (such as those from a sliced Mjpeg422Encoder) are 
+         * cut at the markers and the pieces decoded in parallel. Other
+         * images are decoded on the calling thread.
+         */
+        Mjpeg422Decoder(coord_t maxw_, coord_t maxh_, 
+                unsigned int threads = 1);
         RawFrame *decode(void *data, size_t size, int scale_down = 1);
         void get_comment(std::string &comment);
+
+        /* 
+         * Tables (a tables-only JPEG) for decoding abbreviated images.
+         * They are only parsed again when they change, so it is cheap to
+         * call this before every decode. Images that carry their own 
+         * tables use those.
+         */
+        void set_tables(const void *tables, size_t size);
         ~Mjpeg422Decoder( );
 
     protected:
-        void libjpeg_init( );
+        void libjpeg_init(jpeg_decompress_struct *c, jpeg_error_mgr *e);
+        void setup_scaling(jpeg_decompress_struct *c, int scale_down);
+        void decompress(jpeg_decompress_struct *c, coord_t first_line);
+        void decompress_band(jpeg_decompress_struct *c, Mjpeg422Band *b,
+                RawFrame *out, coord_t first_line);
         coord_t maxw, maxh;
 
+        /* 
+         * Images whose width is a multiple of 16 stream through the band
+         * and are packed an MCU row at a time. Others are decoded to the
+         * whole-frame planes and packed at the end.
+         */
+        Mjpeg422Band band;
         uint8_t *y_plane, *cb_plane, *cr_plane;
+        uint8_t *pad_line;
         JSAMPARRAY y_scans, cb_scans, cr_scans;
 
         struct jpeg_decompress_struct cinfo;
         struct jpeg_error_mgr jerr;
 
         std::string comment;
+
+        /* 
+         * Tables for abbreviated images, and the generation of them 
+         * each decompressor has loaded (0 for none).
+         */
+        std::string tables;
+        unsigned long tables_generation, cinfo_tables;
+        void load_tables(jpeg_decompress_struct *c, unsigned long &loaded);
+        bool image_has_tables;
+
+        /* sliced decoding */
+        class SliceJob;
+        friend class SliceJob;
+
+        struct slice_decompressor {
+            slice_decompressor(coord_t w) : band(w), tables(0) { }
+            struct jpeg_decompress_struct cinfo;
+            struct jpeg_error_mgr jerr;
+            Mjpeg422Band band;
+            unsigned long tables;
+        };
+
+        /* a run of restart intervals, rebuilt as an image of its own */
+        struct slice {
+            size_t start, end;
+            unsigned int first_interval, n_intervals;
+            uint8_t *data;
+            size_t alloc;
+        };
+
+        bool find_slices(uint8_t *data, size_t size);
+        void decode_slice(unsigned int n, unsigned int thread);
+
+        WorkerPool *pool;
+        /* one per pool thread */
+        std::vector<slice_decompressor *> decompressors;
+        std::vector<slice> slices;
+        /* slices of the current image (buffers are kept for reuse) */
+        unsigned int slices_in_use;
+        /* restart markers within the scan being decoded */
+        std::vector<size_t> restarts;
+
+        /* the image being decoded in slices */
+        uint8_t *slice_src;
+        size_t slice_sof, slice_sos, slice_scan;
+        unsigned int mcu_rows_per_interval;
+        int slice_scale_down;
+        RawFrame *slice_result;
+
+        /* decoding through the band(s) rather than the planes */
+        bool streaming;
+};
+
+/*
+ * Rewrites JPEG images with Huffman tables optimized for each image.
+ * The DCT coefficients are copied as they are, so this is lossless and
+ * much cheaper than decoding and encoding again. Comments and restart
+ * intervals are kept. Meant for clips that are stored for a long time,
+ * not for the real-time path.
+ */
+class MjpegRecoder {
+    public:
+        MjpegRecoder( );
+        ~MjpegRecoder( );
+
+        /* recode one complete (not abbreviated) JPEG image into out */
+        void recode(const void *data, size_t size, std::string &out);
+
+    protected:
+        struct jpeg_decompress_struct dinfo;
+        struct jpeg_compress_struct cinfo;
+        struct jpeg_error_mgr djerr, cjerr;
 };
 #endif
@@ -22,8 +22,38 @@
 #include "xmalloc.h"
 #include <string.h>
 #include <assert.h>
+#include <stdexcept>
 
-Mjpeg422Decoder::Mjpeg422Decoder(coord_t maxw_, coord_t maxh_) {
+/* output lines per input MCU row (8 lines, as we only take 4:2:2) */
+#if JPEG_LIB_VERSION >= 70
+#define MCU_ROW_OUTPUT_LINES(c) ((c)->min_DCT_v_scaled_size)
+#else
+#define MCU_ROW_OUTPUT_LINES(c) ((c)->min_DCT_scaled_size)
+#endif
+
+#define MCU_LINES 8
+
+/* 
+ * libjpeg hands out whole MCU rows, so images whose height is not a
+ * multiple of 8 (such as 540-line fields) need a few lines of scratch 
+ * past the end.
+ */
+#define PAD_LINES 16
+
+class Mjpeg422Decoder::SliceJob : public WorkerPool::Job {
+    public:
+        SliceJob(Mjpeg422Decoder *dec_) : dec(dec_) { }
+
+        void run_item(unsigned int item, unsigned int thread) {
+            dec->decode_slice(item, thread);
+        }
+
+    protected:
+        Mjpeg422Decoder *dec;
+};
+
+Mjpeg422Decoder::Mjpeg422Decoder(coord_t maxw_, coord_t maxh_,
+        unsigned int threads) : band(maxw_) {
     maxw = maxw_;
     maxh = maxh_;
 
@@ -33,12 +63,15 @@ Mjpeg422Decoder::Mjpeg422Decoder(coord_t maxw_, coord_t maxh_) {
     cb_plane = y_plane + maxw * maxh;
     cr_plane = cb_plane + maxw * maxh / 2;
 
-    y_scans = (JSAMPARRAY)
-        xmalloc(sizeof(JSAMPROW) * maxh, "Mjpeg422Decoder", "y_scans");
-    cb_scans = (JSAMPARRAY)
-        xmalloc(sizeof(JSAMPROW) * maxh, "Mjpeg422Decoder", "cb_scans");
-    cr_scans = (JSAMPARRAY)
-        xmalloc(sizeof(JSAMPROW) * maxh, "Mjpeg422Decoder", "cr_scans");
+    pad_line = (uint8_t *) 
+        xmalloc(maxw, "Mjpeg422Decoder", "padding line");
+
+    y_scans = (JSAMPARRAY) xmalloc(sizeof(JSAMPROW) * (maxh + PAD_LINES), 
+            "Mjpeg422Decoder", "y_scans");
+    cb_scans = (JSAMPARRAY) xmalloc(sizeof(JSAMPROW) * (maxh + PAD_LINES), 
+            "Mjpeg422Decoder", "cb_scans");
+    cr_scans = (JSAMPARRAY) xmalloc(sizeof(JSAMPROW) * (maxh + PAD_LINES), 
+            "Mjpeg422Decoder", "cr_scans");
 
     for (int i = 0; i < maxh; i++) {
         y_scans[i] = (JSAMPROW) (y_plane + i * maxw);
@@ -46,11 +79,43 @@ Mjpeg422Decoder::Mjpeg422Decoder(coord_t maxw_, coord_t maxh_) {
         cr_scans[i] = (JSAMPROW) (cr_plane + i * maxw/2);
     }
 
-    libjpeg_init( );
+    libjpeg_init(&cinfo, &jerr);
+
+    tables_generation = 0;
+    cinfo_tables = 0;
+    image_has_tables = true;
+
+    pool = NULL;
+    slice_src = NULL;
+    slice_result = NULL;
+    slices_in_use = 0;
+
+    if (threads > 1) {
+        pool = new WorkerPool(threads);
+
+        for (unsigned int i = 0; i < threads; i++) {
+            slice_decompressor *sd = new slice_decompressor(maxw);
+            libjpeg_init(&sd->cinfo, &sd->jerr);
+            decompressors.push_back(sd);
+        }
+    }
 }
 
 Mjpeg422Decoder::~Mjpeg422Decoder( ) {
+    /* stop the workers before tearing down what they use */
+    delete pool;
+
+    for (unsigned int i = 0; i < decompressors.size( ); i++) {
+        jpeg_destroy_decompress(&decompressors[i]->cinfo);
+        delete decompressors[i];
+    }
+
+    for (unsigned int i = 0; i < slices.size( ); i++) {
+        free(slices[i].data);
+    }
+
     free(y_plane);
+    free(pad_line);
     free(y_scans);
     free(cb_scans);
     free(cr_scans);
@@ -58,97 +123,414 @@ Mjpeg422Decoder::~Mjpeg422Decoder( ) {
     jpeg_destroy_decompress(&cinfo);
 }
 
-void Mjpeg422Decoder::libjpeg_init( ) {
-    memset(&cinfo, 0, sizeof(cinfo));
+void Mjpeg422Decoder::libjpeg_init(jpeg_decompress_struct *c,
+        jpeg_error_mgr *e) {
+    memset(c, 0, sizeof(*c));
 
-    cinfo.err = jpeg_throw_on_error(&jerr);
-    jpeg_create_decompress(&cinfo);
+    c->err = jpeg_throw_on_error(e);
+    jpeg_create_decompress(c);
 }
 
 void Mjpeg422Decoder::get_comment(std::string &com) {
     com = comment;
 }
 
-RawFrame *Mjpeg422Decoder::decode(void *data, size_t size, int scale_down) {
-    JSAMPARRAY planes[3];
-    JDIMENSION scanlines_produced = 0;
+void Mjpeg422Decoder::set_tables(const void *data, size_t size) {
+    if (size == tables.size( ) && memcmp(data, tables.data( ), size) == 0) {
+        return;
+    }
 
-    jpeg_mem_src(&cinfo, data, size);
-    jpeg_save_markers(&cinfo, JPEG_COM, 64);
-    jpeg_read_header(&cinfo, TRUE /* require_image */);
+    tables.assign((const char *) data, size);
+    tables_generation++;
+}
 
-    /* search for a JPEG comment */
-    jpeg_saved_marker_ptr marker = cinfo.marker_list;
+/* 
+ * Give c the current tables, unless it has them already. They stay 
+ * with c until an image with tables of its own replaces them.
+ */
+void Mjpeg422Decoder::load_tables(jpeg_decompress_struct *c, 
+        unsigned long &loaded) {
+    if (loaded == tables_generation || tables.empty( )) {
+        return;
+    }
 
-    while (marker != NULL) {
-        if (marker->marker == JPEG_COM) {
-            comment.assign((char *)marker->data, marker->data_length);
-            break;
-        }
-        marker = marker->next;
+    jpeg_mem_src(c, (void *) tables.data( ), tables.size( ));
+    if (jpeg_read_header(c, FALSE) != JPEG_HEADER_TABLES_ONLY) {
+        jpeg_abort_decompress(c);
+        throw std::runtime_error("Mjpeg422Decoder: bad JPEG tables");
     }
 
-    cinfo.dct_method = JDCT_FASTEST;
-    cinfo.raw_data_out = TRUE;
+    loaded = tables_generation;
+}
+
+void Mjpeg422Decoder::setup_scaling(jpeg_decompress_struct *c, 
+        int scale_down) {
+    c->dct_method = JDCT_FASTEST;
+    c->raw_data_out = TRUE;
 
     /* less than 20, assume it's a ratio... otherwise, assume a max. width */
     if (scale_down < 20) {
-        cinfo.scale_num = 1;
-        cinfo.scale_denom = scale_down;
+        c->scale_num = 1;
+        c->scale_denom = scale_down;
     } else {
         /* crudely fit decompressed results into specified width */
-        cinfo.scale_num = 1;
-        cinfo.scale_denom = 1;
+        c->scale_num = 1;
+        c->scale_denom = 1;
 
-        while ((int)(cinfo.image_width / cinfo.scale_denom) > scale_down) {
-            cinfo.scale_denom++;
+        while ((int)(c->image_width / c->scale_denom) > scale_down) {
+            c->scale_denom++;
         }
     }
+}
 
+/* 
+ * Read all of a started decompression into the planes, from output
+ * line first_line on.
+ */
+void Mjpeg422Decoder::decompress(jpeg_decompress_struct *c, 
+        coord_t first_line) {
+    JSAMPARRAY planes[3];
+    JDIMENSION scanlines_produced = 0;
+    JDIMENSION padded_lines = c->output_height 
+            + MCU_ROW_OUTPUT_LINES(c) - 1;
+
+    padded_lines -= padded_lines % MCU_ROW_OUTPUT_LINES(c);
 
-    if (cinfo.num_components != 3) {
-        throw std::runtime_error("Mjpeg422Decoder: wrong number of components");
+    while (c->output_scanline < c->output_height) {
+        planes[0] = y_scans + first_line + scanlines_produced;
+        planes[1] = cb_scans + first_line + scanlines_produced;
+        planes[2] = cr_scans + first_line + scanlines_produced;
+        scanlines_produced += jpeg_read_raw_data(c, planes,
+                padded_lines - scanlines_produced);
     }
 
-    if (cinfo.comp_info[0].v_samp_factor != 1 
-            || cinfo.comp_info[0].h_samp_factor != 2) {
-        throw std::runtime_error("JPEG not in 4:2:2 format");
+    jpeg_finish_decompress(c);
+}
+
+/*
+ * Read all of a started decompression an MCU row at a time into the 
+ * band, packing each row into out from line first_line on. The output
+ * width must be a multiple of 16.
+ */
+void Mjpeg422Decoder::decompress_band(jpeg_decompress_struct *c, 
+        Mjpeg422Band *b, RawFrame *out, coord_t first_line) {
+    JSAMPARRAY planes[3];
+    JDIMENSION row_lines = MCU_ROW_OUTPUT_LINES(c);
+    JDIMENSION line, n;
+
+    b->set_width(c->output_width);
+    planes[0] = b->y;
+    planes[1] = b->cb;
+    planes[2] = b->cr;
+
+    while (c->output_scanline < c->output_height) {
+        line = c->output_scanline;
+        jpeg_read_raw_data(c, planes, row_lines);
+
+        /* the last MCU row may run past the bottom of the image */
+        n = c->output_height - line;
+        if (n > row_lines) {
+            n = row_lines;
+        }
+
+        out->pack->YCbCr8P422_lines(b->y[0], b->cb[0], b->cr[0], 
+                first_line + line, n);
     }
 
-    if (cinfo.comp_info[1].v_samp_factor != 1
-            || cinfo.comp_info[1].h_samp_factor != 1) {
-        throw std::runtime_error("JPEG not in 4:2:2 format");
+    jpeg_finish_decompress(c);
+}
+
+RawFrame *Mjpeg422Decoder::decode(void *data, size_t size, int scale_down) {
+    RawFrame *result = NULL;
+    SliceJob job(this);
+    bool sliced;
+
+    /* 
+     * a torn or corrupt image can fail anywhere in here; leave the 
+     * decompressor ready for the next frame either way
+     */
+    try {
+        image_has_tables = jpeg_has_tables((uint8_t *) data, size);
+        if (image_has_tables) {
+            /* they will replace whatever cinfo has */
+            cinfo_tables = 0;
+        } else {
+            load_tables(&cinfo, cinfo_tables);
+        }
+
+        jpeg_mem_src(&cinfo, data, size);
+        jpeg_save_markers(&cinfo, JPEG_COM, 64);
+        jpeg_read_header(&cinfo, TRUE /* require_image */);
+
+        /* search for a JPEG comment */
+        jpeg_saved_marker_ptr marker = cinfo.marker_list;
+
+        while (marker != NULL) {
+            if (marker->marker == JPEG_COM) {
+                comment.assign((char *)marker->data, marker->data_length);
+                break;
+            }
+            marker = marker->next;
+        }
+
+        setup_scaling(&cinfo, scale_down);
+
+        if (cinfo.num_components != 3) {
+            throw std::runtime_error(
+                    "Mjpeg422Decoder: wrong number of components");
+        }
+
+        if (cinfo.comp_info[0].v_samp_factor != 1 
+                || cinfo.comp_info[0].h_samp_factor != 2) {
+            throw std::runtime_error("JPEG not in 4:2:2 format");
+        }
+
+        if (cinfo.comp_info[1].v_samp_factor != 1
+                || cinfo.comp_info[1].h_samp_factor != 1) {
+            throw std::runtime_error("JPEG not in 4:2:2 format");
+        }
+
+        if (cinfo.comp_info[2].v_samp_factor != 1
+                || cinfo.comp_info[2].h_samp_factor != 1) {
+            throw std::runtime_error("JPEG not in 4:2:2 format");
+        }
+
+        sliced = (pool != NULL && find_slices((uint8_t *) data, size));
+
+        if (sliced) {
+            /* the slices are decoded by their own decompressors */
+            jpeg_calc_output_dimensions(&cinfo);
+            jpeg_abort_decompress(&cinfo);
+        } else {
+            jpeg_start_decompress(&cinfo);
+        }
+
+        if (cinfo.output_width > maxw || cinfo.output_height > maxh) {
+            throw std::runtime_error("Mjpeg422Decoder: image too large");
+        }
+
+        result = new RawFrame(cinfo.output_width, cinfo.output_height, 
+                RawFrame::CbYCrY8422);
+
+        /* the SIMD packer wants 16-byte aligned rows */
+        streaming = (cinfo.output_width % 16 == 0);
+
+        if (!streaming) {
+            for (unsigned int i = 0; i < cinfo.output_height; i++) {
+                y_scans[i] = y_plane + i * cinfo.output_width;
+                cb_scans[i] = cb_plane + i * (cinfo.output_width / 2);
+                cr_scans[i] = cr_plane + i * (cinfo.output_width / 2);
+            }
+
+            for (unsigned int i = 0; i < PAD_LINES; i++) {
+                y_scans[cinfo.output_height + i] = pad_line;
+                cb_scans[cinfo.output_height + i] = pad_line;
+                cr_scans[cinfo.output_height + i] = pad_line;
+            }
+        }
+
+        if (sliced) {
+            slice_src = (uint8_t *) data;
+            slice_scale_down = scale_down;
+            slice_result = result;
+            pool->run(&job, slices_in_use);
+        } else if (streaming) {
+            decompress_band(&cinfo, &band, result, 0);
+        } else {
+            decompress(&cinfo, 0);
+        }
+
+        if (!streaming) {
+            result->pack->YCbCr8P422(y_plane, cb_plane, cr_plane);
+        }
+    } catch (...) {
+        jpeg_abort_decompress(&cinfo);
+        delete result;
+        throw;
     }
 
-    if (cinfo.comp_info[2].v_samp_factor != 1
-            || cinfo.comp_info[2].h_samp_factor != 1) {
-        throw std::runtime_error("JPEG not in 4:2:2 format");
+    return result;
+}
+
+/*
+ * See if the image can be decoded in slices, and if so divide its 
+ * restart intervals among the slices. That takes a single baseline scan
+ * whose restart intervals are whole MCU rows.
+ */
+bool Mjpeg422Decoder::find_slices(uint8_t *data, size_t size) {
+    unsigned int mcus_per_row, mcu_rows, n_intervals, per_slice, n_slices;
+    unsigned int i, first;
+    size_t pos, end = 0;
+    uint8_t *p;
+
+    if (cinfo.restart_interval == 0 || cinfo.progressive_mode) {
+        return false;
     }
 
-    jpeg_start_decompress(&cinfo);
+    mcus_per_row = (cinfo.image_width + 15) / 16;
+    mcu_rows = (cinfo.image_height + MCU_LINES - 1) / MCU_LINES;
 
-    if (cinfo.output_width > maxw || cinfo.output_height > maxh) {
-        throw std::runtime_error("Mjpeg422Decoder: image too large");
+    if (cinfo.restart_interval % mcus_per_row != 0) {
+        return false;
     }
 
-    for (unsigned int i = 0; i < cinfo.output_height; i++) {
-        y_scans[i] = y_plane + i * cinfo.output_width;
-        cb_scans[i] = cb_plane + i * (cinfo.output_width / 2);
-        cr_scans[i] = cr_plane + i * (cinfo.output_width / 2);
+    mcu_rows_per_interval = cinfo.restart_interval / mcus_per_row;
+    n_intervals = (mcu_rows + mcu_rows_per_interval - 1) 
+            / mcu_rows_per_interval;
+
+    if (n_intervals < 2) {
+        return false;
     }
 
-    while (cinfo.output_scanline < cinfo.output_height) {
-        planes[0] = y_scans + scanlines_produced;
-        planes[1] = cb_scans + scanlines_produced;
-        planes[2] = cr_scans + scanlines_produced;
-        scanlines_produced += jpeg_read_raw_data(&cinfo, planes,
-                cinfo.output_height - scanlines_produced);
+    jpeg_find_scan(data, size, &slice_sof, slice_sos, slice_scan);
+    if (slice_sof == 0) {
+        return false;
     }
 
-    jpeg_finish_decompress(&cinfo);
+    /* find the restart markers, and the end of the scan */
+    restarts.clear( );
+    pos = slice_scan;
+    while (pos + 1 < size) {
+        p = (uint8_t *) memchr(data + pos, 0xff, size - pos - 1);
+        if (p == NULL) {
+            break;
+        }
 
-    RawFrame *result = new RawFrame(cinfo.output_width, cinfo.output_height, 
-            RawFrame::CbYCrY8422);
-    result->pack->YCbCr8P422(y_plane, cb_plane, cr_plane);
-    return result;
+        pos = p - data;
+
+        if (data[pos + 1] == 0x00) {
+            /* stuffed 0xff byte */
+            pos += 2;
+        } else if (data[pos + 1] >= 0xd0 && data[pos + 1] <= 0xd7) {
+            restarts.push_back(pos);
+            pos += 2;
+        } else if (data[pos + 1] == 0xff) {
+            /* fill byte */
+            pos++;
+        } else if (data[pos + 1] == 0xd9) {
+            end = pos;
+            break;
+        } else {
+            /* DNL, a second scan, ... */
+            return false;
+        }
+    }
+
+    if (end == 0 || restarts.size( ) + 1 != n_intervals) {
+        return false;
+    }
+
+    per_slice = (n_intervals + pool->n_threads( ) - 1) / pool->n_threads( );
+    n_slices = (n_intervals + per_slice - 1) / per_slice;
+
+    while (slices.size( ) < n_slices) {
+        slice s;
+        s.data = NULL;
+        s.alloc = 0;
+        slices.push_back(s);
+    }
+
+    for (i = 0; i < n_slices; i++) {
+        slice &s = slices[i];
+        first = i * per_slice;
+
+        s.first_interval = first;
+        s.n_intervals = per_slice;
+        if (first + per_slice > n_intervals) {
+            s.n_intervals = n_intervals - first;
+        }
+
+        s.start = (first == 0) ? slice_scan : restarts[first - 1] + 2;
+        if (first + s.n_intervals == n_intervals) {
+            s.end = end;
+        } else {
+            s.end = restarts[first + s.n_intervals - 1];
+        }
+    }
+
+    slices_in_use = n_slices;
+    return true;
+}
+
+/*
+ * Rebuild a slice as an image of its own: the original headers with 
+ * the height cut down, then its restart intervals with their markers
+ * renumbered from RST0. Decode that and pack it into its lines of 
+ * the result (or into its lines of the planes, if not streaming).
+ */
+void Mjpeg422Decoder::decode_slice(unsigned int n, unsigned int thread) {
+    jpeg_decompress_struct *c = &decompressors[thread]->cinfo;
+    slice &s = slices[n];
+    coord_t first_line, lines, out_line;
+    size_t need, used, seg;
+    unsigned int i, k;
+
+    first_line = s.first_interval * mcu_rows_per_interval * MCU_LINES;
+    lines = s.n_intervals * mcu_rows_per_interval * MCU_LINES;
+    if (first_line + lines > cinfo.image_height) {
+        lines = cinfo.image_height - first_line;
+    }
+
+    need = slice_scan + (s.end - s.start) + 2;
+    if (need > s.alloc) {
+        free(s.data);
+        s.alloc = need;
+        s.data = (uint8_t *) xmalloc(s.alloc, "Mjpeg422Decoder", 
+                "slice data");
+    }
+
+    memcpy(s.data, slice_src, slice_scan);
+    s.data[slice_sof + 5] = lines >> 8;
+    s.data[slice_sof + 6] = lines & 0xff;
+    used = slice_scan;
+
+    seg = s.start;
+    for (i = 0; i + 1 < s.n_intervals; i++) {
+        k = s.first_interval + i;
+        memcpy(s.data + used, slice_src + seg, restarts[k] - seg);
+        used += restarts[k] - seg;
+        s.data[used++] = 0xff;
+        s.data[used++] = 0xd0 + (i % 8);
+        seg = restarts[k] + 2;
+    }
+
+    memcpy(s.data + used, slice_src + seg, s.end - seg);
+    used += s.end - seg;
+    s.data[used++] = 0xff;
+    s.data[used++] = 0xd9;
+
+    try {
+        if (image_has_tables) {
+            decompressors[thread]->tables = 0;
+        } else {
+            load_tables(c, decompressors[thread]->tables);
+        }
+
+        /* 
+         * (void *) picks our jpeg_mem_src; libjpeg's own takes an 
+         * unsigned char * and won't mix with ours on one decompressor.
+         */
+        jpeg_mem_src(c, (void *) s.data, used);
+        jpeg_read_header(c, TRUE);
+        setup_scaling(c, slice_scale_down);
+        jpeg_start_decompress(c);
+
+        out_line = (first_line / MCU_LINES) * MCU_ROW_OUTPUT_LINES(c);
+
+        if (c->output_width != slice_result->w( ) 
+                || out_line + c->output_height > slice_result->h( )) {
+            throw std::runtime_error("Mjpeg422Decoder: slice size mismatch");
+        }
+
+        if (streaming) {
+            decompress_band(c, &decompressors[thread]->band, slice_result,
+                    out_line);
+        } else {
+            decompress(c, out_line);
+        }
+    } catch (...) {
+        /* leave the decompressor ready for the next frame */
+        jpeg_abort_decompress(c);
+        throw;
+    }
 }
@@ -22,83 +22,162 @@
 #include "xmalloc.h"
 #include <string.h>
 #include <assert.h>
+#include <stdexcept>
+
+/* 
+ * Baseline JPEG allows restart intervals of up to 65535 MCUs. 
+ * With 4:2:2 sampling an MCU is 16x8 pixels.
+ */
+#define MAX_RESTART_INTERVAL 65535
+#define MCU_LINES 8
+
+class Mjpeg422Encoder::SliceJob : public WorkerPool::Job {
+    public:
+        SliceJob(Mjpeg422Encoder *enc_) : enc(enc_) { }
+
+        void run_item(unsigned int item, unsigned int thread) {
+            enc->encode_slice(item, thread);
+        }
+
+    protected:
+        Mjpeg422Encoder *enc;
+};
+
+class Mjpeg422Encoder::FieldJob : public WorkerPool::Job {
+    public:
+        FieldJob(Mjpeg422Encoder *enc_) : enc(enc_) { }
+
+        void run_item(unsigned int item, unsigned int thread) {
+            enc->encode_field(item, thread);
+        }
+
+    protected:
+        Mjpeg422Encoder *enc;
+};
 
 Mjpeg422Encoder::Mjpeg422Encoder(coord_t w_, coord_t h_, 
-        int qual, size_t max_frame_size) {
+        int qual, size_t max_frame_size, unsigned int threads) 
+        : band(w_) {
     w = w_;
     h = h_;
     jpeg_alloc_size = max_frame_size;
-    quality = qual;
+    quality = max_quality = qual;
+    min_quality = qual;
+    target_size = 0;
+    abbreviated = false;
+    frame = NULL;
+    slice_overflow = false;
+
+    thumb_factor = 0;
+    thumb_w = thumb_h = 0;
+    thumb_y = thumb_cb = thumb_cr = NULL;
+    thumb_size = 0;
 
     jpeg_data = (uint8_t *)
         xmalloc(jpeg_alloc_size, "Mjpeg422Encoder", "jpeg_data");
 
-    y_plane = (uint8_t *)
-        xmalloc(2 * w * h, "Mjpeg422Encoder", "YCbCr planes");
+    field_sizes[0] = field_sizes[1] = 0;
 
-    /* put the Cb and Cr planes in the same memory chunk as the y plane */
-    cb_plane = y_plane + w * h;
-    cr_plane = cb_plane + w * h / 2;
-    
-    /* allocate arrays of pointers to feed to libjpeg */
-    y_scans = (JSAMPARRAY)
-        xmalloc(sizeof(JSAMPROW) * h, "Mjpeg422Encoder", "y_scans");
-    cb_scans = (JSAMPARRAY)
-        xmalloc(sizeof(JSAMPROW) * h, "Mjpeg422Encoder", "cb_scans");
-    cr_scans = (JSAMPARRAY)
-        xmalloc(sizeof(JSAMPROW) * h, "Mjpeg422Encoder", "cr_scans");
+    libjpeg_init(&cinfo, &jerr);
 
-    for (int i = 0; i < h; i++) {
-        y_scans[i] = (JSAMPROW) (y_plane + i * w);
-        cb_scans[i] = (JSAMPROW) (cb_plane + i * w/2);
-        cr_scans[i] = (JSAMPROW) (cr_plane + i * w/2);
+    jpeg_finished_size = 0;
+
+    /* 
+     * Slices are a whole number of MCU rows, all the same height but 
+     * the last, since the restart interval is fixed for the whole scan.
+     */
+    pool = NULL;
+    slice_lines = h;
+
+    if (threads > 1) {
+        unsigned int mcu_rows = h / MCU_LINES;
+        unsigned int mcus_per_row = w / 16;
+        unsigned int rows = (mcu_rows + threads - 1) / threads;
+
+        if (rows * mcus_per_row > MAX_RESTART_INTERVAL) {
+            rows = MAX_RESTART_INTERVAL / mcus_per_row;
+        }
+
+        if (rows > 0 && rows < mcu_rows) {
+            slice_lines = rows * MCU_LINES;
+        }
     }
 
-    libjpeg_init( );
+    if (slice_lines < h) {
+        unsigned int n_slices = (h + slice_lines - 1) / slice_lines;
 
-    jpeg_finished_size = 0;
+        pool = new WorkerPool(threads);
+
+        for (unsigned int i = 0; i < threads; i++) {
+            slice_compressor *sc = new slice_compressor(w);
+            libjpeg_init(&sc->cinfo, &sc->jerr);
+            compressors.push_back(sc);
+        }
+
+        for (unsigned int i = 0; i < n_slices; i++) {
+            slice s;
+            s.data = (uint8_t *) xmalloc(jpeg_alloc_size, 
+                    "Mjpeg422Encoder", "slice data");
+            s.size = 0;
+            slices.push_back(s);
+        }
+    }
 }
 
 Mjpeg422Encoder::~Mjpeg422Encoder( ) {
+    /* stop the workers before tearing down what they use */
+    delete pool;
+
+    for (unsigned int i = 0; i < compressors.size( ); i++) {
+        jpeg_destroy_compress(&compressors[i]->cinfo);
+        delete compressors[i];
+    }
+
+    for (unsigned int i = 0; i < slices.size( ); i++) {
+        free(slices[i].data);
+    }
+
     free(jpeg_data);
-    free(y_plane);
-    free(y_scans);
-    free(cb_scans);
-    free(cr_scans);
+
+    if (thumb_factor != 0) {
+        free(thumb_y);
+        jpeg_destroy_compress(&thumb_cinfo);
+    }
 
     jpeg_destroy_compress(&cinfo);
 }
 
-void Mjpeg422Encoder::libjpeg_init( ) {
-    memset(&cinfo, 0, sizeof(cinfo));
+void Mjpeg422Encoder::libjpeg_init(jpeg_compress_struct *c, 
+        jpeg_error_mgr *e) {
+    memset(c, 0, sizeof(*c));
 
-    cinfo.err = jpeg_throw_on_error(&jerr);
-    jpeg_create_compress(&cinfo);
+    c->err = jpeg_throw_on_error(e);
+    jpeg_create_compress(c);
 
     /* test if things properly match the DCT size */
     assert(w % 16 == 0);
     assert(h % 8 == 0);
 
-    cinfo.image_width = w;
-    cinfo.image_height = h;
+    c->image_width = w;
+    c->image_height = h;
 
-    cinfo.input_components = 3;
-    jpeg_set_defaults(&cinfo);
-    jpeg_set_quality(&cinfo, quality, false);
-    jpeg_set_colorspace(&cinfo, JCS_YCbCr);
+    c->input_components = 3;
+    jpeg_set_defaults(c);
+    jpeg_set_quality(c, quality, false);
+    jpeg_set_colorspace(c, JCS_YCbCr);
 
-    cinfo.raw_data_in = TRUE;
-    cinfo.dct_method = JDCT_FASTEST;
+    c->raw_data_in = TRUE;
+    c->dct_method = JDCT_FASTEST;
 
     /* Y */
-    cinfo.comp_info[0].v_samp_factor = 1;
-    cinfo.comp_info[0].h_samp_factor = 2;
+    c->comp_info[0].v_samp_factor = 1;
+    c->comp_info[0].h_samp_factor = 2;
     /* Cb */
-    cinfo.comp_info[1].v_samp_factor = 1;
-    cinfo.comp_info[1].h_samp_factor = 1;
+    c->comp_info[1].v_samp_factor = 1;
+    c->comp_info[1].h_samp_factor = 1;
     /* Cr */
-    cinfo.comp_info[2].v_samp_factor = 1;
-    cinfo.comp_info[2].h_samp_factor = 1;
+    c->comp_info[2].v_samp_factor = 1;
+    c->comp_info[2].h_samp_factor = 1;
 }
 
 void Mjpeg422Encoder::set_comment(const std::string &com) {
@@ -106,58 +185,492 @@ void Mjpeg422Encoder::set_comment(const std::string &com) {
 }
 
 void Mjpeg422Encoder::encode(RawFrame *f) {
-    size_t jpeg_size = jpeg_alloc_size;
+    encode_to(f, jpeg_data, jpeg_alloc_size);
+}
+
+void Mjpeg422Encoder::encode_to(RawFrame *f, void *buf, size_t size) {
+    encode_rate_controlled(f, buf, size, false);
+}
 
-    JDIMENSION scanlines_consumed = 0;
+void Mjpeg422Encoder::encode_fields_to(RawFrame *f, void *buf, 
+        size_t size) {
+    encode_rate_controlled(f, buf, size, true);
+}
 
-    JSAMPARRAY planes[3];
+void Mjpeg422Encoder::set_rate_control(size_t target, int min_qual) {
+    if (target != 0 && abbreviated) {
+        throw std::runtime_error(
+                "Mjpeg422Encoder: rate control needs full JPEGs");
+    }
 
-    f->unpack->YCbCr8P422(y_plane, cb_plane, cr_plane);    
-   
-    jpeg_mem_dest(&cinfo, jpeg_data, &jpeg_size);
-    jpeg_start_compress(&cinfo, TRUE);
+    target_size = target;
+    min_quality = (target != 0) ? min_qual : max_quality;
+    set_quality(max_quality);
+}
 
-    /* write JPEG comment */
-    jpeg_write_marker(&cinfo, JPEG_COM, (JOCTET *) comment.c_str( ),
-            comment.length( ) + 1);
-    
-    while (scanlines_consumed < h) {
-        planes[0] = y_scans + scanlines_consumed;
-        planes[1] = cb_scans + scanlines_consumed;
-        planes[2] = cr_scans + scanlines_consumed;
-        scanlines_consumed += jpeg_write_raw_data(&cinfo, planes, 
-                h - scanlines_consumed);
+void Mjpeg422Encoder::set_abbreviated(bool abbr) {
+    if (abbr && target_size != 0) {
+        throw std::runtime_error(
+                "Mjpeg422Encoder: rate control needs full JPEGs");
     }
 
-    jpeg_finish_compress(&cinfo);
+    abbreviated = abbr;
+}
 
-    jpeg_finished_size = jpeg_size;
+size_t Mjpeg422Encoder::write_tables_to(void *buf, size_t size) {
+    jpeg_mem_dest(&cinfo, buf, &size);
+    /* all of them, even if the last image already had them */
+    jpeg_suppress_tables(&cinfo, FALSE);
+    jpeg_write_tables(&cinfo);
+    return size;
 }
 
-void Mjpeg422Encoder::encode_to(RawFrame *f, void *buf, size_t size) {
-    /* FIXME: lots of code in common with encode() */
-    JDIMENSION scanlines_consumed = 0;
+/* set the quality of all the compressors, within the rate control range */
+void Mjpeg422Encoder::set_quality(int q) {
+    if (q < min_quality) {
+        q = min_quality;
+    } else if (q > max_quality) {
+        q = max_quality;
+    }
 
-    JSAMPARRAY planes[3];
+    quality = q;
 
-    f->unpack->YCbCr8P422(y_plane, cb_plane, cr_plane);    
-   
-    jpeg_mem_dest(&cinfo, buf, &size);
-    jpeg_start_compress(&cinfo, TRUE);
+    /* 
+     * Keep to 8-bit quantization tables (baseline JPEG) at low 
+     * qualities, so the slices can still be stitched together.
+     */
+    jpeg_set_quality(&cinfo, quality, true);
+
+    for (unsigned int i = 0; i < compressors.size( ); i++) {
+        jpeg_set_quality(&compressors[i]->cinfo, quality, true);
+    }
+}
+
+/*
+ * Encode f, and under rate control retry at a lower quality whenever it 
+ * overflows buf. libjpeg gives up as soon as the buffer fills, so a 
+ * failed try costs only part of a frame. Afterwards, steer the quality
+ * toward the target for the next frame.
+ */
+void Mjpeg422Encoder::encode_rate_controlled(RawFrame *f, void *buf, 
+        size_t size, bool fields) {
+    for (;;) {
+        try {
+            if (fields) {
+                encode_fields(f, buf, size);
+            } else {
+                encode_frame(f, buf, size);
+            }
+            break;
+        } catch (JpegBufferFullException &) {
+            if (target_size == 0 || quality <= min_quality) {
+                throw;
+            }
+            set_quality(quality - RETRY_QUALITY_STEP);
+        }
+    }
 
-    /* write JPEG comment */
-    jpeg_write_marker(&cinfo, JPEG_COM, (JOCTET *) comment.c_str( ),
-            comment.length( ) + 1);
+    if (target_size != 0) {
+        if (jpeg_finished_size > target_size) {
+            /* about one step for every 10% over */
+            set_quality(quality - 1 - (int) 
+                    ((jpeg_finished_size - target_size) * 10 / target_size));
+        } else if (jpeg_finished_size < target_size - target_size / 10) {
+            set_quality(quality + 1);
+        }
+    }
+}
 
-    while (scanlines_consumed < h) {
-        planes[0] = y_scans + scanlines_consumed;
-        planes[1] = cb_scans + scanlines_consumed;
-        planes[2] = cr_scans + scanlines_consumed;
-        scanlines_consumed += jpeg_write_raw_data(&cinfo, planes, 
-                h - scanlines_consumed);
+void Mjpeg422Encoder::encode_frame(RawFrame *f, void *buf, size_t size) {
+    if (f->w( ) > w || f->h( ) > h || f->w( ) % 16 != 0) {
+        throw std::runtime_error("Mjpeg422Encoder: bad frame size");
     }
 
-    jpeg_finish_compress(&cinfo);
+    frame = f;
+    start_thumbnail( );
+
+    /* the slices are laid out for full-size frames only */
+    if (pool != NULL && f->w( ) == w && f->h( ) == h) {
+        encode_slices(buf, size);
+    } else {
+        jpeg_mem_dest(&cinfo, buf, &size);
+        try {
+            compress(&cinfo, &band, 0, f->h( ), 1, true);
+        } catch (...) {
+            jpeg_abort_compress(&cinfo);
+            throw;
+        }
+    }
 
     jpeg_finished_size = size;
 }
+
+/* 
+ * Compress lines of the frame as a complete JPEG image to c's 
+ * destination: lines first_line, first_line + line_step, ... up to 
+ * lines of them. They go through the band one MCU row at a time.
+ * The frame may be narrower than the encoder.
+ */
+void Mjpeg422Encoder::compress(jpeg_compress_struct *c, Mjpeg422Band *b,
+        coord_t first_line, coord_t lines, coord_t line_step, 
+        bool with_comment) {
+    coord_t done = 0, n;
+    JSAMPARRAY planes[3];
+
+    b->set_width(frame->w( ));
+    planes[0] = b->y;
+    planes[1] = b->cb;
+    planes[2] = b->cr;
+
+    c->image_width = frame->w( );
+    c->image_height = lines;
+
+    if (abbreviated) {
+        jpeg_suppress_tables(c, TRUE);
+    }
+    jpeg_start_compress(c, !abbreviated);
+
+    if (with_comment) {
+        /* write JPEG comment */
+        jpeg_write_marker(c, JPEG_COM, (JOCTET *) comment.c_str( ),
+                comment.length( ) + 1);
+    }
+
+    while (done < lines) {
+        n = lines - done;
+        if (n > MCU_LINES) {
+            n = MCU_LINES;
+        }
+
+        if (line_step == 1) {
+            frame->unpack->YCbCr8P422_lines(b->y[0], b->cb[0], b->cr[0],
+                    first_line + done, n);
+        } else {
+            for (coord_t i = 0; i < n; i++) {
+                frame->unpack->YCbCr8P422_lines(b->y[i], b->cb[i], 
+                        b->cr[i], first_line + (done + i) * line_step, 1);
+            }
+        }
+
+        if (thumb_factor != 0) {
+            sample_thumbnail(b, first_line + done * line_step, n, 
+                    line_step);
+        }
+
+        /* libjpeg takes whole MCU rows; pad with the last line */
+        if (n < MCU_LINES) {
+            b->repeat_line(n - 1, MCU_LINES);
+        }
+
+        jpeg_write_raw_data(c, planes, MCU_LINES);
+        done += n;
+    }
+
+    jpeg_finish_compress(c);
+}
+
+void Mjpeg422Encoder::encode_slice(unsigned int n, unsigned int thread) {
+    jpeg_compress_struct *c = &compressors[thread]->cinfo;
+    coord_t first_line = n * slice_lines;
+    coord_t lines = slice_lines;
+
+    if (first_line + lines > h) {
+        lines = h - first_line;
+    }
+
+    slices[n].size = jpeg_alloc_size;
+    jpeg_mem_dest(c, slices[n].data, &slices[n].size);
+
+    try {
+        /* only the headers of the first slice are kept */
+        compress(c, &compressors[thread]->band, first_line, lines, 1, 
+                n == 0);
+    } catch (JpegBufferFullException &) {
+        jpeg_abort_compress(c);
+        __atomic_store_n(&slice_overflow, true, __ATOMIC_RELEASE);
+        throw;
+    } catch (...) {
+        /* leave the compressor ready for the next frame */
+        jpeg_abort_compress(c);
+        throw;
+    }
+}
+
+/* 
+ * Run a job on the pool. Errors come back from the pool as plain 
+ * runtime_errors, so note overflows on the side to rethrow them as such.
+ */
+void Mjpeg422Encoder::run_pool(WorkerPool::Job *job, unsigned int n) {
+    __atomic_store_n(&slice_overflow, false, __ATOMIC_RELEASE);
+
+    try {
+        pool->run(job, n);
+    } catch (std::runtime_error &) {
+        if (__atomic_load_n(&slice_overflow, __ATOMIC_ACQUIRE)) {
+            throw JpegBufferFullException( );
+        }
+        throw;
+    }
+}
+
+static void append(uint8_t *out, size_t &used, size_t size, 
+        const void *data, size_t length) {
+    if (used + length > size) {
+        throw JpegBufferFullException( );
+    }
+
+    memcpy(out + used, data, length);
+    used += length;
+}
+
+/*
+ * Compress the slices in parallel, then stitch them together: the 
+ * headers of the first slice (with the frame height fixed up and a
+ * restart interval added), then each slice's entropy-coded data with
+ * a restart marker between slices. Each slice's scan starts with fresh
+ * DC predictions and ends padded to a byte, which is exactly what a 
+ * decoder expects around a restart marker.
+ */
+void Mjpeg422Encoder::encode_slices(void *buf, size_t &size) {
+    SliceJob job(this);
+    uint8_t *out = (uint8_t *) buf;
+    size_t used = 0, sof = 0, sos, scan;
+    unsigned int restart_interval;
+    uint8_t marker[6];
+
+    run_pool(&job, slices.size( ));
+
+    jpeg_find_scan(slices[0].data, slices[0].size, &sof, sos, scan);
+    if (sof == 0) {
+        throw std::runtime_error("JPEG slice has no SOF0 marker");
+    }
+
+    /* headers, with the SOF0 height set to the whole frame */
+    append(out, used, size, slices[0].data, sos);
+    out[sof + 5] = h >> 8;
+    out[sof + 6] = h & 0xff;
+
+    /* DRI: restart after every slice */
+    restart_interval = (w / 16) * (slice_lines / MCU_LINES);
+    marker[0] = 0xff;
+    marker[1] = 0xdd;
+    marker[2] = 0;
+    marker[3] = 4;
+    marker[4] = restart_interval >> 8;
+    marker[5] = restart_interval & 0xff;
+    append(out, used, size, marker, 6);
+
+    append(out, used, size, slices[0].data + sos, scan - sos);
+
+    for (unsigned int i = 0; i < slices.size( ); i++) {
+        const slice &s = slices[i];
+
+        if (i > 0) {
+            jpeg_find_scan(s.data, s.size, NULL, sos, scan);
+
+            /* RSTn, n counting 0-7 */
+            marker[0] = 0xff;
+            marker[1] = 0xd0 + ((i - 1) % 8);
+            append(out, used, size, marker, 2);
+        }
+
+        /* entropy-coded data, without the EOI marker */
+        if (s.size < scan + 2) {
+            throw std::runtime_error("JPEG slice truncated");
+        }
+        append(out, used, size, s.data + scan, s.size - scan - 2);
+    }
+
+    marker[0] = 0xff;
+    marker[1] = 0xd9;
+    append(out, used, size, marker, 2);
+
+    size = used;
+}
+
+void Mjpeg422Encoder::encode_fields(RawFrame *f, void *buf, size_t size) {
+    uint8_t *out = (uint8_t *) buf;
+    size_t used = 0;
+
+    if (f->w( ) != w || f->h( ) != h) {
+        throw std::runtime_error("Mjpeg422Encoder: wrong frame size");
+    }
+
+    frame = f;
+    start_thumbnail( );
+
+    if (pool != NULL) {
+        /* one field on each of two threads */
+        FieldJob job(this);
+        run_pool(&job, 2);
+
+        for (int i = 0; i < 2; i++) {
+            append(out, used, size, slices[i].data, slices[i].size);
+            field_sizes[i] = slices[i].size;
+        }
+    } else {
+        for (int i = 0; i < 2; i++) {
+            field_sizes[i] = size - used;
+            jpeg_mem_dest(&cinfo, out + used, &field_sizes[i]);
+            try {
+                compress_field(&cinfo, &band, i);
+            } catch (...) {
+                jpeg_abort_compress(&cinfo);
+                throw;
+            }
+            used += field_sizes[i];
+        }
+    }
+
+    jpeg_finished_size = used;
+}
+
+void Mjpeg422Encoder::encode_field(unsigned int n, unsigned int thread) {
+    jpeg_compress_struct *c = &compressors[thread]->cinfo;
+
+    slices[n].size = jpeg_alloc_size;
+    jpeg_mem_dest(c, slices[n].data, &slices[n].size);
+
+    try {
+        compress_field(c, &compressors[thread]->band, n);
+    } catch (JpegBufferFullException &) {
+        jpeg_abort_compress(c);
+        __atomic_store_n(&slice_overflow, true, __ATOMIC_RELEASE);
+        throw;
+    } catch (...) {
+        jpeg_abort_compress(c);
+        throw;
+    }
+}
+
+void Mjpeg422Encoder::compress_field(jpeg_compress_struct *c, 
+        Mjpeg422Band *b, unsigned int n) {
+    compress(c, b, n, h / 2, 2, true);
+}
+
+void Mjpeg422Encoder::enable_thumbnail(unsigned int factor, 
+        int thumb_quality) {
+    if (thumb_factor != 0) {
+        throw std::runtime_error("Mjpeg422Encoder: thumbnail already on");
+    }
+
+    if (factor == 0 || (w / factor) % 16 != 0) {
+        throw std::runtime_error("Mjpeg422Encoder: bad thumbnail factor");
+    }
+
+    thumb_y = (uint8_t *) xmalloc(2 * (w / factor) * (h / factor), 
+            "Mjpeg422Encoder", "thumbnail planes");
+
+    libjpeg_init(&thumb_cinfo, &thumb_jerr);
+    jpeg_set_quality(&thumb_cinfo, thumb_quality, false);
+
+    thumb_factor = factor;
+}
+
+/* lay out the thumbnail planes for the frame about to be encoded */
+void Mjpeg422Encoder::start_thumbnail( ) {
+    if (thumb_factor == 0) {
+        return;
+    }
+
+    thumb_w = frame->w( ) / thumb_factor;
+    thumb_h = frame->h( ) / thumb_factor;
+
+    if (thumb_w % 16 != 0) {
+        throw std::runtime_error("Mjpeg422Encoder: bad thumbnail width");
+    }
+
+    thumb_cb = thumb_y + thumb_w * thumb_h;
+    thumb_cr = thumb_cb + thumb_w / 2 * thumb_h;
+    thumb_size = 0;
+}
+
+/* 
+ * Keep the lines of the band that land in the thumbnail. Different 
+ * slices or fields fill in different thumbnail lines, so this is safe
+ * to call from several threads at once.
+ */
+void Mjpeg422Encoder::sample_thumbnail(Mjpeg422Band *b, 
+        coord_t first_line, coord_t lines, coord_t line_step) {
+    coord_t line, tl, j;
+    uint8_t *y, *cb, *cr;
+
+    for (coord_t i = 0; i < lines; i++) {
+        line = first_line + i * line_step;
+        tl = line / thumb_factor;
+        if (line % thumb_factor != 0 || tl >= thumb_h) {
+            continue;
+        }
+
+        y = thumb_y + tl * thumb_w;
+        cb = thumb_cb + tl * (thumb_w / 2);
+        cr = thumb_cr + tl * (thumb_w / 2);
+
+        for (j = 0; j < thumb_w; j++) {
+            y[j] = b->y[i][j * thumb_factor];
+        }
+
+        for (j = 0; j < thumb_w / 2; j++) {
+            cb[j] = b->cb[i][j * thumb_factor];
+            cr[j] = b->cr[i][j * thumb_factor];
+        }
+    }
+}
+
+void Mjpeg422Encoder::encode_thumbnail_to(void *buf, size_t size) {
+    JSAMPROW ys[MCU_LINES], cbs[MCU_LINES], crs[MCU_LINES];
+    JSAMPARRAY planes[3];
+    coord_t done = 0, line;
+
+    if (thumb_factor == 0 || thumb_h == 0) {
+        throw std::runtime_error("Mjpeg422Encoder: no thumbnail");
+    }
+
+    planes[0] = ys;
+    planes[1] = cbs;
+    planes[2] = crs;
+
+    try {
+        jpeg_mem_dest(&thumb_cinfo, buf, &size);
+        thumb_cinfo.image_width = thumb_w;
+        thumb_cinfo.image_height = thumb_h;
+        jpeg_start_compress(&thumb_cinfo, TRUE);
+
+        while (done < thumb_h) {
+            for (int i = 0; i < MCU_LINES; i++) {
+                /* pad the last MCU row with the last line */
+                line = done + i;
+                if (line >= thumb_h) {
+                    line = thumb_h - 1;
+                }
+
+                ys[i] = thumb_y + line * thumb_w;
+                cbs[i] = thumb_cb + line * (thumb_w / 2);
+                crs[i] = thumb_cr + line * (thumb_w / 2);
+            }
+
+            jpeg_write_raw_data(&thumb_cinfo, planes, MCU_LINES);
+            done += MCU_LINES;
+        }
+
+        jpeg_finish_compress(&thumb_cinfo);
+    } catch (...) {
+        /* leave the compressor ready for the next thumbnail */
+        jpeg_abort_compress(&thumb_cinfo);
+        throw;
+    }
+
+    thumb_size = size;
+}
+
+RawFrame *Mjpeg422Encoder::get_thumbnail( ) {
+    RawFrame *ret;
+
+    if (thumb_factor == 0 || thumb_h == 0) {
+        throw std::runtime_error("Mjpeg422Encoder: no thumbnail");
+    }
+
+    ret = new RawFrame(thumb_w, thumb_h, RawFrame::CbYCrY8422);
+    ret->pack->YCbCr8P422(thumb_y, thumb_cb, thumb_cr);
+    return ret;
+}
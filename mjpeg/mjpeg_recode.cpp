@@ -0,0 +1,93 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ * 
+ * This file is part of openreplay.
+ * 
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mjpeg_codec.h"
+#include "libjpeg_glue.h"
+#include <stdexcept>
+
+/* 
+ * Room for tables and markers beyond the input size. Optimal codes are
+ * never longer than the ones the image came with, so this is plenty.
+ */
+#define RECODE_SLACK 4096
+
+MjpegRecoder::MjpegRecoder( ) {
+    dinfo.err = jpeg_throw_on_error(&djerr);
+    jpeg_create_decompress(&dinfo);
+    cinfo.err = jpeg_throw_on_error(&cjerr);
+    jpeg_create_compress(&cinfo);
+}
+
+MjpegRecoder::~MjpegRecoder( ) {
+    jpeg_destroy_compress(&cinfo);
+    jpeg_destroy_decompress(&dinfo);
+}
+
+void MjpegRecoder::recode(const void *data, size_t size, 
+        std::string &out) {
+    jvirt_barray_ptr *coefs;
+    jpeg_saved_marker_ptr marker;
+    size_t out_size = size + RECODE_SLACK;
+
+    if (!jpeg_has_tables((const uint8_t *) data, size)) {
+        throw std::runtime_error("MjpegRecoder: abbreviated image");
+    }
+
+    jpeg_mem_src(&dinfo, (void *) data, size);
+    jpeg_save_markers(&dinfo, JPEG_COM, 0xffff);
+
+    try {
+        jpeg_read_header(&dinfo, TRUE);
+        coefs = jpeg_read_coefficients(&dinfo);
+
+        for (;;) {
+            out.resize(out_size);
+
+            jpeg_copy_critical_parameters(&dinfo, &cinfo);
+            cinfo.optimize_coding = TRUE;
+            /* sliced decoding relies on these */
+            cinfo.restart_interval = dinfo.restart_interval;
+
+            try {
+                jpeg_mem_dest(&cinfo, &out[0], &out_size);
+                jpeg_write_coefficients(&cinfo, coefs);
+
+                for (marker = dinfo.marker_list; marker != NULL; 
+                        marker = marker->next) {
+                    jpeg_write_marker(&cinfo, marker->marker, 
+                            marker->data, marker->data_length);
+                }
+
+                jpeg_finish_compress(&cinfo);
+                break;
+            } catch (JpegBufferFullException &) {
+                /* should not happen, but it is not worth failing over */
+                jpeg_abort_compress(&cinfo);
+                out_size = 2 * out.size( );
+            }
+        }
+
+        out.resize(out_size);
+        jpeg_finish_decompress(&dinfo);
+    } catch (...) {
+        jpeg_abort_compress(&cinfo);
+        jpeg_abort_decompress(&dinfo);
+        throw;
+    }
+}
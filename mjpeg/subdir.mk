@@ -1,5 +1,7 @@
 mjpeg_OBJECTS = \
 	mjpeg/libjpeg_glue.o \
+	mjpeg/mjpeg_band.o \
 	mjpeg/mjpeg_encode.o \
+	mjpeg/mjpeg_recode.o \
     mjpeg/mjpeg_decode.o \
 
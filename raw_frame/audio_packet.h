@@ -39,6 +39,8 @@ class AudioPacket {
 
         /* save audio packet to a block of memory */
         void serialize(void *dest, size_t size);
+        /* number of bytes serialize() writes */
+        size_t serialized_size( ) { return sizeof(struct sdata) + _size; }
 
         uint8_t *data( ) { return _data; }
         size_t size( ) { return _size; }
@@ -60,7 +62,7 @@ class AudioPacket {
             unsigned int _rate;
             unsigned int _channels;
             size_t _sample_size;
-            uint8_t data[0];
+            uint8_t _data[0];
         };
 
         uint8_t *_data;
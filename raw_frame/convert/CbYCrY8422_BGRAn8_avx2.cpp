@@ -0,0 +1,212 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ * 
+ * This file is part of openreplay.
+ * 
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * AVX2 versions of the SSE2 CbYCrY8422 -> BGRAn8 routines. Each 128-bit
+ * lane does exactly what the SSE2 code does to one register, so the
+ * results are identical; only the loads and stores differ. Whatever is
+ * left over at the end of a line goes to the SSE2 code.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <immintrin.h>
+
+extern "C" void CbYCrY8422_BGRAn8_vector(size_t, uint8_t *, uint8_t *);
+extern "C" void CbYCrY8422_BGRAn8_scale_line_1_2_vector(size_t src_size, 
+        uint8_t *src, uint8_t *dst);
+extern "C" void CbYCrY8422_BGRAn8_scale_line_1_4_vector(size_t src_size, 
+        uint8_t *src, uint8_t *dst);
+
+#define AVX2 __attribute__((target("avx2")))
+
+/* 
+ * Convert 16 CbYCrY pixels and store them as 16 BGRA pixels. See
+ * CbYCrY8422_BGRAn8_vector.asm for what the constants mean.
+ */
+static inline AVX2 void convert_store(__m256i src, uint8_t *dst) {
+    const __m256i zero = _mm256_setzero_si256( );
+    const __m256i lsb_mask = _mm256_set1_epi16(0xff);
+    const __m256i rgb_scale = _mm256_set1_epi16((short) 38154);
+    const __m256i alpha = _mm256_set1_epi32(0xff000000);
+    __m256i y, u, v, t, lo, hi;
+
+    u = _mm256_shufflelo_epi16(src, 0xa0);
+    u = _mm256_shufflehi_epi16(u, 0xa0);
+    u = _mm256_and_si256(u, lsb_mask);
+
+    v = _mm256_shufflelo_epi16(src, 0xf5);
+    v = _mm256_shufflehi_epi16(v, 0xf5);
+    v = _mm256_and_si256(v, lsb_mask);
+
+    y = _mm256_srli_epi16(src, 8);
+    y = _mm256_subs_epu16(y, _mm256_set1_epi16(16));
+
+    /* B and R */
+    u = _mm256_mulhi_epu16(_mm256_slli_epi16(u, 1), 
+            _mm256_set1_epi16((short) 59447));
+    v = _mm256_mulhi_epu16(_mm256_slli_epi16(v, 1), 
+            _mm256_set1_epi16((short) 50451));
+    u = _mm256_subs_epu16(_mm256_adds_epu16(u, y), _mm256_set1_epi16(232));
+    v = _mm256_subs_epu16(_mm256_adds_epu16(v, y), _mm256_set1_epi16(197));
+
+    /* G */
+    t = _mm256_mulhi_epu16(u, _mm256_set1_epi16(4731));
+    y = _mm256_subs_epu16(y, t);
+    t = _mm256_mulhi_epu16(v, _mm256_set1_epi16(13933));
+    y = _mm256_subs_epu16(y, t);
+    y = _mm256_mulhi_epu16(_mm256_slli_epi16(y, 1), 
+            _mm256_set1_epi16((short) 45817));
+
+    /* scale to 0-255 and saturate */
+    y = _mm256_mulhi_epu16(_mm256_slli_epi16(y, 1), rgb_scale);
+    u = _mm256_mulhi_epu16(_mm256_slli_epi16(u, 1), rgb_scale);
+    v = _mm256_mulhi_epu16(_mm256_slli_epi16(v, 1), rgb_scale);
+    y = _mm256_unpacklo_epi8(_mm256_packus_epi16(y, zero), zero);
+    u = _mm256_unpacklo_epi8(_mm256_packus_epi16(u, zero), zero);
+    v = _mm256_unpacklo_epi8(_mm256_packus_epi16(v, zero), zero);
+
+    /* to BGRA */
+    lo = _mm256_slli_epi32(_mm256_unpacklo_epi16(y, zero), 8);
+    hi = _mm256_slli_epi32(_mm256_unpackhi_epi16(y, zero), 8);
+    lo = _mm256_or_si256(lo, _mm256_unpacklo_epi16(u, zero));
+    hi = _mm256_or_si256(hi, _mm256_unpackhi_epi16(u, zero));
+    lo = _mm256_or_si256(lo, 
+            _mm256_slli_epi32(_mm256_unpacklo_epi16(v, zero), 16));
+    hi = _mm256_or_si256(hi, 
+            _mm256_slli_epi32(_mm256_unpackhi_epi16(v, zero), 16));
+    lo = _mm256_or_si256(lo, alpha);
+    hi = _mm256_or_si256(hi, alpha);
+
+    /* each lane made 8 pixels: 4 in lo and the next 4 in hi */
+    _mm256_storeu_si256((__m256i *) dst, 
+            _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256((__m256i *) (dst + 32), 
+            _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+AVX2 void CbYCrY8422_BGRAn8_avx2(size_t n, uint8_t *src, uint8_t *dst) {
+    while (n >= 32) {
+        convert_store(_mm256_loadu_si256((__m256i *) src), dst);
+        src += 32;
+        dst += 64;
+        n -= 32;
+    }
+
+    if (n > 0) {
+        CbYCrY8422_BGRAn8_vector(n, src, dst);
+    }
+}
+
+/* every other pixel pair */
+static AVX2 void scale_line_1_2(size_t n, uint8_t *src, uint8_t *dst) {
+    const __m256i even = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+    __m256i a, b;
+
+    while (n >= 64) {
+        a = _mm256_permutevar8x32_epi32(
+                _mm256_loadu_si256((__m256i *) src), even);
+        b = _mm256_permutevar8x32_epi32(
+                _mm256_loadu_si256((__m256i *) (src + 32)), even);
+        convert_store(_mm256_permute2x128_si256(a, b, 0x20), dst);
+        src += 64;
+        dst += 64;
+        n -= 64;
+    }
+
+    if (n > 0) {
+        CbYCrY8422_BGRAn8_scale_line_1_2_vector(n, src, dst);
+    }
+}
+
+/* 
+ * Cb and the first Y of one pixel pair, with Cr and the second Y of
+ * the pair after next, out of each four pairs (like the SSE2 code).
+ * The four from each lane land in dword slot of the lane.
+ */
+static inline AVX2 __m256i pick_1_4(int slot) {
+    int8_t mask[32];
+
+    memset(mask, -1, sizeof(mask));
+    for (int lane = 0; lane < 32; lane += 16) {
+        mask[lane + 4 * slot] = 0;
+        mask[lane + 4 * slot + 1] = 1;
+        mask[lane + 4 * slot + 2] = 10;
+        mask[lane + 4 * slot + 3] = 11;
+    }
+
+    return _mm256_loadu_si256((__m256i *) mask);
+}
+
+static AVX2 void scale_line_1_4(size_t n, uint8_t *src, uint8_t *dst) {
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    __m256i pick[4], v;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        pick[i] = pick_1_4(i);
+    }
+
+    while (n >= 128) {
+        v = _mm256_shuffle_epi8(_mm256_loadu_si256((__m256i *) src), 
+                pick[0]);
+        for (i = 1; i < 4; i++) {
+            v = _mm256_or_si256(v, _mm256_shuffle_epi8(
+                    _mm256_loadu_si256((__m256i *) (src + 32 * i)), 
+                    pick[i]));
+        }
+        convert_store(_mm256_permutevar8x32_epi32(v, order), dst);
+        src += 128;
+        dst += 64;
+        n -= 128;
+    }
+
+    if (n > 0) {
+        CbYCrY8422_BGRAn8_scale_line_1_4_vector(n, src, dst);
+    }
+}
+
+AVX2 void CbYCrY8422_BGRAn8_scale_1_2_avx2(size_t n, uint8_t *src,
+        uint8_t *dst, unsigned int s_pitch) {
+    size_t n_scans = n / s_pitch;
+    size_t j = 0;
+
+    while (j < n_scans) {
+        scale_line_1_2(s_pitch, src, dst);
+        src += 2*s_pitch;
+        dst += s_pitch;
+
+        j += 2;
+    }
+}
+
+AVX2 void CbYCrY8422_BGRAn8_scale_1_4_avx2(size_t n, uint8_t *src,
+        uint8_t *dst, unsigned int s_pitch) {
+    size_t n_scans = n / s_pitch;
+    size_t j = 0;
+
+    while (j < n_scans - 2) {
+        scale_line_1_4(s_pitch, src, dst);
+        src += 4*s_pitch;
+        dst += s_pitch / 2;
+
+        j += 4;
+    }
+}
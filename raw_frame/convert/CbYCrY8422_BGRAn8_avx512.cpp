@@ -0,0 +1,213 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ * 
+ * This file is part of openreplay.
+ * 
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * AVX-512 (F and BW) versions of the CbYCrY8422 -> BGRAn8 routines.
+ * Like the AVX2 ones, each 128-bit lane matches the SSE2 code exactly,
+ * and what is left at the end of a line goes to the AVX2 code.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <immintrin.h>
+
+void CbYCrY8422_BGRAn8_avx2(size_t, uint8_t *, uint8_t *);
+extern "C" void CbYCrY8422_BGRAn8_scale_line_1_2_vector(size_t src_size, 
+        uint8_t *src, uint8_t *dst);
+extern "C" void CbYCrY8422_BGRAn8_scale_line_1_4_vector(size_t src_size, 
+        uint8_t *src, uint8_t *dst);
+
+#define AVX512 __attribute__((target("avx512f,avx512bw")))
+
+/* gcc 12's own _mm512_undefined_epi32( ) trips this at -O2 */
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+/* 
+ * Convert 32 CbYCrY pixels and store them as 32 BGRA pixels. See
+ * CbYCrY8422_BGRAn8_vector.asm for what the constants mean.
+ */
+static inline AVX512 void convert_store(__m512i src, uint8_t *dst) {
+    const __m512i zero = _mm512_setzero_si512( );
+    const __m512i lsb_mask = _mm512_set1_epi16(0xff);
+    const __m512i rgb_scale = _mm512_set1_epi16((short) 38154);
+    const __m512i alpha = _mm512_set1_epi32(0xff000000);
+    const __m512i first = _mm512_setr_epi64(0, 1, 8, 9, 2, 3, 10, 11);
+    const __m512i second = _mm512_setr_epi64(4, 5, 12, 13, 6, 7, 14, 15);
+    __m512i y, u, v, t, lo, hi;
+
+    u = _mm512_shufflelo_epi16(src, 0xa0);
+    u = _mm512_shufflehi_epi16(u, 0xa0);
+    u = _mm512_and_si512(u, lsb_mask);
+
+    v = _mm512_shufflelo_epi16(src, 0xf5);
+    v = _mm512_shufflehi_epi16(v, 0xf5);
+    v = _mm512_and_si512(v, lsb_mask);
+
+    y = _mm512_srli_epi16(src, 8);
+    y = _mm512_subs_epu16(y, _mm512_set1_epi16(16));
+
+    /* B and R */
+    u = _mm512_mulhi_epu16(_mm512_slli_epi16(u, 1), 
+            _mm512_set1_epi16((short) 59447));
+    v = _mm512_mulhi_epu16(_mm512_slli_epi16(v, 1), 
+            _mm512_set1_epi16((short) 50451));
+    u = _mm512_subs_epu16(_mm512_adds_epu16(u, y), _mm512_set1_epi16(232));
+    v = _mm512_subs_epu16(_mm512_adds_epu16(v, y), _mm512_set1_epi16(197));
+
+    /* G */
+    t = _mm512_mulhi_epu16(u, _mm512_set1_epi16(4731));
+    y = _mm512_subs_epu16(y, t);
+    t = _mm512_mulhi_epu16(v, _mm512_set1_epi16(13933));
+    y = _mm512_subs_epu16(y, t);
+    y = _mm512_mulhi_epu16(_mm512_slli_epi16(y, 1), 
+            _mm512_set1_epi16((short) 45817));
+
+    /* scale to 0-255 and saturate */
+    y = _mm512_mulhi_epu16(_mm512_slli_epi16(y, 1), rgb_scale);
+    u = _mm512_mulhi_epu16(_mm512_slli_epi16(u, 1), rgb_scale);
+    v = _mm512_mulhi_epu16(_mm512_slli_epi16(v, 1), rgb_scale);
+    y = _mm512_unpacklo_epi8(_mm512_packus_epi16(y, zero), zero);
+    u = _mm512_unpacklo_epi8(_mm512_packus_epi16(u, zero), zero);
+    v = _mm512_unpacklo_epi8(_mm512_packus_epi16(v, zero), zero);
+
+    /* to BGRA */
+    lo = _mm512_slli_epi32(_mm512_unpacklo_epi16(y, zero), 8);
+    hi = _mm512_slli_epi32(_mm512_unpackhi_epi16(y, zero), 8);
+    lo = _mm512_or_si512(lo, _mm512_unpacklo_epi16(u, zero));
+    hi = _mm512_or_si512(hi, _mm512_unpackhi_epi16(u, zero));
+    lo = _mm512_or_si512(lo, 
+            _mm512_slli_epi32(_mm512_unpacklo_epi16(v, zero), 16));
+    hi = _mm512_or_si512(hi, 
+            _mm512_slli_epi32(_mm512_unpackhi_epi16(v, zero), 16));
+    lo = _mm512_or_si512(lo, alpha);
+    hi = _mm512_or_si512(hi, alpha);
+
+    /* each lane made 8 pixels: 4 in lo and the next 4 in hi */
+    _mm512_storeu_si512(dst, _mm512_permutex2var_epi64(lo, first, hi));
+    _mm512_storeu_si512(dst + 64, 
+            _mm512_permutex2var_epi64(lo, second, hi));
+}
+
+AVX512 void CbYCrY8422_BGRAn8_avx512(size_t n, uint8_t *src, 
+        uint8_t *dst) {
+    while (n >= 64) {
+        convert_store(_mm512_loadu_si512(src), dst);
+        src += 64;
+        dst += 128;
+        n -= 64;
+    }
+
+    if (n > 0) {
+        CbYCrY8422_BGRAn8_avx2(n, src, dst);
+    }
+}
+
+/* every other pixel pair */
+static AVX512 void scale_line_1_2(size_t n, uint8_t *src, uint8_t *dst) {
+    const __m512i even = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14,
+            16, 18, 20, 22, 24, 26, 28, 30);
+
+    while (n >= 128) {
+        convert_store(_mm512_permutex2var_epi32(_mm512_loadu_si512(src), 
+                even, _mm512_loadu_si512(src + 64)), dst);
+        src += 128;
+        dst += 128;
+        n -= 128;
+    }
+
+    if (n > 0) {
+        CbYCrY8422_BGRAn8_scale_line_1_2_vector(n, src, dst);
+    }
+}
+
+/* 
+ * Cb and the first Y of one pixel pair, with Cr and the second Y of
+ * the pair after next, out of each four pairs (like the SSE2 code).
+ * The four bytes from each lane land in dword `slot' of that lane.
+ */
+static inline AVX512 __m512i pick_1_4(int slot) {
+    int8_t mask[64];
+
+    memset(mask, -1, sizeof(mask));
+    for (int lane = 0; lane < 64; lane += 16) {
+        mask[lane + 4 * slot] = 0;
+        mask[lane + 4 * slot + 1] = 1;
+        mask[lane + 4 * slot + 2] = 10;
+        mask[lane + 4 * slot + 3] = 11;
+    }
+
+    return _mm512_loadu_si512(mask);
+}
+
+static AVX512 void scale_line_1_4(size_t n, uint8_t *src, uint8_t *dst) {
+    /* lane l, slot s holds the picks from load s, lane l */
+    const __m512i order = _mm512_setr_epi32(0, 4, 8, 12, 1, 5, 9, 13,
+            2, 6, 10, 14, 3, 7, 11, 15);
+    __m512i pick[4], v;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        pick[i] = pick_1_4(i);
+    }
+
+    while (n >= 256) {
+        v = _mm512_shuffle_epi8(_mm512_loadu_si512(src), pick[0]);
+        for (i = 1; i < 4; i++) {
+            v = _mm512_or_si512(v, _mm512_shuffle_epi8(
+                    _mm512_loadu_si512(src + 64 * i), pick[i]));
+        }
+        convert_store(_mm512_permutexvar_epi32(order, v), dst);
+        src += 256;
+        dst += 128;
+        n -= 256;
+    }
+
+    if (n > 0) {
+        CbYCrY8422_BGRAn8_scale_line_1_4_vector(n, src, dst);
+    }
+}
+
+AVX512 void CbYCrY8422_BGRAn8_scale_1_2_avx512(size_t n, uint8_t *src,
+        uint8_t *dst, unsigned int s_pitch) {
+    size_t n_scans = n / s_pitch;
+    size_t j = 0;
+
+    while (j < n_scans) {
+        scale_line_1_2(s_pitch, src, dst);
+        src += 2*s_pitch;
+        dst += s_pitch;
+
+        j += 2;
+    }
+}
+
+AVX512 void CbYCrY8422_BGRAn8_scale_1_4_avx512(size_t n, uint8_t *src,
+        uint8_t *dst, unsigned int s_pitch) {
+    size_t n_scans = n / s_pitch;
+    size_t j = 0;
+
+    while (j < n_scans - 2) {
+        scale_line_1_4(s_pitch, src, dst);
+        src += 4*s_pitch;
+        dst += s_pitch / 2;
+
+        j += 4;
+    }
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ * 
+ * This file is part of openreplay.
+ * 
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * AVX2 version of CbYCrY8422_CbYCrY8422_scale_1_4_vector. It picks the
+ * same bytes as the SSE2 code, 8 pixel pairs out of 32 per pass.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <immintrin.h>
+
+extern "C" void CbYCrY8422_CbYCrY8422_scale_line_1_4_vector(size_t src_size, 
+        uint8_t *src, uint8_t *dst);
+
+#define AVX2 __attribute__((target("avx2")))
+
+/* 
+ * Cb and the first Y of one pixel pair, with Cr and the second Y of
+ * the pair after next, into dword `slot' of each lane.
+ */
+static inline AVX2 __m256i pick_1_4(int slot) {
+    int8_t mask[32];
+
+    memset(mask, -1, sizeof(mask));
+    for (int lane = 0; lane < 32; lane += 16) {
+        mask[lane + 4 * slot] = 0;
+        mask[lane + 4 * slot + 1] = 1;
+        mask[lane + 4 * slot + 2] = 10;
+        mask[lane + 4 * slot + 3] = 11;
+    }
+
+    return _mm256_loadu_si256((__m256i *) mask);
+}
+
+static AVX2 void scale_line_1_4(size_t n, uint8_t *src, uint8_t *dst) {
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    __m256i pick[4], v;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        pick[i] = pick_1_4(i);
+    }
+
+    while (n >= 128) {
+        v = _mm256_shuffle_epi8(_mm256_loadu_si256((__m256i *) src), 
+                pick[0]);
+        for (i = 1; i < 4; i++) {
+            v = _mm256_or_si256(v, _mm256_shuffle_epi8(
+                    _mm256_loadu_si256((__m256i *) (src + 32 * i)), 
+                    pick[i]));
+        }
+        _mm256_storeu_si256((__m256i *) dst, 
+                _mm256_permutevar8x32_epi32(v, order));
+        src += 128;
+        dst += 32;
+        n -= 128;
+    }
+
+    if (n > 0) {
+        CbYCrY8422_CbYCrY8422_scale_line_1_4_vector(n, src, dst);
+    }
+}
+
+AVX2 void CbYCrY8422_CbYCrY8422_scale_1_4_avx2(size_t n, uint8_t *src,
+        uint8_t *dst, unsigned int s_pitch) {
+    size_t n_scans = n / s_pitch;
+    size_t j = 0;
+
+    while (j < n_scans) {
+        scale_line_1_4(s_pitch, src, dst);
+        src += 4*s_pitch;
+        dst += s_pitch / 4;
+        j += 4;
+    }
+}
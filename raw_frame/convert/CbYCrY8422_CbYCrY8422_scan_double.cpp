@@ -1,41 +1,76 @@
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
-static void CbYCrY8422_double_scanline(uint8_t *dst, uint8_t *src, 
-        size_t src_length) {
-    uint8_t y1, y2, cb, cr;
-    size_t i, dp;
-
-    dp = 0;
-
-    for (i = 0; i < src_length; i += 4) {
-        cb = src[i];
-        y1 = src[i+1];
-        cr = src[i+2];
-        y2 = src[i+3];
-
-        dst[dp+0] = cb;
-        dst[dp+1] = y1;
-        dst[dp+2] = cr;
-        dst[dp+3] = y1;
-        dst[dp+4] = cb;
-        dst[dp+5] = y2;
-        dst[dp+6] = cr;
-        dst[dp+7] = y2;
-
-        dp += 8;
-    }
-}
+#include "scan_CbYCrY8422.h"
 
-void CbYCrY8422_CbYCrY8422_scan_double(size_t src_size, 
-        uint8_t *src, uint8_t *dst, unsigned int src_pitch) {
+void CbYCrY8422_scan_double_frame(const CbYCrY8422ScanLines *lines,
+        bool linear, size_t src_size, uint8_t *src, uint8_t *dst, 
+        unsigned int src_pitch) {
     size_t n_scanlines = src_size / src_pitch;
+    size_t dst_pitch = 2 * src_pitch;
     size_t i;
 
-    for (i = 0; i < n_scanlines; i++) {
-        CbYCrY8422_double_scanline(dst, src, src_pitch);
-        CbYCrY8422_double_scanline(dst + 2*src_pitch, src, src_pitch);
-        dst += 4*src_pitch;
+    if (n_scanlines == 0) {
+        return;
+    }
+
+    if (!linear) {
+        for (i = 0; i < n_scanlines; i++) {
+            lines->double_nearest(src_pitch, src, dst);
+            memcpy(dst + dst_pitch, dst, dst_pitch);
+            dst += 2*dst_pitch;
+            src += src_pitch;
+        }
+        return;
+    }
+
+    /* expand each scanline once, then blend it with the one above */
+    lines->double_linear(src_pitch, src, dst);
+    for (i = 1; i < n_scanlines; i++) {
         src += src_pitch;
+        lines->double_linear(src_pitch, src, dst + 2*dst_pitch);
+        lines->blend_halves(dst_pitch, dst, dst + 2*dst_pitch, 
+                dst + dst_pitch);
+        dst += 2*dst_pitch;
     }
+    memcpy(dst + dst_pitch, dst, dst_pitch);
+}
+
+void CbYCrY8422_CbYCrY8422_scan_double(size_t src_size, 
+        uint8_t *src, uint8_t *dst, unsigned int src_pitch) {
+    CbYCrY8422_scan_double_frame(&CbYCrY8422_scan_lines_default, false,
+            src_size, src, dst, src_pitch);
+}
+
+void CbYCrY8422_CbYCrY8422_scan_double_linear(size_t src_size, 
+        uint8_t *src, uint8_t *dst, unsigned int src_pitch) {
+    CbYCrY8422_scan_double_frame(&CbYCrY8422_scan_lines_default, true,
+            src_size, src, dst, src_pitch);
+}
+
+#ifndef SKIP_ASSEMBLY_ROUTINES
+void CbYCrY8422_CbYCrY8422_scan_double_ssse3(size_t src_size, 
+        uint8_t *src, uint8_t *dst, unsigned int src_pitch) {
+    CbYCrY8422_scan_double_frame(&CbYCrY8422_scan_lines_ssse3, false,
+            src_size, src, dst, src_pitch);
+}
+
+void CbYCrY8422_CbYCrY8422_scan_double_linear_ssse3(size_t src_size, 
+        uint8_t *src, uint8_t *dst, unsigned int src_pitch) {
+    CbYCrY8422_scan_double_frame(&CbYCrY8422_scan_lines_ssse3, true,
+            src_size, src, dst, src_pitch);
+}
+
+void CbYCrY8422_CbYCrY8422_scan_double_avx2(size_t src_size, 
+        uint8_t *src, uint8_t *dst, unsigned int src_pitch) {
+    CbYCrY8422_scan_double_frame(&CbYCrY8422_scan_lines_avx2, false,
+            src_size, src, dst, src_pitch);
+}
+
+void CbYCrY8422_CbYCrY8422_scan_double_linear_avx2(size_t src_size, 
+        uint8_t *src, uint8_t *dst, unsigned int src_pitch) {
+    CbYCrY8422_scan_double_frame(&CbYCrY8422_scan_lines_avx2, true,
+            src_size, src, dst, src_pitch);
 }
+#endif
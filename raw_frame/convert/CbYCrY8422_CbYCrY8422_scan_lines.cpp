@@ -0,0 +1,203 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ *
+ * This file is part of openreplay.
+ *
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "scan_CbYCrY8422.h"
+#include "cpu_dispatch.h"
+
+static void double_nearest(size_t src_length, const uint8_t *src, 
+        uint8_t *dst) {
+    uint8_t y1, y2, cb, cr;
+    size_t i, dp;
+
+    dp = 0;
+
+    for (i = 0; i < src_length; i += 4) {
+        cb = src[i];
+        y1 = src[i+1];
+        cr = src[i+2];
+        y2 = src[i+3];
+
+        dst[dp+0] = cb;
+        dst[dp+1] = y1;
+        dst[dp+2] = cr;
+        dst[dp+3] = y1;
+        dst[dp+4] = cb;
+        dst[dp+5] = y2;
+        dst[dp+6] = cr;
+        dst[dp+7] = y2;
+
+        dp += 8;
+    }
+}
+
+static void double_linear(size_t src_length, const uint8_t *src, 
+        uint8_t *dst) {
+    unsigned int y1, y2, cb, cr, y_next, cb_next, cr_next;
+    size_t i, dp;
+
+    dp = 0;
+
+    for (i = 0; i < src_length; i += 4) {
+        cb = src[i];
+        y1 = src[i+1];
+        cr = src[i+2];
+        y2 = src[i+3];
+
+        /* the next pixel pair, or this one again at the end */
+        if (i + 4 < src_length) {
+            cb_next = src[i+4];
+            y_next = src[i+5];
+            cr_next = src[i+6];
+        } else {
+            cb_next = cb;
+            y_next = y2;
+            cr_next = cr;
+        }
+
+        dst[dp+0] = cb;
+        dst[dp+1] = y1;
+        dst[dp+2] = cr;
+        dst[dp+3] = (y1 + y2 + 1) / 2;
+        dst[dp+4] = (cb + cb_next + 1) / 2;
+        dst[dp+5] = y2;
+        dst[dp+6] = (cr + cr_next + 1) / 2;
+        dst[dp+7] = (y2 + y_next + 1) / 2;
+
+        dp += 8;
+    }
+}
+
+static void triple_nearest(size_t src_length, const uint8_t *src, 
+        uint8_t *dst) {
+    uint8_t y1, y2, cb, cr;
+    size_t i, dp;
+
+    dp = 0;
+
+    for (i = 0; i < src_length; i += 4) {
+        /* load 2 source pixels */
+        cb = src[i];
+        y1 = src[i+1];
+        cr = src[i+2];
+        y2 = src[i+3];
+
+        /* write 6 destination pixels */
+        dst[dp+0] = cb;
+        dst[dp+1] = y1;
+        dst[dp+2] = cr;
+        dst[dp+3] = y1;
+
+        dst[dp+4] = cb;
+        dst[dp+5] = y1;
+        dst[dp+6] = cr;
+        dst[dp+7] = y2;
+
+        dst[dp+8] = cb;
+        dst[dp+9] = y2;
+        dst[dp+10] = cr;
+        dst[dp+11] = y2;
+
+        dp += 12;
+    }
+}
+
+/* a third and two thirds of the way from a to b, rounded */
+static inline uint8_t third(unsigned int a, unsigned int b) {
+    return (2 * a + b + 1) / 3;
+}
+
+static void triple_linear(size_t src_length, const uint8_t *src, 
+        uint8_t *dst) {
+    unsigned int y1, y2, cb, cr, y_next, cb_next, cr_next;
+    size_t i, dp;
+
+    dp = 0;
+
+    for (i = 0; i < src_length; i += 4) {
+        cb = src[i];
+        y1 = src[i+1];
+        cr = src[i+2];
+        y2 = src[i+3];
+
+        if (i + 4 < src_length) {
+            cb_next = src[i+4];
+            y_next = src[i+5];
+            cr_next = src[i+6];
+        } else {
+            cb_next = cb;
+            y_next = y2;
+            cr_next = cr;
+        }
+
+        /* 
+         * 6 luma samples and 3 chroma pairs: the source sample, then 
+         * a third and two thirds of the way to the next one
+         */
+        dst[dp+0] = cb;
+        dst[dp+1] = y1;
+        dst[dp+2] = cr;
+        dst[dp+3] = third(y1, y2);
+
+        dst[dp+4] = third(cb, cb_next);
+        dst[dp+5] = third(y2, y1);
+        dst[dp+6] = third(cr, cr_next);
+        dst[dp+7] = y2;
+
+        dst[dp+8] = third(cb_next, cb);
+        dst[dp+9] = third(y2, y_next);
+        dst[dp+10] = third(cr_next, cr);
+        dst[dp+11] = third(y_next, y2);
+
+        dp += 12;
+    }
+}
+
+static void blend_halves(size_t n, const uint8_t *a, const uint8_t *b, 
+        uint8_t *dst) {
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = (a[i] + b[i] + 1) / 2;
+    }
+}
+
+static void blend_thirds(size_t n, const uint8_t *a, const uint8_t *b,
+        uint8_t *near_a, uint8_t *near_b) {
+    for (size_t i = 0; i < n; i++) {
+        near_a[i] = third(a[i], b[i]);
+        near_b[i] = third(b[i], a[i]);
+    }
+}
+
+const CbYCrY8422ScanLines CbYCrY8422_scan_lines_default = {
+    double_nearest, double_linear, triple_nearest, triple_linear,
+    blend_halves, blend_thirds
+};
+
+const CbYCrY8422ScanLines *CbYCrY8422_scan_lines_for_cpu( ) {
+#ifndef SKIP_ASSEMBLY_ROUTINES
+    if (cpu_avx2_available( )) {
+        return &CbYCrY8422_scan_lines_avx2;
+    } else if (cpu_ssse3_available( )) {
+        return &CbYCrY8422_scan_lines_ssse3;
+    }
+#endif
+    return &CbYCrY8422_scan_lines_default;
+}
@@ -0,0 +1,183 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ *
+ * This file is part of openreplay.
+ *
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * AVX2 versions of the SSSE3 upscaler scanline routines. They work on 
+ * 32 source bytes at a time. vpshufb stays within 128-bit lanes, so each
+ * lane expands its own 16 source bytes with the SSSE3 masks, and the two
+ * halves of each result are stored to their own places.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <immintrin.h>
+
+#include "scan_CbYCrY8422.h"
+
+const int8_t *CbYCrY8422_scan_shuffle_mask(unsigned int factor, 
+        bool linear, unsigned int block, unsigned int vec);
+
+#define AVX2 __attribute__((target("avx2")))
+
+static inline AVX2 __m256i load(const uint8_t *p) {
+    return _mm256_loadu_si256((const __m256i *) p);
+}
+
+/* the SSSE3 mask for one output block, in both lanes */
+static inline AVX2 __m256i mask_for(unsigned int factor, bool linear,
+        unsigned int block, unsigned int vec) {
+    return _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) 
+            CbYCrY8422_scan_shuffle_mask(factor, linear, block, vec)));
+}
+
+static inline AVX2 __m256i neighbors(const uint8_t *src) {
+    const __m256i luma = _mm256_set1_epi16((short) 0xff00);
+
+    return _mm256_or_si256(_mm256_and_si256(luma, load(src + 2)), 
+            _mm256_andnot_si256(luma, load(src + 4)));
+}
+
+static inline AVX2 __m256i third_16(__m256i a, __m256i b) {
+    __m256i sum = _mm256_add_epi16(_mm256_add_epi16(a, a), 
+            _mm256_add_epi16(b, _mm256_set1_epi16(1)));
+    return _mm256_mulhi_epu16(sum, _mm256_set1_epi16(21846));
+}
+
+/* unpacking and packing both stay within lanes, so bytes keep order */
+static inline AVX2 __m256i third(__m256i a, __m256i b) {
+    const __m256i zero = _mm256_setzero_si256( );
+
+    return _mm256_packus_epi16(
+        third_16(_mm256_unpacklo_epi8(a, zero), 
+                _mm256_unpacklo_epi8(b, zero)),
+        third_16(_mm256_unpackhi_epi8(a, zero), 
+                _mm256_unpackhi_epi8(b, zero))
+    );
+}
+
+static inline AVX2 void expand(size_t n, const uint8_t *src, 
+        uint8_t *dst, unsigned int factor, bool linear,
+        void (*finish)(size_t, const uint8_t *, uint8_t *)) {
+    const size_t reach = linear ? 36 : 32;
+    const unsigned int n_vecs = linear ? factor : 1;
+    __m256i mask[3][3], v[3], b, out;
+    unsigned int blk, s;
+    uint8_t *out_lo, *out_hi;
+    size_t i;
+
+    for (blk = 0; blk < factor; blk++) {
+        for (s = 0; s < n_vecs; s++) {
+            mask[blk][s] = mask_for(factor, linear, blk, s);
+        }
+    }
+
+    for (i = 0; i + reach <= n; i += 32) {
+        v[0] = load(src + i);
+        if (linear) {
+            b = neighbors(src + i);
+            if (factor == 2) {
+                v[1] = _mm256_avg_epu8(v[0], b);
+            } else {
+                v[1] = third(v[0], b);
+                v[2] = third(b, v[0]);
+            }
+        }
+
+        /* the high lane's output follows all of the low lane's */
+        for (blk = 0; blk < factor; blk++) {
+            out = _mm256_shuffle_epi8(v[0], mask[blk][0]);
+            for (s = 1; s < n_vecs; s++) {
+                out = _mm256_or_si256(out, 
+                        _mm256_shuffle_epi8(v[s], mask[blk][s]));
+            }
+            out_lo = dst + factor * i + 16 * blk;
+            out_hi = out_lo + 16 * factor;
+            _mm_storeu_si128((__m128i *) out_lo, 
+                    _mm256_castsi256_si128(out));
+            _mm_storeu_si128((__m128i *) out_hi, 
+                    _mm256_extracti128_si256(out, 1));
+        }
+    }
+
+    if (i < n) {
+        finish(n - i, src + i, dst + factor * i);
+    }
+}
+
+static AVX2 void double_nearest(size_t n, const uint8_t *src, 
+        uint8_t *dst) {
+    expand(n, src, dst, 2, false, 
+            CbYCrY8422_scan_lines_ssse3.double_nearest);
+}
+
+static AVX2 void double_linear(size_t n, const uint8_t *src, 
+        uint8_t *dst) {
+    expand(n, src, dst, 2, true, 
+            CbYCrY8422_scan_lines_ssse3.double_linear);
+}
+
+static AVX2 void triple_nearest(size_t n, const uint8_t *src, 
+        uint8_t *dst) {
+    expand(n, src, dst, 3, false, 
+            CbYCrY8422_scan_lines_ssse3.triple_nearest);
+}
+
+static AVX2 void triple_linear(size_t n, const uint8_t *src, 
+        uint8_t *dst) {
+    expand(n, src, dst, 3, true, 
+            CbYCrY8422_scan_lines_ssse3.triple_linear);
+}
+
+static AVX2 void blend_halves(size_t n, const uint8_t *a, 
+        const uint8_t *b, uint8_t *dst) {
+    size_t i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        _mm256_storeu_si256((__m256i *) (dst + i), 
+                _mm256_avg_epu8(load(a + i), load(b + i)));
+    }
+
+    if (i < n) {
+        CbYCrY8422_scan_lines_ssse3.blend_halves(n - i, a + i, b + i, 
+                dst + i);
+    }
+}
+
+static AVX2 void blend_thirds(size_t n, const uint8_t *a, 
+        const uint8_t *b, uint8_t *near_a, uint8_t *near_b) {
+    __m256i va, vb;
+    size_t i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        va = load(a + i);
+        vb = load(b + i);
+        _mm256_storeu_si256((__m256i *) (near_a + i), third(va, vb));
+        _mm256_storeu_si256((__m256i *) (near_b + i), third(vb, va));
+    }
+
+    if (i < n) {
+        CbYCrY8422_scan_lines_ssse3.blend_thirds(n - i, a + i, b + i, 
+                near_a + i, near_b + i);
+    }
+}
+
+const CbYCrY8422ScanLines CbYCrY8422_scan_lines_avx2 = {
+    double_nearest, double_linear, triple_nearest, triple_linear,
+    blend_halves, blend_thirds
+};
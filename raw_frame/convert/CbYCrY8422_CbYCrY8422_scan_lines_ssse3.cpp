@@ -0,0 +1,259 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ *
+ * This file is part of openreplay.
+ *
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * SSSE3 scanline routines for the CbYCrY8422 upscalers. 16 source bytes
+ * (4 pixel pairs) go out as 2 or 3 vectors, each put together with 
+ * pshufb from the source and, when interpolating, from the blends of 
+ * each byte with its neighbor to the right.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <immintrin.h>
+
+#include "scan_CbYCrY8422.h"
+
+#define SSSE3 __attribute__((target("ssse3")))
+
+/*
+ * pshufb masks for each 16-byte output block (2 or 3 of them per 16 
+ * source bytes), one for each vector the block draws from: the source 
+ * itself, then when interpolating the blends of each byte toward its 
+ * neighbor (a half of the way; or a third, then two thirds).
+ *
+ * Doubled, a pixel pair Cb Y0 Cr Y1 turns into Cb Y0 Cr y0 cb Y1 cr y1, 
+ * where lowercase samples are repeats or half blends. Tripled, it turns
+ * into Cb Y0 Cr y0 cb y0' cr Y1 cb' y1 cr' y1', with y0' two thirds of 
+ * the way along.
+ */
+static const int8_t double_nearest_masks[2][1][16] = {
+    {
+        {  0,  1,  2,  1,  0,  3,  2,  3,
+           4,  5,  6,  5,  4,  7,  6,  7 }
+    },
+    {
+        {  8,  9, 10,  9,  8, 11, 10, 11,
+          12, 13, 14, 13, 12, 15, 14, 15 }
+    }
+};
+
+static const int8_t double_linear_masks[2][2][16] = {
+    {
+        {  0,  1,  2, -1, -1,  3, -1, -1,
+           4,  5,  6, -1, -1,  7, -1, -1 },
+        { -1, -1, -1,  1,  0, -1,  2,  3,
+          -1, -1, -1,  5,  4, -1,  6,  7 }
+    },
+    {
+        {  8,  9, 10, -1, -1, 11, -1, -1,
+          12, 13, 14, -1, -1, 15, -1, -1 },
+        { -1, -1, -1,  9,  8, -1, 10, 11,
+          -1, -1, -1, 13, 12, -1, 14, 15 }
+    }
+};
+
+static const int8_t triple_nearest_masks[3][1][16] = {
+    {
+        {  0,  1,  2,  1,  0,  1,  2,  3,
+           0,  3,  2,  3,  4,  5,  6,  5 }
+    },
+    {
+        {  4,  5,  6,  7,  4,  7,  6,  7,
+           8,  9, 10,  9,  8,  9, 10, 11 }
+    },
+    {
+        {  8, 11, 10, 11, 12, 13, 14, 13,
+          12, 13, 14, 15, 12, 15, 14, 15 }
+    }
+};
+
+static const int8_t triple_linear_masks[3][3][16] = {
+    {
+        {  0,  1,  2, -1, -1, -1, -1,  3,
+          -1, -1, -1, -1,  4,  5,  6, -1 },
+        { -1, -1, -1,  1,  0, -1,  2, -1,
+          -1,  3, -1, -1, -1, -1, -1,  5 },
+        { -1, -1, -1, -1, -1,  1, -1, -1,
+           0, -1,  2,  3, -1, -1, -1, -1 }
+    },
+    {
+        { -1, -1, -1,  7, -1, -1, -1, -1,
+           8,  9, 10, -1, -1, -1, -1, 11 },
+        {  4, -1,  6, -1, -1,  7, -1, -1,
+          -1, -1, -1,  9,  8, -1, 10, -1 },
+        { -1,  5, -1, -1,  4, -1,  6,  7,
+          -1, -1, -1, -1, -1,  9, -1, -1 }
+    },
+    {
+        { -1, -1, -1, -1, 12, 13, 14, -1,
+          -1, -1, -1, 15, -1, -1, -1, -1 },
+        { -1, 11, -1, -1, -1, -1, -1, 13,
+          12, -1, 14, -1, -1, 15, -1, -1 },
+        {  8, -1, 10, 11, -1, -1, -1, -1,
+          -1, 13, -1, -1, 12, -1, 14, 15 }
+    }
+};
+
+const int8_t *CbYCrY8422_scan_shuffle_mask(unsigned int factor, 
+        bool linear, unsigned int block, unsigned int vec) {
+    if (factor == 2) {
+        return linear ? double_linear_masks[block][vec] 
+                : double_nearest_masks[block][vec];
+    } else {
+        return linear ? triple_linear_masks[block][vec] 
+                : triple_nearest_masks[block][vec];
+    }
+}
+
+static inline SSSE3 __m128i load(const uint8_t *p) {
+    return _mm_loadu_si128((const __m128i *) p);
+}
+
+/* the next luma sample after each Y, the next pair's chroma for Cb/Cr */
+static inline SSSE3 __m128i neighbors(const uint8_t *src) {
+    const __m128i luma = _mm_set1_epi16((short) 0xff00);
+
+    return _mm_or_si128(_mm_and_si128(luma, load(src + 2)), 
+            _mm_andnot_si128(luma, load(src + 4)));
+}
+
+/* (2a + b + 1) / 3, 8 words at a time; 21846/65536 is 1/3 near enough */
+static inline SSSE3 __m128i third_16(__m128i a, __m128i b) {
+    __m128i sum = _mm_add_epi16(_mm_add_epi16(a, a), 
+            _mm_add_epi16(b, _mm_set1_epi16(1)));
+    return _mm_mulhi_epu16(sum, _mm_set1_epi16(21846));
+}
+
+static inline SSSE3 __m128i third(__m128i a, __m128i b) {
+    const __m128i zero = _mm_setzero_si128( );
+
+    return _mm_packus_epi16(
+        third_16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)),
+        third_16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero))
+    );
+}
+
+static inline SSSE3 void expand(size_t n, const uint8_t *src, 
+        uint8_t *dst, unsigned int factor, bool linear,
+        void (*finish)(size_t, const uint8_t *, uint8_t *)) {
+    /* interpolating reads the pixel pair after each block */
+    const size_t reach = linear ? 20 : 16;
+    const unsigned int n_vecs = linear ? factor : 1;
+    __m128i mask[3][3], v[3], b, out;
+    unsigned int blk, s;
+    size_t i;
+
+    for (blk = 0; blk < factor; blk++) {
+        for (s = 0; s < n_vecs; s++) {
+            mask[blk][s] = load((const uint8_t *) 
+                    CbYCrY8422_scan_shuffle_mask(factor, linear, blk, s));
+        }
+    }
+
+    for (i = 0; i + reach <= n; i += 16) {
+        v[0] = load(src + i);
+        if (linear) {
+            b = neighbors(src + i);
+            if (factor == 2) {
+                v[1] = _mm_avg_epu8(v[0], b);
+            } else {
+                v[1] = third(v[0], b);
+                v[2] = third(b, v[0]);
+            }
+        }
+
+        for (blk = 0; blk < factor; blk++) {
+            out = _mm_shuffle_epi8(v[0], mask[blk][0]);
+            for (s = 1; s < n_vecs; s++) {
+                out = _mm_or_si128(out, 
+                        _mm_shuffle_epi8(v[s], mask[blk][s]));
+            }
+            _mm_storeu_si128((__m128i *) (dst + factor * i + 16 * blk), 
+                    out);
+        }
+    }
+
+    /* the end of the line, where the last pixel pair is repeated */
+    if (i < n) {
+        finish(n - i, src + i, dst + factor * i);
+    }
+}
+
+static SSSE3 void double_nearest(size_t n, const uint8_t *src, 
+        uint8_t *dst) {
+    expand(n, src, dst, 2, false, 
+            CbYCrY8422_scan_lines_default.double_nearest);
+}
+
+static SSSE3 void double_linear(size_t n, const uint8_t *src, 
+        uint8_t *dst) {
+    expand(n, src, dst, 2, true, 
+            CbYCrY8422_scan_lines_default.double_linear);
+}
+
+static SSSE3 void triple_nearest(size_t n, const uint8_t *src, 
+        uint8_t *dst) {
+    expand(n, src, dst, 3, false, 
+            CbYCrY8422_scan_lines_default.triple_nearest);
+}
+
+static SSSE3 void triple_linear(size_t n, const uint8_t *src, 
+        uint8_t *dst) {
+    expand(n, src, dst, 3, true, 
+            CbYCrY8422_scan_lines_default.triple_linear);
+}
+
+static SSSE3 void blend_halves(size_t n, const uint8_t *a, 
+        const uint8_t *b, uint8_t *dst) {
+    size_t i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        _mm_storeu_si128((__m128i *) (dst + i), 
+                _mm_avg_epu8(load(a + i), load(b + i)));
+    }
+
+    if (i < n) {
+        CbYCrY8422_scan_lines_default.blend_halves(n - i, a + i, b + i, 
+                dst + i);
+    }
+}
+
+static SSSE3 void blend_thirds(size_t n, const uint8_t *a, 
+        const uint8_t *b, uint8_t *near_a, uint8_t *near_b) {
+    __m128i va, vb;
+    size_t i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        va = load(a + i);
+        vb = load(b + i);
+        _mm_storeu_si128((__m128i *) (near_a + i), third(va, vb));
+        _mm_storeu_si128((__m128i *) (near_b + i), third(vb, va));
+    }
+
+    if (i < n) {
+        CbYCrY8422_scan_lines_default.blend_thirds(n - i, a + i, b + i, 
+                near_a + i, near_b + i);
+    }
+}
+
+const CbYCrY8422ScanLines CbYCrY8422_scan_lines_ssse3 = {
+    double_nearest, double_linear, triple_nearest, triple_linear,
+    blend_halves, blend_thirds
+};
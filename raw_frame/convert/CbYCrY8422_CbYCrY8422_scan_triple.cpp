@@ -1,55 +1,78 @@
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
-static void CbYCrY8422_triple_scanline(uint8_t *dst, uint8_t *src, 
-        size_t src_length) {
-    uint8_t y1, y2, cb, cr;
-    size_t i, dp;
-
-    dp = 0;
-
-    for (i = 0; i < src_length; i += 4) {
-        /* load 2 source pixels */
-        cb = src[i];
-        y1 = src[i+1];
-        cr = src[i+2];
-        y2 = src[i+3];
-
-        /* write 6 destination pixels */
-        dst[dp+0] = cb;
-        dst[dp+1] = y1;
-        dst[dp+2] = cr;
-        dst[dp+3] = y1;
-
-        dst[dp+4] = cb;
-        dst[dp+5] = y1;
-        dst[dp+6] = cr;
-        dst[dp+7] = y2;
-
-        dst[dp+8] = cb;
-        dst[dp+9] = y2;
-        dst[dp+10] = cr;
-        dst[dp+11] = y2;
-
-        dp += 12;
-    }
-}
+#include "scan_CbYCrY8422.h"
 
-void CbYCrY8422_CbYCrY8422_scan_triple(size_t src_size, 
-        uint8_t *src, uint8_t *dst, unsigned int src_pitch) {
+void CbYCrY8422_scan_triple_frame(const CbYCrY8422ScanLines *lines,
+        bool linear, size_t src_size, uint8_t *src, uint8_t *dst, 
+        unsigned int src_pitch) {
     size_t n_scanlines = src_size / src_pitch;
+    size_t dst_pitch = 3 * src_pitch;
     size_t i;
 
     /* hack to get a center cut of the 4:3 frame */
     src += 60*src_pitch;
     n_scanlines -= 120;
 
-    for (i = 0; i < n_scanlines; i++) {
-        CbYCrY8422_triple_scanline(dst, src, src_pitch);
-        CbYCrY8422_triple_scanline(dst + 3*src_pitch, src, src_pitch);
-        CbYCrY8422_triple_scanline(dst + 6*src_pitch, src, src_pitch);
-        dst += 9*src_pitch;
+    if (!linear) {
+        for (i = 0; i < n_scanlines; i++) {
+            lines->triple_nearest(src_pitch, src, dst);
+            memcpy(dst + dst_pitch, dst, dst_pitch);
+            memcpy(dst + 2*dst_pitch, dst, dst_pitch);
+            dst += 3*dst_pitch;
+            src += src_pitch;
+        }
+        return;
+    }
+
+    /* expand each scanline once, then blend it with the one above */
+    lines->triple_linear(src_pitch, src, dst);
+    for (i = 1; i < n_scanlines; i++) {
         src += src_pitch;
+        lines->triple_linear(src_pitch, src, dst + 3*dst_pitch);
+        lines->blend_thirds(dst_pitch, dst, dst + 3*dst_pitch, 
+                dst + dst_pitch, dst + 2*dst_pitch);
+        dst += 3*dst_pitch;
     }
+    memcpy(dst + dst_pitch, dst, dst_pitch);
+    memcpy(dst + 2*dst_pitch, dst, dst_pitch);
+}
+
+void CbYCrY8422_CbYCrY8422_scan_triple(size_t src_size, 
+        uint8_t *src, uint8_t *dst, unsigned int src_pitch) {
+    CbYCrY8422_scan_triple_frame(&CbYCrY8422_scan_lines_default, false,
+            src_size, src, dst, src_pitch);
+}
+
+void CbYCrY8422_CbYCrY8422_scan_triple_linear(size_t src_size, 
+        uint8_t *src, uint8_t *dst, unsigned int src_pitch) {
+    CbYCrY8422_scan_triple_frame(&CbYCrY8422_scan_lines_default, true,
+            src_size, src, dst, src_pitch);
+}
+
+#ifndef SKIP_ASSEMBLY_ROUTINES
+void CbYCrY8422_CbYCrY8422_scan_triple_ssse3(size_t src_size, 
+        uint8_t *src, uint8_t *dst, unsigned int src_pitch) {
+    CbYCrY8422_scan_triple_frame(&CbYCrY8422_scan_lines_ssse3, false,
+            src_size, src, dst, src_pitch);
+}
+
+void CbYCrY8422_CbYCrY8422_scan_triple_linear_ssse3(size_t src_size, 
+        uint8_t *src, uint8_t *dst, unsigned int src_pitch) {
+    CbYCrY8422_scan_triple_frame(&CbYCrY8422_scan_lines_ssse3, true,
+            src_size, src, dst, src_pitch);
+}
+
+void CbYCrY8422_CbYCrY8422_scan_triple_avx2(size_t src_size, 
+        uint8_t *src, uint8_t *dst, unsigned int src_pitch) {
+    CbYCrY8422_scan_triple_frame(&CbYCrY8422_scan_lines_avx2, false,
+            src_size, src, dst, src_pitch);
 }
 
+void CbYCrY8422_CbYCrY8422_scan_triple_linear_avx2(size_t src_size, 
+        uint8_t *src, uint8_t *dst, unsigned int src_pitch) {
+    CbYCrY8422_scan_triple_frame(&CbYCrY8422_scan_lines_avx2, true,
+            src_size, src, dst, src_pitch);
+}
+#endif
@@ -0,0 +1,70 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ * 
+ * This file is part of openreplay.
+ * 
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * AVX2 version of CbYCrY8422_YCbCr8P422_vector: 32 pixels per pass
+ * instead of 8. The tail of the frame goes to the SSE2 code.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <immintrin.h>
+
+extern "C" void CbYCrY8422_YCbCr8P422_vector(size_t, uint8_t *, uint8_t *,
+        uint8_t *, uint8_t *);
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 void CbYCrY8422_YCbCr8P422_avx2(size_t n, uint8_t *src, uint8_t *y,
+        uint8_t *cb, uint8_t *cr) {
+    /* each lane becomes [yyyyyyyy uuuu vvvv] */
+    const __m256i split = _mm256_setr_epi8(
+            1, 3, 5, 7, 9, 11, 13, 15, 0, 4, 8, 12, 2, 6, 10, 14,
+            1, 3, 5, 7, 9, 11, 13, 15, 0, 4, 8, 12, 2, 6, 10, 14);
+    /* then [y y y y | u u v v] across the register */
+    const __m256i gather = _mm256_setr_epi32(0, 1, 4, 5, 2, 6, 3, 7);
+    /* and finally [u u u u | v v v v] for the chroma */
+    const __m256i chroma = _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7);
+    __m256i a, b, c;
+
+    while (n >= 64) {
+        a = _mm256_shuffle_epi8(_mm256_loadu_si256((__m256i *) src), split);
+        b = _mm256_shuffle_epi8(
+                _mm256_loadu_si256((__m256i *) (src + 32)), split);
+        a = _mm256_permutevar8x32_epi32(a, gather);
+        b = _mm256_permutevar8x32_epi32(b, gather);
+
+        _mm256_storeu_si256((__m256i *) y, 
+                _mm256_permute2x128_si256(a, b, 0x20));
+        c = _mm256_permutevar8x32_epi32(
+                _mm256_permute2x128_si256(a, b, 0x31), chroma);
+        _mm_storeu_si128((__m128i *) cb, _mm256_castsi256_si128(c));
+        _mm_storeu_si128((__m128i *) cr, _mm256_extracti128_si256(c, 1));
+
+        src += 64;
+        y += 32;
+        cb += 16;
+        cr += 16;
+        n -= 64;
+    }
+
+    if (n > 0) {
+        CbYCrY8422_YCbCr8P422_vector(n, src, y, cb, cr);
+    }
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ * 
+ * This file is part of openreplay.
+ * 
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * AVX2 version of YCbCr8P422_CbYCrY8422_vector: 32 pixels per pass
+ * instead of 16. The tail of the frame goes to the SSE2 code.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <immintrin.h>
+
+extern "C" void YCbCr8P422_CbYCrY8422_vector(size_t, uint8_t *, uint8_t *,
+        uint8_t *, uint8_t *);
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 void YCbCr8P422_CbYCrY8422_avx2(size_t n, uint8_t *dst, uint8_t *y,
+        uint8_t *cb, uint8_t *cr) {
+    /* Cb for pixel pairs 0-3, then Cr for the same, then 4-7 and so on */
+    const __m256i pairs = _mm256_setr_epi32(0, 4, 2, 6, 1, 5, 3, 7);
+    /* [yyyyyyyy uuuu vvvv] to [uyvyuyvyuyvyuyvy] in each lane */
+    const __m256i merge = _mm256_setr_epi8(
+            8, 0, 12, 1, 9, 2, 13, 3, 10, 4, 14, 5, 11, 6, 15, 7,
+            8, 0, 12, 1, 9, 2, 13, 3, 10, 4, 14, 5, 11, 6, 15, 7);
+    __m256i luma, chroma;
+
+    while (n >= 64) {
+        luma = _mm256_permute4x64_epi64(
+                _mm256_loadu_si256((__m256i *) y), 0xd8);
+        chroma = _mm256_permutevar8x32_epi32(_mm256_set_m128i(
+                _mm_loadu_si128((__m128i *) cr),
+                _mm_loadu_si128((__m128i *) cb)), pairs);
+
+        _mm256_storeu_si256((__m256i *) dst, _mm256_shuffle_epi8(
+                _mm256_unpacklo_epi64(luma, chroma), merge));
+        _mm256_storeu_si256((__m256i *) (dst + 32), _mm256_shuffle_epi8(
+                _mm256_unpackhi_epi64(luma, chroma), merge));
+
+        dst += 64;
+        y += 32;
+        cb += 16;
+        cr += 16;
+        n -= 64;
+    }
+
+    if (n > 0) {
+        YCbCr8P422_CbYCrY8422_vector(n, dst, y, cb, cr);
+    }
+}
@@ -0,0 +1,413 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ * 
+ * This file is part of openreplay.
+ * 
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "polyphase_scaler.h"
+#include "cpu_dispatch.h"
+#include "mutex.h"
+#include <math.h>
+#include <string.h>
+
+/* limits how far one pass can shrink (about 10:1 with Lanczos) */
+#define MAX_TAPS 64
+
+/* distinct size pairs kept around */
+#define CACHE_SIZE 16
+
+void polyphase_horizontal_default(size_t, int16_t *, const uint8_t *,
+        const int32_t *, const int16_t *, unsigned int);
+void polyphase_vertical_default(size_t, uint8_t *, int16_t **,
+        const int16_t *, unsigned int);
+
+#ifndef SKIP_ASSEMBLY_ROUTINES
+void polyphase_vertical_sse2(size_t, uint8_t *, int16_t **,
+        const int16_t *, unsigned int);
+void polyphase_horizontal_avx2(size_t, int16_t *, const uint8_t *,
+        const int32_t *, const int16_t *, unsigned int);
+void polyphase_vertical_avx2(size_t, uint8_t *, int16_t **,
+        const int16_t *, unsigned int);
+#endif
+
+static double filter_radius(scale_filter_t filter) {
+    switch (filter) {
+        case SCALE_BILINEAR:
+            return 1.0;
+        case SCALE_BICUBIC:
+            return 2.0;
+        case SCALE_LANCZOS3:
+            return 3.0;
+        default:
+            throw std::runtime_error("unknown scaling filter");
+    }
+}
+
+static double filter_weight(scale_filter_t filter, double x) {
+    x = fabs(x);
+
+    switch (filter) {
+        case SCALE_BILINEAR:
+            return (x < 1.0) ? 1.0 - x : 0.0;
+
+        case SCALE_BICUBIC:
+            /* Catmull-Rom */
+            if (x < 1.0) {
+                return (1.5 * x - 2.5) * x * x + 1.0;
+            } else if (x < 2.0) {
+                return ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0;
+            } else {
+                return 0.0;
+            }
+
+        case SCALE_LANCZOS3:
+            if (x < 1e-6) {
+                return 1.0;
+            } else if (x < 3.0) {
+                return 3.0 * sin(M_PI * x) * sin(M_PI * x / 3.0) 
+                        / (M_PI * M_PI * x * x);
+            } else {
+                return 0.0;
+            }
+
+        default:
+            throw std::runtime_error("unknown scaling filter");
+    }
+}
+
+/* filter taps along one axis, for every output sample */
+struct polyphase_axis {
+    unsigned int taps;
+    std::vector<int> index;         /* clamped to the source */
+    std::vector<int16_t> coefs;
+};
+
+/*
+ * Weights for resampling n_src samples to n_dst, where scale is the
+ * source/output ratio of the luma. Shrinking widens the filter by the
+ * same ratio, so it still low-passes. Co-sited 4:2:2 chroma sample i
+ * sits on luma sample 2i, on both sides.
+ */
+static void build_axis(polyphase_axis &a, int n_src, int n_dst, 
+        double scale, bool cosited, scale_filter_t filter) {
+    double stretch = (scale > 1.0) ? scale : 1.0;
+    double radius = filter_radius(filter) * stretch;
+    double center, sum, w[MAX_TAPS];
+    int i, first, best, total, c;
+    unsigned int t;
+
+    a.taps = (unsigned int) ceil(2.0 * radius) + 1;
+    if (a.taps > MAX_TAPS) {
+        throw std::runtime_error("scaling ratio too large");
+    }
+
+    a.index.resize(n_dst * a.taps);
+    a.coefs.resize(n_dst * a.taps);
+
+    for (i = 0; i < n_dst; i++) {
+        if (cosited) {
+            center = ((2 * i + 0.5) * scale - 0.5) / 2.0;
+        } else {
+            center = (i + 0.5) * scale - 0.5;
+        }
+        first = (int) floor(center - radius) + 1;
+
+        sum = 0.0;
+        for (t = 0; t < a.taps; t++) {
+            w[t] = filter_weight(filter, (first + (int) t - center) / stretch);
+            sum += w[t];
+        }
+
+        /* quantize, and put the rounding error on the biggest tap */
+        total = 0;
+        best = 0;
+        for (t = 0; t < a.taps; t++) {
+            c = (int) lrint(w[t] / sum * (1 << POLYPHASE_COEF_BITS));
+            a.coefs[i * a.taps + t] = c;
+            total += c;
+            if (w[t] > w[best]) {
+                best = t;
+            }
+
+            if (first + (int) t < 0) {
+                a.index[i * a.taps + t] = 0;
+            } else if (first + (int) t >= n_src) {
+                a.index[i * a.taps + t] = n_src - 1;
+            } else {
+                a.index[i * a.taps + t] = first + t;
+            }
+        }
+        a.coefs[i * a.taps + best] += (1 << POLYPHASE_COEF_BITS) - total;
+    }
+}
+
+PolyphaseScaler::PolyphaseScaler(RawFrame::PixelFormat pf_, coord_t sw_,
+        coord_t sh_, coord_t dw_, coord_t dh_, scale_filter_t filter_) {
+    polyphase_axis rows, luma, chroma;
+    double x_scale, y_scale;
+    unsigned int t, k;
+    size_t j, x;
+
+    pf = pf_;
+    sw = sw_;
+    sh = sh_;
+    dw = dw_;
+    dh = dh_;
+    filter = filter_;
+    simd = cpu_best_simd( );
+    users = 0;
+    last_used = 0;
+
+    x_scale = (double) sw / dw;
+    y_scale = (double) sh / dh;
+
+    /* vertical: the SIMD code takes taps in pairs, so pad with a zero */
+    build_axis(rows, sh, dh, y_scale, false, filter);
+    v_taps = rows.taps + rows.taps % 2;
+    v_lines.resize(dh * v_taps);
+    v_coefs.resize(dh * v_taps);
+    for (j = 0; j < dh; j++) {
+        for (t = 0; t < v_taps; t++) {
+            k = (t < rows.taps) ? t : rows.taps - 1;
+            v_lines[j * v_taps + t] = rows.index[j * rows.taps + k];
+            v_coefs[j * v_taps + t] = 
+                    (t < rows.taps) ? rows.coefs[j * rows.taps + t] : 0;
+        }
+    }
+
+    /* horizontal: expand the per-sample taps to every output byte */
+    if (pf == RawFrame::BGRAn8) {
+        build_axis(luma, sw, dw, x_scale, false, filter);
+        h_taps = luma.taps;
+        h_bytes = 4 * dw;
+    } else if (pf == RawFrame::CbYCrY8422) {
+        if (sw % 2 != 0 || dw % 2 != 0) {
+            throw std::runtime_error("CbYCrY8422 widths must be even");
+        }
+        build_axis(luma, sw, dw, x_scale, false, filter);
+        build_axis(chroma, sw / 2, dw / 2, x_scale, true, filter);
+        h_taps = (luma.taps > chroma.taps) ? luma.taps : chroma.taps;
+        h_bytes = 2 * dw;
+    } else {
+        throw std::runtime_error("cannot scale this pixel format");
+    }
+
+    /* padding bytes read byte 0 with weight 0 */
+    h_stride = (h_bytes + 15) & ~15;
+    h_offsets.assign(h_taps * h_stride, 0);
+    h_coefs.assign(h_taps * h_stride, 0);
+
+    for (j = 0; j < h_bytes; j++) {
+        for (t = 0; t < h_taps; t++) {
+            const polyphase_axis *a;
+            int32_t offset;
+
+            if (pf == RawFrame::BGRAn8) {
+                /* B, G, R or A of pixel j / 4 */
+                a = &luma;
+                x = j / 4;
+            } else if (j % 2 == 1) {
+                /* Y of pixel j / 2 */
+                a = &luma;
+                x = j / 2;
+            } else {
+                /* Cb or Cr of pixel pair j / 4 */
+                a = &chroma;
+                x = j / 4;
+            }
+
+            k = (t < a->taps) ? t : a->taps - 1;
+            if (pf == RawFrame::BGRAn8 || j % 2 == 0) {
+                offset = 4 * a->index[x * a->taps + k] + j % 4;
+            } else {
+                offset = 2 * a->index[x * a->taps + k] + 1;
+            }
+
+            h_offsets[t * h_stride + j] = offset;
+            h_coefs[t * h_stride + j] = 
+                    (t < a->taps) ? a->coefs[x * a->taps + t] : 0;
+        }
+    }
+
+#ifdef SKIP_ASSEMBLY_ROUTINES
+    do_horizontal = polyphase_horizontal_default;
+    do_vertical = polyphase_vertical_default;
+#else
+    if (cpu_avx2_available( )) {
+        do_horizontal = polyphase_horizontal_avx2;
+        do_vertical = polyphase_vertical_avx2;
+    } else if (cpu_sse2_available( )) {
+        do_horizontal = polyphase_horizontal_default;
+        do_vertical = polyphase_vertical_sse2;
+    } else {
+        do_horizontal = polyphase_horizontal_default;
+        do_vertical = polyphase_vertical_default;
+    }
+#endif
+}
+
+void PolyphaseScaler::run(RawFrame *src, RawFrame *dst) {
+    unsigned int t, slot;
+    size_t src_bytes = h_bytes / dw * sw;
+    std::vector<int16_t> ring(v_taps * h_stride);
+    std::vector<int> ring_line(v_taps, -1);
+    std::vector<int16_t *> lines(v_taps);
+    std::vector<uint8_t> line(src_bytes + 4);
+    coord_t y;
+    int l;
+
+    /* 
+     * The source lines one output line needs are consecutive, so with
+     * v_taps slots, line l can always live in slot l % v_taps.
+     */
+    for (y = 0; y < dh; y++) {
+        for (t = 0; t < v_taps; t++) {
+            l = v_lines[y * v_taps + t];
+            slot = l % v_taps;
+
+            if (ring_line[slot] != l) {
+                /* the SIMD code loads a few bytes past each sample */
+                memcpy(&line[0], src->scanline(l), src_bytes);
+                do_horizontal(h_stride, &ring[slot * h_stride], &line[0],
+                        &h_offsets[0], &h_coefs[0], h_taps);
+                ring_line[slot] = l;
+            }
+
+            lines[t] = &ring[slot * h_stride];
+        }
+
+        do_vertical(h_bytes, dst->scanline(y), &lines[0],
+                &v_coefs[y * v_taps], v_taps);
+    }
+}
+
+static Mutex cache_m;
+static std::vector<PolyphaseScaler *> cache;
+static unsigned long cache_clock = 0;
+
+PolyphaseScaler *PolyphaseScaler::get(RawFrame::PixelFormat pf,
+        coord_t sw, coord_t sh, coord_t dw, coord_t dh,
+        scale_filter_t filter) {
+    MutexLock l(cache_m);
+    cpu_simd_level simd = cpu_best_simd( );
+    PolyphaseScaler *s;
+    size_t i, oldest;
+
+    for (i = 0; i < cache.size( ); i++) {
+        s = cache[i];
+        if (s->pf == pf && s->sw == sw && s->sh == sh && s->dw == dw 
+                && s->dh == dh && s->filter == filter && s->simd == simd) {
+            s->users++;
+            s->last_used = ++cache_clock;
+            return s;
+        }
+    }
+
+    /* make room by dropping the least recently used idle entry */
+    while (cache.size( ) >= CACHE_SIZE) {
+        oldest = cache.size( );
+        for (i = 0; i < cache.size( ); i++) {
+            if (cache[i]->users == 0 && (oldest == cache.size( ) 
+                    || cache[i]->last_used < cache[oldest]->last_used)) {
+                oldest = i;
+            }
+        }
+
+        if (oldest == cache.size( )) {
+            break;
+        }
+
+        delete cache[oldest];
+        cache.erase(cache.begin( ) + oldest);
+    }
+
+    s = new PolyphaseScaler(pf, sw, sh, dw, dh, filter);
+    s->users = 1;
+    s->last_used = ++cache_clock;
+    cache.push_back(s);
+    return s;
+}
+
+void PolyphaseScaler::release(PolyphaseScaler *s) {
+    MutexLock l(cache_m);
+    s->users--;
+}
+
+void PolyphaseScaler::scale(RawFrame *src, RawFrame *dst,
+        scale_filter_t filter) {
+    PolyphaseScaler *s;
+
+    if (src->pixel_format( ) != dst->pixel_format( )) {
+        throw std::runtime_error("cannot change pixel format while scaling");
+    }
+
+    s = get(src->pixel_format( ), src->w( ), src->h( ), 
+            dst->w( ), dst->h( ), filter);
+
+    try {
+        s->run(src, dst);
+    } catch (...) {
+        release(s);
+        throw;
+    }
+
+    release(s);
+}
+
+/* 
+ * For each output byte j, the weighted sum of its source bytes, with
+ * POLYPHASE_LINE_BITS of fraction.
+ */
+void polyphase_horizontal_default(size_t n, int16_t *dst, 
+        const uint8_t *src, const int32_t *offsets, const int16_t *coefs,
+        unsigned int taps) {
+    const int shift = POLYPHASE_COEF_BITS - POLYPHASE_LINE_BITS;
+    unsigned int t;
+    size_t j;
+    int32_t sum;
+
+    for (j = 0; j < n; j++) {
+        sum = 0;
+        for (t = 0; t < taps; t++) {
+            sum += coefs[t * n + j] * src[offsets[t * n + j]];
+        }
+        dst[j] = (sum + (1 << (shift - 1))) >> shift;
+    }
+}
+
+void polyphase_vertical_default(size_t n, uint8_t *dst, int16_t **lines,
+        const int16_t *coefs, unsigned int taps) {
+    const int shift = POLYPHASE_COEF_BITS + POLYPHASE_LINE_BITS;
+    unsigned int t;
+    size_t j;
+    int32_t sum;
+
+    for (j = 0; j < n; j++) {
+        sum = 0;
+        for (t = 0; t < taps; t++) {
+            sum += coefs[t] * lines[t][j];
+        }
+
+        sum = (sum + (1 << (shift - 1))) >> shift;
+        if (sum < 0) {
+            dst[j] = 0;
+        } else if (sum > 255) {
+            dst[j] = 255;
+        } else {
+            dst[j] = sum;
+        }
+    }
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ * 
+ * This file is part of openreplay.
+ * 
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * AVX2 passes for PolyphaseScaler. The horizontal pass gathers each
+ * tap's source bytes for 16 output bytes at once, whatever the layout;
+ * the vertical pass is the SSE2 one twice as wide.
+ */
+
+#include "polyphase_scaler.h"
+#include <immintrin.h>
+
+void polyphase_vertical_default(size_t, uint8_t *, int16_t **,
+        const int16_t *, unsigned int);
+
+#define AVX2 __attribute__((target("avx2")))
+
+/* n must be a multiple of 16, and src readable 3 bytes past any offset */
+AVX2 void polyphase_horizontal_avx2(size_t n, int16_t *dst, 
+        const uint8_t *src, const int32_t *offsets, const int16_t *coefs,
+        unsigned int taps) {
+    const int shift = POLYPHASE_COEF_BITS - POLYPHASE_LINE_BITS;
+    const __m256i lsb_mask = _mm256_set1_epi32(0xff);
+    __m256i acc[2], v, c;
+    unsigned int t;
+    size_t j;
+    int i;
+
+    for (j = 0; j < n; j += 16) {
+        acc[0] = acc[1] = _mm256_set1_epi32(1 << (shift - 1));
+
+        for (t = 0; t < taps; t++) {
+            for (i = 0; i < 2; i++) {
+                v = _mm256_i32gather_epi32((const int *) src, 
+                        _mm256_loadu_si256((__m256i *) 
+                            (offsets + t * n + j + 8 * i)), 1);
+                v = _mm256_and_si256(v, lsb_mask);
+                /* high words zero, so this is a plain 32-bit multiply */
+                c = _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i *)
+                        (coefs + t * n + j + 8 * i)));
+                acc[i] = _mm256_add_epi32(acc[i], _mm256_madd_epi16(v, c));
+            }
+        }
+
+        acc[0] = _mm256_srai_epi32(acc[0], shift);
+        acc[1] = _mm256_srai_epi32(acc[1], shift);
+        _mm256_storeu_si256((__m256i *) (dst + j), _mm256_permute4x64_epi64(
+                _mm256_packs_epi32(acc[0], acc[1]), 0xd8));
+    }
+}
+
+/* coefficients t and t + 1, paired up to go with unpacked lines */
+static inline AVX2 __m256i coef_pair(const int16_t *coefs, unsigned int t) {
+    return _mm256_set1_epi32((uint16_t) coefs[t] 
+            | ((uint32_t) (uint16_t) coefs[t + 1] << 16));
+}
+
+static inline AVX2 void vertical_32(uint8_t *dst, int16_t **lines, 
+        size_t j, const int16_t *coefs, unsigned int taps) {
+    const int shift = POLYPHASE_COEF_BITS + POLYPHASE_LINE_BITS;
+    __m256i acc[4], a, b, c;
+    unsigned int t;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        acc[i] = _mm256_set1_epi32(1 << (shift - 1));
+    }
+
+    /* unpack and pack both work per lane, so the order comes back */
+    for (t = 0; t < taps; t += 2) {
+        c = coef_pair(coefs, t);
+        for (i = 0; i < 2; i++) {
+            a = _mm256_loadu_si256((__m256i *) (lines[t] + j + 16 * i));
+            b = _mm256_loadu_si256((__m256i *) (lines[t + 1] + j + 16 * i));
+            acc[2 * i] = _mm256_add_epi32(acc[2 * i], 
+                    _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), c));
+            acc[2 * i + 1] = _mm256_add_epi32(acc[2 * i + 1], 
+                    _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), c));
+        }
+    }
+
+    for (i = 0; i < 4; i++) {
+        acc[i] = _mm256_srai_epi32(acc[i], shift);
+    }
+
+    _mm256_storeu_si256((__m256i *) (dst + j), _mm256_permute4x64_epi64(
+            _mm256_packus_epi16(_mm256_packs_epi32(acc[0], acc[1]), 
+                _mm256_packs_epi32(acc[2], acc[3])), 0xd8));
+}
+
+AVX2 void polyphase_vertical_avx2(size_t n, uint8_t *dst, int16_t **lines,
+        const int16_t *coefs, unsigned int taps) {
+    size_t j;
+
+    if (n < 32) {
+        polyphase_vertical_default(n, dst, lines, coefs, taps);
+        return;
+    }
+
+    /* the last block overlaps the one before it, rather than a tail */
+    for (j = 0; j < n; j += 32) {
+        if (j + 32 > n) {
+            j = n - 32;
+        }
+        vertical_32(dst, lines, j, coefs, taps);
+    }
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ * 
+ * This file is part of openreplay.
+ * 
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * SSE2 vertical pass for PolyphaseScaler: 16 output bytes at a time,
+ * two taps per multiply-add.
+ */
+
+#include "polyphase_scaler.h"
+#include <emmintrin.h>
+
+void polyphase_vertical_default(size_t, uint8_t *, int16_t **,
+        const int16_t *, unsigned int);
+
+/* coefficients t and t + 1, paired up to go with unpacked lines */
+static inline __m128i coef_pair(const int16_t *coefs, unsigned int t) {
+    return _mm_set1_epi32((uint16_t) coefs[t] 
+            | ((uint32_t) (uint16_t) coefs[t + 1] << 16));
+}
+
+static inline void vertical_16(uint8_t *dst, int16_t **lines, size_t j,
+        const int16_t *coefs, unsigned int taps) {
+    const int shift = POLYPHASE_COEF_BITS + POLYPHASE_LINE_BITS;
+    __m128i acc[4], a, b, c;
+    unsigned int t;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        acc[i] = _mm_set1_epi32(1 << (shift - 1));
+    }
+
+    for (t = 0; t < taps; t += 2) {
+        c = coef_pair(coefs, t);
+        for (i = 0; i < 2; i++) {
+            a = _mm_loadu_si128((__m128i *) (lines[t] + j + 8 * i));
+            b = _mm_loadu_si128((__m128i *) (lines[t + 1] + j + 8 * i));
+            acc[2 * i] = _mm_add_epi32(acc[2 * i], 
+                    _mm_madd_epi16(_mm_unpacklo_epi16(a, b), c));
+            acc[2 * i + 1] = _mm_add_epi32(acc[2 * i + 1], 
+                    _mm_madd_epi16(_mm_unpackhi_epi16(a, b), c));
+        }
+    }
+
+    for (i = 0; i < 4; i++) {
+        acc[i] = _mm_srai_epi32(acc[i], shift);
+    }
+
+    _mm_storeu_si128((__m128i *) (dst + j), _mm_packus_epi16(
+            _mm_packs_epi32(acc[0], acc[1]), 
+            _mm_packs_epi32(acc[2], acc[3])));
+}
+
+void polyphase_vertical_sse2(size_t n, uint8_t *dst, int16_t **lines,
+        const int16_t *coefs, unsigned int taps) {
+    size_t j;
+
+    if (n < 16) {
+        polyphase_vertical_default(n, dst, lines, coefs, taps);
+        return;
+    }
+
+    /* the last block overlaps the one before it, rather than a tail */
+    for (j = 0; j < n; j += 16) {
+        if (j + 16 > n) {
+            j = n - 16;
+        }
+        vertical_16(dst, lines, j, coefs, taps);
+    }
+}
@@ -18,42 +18,61 @@
  */
 
 #include "raw_frame.h"
+#include "draw_BGRAn8.h"
 
-static void BGRAn8_BGRAn8_key(RawFrame *bkgd, RawFrame *key,
-        coord_t x, coord_t y, uint8_t galpha);
+/*
+ * Clip key at (x, y) against bkgd, and hand each row of the overlap to 
+ * key_row. Only BGRAn8 keys are supported.
+ */
+void BGRAn8_alpha_key_rows(RawFrame *bkgd, RawFrame *key,
+        coord_t x, coord_t y, uint8_t galpha, BGRAn8_key_row_fn key_row) {
+    coord_t w, h;
 
-void BGRAn8_alpha_key_default(RawFrame *bkgd, RawFrame *key,
-        coord_t x, coord_t y, uint8_t galpha) {
-    switch (key->pixel_format( )) {
-        case RawFrame::BGRAn8:
-            BGRAn8_BGRAn8_key(bkgd, key, x, y, galpha);
-            break;
-        default:
-            throw std::runtime_error("unsupported pixel formats");
+    if (key->pixel_format( ) != RawFrame::BGRAn8) {
+        throw std::runtime_error("unsupported pixel formats");
     }
-}
 
-static void BGRAn8_BGRAn8_key(RawFrame *bkgd, RawFrame *key,
-        coord_t x, coord_t y, uint8_t galpha) {
+    if (x >= bkgd->w( ) || y >= bkgd->h( ) || galpha == 0) {
+        return;
+    }
 
-    uint8_t *src_scanline;
-    uint8_t *dst_scanline;
+    w = key->w( );
+    if (w > bkgd->w( ) - x) {
+        w = bkgd->w( ) - x;
+    }
 
+    h = key->h( );
+    if (h > bkgd->h( ) - y) {
+        h = bkgd->h( ) - y;
+    }
+
+    for (coord_t ys = 0; ys < h; ys++) {
+        key_row(bkgd->scanline(y + ys) + 4*x, key->scanline(ys), w, galpha);
+    }
+}
+
+/* 
+ * Straight alpha: each color is k * a + b * (1 - a), with a scaled by
+ * galpha. The background's alpha is left alone.
+ */
+void BGRAn8_key_row_default(uint8_t *dst_scanline, 
+        const uint8_t *src_scanline, size_t n, uint8_t galpha) {
     int rb, gb, bb;
     int rk, gk, bk, ak;
 
-    for (int yd = y, ys = 0; yd < bkgd->h( ) && ys < key->h( ); yd++, ys++) {
-        src_scanline = key->scanline(ys);
-        dst_scanline = bkgd->scanline(yd) + 4*x;
-        for (int xd = x, xs = 0; xd < bkgd->w( ) && xs < key->w( ); 
-                xd++, xs++) {
-            bk = src_scanline[0];
-            gk = src_scanline[1];
-            rk = src_scanline[2];
-            ak = src_scanline[3];
+    for (size_t i = 0; i < n; i++) {
+        bk = src_scanline[0];
+        gk = src_scanline[1];
+        rk = src_scanline[2];
+        ak = src_scanline[3];
 
-            ak = ak * galpha / 255;
+        ak = ak * galpha / 255;
 
+        if (ak == 255) {
+            dst_scanline[0] = bk;
+            dst_scanline[1] = gk;
+            dst_scanline[2] = rk;
+        } else if (ak != 0) {
             bb = dst_scanline[0];
             gb = dst_scanline[1];
             rb = dst_scanline[2];
@@ -61,9 +80,45 @@ static void BGRAn8_BGRAn8_key(RawFrame *bkgd, RawFrame *key,
             dst_scanline[0] = (bk * ak + bb * (255 - ak)) / 255;
             dst_scanline[1] = (gk * ak + gb * (255 - ak)) / 255;
             dst_scanline[2] = (rk * ak + rb * (255 - ak)) / 255;
+        }
 
-            src_scanline += 4;
-            dst_scanline += 4;
+        src_scanline += 4;
+        dst_scanline += 4;
+    }
+}
+
+/* 
+ * Premultiplied alpha (as Cairo draws): each color is k + b * (1 - a),
+ * with k and a scaled by galpha, saturating at white.
+ */
+void BGRAn8_key_row_premultiplied_default(uint8_t *dst_scanline, 
+        const uint8_t *src_scanline, size_t n, uint8_t galpha) {
+    int ak, v;
+
+    for (size_t i = 0; i < n; i++) {
+        ak = src_scanline[3] * galpha / 255;
+
+        if (ak != 0 || src_scanline[0] != 0 || src_scanline[1] != 0
+                || src_scanline[2] != 0) {
+            for (int c = 0; c < 3; c++) {
+                v = src_scanline[c] * galpha / 255 
+                        + dst_scanline[c] * (255 - ak) / 255;
+                dst_scanline[c] = (v > 255) ? 255 : v;
+            }
         }
+
+        src_scanline += 4;
+        dst_scanline += 4;
     }
 }
+
+void BGRAn8_alpha_key_default(RawFrame *bkgd, RawFrame *key,
+        coord_t x, coord_t y, uint8_t galpha) {
+    BGRAn8_alpha_key_rows(bkgd, key, x, y, galpha, BGRAn8_key_row_default);
+}
+
+void BGRAn8_alpha_key_premultiplied_default(RawFrame *bkgd, RawFrame *key,
+        coord_t x, coord_t y, uint8_t galpha) {
+    BGRAn8_alpha_key_rows(bkgd, key, x, y, galpha, 
+            BGRAn8_key_row_premultiplied_default);
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ * 
+ * This file is part of openreplay.
+ * 
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * AVX2 version of the SSE2 BGRAn8 keying, 8 pixels at a time. Unpacking
+ * and packing stay within 128-bit lanes, so pixels keep their places.
+ */
+
+#include "raw_frame.h"
+#include "draw_BGRAn8.h"
+#include <immintrin.h>
+
+#define AVX2 __attribute__((target("avx2")))
+
+/* every byte of the vector matched */
+#define ALL_SET(v) ((unsigned int) _mm256_movemask_epi8(v) == 0xffffffff)
+
+static inline AVX2 __m256i div255(__m256i x) {
+    return _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(x, 
+            _mm256_set1_epi16(1)), _mm256_srli_epi16(x, 8)), 8);
+}
+
+static inline AVX2 __m256i spread_alpha(__m256i px) {
+    return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(px, 0xff), 0xff);
+}
+
+static inline AVX2 __m256i merge(__m256i key, __m256i bkgd) {
+    const __m256i alpha = _mm256_set1_epi32(0xff000000);
+
+    return _mm256_or_si256(_mm256_andnot_si256(alpha, key), 
+            _mm256_and_si256(alpha, bkgd));
+}
+
+static inline AVX2 __m256i blend_4(__m256i k, __m256i d, __m256i ga, 
+        bool scale) {
+    __m256i a = spread_alpha(k);
+
+    if (scale) {
+        a = div255(_mm256_mullo_epi16(a, ga));
+    }
+
+    return div255(_mm256_add_epi16(_mm256_mullo_epi16(k, a), 
+            _mm256_mullo_epi16(d, 
+                _mm256_sub_epi16(_mm256_set1_epi16(255), a))));
+}
+
+static inline AVX2 __m256i blend_4_premultiplied(__m256i k, __m256i d, 
+        __m256i ga, bool scale) {
+    if (scale) {
+        k = div255(_mm256_mullo_epi16(k, ga));
+    }
+
+    return _mm256_add_epi16(k, div255(_mm256_mullo_epi16(d, 
+            _mm256_sub_epi16(_mm256_set1_epi16(255), spread_alpha(k)))));
+}
+
+static AVX2 void key_row(uint8_t *dst, const uint8_t *key, size_t n, 
+        uint8_t galpha) {
+    const __m256i zero = _mm256_setzero_si256( );
+    const __m256i opaque = _mm256_set1_epi32(0xff);
+    const __m256i ga = _mm256_set1_epi16(galpha);
+    const bool scale = (galpha != 255);
+    __m256i k, d, a, lo, hi;
+    size_t i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        k = _mm256_loadu_si256((__m256i *) (key + 4*i));
+        a = _mm256_srli_epi32(k, 24);
+
+        if (ALL_SET(_mm256_cmpeq_epi32(a, zero))) {
+            continue;
+        }
+
+        d = _mm256_loadu_si256((__m256i *) (dst + 4*i));
+        if (!scale && ALL_SET(_mm256_cmpeq_epi32(a, opaque))) {
+            _mm256_storeu_si256((__m256i *) (dst + 4*i), merge(k, d));
+            continue;
+        }
+
+        lo = blend_4(_mm256_unpacklo_epi8(k, zero), 
+                _mm256_unpacklo_epi8(d, zero), ga, scale);
+        hi = blend_4(_mm256_unpackhi_epi8(k, zero), 
+                _mm256_unpackhi_epi8(d, zero), ga, scale);
+        _mm256_storeu_si256((__m256i *) (dst + 4*i), 
+                merge(_mm256_packus_epi16(lo, hi), d));
+    }
+
+    if (i < n) {
+        BGRAn8_key_row_sse2(dst + 4*i, key + 4*i, n - i, galpha);
+    }
+}
+
+static AVX2 void key_row_premultiplied(uint8_t *dst, const uint8_t *key, 
+        size_t n, uint8_t galpha) {
+    const __m256i zero = _mm256_setzero_si256( );
+    const __m256i opaque = _mm256_set1_epi32(0xff);
+    const __m256i ga = _mm256_set1_epi16(galpha);
+    const bool scale = (galpha != 255);
+    __m256i k, d, lo, hi;
+    size_t i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        k = _mm256_loadu_si256((__m256i *) (key + 4*i));
+
+        if (ALL_SET(_mm256_cmpeq_epi8(k, zero))) {
+            continue;
+        }
+
+        d = _mm256_loadu_si256((__m256i *) (dst + 4*i));
+        if (!scale && ALL_SET(_mm256_cmpeq_epi32(
+                _mm256_srli_epi32(k, 24), opaque))) {
+            _mm256_storeu_si256((__m256i *) (dst + 4*i), merge(k, d));
+            continue;
+        }
+
+        lo = blend_4_premultiplied(_mm256_unpacklo_epi8(k, zero), 
+                _mm256_unpacklo_epi8(d, zero), ga, scale);
+        hi = blend_4_premultiplied(_mm256_unpackhi_epi8(k, zero), 
+                _mm256_unpackhi_epi8(d, zero), ga, scale);
+        _mm256_storeu_si256((__m256i *) (dst + 4*i), 
+                merge(_mm256_packus_epi16(lo, hi), d));
+    }
+
+    if (i < n) {
+        BGRAn8_key_row_premultiplied_sse2(dst + 4*i, key + 4*i, 
+                n - i, galpha);
+    }
+}
+
+void BGRAn8_alpha_key_avx2(RawFrame *bkgd, RawFrame *key,
+        coord_t x, coord_t y, uint8_t galpha) {
+    BGRAn8_alpha_key_rows(bkgd, key, x, y, galpha, key_row);
+}
+
+void BGRAn8_alpha_key_premultiplied_avx2(RawFrame *bkgd, RawFrame *key,
+        coord_t x, coord_t y, uint8_t galpha) {
+    BGRAn8_alpha_key_rows(bkgd, key, x, y, galpha, key_row_premultiplied);
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ * 
+ * This file is part of openreplay.
+ * 
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * SSE2 BGRAn8-over-BGRAn8 keying, 4 pixels at a time, giving exactly
+ * what the C routines do. Blocks of 4 fully transparent key pixels are
+ * skipped, and blocks of 4 fully opaque ones (at full global alpha) are
+ * copied, so text and graticules mostly cost a load and a compare.
+ */
+
+#include "raw_frame.h"
+#include "draw_BGRAn8.h"
+#include <emmintrin.h>
+
+/* x / 255, rounded down, for x up to 255 * 255 */
+static inline __m128i div255(__m128i x) {
+    return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(x, 
+            _mm_set1_epi16(1)), _mm_srli_epi16(x, 8)), 8);
+}
+
+/* each of two pixels' alpha, in all four of its words */
+static inline __m128i spread_alpha(__m128i px) {
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(px, 0xff), 0xff);
+}
+
+/* key color, background alpha */
+static inline __m128i merge(__m128i key, __m128i bkgd) {
+    const __m128i alpha = _mm_set1_epi32(0xff000000);
+
+    return _mm_or_si128(_mm_andnot_si128(alpha, key), 
+            _mm_and_si128(alpha, bkgd));
+}
+
+/* two pixels, one word per channel */
+static inline __m128i blend_2(__m128i k, __m128i d, __m128i ga, 
+        bool scale) {
+    __m128i a = spread_alpha(k);
+
+    if (scale) {
+        a = div255(_mm_mullo_epi16(a, ga));
+    }
+
+    return div255(_mm_add_epi16(_mm_mullo_epi16(k, a), 
+            _mm_mullo_epi16(d, _mm_sub_epi16(_mm_set1_epi16(255), a))));
+}
+
+static inline __m128i blend_2_premultiplied(__m128i k, __m128i d, 
+        __m128i ga, bool scale) {
+    if (scale) {
+        k = div255(_mm_mullo_epi16(k, ga));
+    }
+
+    /* the sum can pass 255; packing saturates it */
+    return _mm_add_epi16(k, div255(_mm_mullo_epi16(d, 
+            _mm_sub_epi16(_mm_set1_epi16(255), spread_alpha(k)))));
+}
+
+void BGRAn8_key_row_sse2(uint8_t *dst, const uint8_t *key, size_t n, 
+        uint8_t galpha) {
+    const __m128i zero = _mm_setzero_si128( );
+    const __m128i opaque = _mm_set1_epi32(0xff);
+    const __m128i ga = _mm_set1_epi16(galpha);
+    const bool scale = (galpha != 255);
+    __m128i k, d, a, lo, hi;
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        k = _mm_loadu_si128((__m128i *) (key + 4*i));
+        a = _mm_srli_epi32(k, 24);
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, zero)) == 0xffff) {
+            continue;
+        }
+
+        d = _mm_loadu_si128((__m128i *) (dst + 4*i));
+        if (!scale && _mm_movemask_epi8(_mm_cmpeq_epi32(a, opaque)) 
+                == 0xffff) {
+            _mm_storeu_si128((__m128i *) (dst + 4*i), merge(k, d));
+            continue;
+        }
+
+        lo = blend_2(_mm_unpacklo_epi8(k, zero), 
+                _mm_unpacklo_epi8(d, zero), ga, scale);
+        hi = blend_2(_mm_unpackhi_epi8(k, zero), 
+                _mm_unpackhi_epi8(d, zero), ga, scale);
+        _mm_storeu_si128((__m128i *) (dst + 4*i), 
+                merge(_mm_packus_epi16(lo, hi), d));
+    }
+
+    if (i < n) {
+        BGRAn8_key_row_default(dst + 4*i, key + 4*i, n - i, galpha);
+    }
+}
+
+void BGRAn8_key_row_premultiplied_sse2(uint8_t *dst, const uint8_t *key, 
+        size_t n, uint8_t galpha) {
+    const __m128i zero = _mm_setzero_si128( );
+    const __m128i opaque = _mm_set1_epi32(0xff);
+    const __m128i ga = _mm_set1_epi16(galpha);
+    const bool scale = (galpha != 255);
+    __m128i k, d, lo, hi;
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        k = _mm_loadu_si128((__m128i *) (key + 4*i));
+
+        /* transparent black adds nothing */
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(k, zero)) == 0xffff) {
+            continue;
+        }
+
+        d = _mm_loadu_si128((__m128i *) (dst + 4*i));
+        if (!scale && _mm_movemask_epi8(_mm_cmpeq_epi32(
+                _mm_srli_epi32(k, 24), opaque)) == 0xffff) {
+            _mm_storeu_si128((__m128i *) (dst + 4*i), merge(k, d));
+            continue;
+        }
+
+        lo = blend_2_premultiplied(_mm_unpacklo_epi8(k, zero), 
+                _mm_unpacklo_epi8(d, zero), ga, scale);
+        hi = blend_2_premultiplied(_mm_unpackhi_epi8(k, zero), 
+                _mm_unpackhi_epi8(d, zero), ga, scale);
+        _mm_storeu_si128((__m128i *) (dst + 4*i), 
+                merge(_mm_packus_epi16(lo, hi), d));
+    }
+
+    if (i < n) {
+        BGRAn8_key_row_premultiplied_default(dst + 4*i, key + 4*i, 
+                n - i, galpha);
+    }
+}
+
+void BGRAn8_alpha_key_sse2(RawFrame *bkgd, RawFrame *key,
+        coord_t x, coord_t y, uint8_t galpha) {
+    BGRAn8_alpha_key_rows(bkgd, key, x, y, galpha, BGRAn8_key_row_sse2);
+}
+
+void BGRAn8_alpha_key_premultiplied_sse2(RawFrame *bkgd, RawFrame *key,
+        coord_t x, coord_t y, uint8_t galpha) {
+    BGRAn8_alpha_key_rows(bkgd, key, x, y, galpha, 
+            BGRAn8_key_row_premultiplied_sse2);
+}
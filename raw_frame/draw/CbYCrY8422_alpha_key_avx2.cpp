@@ -0,0 +1,145 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ * 
+ * This file is part of openreplay.
+ * 
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * AVX2 version of CbYCrY8422_alpha_key_sse2. Each 128-bit lane works
+ * exactly like CbYCrY8422_BGRAn8_key_chunk_sse2 (see there for the
+ * constants), so the output is identical, 8 pixels at a time.
+ */
+
+#include "raw_frame.h"
+#include <assert.h>
+#include <immintrin.h>
+
+extern "C" 
+void CbYCrY8422_BGRAn8_key_chunk_sse2(void *bkgd, void *key, 
+        uint64_t size, uint64_t galpha);
+
+void CbYCrY8422_alpha_key_default(RawFrame *bkgd, RawFrame *key,
+        coord_t x, coord_t y, uint8_t galpha);
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 void CbYCrY8422_BGRAn8_key_chunk_avx2(uint8_t *bkgd, uint8_t *key,
+        size_t size, uint8_t galpha) {
+    const __m256i zero = _mm256_setzero_si256( );
+    const __m256i lsb32_mask = _mm256_set1_epi32(0xff);
+    const __m256i rgb_scale = _mm256_set1_epi32(56284);
+    const __m256i kb = _mm256_set1_epi32(36124);
+    const __m256i kr = _mm256_set1_epi32(42566);
+    const __m256i cb_cr_offset = _mm256_set1_epi32(128);
+    const __m256i ga = _mm256_set1_epi32(galpha << 8);
+    __m256i k, a, r, g, b, t, by, bu, bv;
+
+    while (size >= 32) {
+        k = _mm256_loadu_si256((__m256i *) key);
+
+        a = _mm256_and_si256(_mm256_srli_epi32(k, 24), lsb32_mask);
+        r = _mm256_and_si256(_mm256_srli_epi32(k, 16), lsb32_mask);
+        g = _mm256_and_si256(_mm256_srli_epi32(k, 8), lsb32_mask);
+        b = _mm256_and_si256(k, lsb32_mask);
+
+        /* scale RGB to 0..219 */
+        r = _mm256_mulhi_epu16(r, rgb_scale);
+        g = _mm256_mulhi_epu16(g, rgb_scale);
+        b = _mm256_mulhi_epu16(b, rgb_scale);
+
+        /* luma */
+        g = _mm256_mulhi_epu16(g, _mm256_set1_epi32(46871));
+        g = _mm256_adds_epu16(g, 
+                _mm256_mulhi_epu16(b, _mm256_set1_epi32(4732)));
+        g = _mm256_adds_epu16(g, 
+                _mm256_mulhi_epu16(r, _mm256_set1_epi32(13933)));
+
+        /* Cb and Cr */
+        b = _mm256_subs_epu16(_mm256_adds_epu16(_mm256_mulhi_epu16(b, kb),
+                cb_cr_offset), _mm256_mulhi_epu16(g, kb));
+        r = _mm256_subs_epu16(_mm256_adds_epu16(_mm256_mulhi_epu16(r, kr),
+                cb_cr_offset), _mm256_mulhi_epu16(g, kr));
+
+        g = _mm256_adds_epu16(g, _mm256_set1_epi32(16));
+
+        /* eight background pixels, one word per byte */
+        t = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) bkgd));
+        bu = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(t, 0x00), 0x00);
+        bu = _mm256_and_si256(bu, lsb32_mask);
+        bv = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(t, 0xaa), 0xaa);
+        bv = _mm256_and_si256(bv, lsb32_mask);
+        by = _mm256_srli_epi32(t, 16);
+
+        /* blend */
+        a = _mm256_mulhi_epu16(_mm256_slli_epi32(a, 8), ga);
+        r = _mm256_mulhi_epu16(r, a);
+        g = _mm256_mulhi_epu16(g, a);
+        b = _mm256_mulhi_epu16(b, a);
+
+        a = _mm256_sub_epi32(_mm256_set1_epi32(65535), a);
+        g = _mm256_adds_epu16(g, _mm256_mulhi_epu16(by, a));
+        b = _mm256_adds_epu16(b, _mm256_mulhi_epu16(bu, a));
+        r = _mm256_adds_epu16(r, _mm256_mulhi_epu16(bv, a));
+
+        /* repack; each lane leaves 4 pixels in its low 8 bytes */
+        g = _mm256_slli_epi32(_mm256_packs_epi32(g, zero), 8);
+        b = _mm256_and_si256(_mm256_packs_epi32(b, zero), lsb32_mask);
+        r = _mm256_slli_epi32(_mm256_packs_epi32(r, zero), 16);
+        t = _mm256_or_si256(_mm256_or_si256(g, b), r);
+
+        _mm_storeu_si128((__m128i *) bkgd, _mm256_castsi256_si128(
+                _mm256_permute4x64_epi64(t, 0x08)));
+
+        key += 32;
+        bkgd += 16;
+        size -= 32;
+    }
+
+    if (size > 0) {
+        CbYCrY8422_BGRAn8_key_chunk_sse2(bkgd, key, size, galpha);
+    }
+}
+
+void CbYCrY8422_alpha_key_avx2(RawFrame *bkgd, RawFrame *key,
+        coord_t x, coord_t y, uint8_t galpha) {
+    
+    int i;
+    uint8_t *pix_ptr;
+
+    assert(x % 2 == 0);
+
+    if (key->pixel_format( ) == RawFrame::BGRAn8) {
+        /* special case: exact size */
+        if (x == 0 && bkgd->w( ) == key->w( )) {
+            if (bkgd->h( ) < key->h( )) {
+                CbYCrY8422_BGRAn8_key_chunk_avx2(bkgd->scanline(y), 
+                        key->data( ), 2*bkgd->size( ), galpha);
+            } else {
+                CbYCrY8422_BGRAn8_key_chunk_avx2(bkgd->scanline(y), 
+                        key->data( ), key->size( ), galpha);
+            }
+        } else {
+            for (i = 0; i < key->h( ) && y < bkgd->h( ); i++, y++) {
+                pix_ptr = bkgd->scanline(y) + 2*x;
+                CbYCrY8422_BGRAn8_key_chunk_avx2(pix_ptr, 
+                        key->scanline(i), key->pitch( ), galpha);
+            }
+        }
+    } else {
+        /* fall back on unoptimized routine */
+        CbYCrY8422_alpha_key_default(bkgd, key, x, y, galpha);
+    }
+}
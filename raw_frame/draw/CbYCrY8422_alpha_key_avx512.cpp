@@ -0,0 +1,147 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ * 
+ * This file is part of openreplay.
+ * 
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * AVX-512 (F and BW) version of CbYCrY8422_alpha_key_sse2, 16 pixels at
+ * a time. Like the AVX2 one, each lane matches the SSE2 code exactly.
+ */
+
+#include "raw_frame.h"
+#include <assert.h>
+#include <immintrin.h>
+
+void CbYCrY8422_BGRAn8_key_chunk_avx2(uint8_t *bkgd, uint8_t *key,
+        size_t size, uint8_t galpha);
+
+void CbYCrY8422_alpha_key_default(RawFrame *bkgd, RawFrame *key,
+        coord_t x, coord_t y, uint8_t galpha);
+
+#define AVX512 __attribute__((target("avx512f,avx512bw")))
+
+/* gcc 12's own _mm512_undefined_epi32( ) trips this at -O2 */
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+AVX512 void CbYCrY8422_BGRAn8_key_chunk_avx512(uint8_t *bkgd, uint8_t *key,
+        size_t size, uint8_t galpha) {
+    const __m512i zero = _mm512_setzero_si512( );
+    const __m512i lsb32_mask = _mm512_set1_epi32(0xff);
+    const __m512i rgb_scale = _mm512_set1_epi32(56284);
+    const __m512i kb = _mm512_set1_epi32(36124);
+    const __m512i kr = _mm512_set1_epi32(42566);
+    const __m512i cb_cr_offset = _mm512_set1_epi32(128);
+    const __m512i ga = _mm512_set1_epi32(galpha << 8);
+    const __m512i low_halves = _mm512_setr_epi64(0, 2, 4, 6, 0, 0, 0, 0);
+    __m512i k, a, r, g, b, t, by, bu, bv;
+
+    while (size >= 64) {
+        k = _mm512_loadu_si512(key);
+
+        a = _mm512_and_si512(_mm512_srli_epi32(k, 24), lsb32_mask);
+        r = _mm512_and_si512(_mm512_srli_epi32(k, 16), lsb32_mask);
+        g = _mm512_and_si512(_mm512_srli_epi32(k, 8), lsb32_mask);
+        b = _mm512_and_si512(k, lsb32_mask);
+
+        /* scale RGB to 0..219 */
+        r = _mm512_mulhi_epu16(r, rgb_scale);
+        g = _mm512_mulhi_epu16(g, rgb_scale);
+        b = _mm512_mulhi_epu16(b, rgb_scale);
+
+        /* luma */
+        g = _mm512_mulhi_epu16(g, _mm512_set1_epi32(46871));
+        g = _mm512_adds_epu16(g, 
+                _mm512_mulhi_epu16(b, _mm512_set1_epi32(4732)));
+        g = _mm512_adds_epu16(g, 
+                _mm512_mulhi_epu16(r, _mm512_set1_epi32(13933)));
+
+        /* Cb and Cr */
+        b = _mm512_subs_epu16(_mm512_adds_epu16(_mm512_mulhi_epu16(b, kb),
+                cb_cr_offset), _mm512_mulhi_epu16(g, kb));
+        r = _mm512_subs_epu16(_mm512_adds_epu16(_mm512_mulhi_epu16(r, kr),
+                cb_cr_offset), _mm512_mulhi_epu16(g, kr));
+
+        g = _mm512_adds_epu16(g, _mm512_set1_epi32(16));
+
+        /* sixteen background pixels, one word per byte */
+        t = _mm512_cvtepu8_epi16(_mm256_loadu_si256((__m256i *) bkgd));
+        bu = _mm512_shufflehi_epi16(_mm512_shufflelo_epi16(t, 0x00), 0x00);
+        bu = _mm512_and_si512(bu, lsb32_mask);
+        bv = _mm512_shufflehi_epi16(_mm512_shufflelo_epi16(t, 0xaa), 0xaa);
+        bv = _mm512_and_si512(bv, lsb32_mask);
+        by = _mm512_srli_epi32(t, 16);
+
+        /* blend */
+        a = _mm512_mulhi_epu16(_mm512_slli_epi32(a, 8), ga);
+        r = _mm512_mulhi_epu16(r, a);
+        g = _mm512_mulhi_epu16(g, a);
+        b = _mm512_mulhi_epu16(b, a);
+
+        a = _mm512_sub_epi32(_mm512_set1_epi32(65535), a);
+        g = _mm512_adds_epu16(g, _mm512_mulhi_epu16(by, a));
+        b = _mm512_adds_epu16(b, _mm512_mulhi_epu16(bu, a));
+        r = _mm512_adds_epu16(r, _mm512_mulhi_epu16(bv, a));
+
+        /* repack; each lane leaves 4 pixels in its low 8 bytes */
+        g = _mm512_slli_epi32(_mm512_packs_epi32(g, zero), 8);
+        b = _mm512_and_si512(_mm512_packs_epi32(b, zero), lsb32_mask);
+        r = _mm512_slli_epi32(_mm512_packs_epi32(r, zero), 16);
+        t = _mm512_or_si512(_mm512_or_si512(g, b), r);
+
+        _mm256_storeu_si256((__m256i *) bkgd, _mm512_castsi512_si256(
+                _mm512_permutexvar_epi64(low_halves, t)));
+
+        key += 64;
+        bkgd += 32;
+        size -= 64;
+    }
+
+    if (size > 0) {
+        CbYCrY8422_BGRAn8_key_chunk_avx2(bkgd, key, size, galpha);
+    }
+}
+
+void CbYCrY8422_alpha_key_avx512(RawFrame *bkgd, RawFrame *key,
+        coord_t x, coord_t y, uint8_t galpha) {
+    
+    int i;
+    uint8_t *pix_ptr;
+
+    assert(x % 2 == 0);
+
+    if (key->pixel_format( ) == RawFrame::BGRAn8) {
+        /* special case: exact size */
+        if (x == 0 && bkgd->w( ) == key->w( )) {
+            if (bkgd->h( ) < key->h( )) {
+                CbYCrY8422_BGRAn8_key_chunk_avx512(bkgd->scanline(y), 
+                        key->data( ), 2*bkgd->size( ), galpha);
+            } else {
+                CbYCrY8422_BGRAn8_key_chunk_avx512(bkgd->scanline(y), 
+                        key->data( ), key->size( ), galpha);
+            }
+        } else {
+            for (i = 0; i < key->h( ) && y < bkgd->h( ); i++, y++) {
+                pix_ptr = bkgd->scanline(y) + 2*x;
+                CbYCrY8422_BGRAn8_key_chunk_avx512(pix_ptr, 
+                        key->scanline(i), key->pitch( ), galpha);
+            }
+        }
+    } else {
+        /* fall back on unoptimized routine */
+        CbYCrY8422_alpha_key_default(bkgd, key, x, y, galpha);
+    }
+}
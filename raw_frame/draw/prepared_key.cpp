@@ -0,0 +1,172 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ *
+ * This file is part of openreplay.
+ *
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "prepared_key.h"
+#include "cpu_dispatch.h"
+#include <stdexcept>
+
+/*
+ * One key pixel in the fixed point of CbYCrY8422_BGRAn8_key_chunk_sse2:
+ * Y, Cb and Cr weighted by alpha, and what is left for the background.
+ */
+struct prepared_pixel {
+    uint8_t y, cb, cr;
+    uint16_t inv_alpha;
+};
+
+static inline uint32_t mulhi(uint32_t a, uint32_t b) {
+    return (a * b) >> 16;
+}
+
+static inline uint32_t subs(uint32_t a, uint32_t b) {
+    return (a > b) ? a - b : 0;
+}
+
+static void prepare_pixel(const uint8_t *kp, uint8_t galpha,
+        prepared_pixel &px) {
+    uint32_t r, g, b, y, cb, cr, a;
+
+    /* scale RGB to 0..219 */
+    b = mulhi(kp[0], 56284);
+    g = mulhi(kp[1], 56284);
+    r = mulhi(kp[2], 56284);
+
+    y = mulhi(g, 46871) + mulhi(b, 4732) + mulhi(r, 13933);
+    cb = subs(mulhi(b, 36124) + 128, mulhi(y, 36124));
+    cr = subs(mulhi(r, 42566) + 128, mulhi(y, 42566));
+    y += 16;
+
+    a = kp[3] * galpha;
+    px.y = mulhi(y, a);
+    px.cb = mulhi(cb, a);
+    px.cr = mulhi(cr, a);
+    px.inv_alpha = 65535 - a;
+}
+
+PreparedKey::PreparedKey(RawFrame *key, uint8_t galpha) {
+    prepared_pixel p0, p1;
+    const uint8_t transparent[4] = { 0, 0, 0, 0 };
+    const uint8_t *kp;
+    coord_t i, j;
+    span s;
+
+    if (key->pixel_format( ) != RawFrame::BGRAn8) {
+        throw std::runtime_error("Unsupported key requested");
+    }
+
+    _w = key->w( );
+    _h = key->h( );
+
+    for (i = 0; i < _h; i++) {
+        kp = key->scanline(i);
+        s.w = 0;
+
+        for (j = 0; j < _w; j += 2) {
+            /* a lone last pixel pairs with nothing */
+            prepare_pixel(kp + 4 * j, galpha, p0);
+            prepare_pixel(j + 1 < _w ? kp + 4 * j + 4 : transparent,
+                    galpha, p1);
+
+            if (p0.inv_alpha == 65535 && p1.inv_alpha == 65535) {
+                /* nothing to key here, so end the run */
+                if (s.w > 0) {
+                    spans.push_back(s);
+                    s.w = 0;
+                }
+                continue;
+            }
+
+            if (s.w == 0) {
+                s.x = j;
+                s.y = i;
+                s.offset = color.size( );
+            }
+            s.w += 2;
+
+            /* chroma goes with the first pixel of the pair */
+            color.push_back(p0.cb);
+            color.push_back(p0.y);
+            color.push_back(p0.cr);
+            color.push_back(p1.y);
+            inv_alpha.push_back(p0.inv_alpha);
+            inv_alpha.push_back(p0.inv_alpha);
+            inv_alpha.push_back(p0.inv_alpha);
+            inv_alpha.push_back(p1.inv_alpha);
+        }
+
+        if (s.w > 0) {
+            spans.push_back(s);
+        }
+    }
+
+#ifdef SKIP_ASSEMBLY_ROUTINES
+    do_apply_span = prepared_key_span_default;
+#else
+    if (cpu_sse2_available( )) {
+        do_apply_span = prepared_key_span_sse2;
+    } else {
+        do_apply_span = prepared_key_span_default;
+    }
+#endif
+}
+
+void PreparedKey::apply(RawFrame *bkgd, coord_t x, coord_t y) const {
+    unsigned int bx, by;
+    size_t i, n;
+
+    if (bkgd->pixel_format( ) != RawFrame::CbYCrY8422) {
+        throw std::runtime_error("unsupported pixel formats");
+    }
+
+    x &= ~1;
+
+    for (i = 0; i < spans.size( ); i++) {
+        const span &s = spans[i];
+
+        /* spans are in line order, so nothing further is on screen */
+        by = y + s.y;
+        if (by >= bkgd->h( )) {
+            break;
+        }
+
+        bx = x + s.x;
+        if (bx >= bkgd->w( )) {
+            continue;
+        }
+
+        n = s.w;
+        if (bx + n > bkgd->w( )) {
+            n = bkgd->w( ) - bx;
+        }
+
+        do_apply_span(2 * n, bkgd->scanline(by) + 2 * bx,
+                &color[s.offset], &inv_alpha[s.offset]);
+    }
+}
+
+void prepared_key_span_default(size_t n, uint8_t *bkgd,
+        const uint8_t *color, const uint16_t *inv_alpha) {
+    uint32_t v;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        v = color[i] + mulhi(bkgd[i], inv_alpha[i]);
+        bkgd[i] = (v > 255) ? 255 : v;
+    }
+}
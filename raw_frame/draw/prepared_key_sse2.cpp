@@ -0,0 +1,54 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ *
+ * This file is part of openreplay.
+ *
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * SSE2 span routine for PreparedKey: 16 background bytes at a time.
+ */
+
+#include "prepared_key.h"
+#include <emmintrin.h>
+
+void prepared_key_span_sse2(size_t n, uint8_t *bkgd,
+        const uint8_t *color, const uint16_t *inv_alpha) {
+    const __m128i zero = _mm_setzero_si128( );
+    __m128i b, c, lo, hi;
+
+    while (n >= 16) {
+        b = _mm_loadu_si128((__m128i *) bkgd);
+        c = _mm_loadu_si128((__m128i *) color);
+
+        lo = _mm_mulhi_epu16(_mm_unpacklo_epi8(b, zero),
+                _mm_loadu_si128((__m128i *) inv_alpha));
+        hi = _mm_mulhi_epu16(_mm_unpackhi_epi8(b, zero),
+                _mm_loadu_si128((__m128i *) (inv_alpha + 8)));
+        lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(c, zero));
+        hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(c, zero));
+
+        _mm_storeu_si128((__m128i *) bkgd, _mm_packus_epi16(lo, hi));
+
+        bkgd += 16;
+        color += 16;
+        inv_alpha += 16;
+        n -= 16;
+    }
+
+    if (n > 0) {
+        prepared_key_span_default(n, bkgd, color, inv_alpha);
+    }
+}
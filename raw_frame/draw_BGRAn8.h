@@ -20,17 +20,65 @@
 #ifndef _OPENREPLAY_DRAW_BGRAN8_H
 #define _OPENREPLAY_DRAW_BGRAN8_H
 
+#include "raw_frame.h"
+#include "cpu_dispatch.h"
+
+/* key n pixels from key over dst (both BGRAn8 scanlines) */
+typedef void (*BGRAn8_key_row_fn)(uint8_t *dst, const uint8_t *key, 
+        size_t n, uint8_t galpha);
+
+void BGRAn8_alpha_key_rows(RawFrame *bkgd, RawFrame *key,
+        coord_t x, coord_t y, uint8_t galpha, BGRAn8_key_row_fn key_row);
+
 void BGRAn8_blit_default(RawFrame *bkgd, RawFrame *src, coord_t x, coord_t y);
+
+void BGRAn8_key_row_default(uint8_t *, const uint8_t *, size_t, uint8_t);
+void BGRAn8_key_row_premultiplied_default(uint8_t *, const uint8_t *, 
+        size_t, uint8_t);
 void BGRAn8_alpha_key_default(RawFrame *bkgd, RawFrame *key, 
         coord_t x, coord_t y, uint8_t galpha);
+void BGRAn8_alpha_key_premultiplied_default(RawFrame *bkgd, RawFrame *key, 
+        coord_t x, coord_t y, uint8_t galpha);
+
+#ifndef SKIP_ASSEMBLY_ROUTINES
+void BGRAn8_key_row_sse2(uint8_t *, const uint8_t *, size_t, uint8_t);
+void BGRAn8_key_row_premultiplied_sse2(uint8_t *, const uint8_t *, 
+        size_t, uint8_t);
+void BGRAn8_alpha_key_sse2(RawFrame *bkgd, RawFrame *key, 
+        coord_t x, coord_t y, uint8_t galpha);
+void BGRAn8_alpha_key_premultiplied_sse2(RawFrame *bkgd, RawFrame *key, 
+        coord_t x, coord_t y, uint8_t galpha);
+void BGRAn8_alpha_key_avx2(RawFrame *bkgd, RawFrame *key, 
+        coord_t x, coord_t y, uint8_t galpha);
+void BGRAn8_alpha_key_premultiplied_avx2(RawFrame *bkgd, RawFrame *key, 
+        coord_t x, coord_t y, uint8_t galpha);
+#endif
 
 class BGRAn8DrawOps : public RawFrameDrawOps {
     public:
         BGRAn8DrawOps(RawFrame *f_) : RawFrameDrawOps(f_) {
             do_blit = BGRAn8_blit_default;
+
+#ifdef SKIP_ASSEMBLY_ROUTINES
             do_alpha_blend = BGRAn8_alpha_key_default;
+            do_alpha_blend_premultiplied = 
+                BGRAn8_alpha_key_premultiplied_default;
+#else
+            if (cpu_avx2_available( )) {
+                do_alpha_blend = BGRAn8_alpha_key_avx2;
+                do_alpha_blend_premultiplied = 
+                    BGRAn8_alpha_key_premultiplied_avx2;
+            } else if (cpu_sse2_available( )) {
+                do_alpha_blend = BGRAn8_alpha_key_sse2;
+                do_alpha_blend_premultiplied = 
+                    BGRAn8_alpha_key_premultiplied_sse2;
+            } else {
+                do_alpha_blend = BGRAn8_alpha_key_default;
+                do_alpha_blend_premultiplied = 
+                    BGRAn8_alpha_key_premultiplied_default;
+            }
+#endif
         }
 };
 
 #endif
-
@@ -30,6 +30,10 @@ void CbYCrY8422_alpha_key_default(RawFrame *bkgd, RawFrame *key,
 #ifndef SKIP_ASSEMBLY_ROUTINES 
 void CbYCrY8422_alpha_key_sse2(RawFrame *bkgd, RawFrame *key, 
         coord_t x, coord_t y, uint8_t galpha);
+void CbYCrY8422_alpha_key_avx2(RawFrame *bkgd, RawFrame *key, 
+        coord_t x, coord_t y, uint8_t galpha);
+void CbYCrY8422_alpha_key_avx512(RawFrame *bkgd, RawFrame *key, 
+        coord_t x, coord_t y, uint8_t galpha);
 #endif
 
 class CbYCrY8422DrawOps : public RawFrameDrawOps {
@@ -39,7 +43,11 @@ class CbYCrY8422DrawOps : public RawFrameDrawOps {
 #ifdef SKIP_ASSEMBLY_ROUTINES
             do_alpha_blend = CbYCrY8422_alpha_key_default;
 #else
-            if (cpu_sse3_available( )) {
+            if (cpu_avx512_available( )) {
+                do_alpha_blend = CbYCrY8422_alpha_key_avx512;
+            } else if (cpu_avx2_available( )) {
+                do_alpha_blend = CbYCrY8422_alpha_key_avx2;
+            } else if (cpu_sse3_available( )) {
                 do_alpha_blend = CbYCrY8422_alpha_key_sse2;
             } else {
                 do_alpha_blend = CbYCrY8422_alpha_key_default;
@@ -29,12 +29,16 @@ void YCbCr8P422_CbYCrY8422_default(size_t, uint8_t *, uint8_t *,
 #ifndef SKIP_ASSEMBLY_ROUTINES_
     extern "C" void YCbCr8P422_CbYCrY8422_vector(size_t, uint8_t *, uint8_t *,
         uint8_t *, uint8_t *);
+    void YCbCr8P422_CbYCrY8422_avx2(size_t, uint8_t *, uint8_t *,
+        uint8_t *, uint8_t *);
 #endif
 
 class CbYCrY8422Packer : public RawFramePacker {
     public:
         CbYCrY8422Packer(RawFrame *f) : RawFramePacker(f) {
-            if (cpu_sse2_available( )) {
+            if (cpu_avx2_available( )) {
+                do_YCbCr8P422 = YCbCr8P422_CbYCrY8422_avx2;
+            } else if (cpu_sse2_available( )) {
                 do_YCbCr8P422 = YCbCr8P422_CbYCrY8422_vector;
             } else {
                 do_YCbCr8P422 = YCbCr8P422_CbYCrY8422_default;
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ *
+ * This file is part of openreplay.
+ *
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _OPENREPLAY_POLYPHASE_SCALER_H
+#define _OPENREPLAY_POLYPHASE_SCALER_H
+
+#include "raw_frame.h"
+#include "cpu_dispatch.h"
+#include <vector>
+
+/* 
+ * Fixed point: each set of coefficients sums to 1 << POLYPHASE_COEF_BITS,
+ * and horizontally filtered lines carry POLYPHASE_LINE_BITS of fraction.
+ */
+#define POLYPHASE_COEF_BITS 14
+#define POLYPHASE_LINE_BITS 6
+
+/*
+ * Separable polyphase scaler for any ratio, working directly on packed
+ * CbYCrY8422 (chroma stays co-sited with the even luma samples) or
+ * BGRAn8.
+ *
+ * Each source line the output needs is filtered horizontally once, into
+ * a small ring of 16-bit lines; every output line is then a vertical
+ * filter across the ring. The horizontal filter is table-driven per
+ * output byte, so one kernel serves every packed layout.
+ *
+ * The tables for a given (format, source size, output size, filter) are
+ * built once and cached, so scaling tile after tile to the same size
+ * costs nothing extra.
+ */
+class PolyphaseScaler {
+    public:
+        /* scale all of src into all of dst; both must be the same format */
+        static void scale(RawFrame *src, RawFrame *dst,
+                scale_filter_t filter = SCALE_BICUBIC);
+
+    protected:
+        PolyphaseScaler(RawFrame::PixelFormat pf, coord_t sw, coord_t sh,
+                coord_t dw, coord_t dh, scale_filter_t filter);
+
+        static PolyphaseScaler *get(RawFrame::PixelFormat pf,
+                coord_t sw, coord_t sh, coord_t dw, coord_t dh,
+                scale_filter_t filter);
+        static void release(PolyphaseScaler *scaler);
+
+        void run(RawFrame *src, RawFrame *dst);
+
+        RawFrame::PixelFormat pf;
+        coord_t sw, sh, dw, dh;
+        scale_filter_t filter;
+        /* routines are picked at construction, so part of the key */
+        cpu_simd_level simd;
+
+        /*
+         * horizontal: for tap t and output byte j, source byte
+         * h_offsets[t * h_stride + j] weighted by h_coefs[same]
+         */
+        unsigned int h_taps;
+        size_t h_bytes, h_stride;
+        std::vector<int32_t> h_offsets;
+        std::vector<int16_t> h_coefs;
+
+        /* vertical: source lines and weights for each output line */
+        unsigned int v_taps;
+        std::vector<int> v_lines;
+        std::vector<int16_t> v_coefs;
+
+        void (*do_horizontal)(size_t, int16_t *, const uint8_t *,
+                const int32_t *, const int16_t *, unsigned int);
+        void (*do_vertical)(size_t, uint8_t *, int16_t **,
+                const int16_t *, unsigned int);
+
+        /* cache bookkeeping, under the cache lock */
+        unsigned int users;
+        unsigned long last_used;
+};
+
+#endif
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ *
+ * This file is part of openreplay.
+ *
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _OPENREPLAY_PREPARED_KEY_H
+#define _OPENREPLAY_PREPARED_KEY_H
+
+#include "raw_frame.h"
+#include <vector>
+
+/*
+ * A BGRAn8 key converted ahead of time for keying onto CbYCrY8422, for
+ * graphics that stay the same for many frames (DSKs, the clock).
+ *
+ * Each background byte under the key comes out as
+ *     color + ((background * inv_alpha) >> 16)
+ * where color is the key's Cb, Y or Cr already weighted by its alpha,
+ * which is the same fixed point CbYCrY8422_BGRAn8_key_chunk_sse2 uses.
+ * Only the runs of pixel pairs where the key is not fully transparent
+ * are kept, so applying the key touches only what it covers and does
+ * no color conversion at all.
+ */
+class PreparedKey {
+    public:
+        PreparedKey(RawFrame *key, uint8_t galpha = 255);
+
+        coord_t w( ) const { return _w; }
+        coord_t h( ) const { return _h; }
+        /* number of key pixels applying will touch */
+        size_t covered( ) const { return color.size( ) / 2; }
+
+        /*
+         * Key onto a CbYCrY8422 frame with the top left corner at (x, y).
+         * x is rounded down to a whole pixel pair; anything off the
+         * right or bottom edge is clipped.
+         */
+        void apply(RawFrame *bkgd, coord_t x, coord_t y) const;
+
+    protected:
+        /* a run of covered pixel pairs on one line of the key */
+        struct span {
+            coord_t x, y, w;
+            /* where the run's samples start in color and inv_alpha */
+            size_t offset;
+        };
+
+        coord_t _w, _h;
+        std::vector<span> spans;
+        std::vector<uint8_t> color;
+        std::vector<uint16_t> inv_alpha;
+
+        void (*do_apply_span)(size_t, uint8_t *, const uint8_t *,
+                const uint16_t *);
+};
+
+void prepared_key_span_default(size_t n, uint8_t *bkgd,
+        const uint8_t *color, const uint16_t *inv_alpha);
+
+#ifndef SKIP_ASSEMBLY_ROUTINES
+void prepared_key_span_sse2(size_t n, uint8_t *bkgd,
+        const uint8_t *color, const uint16_t *inv_alpha);
+#endif
+
+#endif
@@ -26,6 +26,7 @@
 #include "unpack_BGRAn8.h"
 #include "draw_CbYCrY8422.h"
 #include "draw_BGRAn8.h"
+#include "polyphase_scaler.h"
 #include <string.h>
 
 #include <png.h>
@@ -166,6 +167,52 @@ void RawFrame::make_converter(void) {
     convert = new RawFrameConverter(this);
 }
 
+RawFrame *RawFrameConverter::scaled(coord_t w, coord_t h, 
+        scale_filter_t filter) {
+    RawFrame *ret = new RawFrame(w, h, f->pixel_format( ));
+
+    try {
+        PolyphaseScaler::scale(f, ret, filter);
+    } catch (...) {
+        delete ret;
+        throw;
+    }
+
+    return ret;
+}
+
+RawFrame *RawFrameConverter::BGRAn8_scaled(coord_t w, coord_t h,
+        scale_filter_t filter) {
+    RawFrame *tmp, *ret;
+
+    if (f->pixel_format( ) == RawFrame::BGRAn8) {
+        return scaled(w, h, filter);
+    }
+
+    if (f->pixel_format( ) == RawFrame::CbYCrY8422) {
+        if (w == f->w( ) && h == f->h( )) {
+            return BGRAn8( );
+        } else if (w == f->w( ) / 2 && h == f->h( ) / 2) {
+            return BGRAn8_scale_1_2( );
+        } else if (w == f->w( ) / 4 && h == f->h( ) / 4) {
+            return BGRAn8_scale_1_4( );
+        }
+    }
+
+    /* convert whichever side has fewer pixels */
+    if (f->pixel_format( ) == RawFrame::CbYCrY8422 && w % 2 == 0 
+            && w * h < f->w( ) * f->h( )) {
+        tmp = scaled(w, h, filter);
+        ret = tmp->convert->BGRAn8( );
+    } else {
+        tmp = BGRAn8( );
+        ret = tmp->convert->scaled(w, h, filter);
+    }
+
+    delete tmp;
+    return ret;
+}
+
 void RawFrame::make_packer(void) {
     switch (_pixel_format) {
         case CbYCrY8422:
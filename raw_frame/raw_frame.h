@@ -28,6 +28,11 @@ class RawFrameUnpacker;
 class RawFrameDrawOps;
 class RawFrameConverter;
 
+/* filters for arbitrary-size scaling, sharpest last */
+enum scale_filter_t {
+    SCALE_BILINEAR, SCALE_BICUBIC, SCALE_LANCZOS3
+};
+
 class RawFrame {
     public:
         enum PixelFormat { 
@@ -128,6 +133,16 @@ class RawFramePacker {
             do_YCbCr8P422(f->size( ), f->data( ), Y, Cb, Cr);
         }
 
+        /*
+         * Pack only n lines starting at first, from planes holding just
+         * those lines. Bands of different lines may be packed in parallel.
+         */
+        void YCbCr8P422_lines(uint8_t *Y, uint8_t *Cb, uint8_t *Cr,
+                coord_t first, coord_t n) {
+            CHECK(do_YCbCr8P422);
+            do_YCbCr8P422(n * f->pitch( ), f->scanline(first), Y, Cb, Cr);
+        }
+
     protected:
         void check(void *ptr) {
             if (ptr == NULL) {
@@ -152,6 +167,8 @@ class RawFrameUnpacker {
             do_CbYCrY8422_scan_double = NULL;
             do_CbYCrY8422_scale_1_4 = NULL;
             do_CbYCrY8422_scan_triple = NULL;
+            do_CbYCrY8422_scan_double_linear = NULL;
+            do_CbYCrY8422_scan_triple_linear = NULL;
         }
     
         /* TODO: provide routines for each desired output format here! */
@@ -160,6 +177,13 @@ class RawFrameUnpacker {
             do_YCbCr8P422(f->size( ), f->data( ), Y, Cb, Cr);
         }
 
+        /* unpack only n lines starting at first, as YCbCr8P422( ) */
+        void YCbCr8P422_lines(uint8_t *Y, uint8_t *Cb, uint8_t *Cr,
+                coord_t first, coord_t n) {
+            CHECK(do_YCbCr8P422);
+            do_YCbCr8P422(n * f->pitch( ), f->scanline(first), Y, Cb, Cr);
+        }
+
         void CbYCrY8422(uint8_t *data) {
             CHECK(do_CbYCrY8422);
             do_CbYCrY8422(f->size( ), f->data( ), data);
@@ -193,11 +217,24 @@ class RawFrameUnpacker {
         }
 
         void CbYCrY8422_scan_triple(uint8_t *data) {
-            CHECK(do_CbYCrY8422_scan_double);
+            CHECK(do_CbYCrY8422_scan_triple);
             do_CbYCrY8422_scan_triple(f->size( ), f->data( ), 
                     data, f->pitch( ));
         }
 
+        /* as above, interpolating instead of repeating pixels */
+        void CbYCrY8422_scan_double_linear(uint8_t *data) {
+            CHECK(do_CbYCrY8422_scan_double_linear);
+            do_CbYCrY8422_scan_double_linear(f->size( ), f->data( ), 
+                    data, f->pitch( ));
+        }
+
+        void CbYCrY8422_scan_triple_linear(uint8_t *data) {
+            CHECK(do_CbYCrY8422_scan_triple_linear);
+            do_CbYCrY8422_scan_triple_linear(f->size( ), f->data( ), 
+                    data, f->pitch( ));
+        }
+
     protected:
         void check(void *ptr) {
             if (ptr == NULL) {
@@ -226,6 +263,10 @@ class RawFrameUnpacker {
                 uint8_t *, unsigned int);
         void (*do_CbYCrY8422_scan_triple)(size_t, uint8_t *,
                 uint8_t *, unsigned int);
+        void (*do_CbYCrY8422_scan_double_linear)(size_t, uint8_t *, 
+                uint8_t *, unsigned int);
+        void (*do_CbYCrY8422_scan_triple_linear)(size_t, uint8_t *,
+                uint8_t *, unsigned int);
 
 };
 
@@ -259,7 +300,7 @@ class RawFrameConverter {
             } else if (f->w( ) == 1920 && f->h( ) == 1080) {
                 return BGRAn8_scale_1_2( );
             } else {
-                return NULL; /* fast conversion not supported */
+                return BGRAn8_scaled(960, 540);
             }
         }
 
@@ -271,10 +312,17 @@ class RawFrameConverter {
             } else if (f->w( ) == 1920 && f->h( ) >= 1080) {
                 return BGRAn8_scale_1_4( );
             } else {
-                return NULL; /* fast conversion not supported */
+                return BGRAn8_scaled(480, 270);
             }
         }
 
+        /* 
+         * BGRAn8 at any size. Exact halves and quarters of CbYCrY8422 
+         * take the fast paths; anything else is scaled before converting.
+         */
+        RawFrame *BGRAn8_scaled(coord_t w, coord_t h, 
+                scale_filter_t filter = SCALE_BICUBIC);
+
         RawFrame *CbYCrY8422( ) {
             RawFrame *ret = match_frame(RawFrame::CbYCrY8422);
             f->unpack->CbYCrY8422(ret->data( ));
@@ -295,6 +343,20 @@ class RawFrameConverter {
             return ret;
         }
 
+        RawFrame *CbYCrY8422_scan_double_linear( ) {
+            RawFrame *ret = new RawFrame(f->w( ) * 2, f->h( ) * 2,
+                    RawFrame::CbYCrY8422);
+            f->unpack->CbYCrY8422_scan_double_linear(ret->data( ));
+            return ret;
+        }
+
+        RawFrame *CbYCrY8422_scan_triple_linear( ) {
+            RawFrame *ret = new RawFrame(f->w( ) * 3, f->h( ) * 3,
+                    RawFrame::CbYCrY8422);
+            f->unpack->CbYCrY8422_scan_triple_linear(ret->data( ));
+            return ret;
+        }
+
         RawFrame *CbYCrY8422_1080( ) {
             if (f->w( ) == 960 && f->h( ) >= 540) {
                 return CbYCrY8422_scan_double( ); 
@@ -303,14 +365,19 @@ class RawFrameConverter {
             }
         }
 
-        RawFrame *CbYCrY8422_scaled(coord_t w, coord_t h) {
+        RawFrame *CbYCrY8422_scaled(coord_t w, coord_t h,
+                scale_filter_t filter = SCALE_BICUBIC) {
             if (w == f->w( ) / 4 && h == f->h( ) / 4) {
                 return CbYCrY8422_scale_1_4( );
             } else {
-                return NULL;
+                return scaled(w, h, filter);
             }
         }
 
+        /* any size, same pixel format (CbYCrY8422 or BGRAn8 only) */
+        RawFrame *scaled(coord_t w, coord_t h, 
+                scale_filter_t filter = SCALE_BICUBIC);
+
         RawFrame *CbYCrY8422_scale_1_4( ) {
             RawFrame *ret = new RawFrame(f->w( ) / 4, f->h( ) / 4,
                     RawFrame::CbYCrY8422);
@@ -330,6 +397,7 @@ class RawFrameDrawOps {
     public:
         RawFrameDrawOps(RawFrame *f_) : f(f_) { 
             do_alpha_blend = NULL;
+            do_alpha_blend_premultiplied = NULL;
             do_blit = NULL;
         }
 
@@ -339,6 +407,13 @@ class RawFrameDrawOps {
             do_alpha_blend(f, key, x, y, galpha);
         }
 
+        /* as alpha_key, for keys whose color is premultiplied by alpha */
+        void alpha_key_premultiplied(coord_t x, coord_t y, RawFrame *key,
+                uint8_t galpha) {
+            CHECK(do_alpha_blend_premultiplied);
+            do_alpha_blend_premultiplied(f, key, x, y, galpha);
+        }
+
         void blit(coord_t x, coord_t y, RawFrame *src) {
             CHECK(do_blit);
             do_blit(f, src, x, y);
@@ -352,6 +427,8 @@ class RawFrameDrawOps {
 
         void (*do_alpha_blend)(RawFrame *bkgd, RawFrame *key, 
                 coord_t x, coord_t y, uint8_t galpha);
+        void (*do_alpha_blend_premultiplied)(RawFrame *bkgd, RawFrame *key, 
+                coord_t x, coord_t y, uint8_t galpha);
         void (*do_blit)(RawFrame *bkgd, RawFrame *src, coord_t x, coord_t y);
 
         RawFrame *f;
@@ -0,0 +1,69 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ *
+ * This file is part of openreplay.
+ *
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _OPENREPLAY_SCAN_CBYCRY8422_H
+#define _OPENREPLAY_SCAN_CBYCRY8422_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Scanline routines behind the 2x and 3x CbYCrY8422 upscalers.
+ *
+ * The expanders turn src_size bytes of one scanline into 2 * src_size
+ * or 3 * src_size bytes, either by repeating pixels (nearest) or by
+ * interpolating luma between neighboring pixels and chroma between
+ * neighboring pixel pairs (linear). The last pixel is repeated.
+ *
+ * The blends make the scanlines in between: blend_halves gives
+ * (a + b + 1) / 2 and blend_thirds gives (2a + b + 1) / 3 in near_a
+ * and (a + 2b + 1) / 3 in near_b, byte by byte.
+ */
+struct CbYCrY8422ScanLines {
+    void (*double_nearest)(size_t, const uint8_t *, uint8_t *);
+    void (*double_linear)(size_t, const uint8_t *, uint8_t *);
+    void (*triple_nearest)(size_t, const uint8_t *, uint8_t *);
+    void (*triple_linear)(size_t, const uint8_t *, uint8_t *);
+    void (*blend_halves)(size_t, const uint8_t *, const uint8_t *, 
+            uint8_t *);
+    void (*blend_thirds)(size_t, const uint8_t *, const uint8_t *,
+            uint8_t *, uint8_t *);
+};
+
+extern const CbYCrY8422ScanLines CbYCrY8422_scan_lines_default;
+#ifndef SKIP_ASSEMBLY_ROUTINES
+extern const CbYCrY8422ScanLines CbYCrY8422_scan_lines_ssse3;
+extern const CbYCrY8422ScanLines CbYCrY8422_scan_lines_avx2;
+#endif
+
+/* 
+ * The best routines for this CPU, for code that builds frames a line at
+ * a time (e.g. from capture buffers). Ask again after cpu_limit_simd.
+ */
+const CbYCrY8422ScanLines *CbYCrY8422_scan_lines_for_cpu( );
+
+/* whole frames, as RawFrameUnpacker's scan_double and scan_triple */
+void CbYCrY8422_scan_double_frame(const CbYCrY8422ScanLines *lines,
+        bool linear, size_t src_size, uint8_t *src, uint8_t *dst, 
+        unsigned int src_pitch);
+void CbYCrY8422_scan_triple_frame(const CbYCrY8422ScanLines *lines,
+        bool linear, size_t src_size, uint8_t *src, uint8_t *dst, 
+        unsigned int src_pitch);
+
+#endif
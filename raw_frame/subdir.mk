@@ -4,15 +4,18 @@ raw_frame_OBJECTS = \
     raw_frame/convert/CbYCrY8422_YCbCr8P422_default.o \
     raw_frame/convert/CbYCrY8422_CbYCrY8422_scan_double.o \
     raw_frame/convert/CbYCrY8422_CbYCrY8422_scan_triple.o \
+    raw_frame/convert/CbYCrY8422_CbYCrY8422_scan_lines.o \
     raw_frame/convert/CbYCrY8422_CbYCrY8422_default.o \
     raw_frame/convert/YCbCr8P422_CbYCrY8422_default.o \
     raw_frame/convert/CbYCrY8422_BGRAn8_default.o \
     raw_frame/convert/CbYCrY8422_BGRAn8_scale_1_2_default.o \
     raw_frame/convert/CbYCrY8422_BGRAn8_scale_1_4_default.o \
     raw_frame/convert/CbYCrY8422_CbYCrY8422_scale_1_4.o \
+    raw_frame/convert/polyphase_scaler.o \
     raw_frame/draw/CbYCrY8422_alpha_key.o \
     raw_frame/draw/BGRAn8_blit.o \
     raw_frame/draw/BGRAn8_alpha_key.o \
+    raw_frame/draw/prepared_key.o \
 
 
 ifneq ($(SKIP_X86_64_ASM), 1)
@@ -29,5 +32,19 @@ raw_frame_OBJECTS += \
     raw_frame/convert/BGRAn8_BGRAn8_default.o \
     raw_frame/draw/CbYCrY8422_BGRAn8_key_chunk_sse2.o \
     raw_frame/draw/CbYCrY8422_alpha_key_sse2.o \
+    raw_frame/convert/CbYCrY8422_BGRAn8_avx2.o \
+    raw_frame/convert/CbYCrY8422_BGRAn8_avx512.o \
+    raw_frame/convert/CbYCrY8422_YCbCr8P422_avx2.o \
+    raw_frame/convert/YCbCr8P422_CbYCrY8422_avx2.o \
+    raw_frame/convert/CbYCrY8422_CbYCrY8422_scale_1_4_avx2.o \
+    raw_frame/draw/CbYCrY8422_alpha_key_avx2.o \
+    raw_frame/draw/CbYCrY8422_alpha_key_avx512.o \
+    raw_frame/draw/BGRAn8_alpha_key_sse2.o \
+    raw_frame/draw/BGRAn8_alpha_key_avx2.o \
+    raw_frame/draw/prepared_key_sse2.o \
+    raw_frame/convert/polyphase_scaler_sse2.o \
+    raw_frame/convert/polyphase_scaler_avx2.o \
+    raw_frame/convert/CbYCrY8422_CbYCrY8422_scan_lines_ssse3.o \
+    raw_frame/convert/CbYCrY8422_CbYCrY8422_scan_lines_avx2.o \
 
 endif
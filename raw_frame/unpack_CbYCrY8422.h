@@ -41,6 +41,39 @@ extern "C" void CbYCrY8422_YCbCr8P422_vector(size_t, uint8_t *, uint8_t *,
 void CbYCrY8422_CbYCrY8422_scale_1_4_vector(size_t, uint8_t *,
         uint8_t *, unsigned int);
 
+void CbYCrY8422_BGRAn8_avx2(size_t, uint8_t *, uint8_t *);
+void CbYCrY8422_BGRAn8_scale_1_2_avx2(size_t, uint8_t *,
+        uint8_t *, unsigned int);
+void CbYCrY8422_BGRAn8_scale_1_4_avx2(size_t, uint8_t *,
+        uint8_t *, unsigned int);
+void CbYCrY8422_YCbCr8P422_avx2(size_t, uint8_t *, uint8_t *,
+        uint8_t *, uint8_t *);
+void CbYCrY8422_CbYCrY8422_scale_1_4_avx2(size_t, uint8_t *,
+        uint8_t *, unsigned int);
+
+void CbYCrY8422_CbYCrY8422_scan_double_ssse3(size_t, uint8_t *,
+        uint8_t *, unsigned int);
+void CbYCrY8422_CbYCrY8422_scan_double_linear_ssse3(size_t, uint8_t *,
+        uint8_t *, unsigned int);
+void CbYCrY8422_CbYCrY8422_scan_triple_ssse3(size_t, uint8_t *,
+        uint8_t *, unsigned int);
+void CbYCrY8422_CbYCrY8422_scan_triple_linear_ssse3(size_t, uint8_t *,
+        uint8_t *, unsigned int);
+void CbYCrY8422_CbYCrY8422_scan_double_avx2(size_t, uint8_t *,
+        uint8_t *, unsigned int);
+void CbYCrY8422_CbYCrY8422_scan_double_linear_avx2(size_t, uint8_t *,
+        uint8_t *, unsigned int);
+void CbYCrY8422_CbYCrY8422_scan_triple_avx2(size_t, uint8_t *,
+        uint8_t *, unsigned int);
+void CbYCrY8422_CbYCrY8422_scan_triple_linear_avx2(size_t, uint8_t *,
+        uint8_t *, unsigned int);
+
+void CbYCrY8422_BGRAn8_avx512(size_t, uint8_t *, uint8_t *);
+void CbYCrY8422_BGRAn8_scale_1_2_avx512(size_t, uint8_t *,
+        uint8_t *, unsigned int);
+void CbYCrY8422_BGRAn8_scale_1_4_avx512(size_t, uint8_t *,
+        uint8_t *, unsigned int);
+
 #endif
 
 void CbYCrY8422_BGRAn8_default(size_t, uint8_t *, uint8_t *);
@@ -52,19 +85,36 @@ void CbYCrY8422_BGRAn8_scale_1_4_default(size_t, uint8_t *,
 
 void CbYCrY8422_CbYCrY8422_scan_double(size_t, uint8_t *,
         uint8_t *, unsigned int);
+void CbYCrY8422_CbYCrY8422_scan_double_linear(size_t, uint8_t *,
+        uint8_t *, unsigned int);
 
 void CbYCrY8422_CbYCrY8422_scale_1_4(size_t, uint8_t *,
         uint8_t *, unsigned int);
 
 void CbYCrY8422_CbYCrY8422_scan_triple(size_t, uint8_t *,
         uint8_t *, unsigned int);
+void CbYCrY8422_CbYCrY8422_scan_triple_linear(size_t, uint8_t *,
+        uint8_t *, unsigned int);
 
 class CbYCrY8422Unpacker : public RawFrameUnpacker {
     public:
         CbYCrY8422Unpacker(RawFrame *f) : RawFrameUnpacker(f) {
             /* CPU dispatched routines */
 
-            if (cpu_sse2_available( )) {
+            if (cpu_avx512_available( )) {
+                do_BGRAn8_scale_1_4 = CbYCrY8422_BGRAn8_scale_1_4_avx512;
+                do_BGRAn8_scale_1_2 = CbYCrY8422_BGRAn8_scale_1_2_avx512;
+                do_BGRAn8 = CbYCrY8422_BGRAn8_avx512;
+                /* these only move bytes around; AVX2 keeps up with memory */
+                do_YCbCr8P422 = CbYCrY8422_YCbCr8P422_avx2;
+                do_CbYCrY8422_scale_1_4 = CbYCrY8422_CbYCrY8422_scale_1_4_avx2;
+            } else if (cpu_avx2_available( )) {
+                do_BGRAn8_scale_1_4 = CbYCrY8422_BGRAn8_scale_1_4_avx2;
+                do_BGRAn8_scale_1_2 = CbYCrY8422_BGRAn8_scale_1_2_avx2;
+                do_BGRAn8 = CbYCrY8422_BGRAn8_avx2;
+                do_YCbCr8P422 = CbYCrY8422_YCbCr8P422_avx2;
+                do_CbYCrY8422_scale_1_4 = CbYCrY8422_CbYCrY8422_scale_1_4_avx2;
+            } else if (cpu_sse2_available( )) {
                 do_BGRAn8_scale_1_4 = CbYCrY8422_BGRAn8_scale_1_4_vector;
                 do_BGRAn8_scale_1_2 = CbYCrY8422_BGRAn8_scale_1_2_vector;
                 do_BGRAn8 = CbYCrY8422_BGRAn8_vector;
@@ -78,10 +128,38 @@ class CbYCrY8422Unpacker : public RawFrameUnpacker {
                 do_CbYCrY8422_scale_1_4 = CbYCrY8422_CbYCrY8422_scale_1_4;
             }
 
+            /* the upscalers are all shuffles, so they start at SSSE3 */
+            if (cpu_avx2_available( )) {
+                do_CbYCrY8422_scan_double = 
+                    CbYCrY8422_CbYCrY8422_scan_double_avx2;
+                do_CbYCrY8422_scan_double_linear = 
+                    CbYCrY8422_CbYCrY8422_scan_double_linear_avx2;
+                do_CbYCrY8422_scan_triple = 
+                    CbYCrY8422_CbYCrY8422_scan_triple_avx2;
+                do_CbYCrY8422_scan_triple_linear = 
+                    CbYCrY8422_CbYCrY8422_scan_triple_linear_avx2;
+            } else if (cpu_ssse3_available( )) {
+                do_CbYCrY8422_scan_double = 
+                    CbYCrY8422_CbYCrY8422_scan_double_ssse3;
+                do_CbYCrY8422_scan_double_linear = 
+                    CbYCrY8422_CbYCrY8422_scan_double_linear_ssse3;
+                do_CbYCrY8422_scan_triple = 
+                    CbYCrY8422_CbYCrY8422_scan_triple_ssse3;
+                do_CbYCrY8422_scan_triple_linear = 
+                    CbYCrY8422_CbYCrY8422_scan_triple_linear_ssse3;
+            } else {
+                do_CbYCrY8422_scan_double = 
+                    CbYCrY8422_CbYCrY8422_scan_double;
+                do_CbYCrY8422_scan_double_linear = 
+                    CbYCrY8422_CbYCrY8422_scan_double_linear;
+                do_CbYCrY8422_scan_triple = 
+                    CbYCrY8422_CbYCrY8422_scan_triple;
+                do_CbYCrY8422_scan_triple_linear = 
+                    CbYCrY8422_CbYCrY8422_scan_triple_linear;
+            }
+
             /* Non CPU-dispatched routines */
             do_CbYCrY8422 = CbYCrY8422_CbYCrY8422_default;
-            do_CbYCrY8422_scan_double = CbYCrY8422_CbYCrY8422_scan_double;
-            do_CbYCrY8422_scan_triple = CbYCrY8422_CbYCrY8422_scan_triple;
         }
 };
 
@@ -2,6 +2,8 @@
 %include "replay_types.i"
 %include "replay_shot.i"
 %include "replay_frame_extractor.i"
+%include "replay_clip_recoder.i"
+%include "replay_frame_cache.i"
 %include "replay_buffer.i"
 %include "replay_multiviewer.i"
 %include "replay_preview.i"
@@ -23,14 +23,34 @@ module Replay
             input = opts[:input]
             mjpeg_cmd = opts[:mjpeg_cmd]
             file = opts[:file] || fail("Cannot have a source with no file")
-            name = opts[:name] || file
+            name = opts[:name] || Array(file).join(':')
+            map_mode = opts[:map_mode] || ReplayBuffer::MAP_PER_FRAME
+            layout = opts[:layout] || ReplayBuffer::LAYOUT_SLOTS
+            write_mode = opts[:write_mode] || ReplayBuffer::WRITE_MMAP
+            writes_in_flight = opts[:writes_in_flight] || 8
+            encode_threads = opts[:encode_threads] || 1
+            encode_fields = opts[:encode_fields] || false
+            # bytes per frame to aim for, varying the quality (0 = fixed)
+            target_frame_size = opts[:target_frame_size] || 0
+            # keep JPEG tables once in the buffer instead of in each frame
+            share_tables = opts[:share_jpeg_tables] || false
             game_data = opts[:game_data] || \
                 fail("Cannot create source without game data");
 
-            @buffer = ReplayBuffer.new(file, buf_size, frame_size, name)
+            if file.is_a?(Array)
+                # stripe frames across several files/devices
+                @buffer = StripedReplayBuffer.new(file.join(':'), buf_size, 
+                        frame_size, name, map_mode, layout, write_mode, 
+                        writes_in_flight)
+            else
+                @buffer = ReplayBuffer.new(file, buf_size, frame_size, name, 
+                        map_mode, layout, write_mode, writes_in_flight)
+            end
 
             if input
-                @ingest = ReplayIngest.new(input, @buffer, game_data)
+                @ingest = ReplayIngest.new(input, @buffer, game_data,
+                        encode_threads, encode_fields, target_frame_size,
+                        share_tables)
             elsif mjpeg_cmd
                 @ingest = ReplayMjpegIngest.new(mjpeg_cmd, @buffer)
             else
@@ -90,6 +110,11 @@ module Replay
         def make_output_adapter
             Replay::create_decklink_output_adapter_with_audio(7, 0, RawFrame::CbYCrY8422)
         end
+
+        # only helps with sources encoded in slices (:encode_threads)
+        def playout_decode_threads
+            4
+        end
     end
 
     class ReplayShot
@@ -113,6 +138,12 @@ module Replay
             @@previewer.extract_raw_jpeg(self, x)
         end
 
+        # columns x rows frames from across the shot in one JPEG
+        def contact_sheet(columns, rows)
+            @@previewer ||= ReplayFrameExtractor.new
+            @@previewer.extract_contact_sheet(self, columns, rows)
+        end
+
         def make_json(source_id)
             {
                 "source" => source_id,
@@ -150,8 +181,11 @@ module Replay
             config = ReplayConfig.new # something something something
 
             @game_data = ReplayGameData.new
-            @program = ReplayPlayout.new(config.make_output_adapter)
+            @program = ReplayPlayout.new(config.make_output_adapter,
+                    config.playout_decode_threads)
             @preview = ReplayPreview.new
+            # shrinks saved clips in the background
+            @clip_recoder = ReplayClipRecoder.new
 
             # wire program and preview into multiviewer
             @multiviewer.add_source(:port => @preview.monitor,
@@ -172,6 +206,16 @@ module Replay
             @multiviewer.change_mode
         end
 
+        # memory for decoded frames shared by preview, program and export
+        def frame_cache_size=(bytes)
+            ReplayFrameCache.shared.max_size = bytes
+        end
+
+        # memory all preview, program and scrub windows may pin (0 = off)
+        def pin_budget=(bytes)
+            ReplayBufferLocker.set_memory_budget(bytes)
+        end
+
         def add_source(opts={})
             opts.merge!({ :game_data => @game_data })
             source = ReplaySource.new(opts)
@@ -192,7 +236,7 @@ module Replay
             @multiviewer.start
         end
 
-        attr_reader :preview, :program, :game_data
+        attr_reader :preview, :program, :game_data, :clip_recoder
 
         def source(i)
             @sources[i]
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ *
+ * This file is part of openreplay.
+ *
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "replay_batch_decoder.h"
+#include "replay_frame_cache.h"
+
+class ReplayBatchDecoder::BatchJob : public WorkerPool::Job {
+    public:
+        BatchJob(ReplayBatchDecoder *dec_, 
+                const std::vector<request> &requests_, Sink *sink_) 
+                : dec(dec_), requests(requests_), sink(sink_) { }
+
+        void run_item(unsigned int item, unsigned int thread) {
+            dec->decode_item(requests[item], item, thread, sink);
+        }
+
+    protected:
+        ReplayBatchDecoder *dec;
+        const std::vector<request> &requests;
+        Sink *sink;
+};
+
+ReplayBatchDecoder::ReplayBatchDecoder(unsigned int threads, coord_t maxw,
+        coord_t maxh) : pool(threads) {
+    /* frames are decoded whole, one per thread, so no slicing */
+    for (unsigned int i = 0; i < pool.n_threads( ); i++) {
+        decoders.push_back(new Mjpeg422Decoder(maxw, maxh));
+    }
+}
+
+ReplayBatchDecoder::~ReplayBatchDecoder( ) {
+    for (unsigned int i = 0; i < decoders.size( ); i++) {
+        delete decoders[i];
+    }
+}
+
+void ReplayBatchDecoder::decode(const std::vector<request> &requests,
+        Sink *sink) {
+    BatchJob job(this, requests, sink);
+
+    if (!requests.empty( )) {
+        pool.run(&job, requests.size( ));
+    }
+}
+
+void ReplayBatchDecoder::decode_item(const request &r, unsigned int n,
+        unsigned int thread, Sink *sink) {
+    ReplayFrameCache *cache = ReplayFrameCache::shared( );
+    RawFrame *frame;
+
+    try {
+        frame = cache->get_frame(r.source, r.tc, r.scale_down, 
+                *decoders[thread]);
+    } catch (std::exception &e) {
+        /* one bad frame should not spoil the rest of the batch */
+        MutexLock l(sink_m);
+        sink->frame_failed(n, e.what( ));
+        return;
+    }
+
+    MutexLock l(sink_m);
+    sink->frame_decoded(n, frame);
+}
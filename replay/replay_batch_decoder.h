@@ -0,0 +1,83 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ *
+ * This file is part of openreplay.
+ *
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _REPLAY_BATCH_DECODER_H
+#define _REPLAY_BATCH_DECODER_H
+
+#include "replay_data.h"
+#include "mjpeg_codec.h"
+#include "worker_pool.h"
+#include "mutex.h"
+
+#include <vector>
+
+class ReplayBuffer;
+
+/*
+ * Decodes a list of frames in one pass, spread over a pool of threads.
+ * Each thread keeps its own decoder from one batch to the next. Frames
+ * go through ReplayFrameCache::shared( ), so a batch picks up frames 
+ * already decoded for playout or scrubbing and leaves its own behind.
+ * For filmstrips, contact sheets and the like.
+ */
+class ReplayBatchDecoder {
+    public:
+        struct request {
+            ReplayBuffer *source;
+            timecode_t tc;
+            /* as passed to Mjpeg422Decoder::decode */
+            int scale_down;
+        };
+
+        /*
+         * Gets the frames as they are decoded, in no particular order.
+         * Calls come from the pool threads, but only one at a time.
+         * Frames are held in the shared cache: hand each back with
+         * ReplayFrameCache::release_frame( ) when done with it.
+         */
+        class Sink {
+            public:
+                virtual ~Sink( ) { }
+                virtual void frame_decoded(unsigned int n, 
+                        RawFrame *frame) = 0;
+                /* request n could not be read or decoded */
+                virtual void frame_failed(unsigned int, const char *) { }
+        };
+
+        ReplayBatchDecoder(unsigned int threads, coord_t maxw = 1920,
+                coord_t maxh = 1080);
+        ~ReplayBatchDecoder( );
+
+        /* returns once the sink has had every request */
+        void decode(const std::vector<request> &requests, Sink *sink);
+
+    protected:
+        class BatchJob;
+        friend class BatchJob;
+
+        void decode_item(const request &r, unsigned int n, 
+                unsigned int thread, Sink *sink);
+
+        WorkerPool pool;
+        /* one per pool thread */
+        std::vector<Mjpeg422Decoder *> decoders;
+        Mutex sink_m;
+};
+
+#endif
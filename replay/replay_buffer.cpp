@@ -18,10 +18,11 @@
  */
 
 #include "replay_buffer.h"
+#include "replay_frame_cache.h"
 #include "posix_util.h"
+#include "xmalloc.h"
 
-#include "pipe.h"
-
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -33,99 +34,1127 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <stddef.h>
 #include <stdexcept>
+#include <map>
+#include <vector>
+
+/* 
+ * Size of each mmap() call when mapping the buffer persistently. 
+ * Rounded down to a whole number of frames.
+ */
+#define MAP_WINDOW_SIZE (256 * 1024 * 1024)
+
+/* 
+ * Packed frames start on page boundaries, so they can still be mmap()ed
+ * individually. 
+ */
+#define PACKED_ALIGN 4096
+
+/*
+ * The packed index is sized assuming frames average at least this size.
+ * If they are smaller, the oldest frames are retired early.
+ */
+#define PACKED_MIN_RECORD (32 * 1024)
+
+/* 
+ * ReplayBufferLocker window: frames kept behind the position, output 
+ * frames of play kept ahead of it, and a cap on the frames ahead.
+ */
+#define PIN_BEHIND 10
+#define PIN_AHEAD 30
+#define PIN_MAX_AHEAD 240
+#define PIN_DEFAULT_BUDGET (256 * 1024 * 1024)
+#define PIN_RECHECK_MSEC 100
+
+/* frames this close to being overwritten are not pinned */
+#define PIN_RETIRE_MARGIN 60
+
+/*
+ * The file starts with a superblock region holding two alternating copies
+ * of the superblock (so a torn write leaves the other intact). Packed 
+ * buffers keep their index right after it.
+ */
+#define SUPERBLOCK_SIZE 4096
+#define SUPERBLOCK_COPY_SIZE 512
+#define SUPERBLOCK_MAGIC 0x4253524f /* "ORSB" */
+#define SUPERBLOCK_VERSION 1
+
+/*
+ * After the two copies comes the JPEG tables record: a header, then the
+ * tables. It belongs to the epoch it was written in.
+ */
+#define JPEG_TABLES_OFFSET (2 * SUPERBLOCK_COPY_SIZE)
+#define JPEG_TABLES_MAGIC 0x4254524f /* "ORTB" */
+
+/* sync the superblock every this many frames */
+#define SUPERBLOCK_INTERVAL 60
+
+struct ReplayBuffer::superblock {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t epoch;
+    uint32_t layout;
+    uint64_t frame_size;
+    uint64_t n_frames;
+    uint64_t data_offset;
+    uint64_t data_size;
+    uint64_t generation;
+    int64_t tc_current;
+    int64_t tc_oldest;
+    int64_t tc_lap_start;
+    uint32_t checksum;
+};
+
+struct jpeg_tables_header {
+    uint32_t magic;
+    uint32_t epoch;
+    uint32_t length;
+    uint32_t checksum;
+};
+
+/* FNV-1a over everything before the checksum field */
+static uint32_t superblock_checksum(const void *sb, size_t size) {
+    const uint8_t *p = (const uint8_t *) sb;
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+/*
+ * Flushes frame data and then writes the superblock, off the ingest
+ * thread. Only the most recent request matters. A request still pending
+ * when the thread is deleted is carried out first.
+ */
+class ReplayBuffer::SuperblockThread : public Thread {
+    public:
+        SuperblockThread(ReplayBuffer *buf) {
+            buf_ = buf;
+            pending = false;
+            shutdown = false;
+            start_thread( );
+        }
+
+        ~SuperblockThread( ) {
+            { MutexLock l(m);
+                shutdown = true;
+                c.signal( );
+            }
+
+            join_thread( );
+        }
+
+        void request(const superblock &sb) {
+            MutexLock l(m);
+            next = sb;
+            pending = true;
+            c.signal( );
+        }
+
+    protected:
+        void run_thread( ) {
+            superblock sb;
+
+            for (;;) {
+                { MutexLock l(m);
+                    while (!pending && !shutdown) {
+                        c.wait(m);
+                    }
+
+                    if (!pending) {
+                        return;
+                    }
+                    sb = next;
+                    pending = false;
+                }
+
+                try {
+                    buf_->sync_superblock(sb);
+                } catch (std::exception &e) {
+                    fprintf(stderr, "superblock sync failed: %s\n", 
+                            e.what( ));
+                }
+            }
+        }
+
+        ReplayBuffer *buf_;
+        superblock next;
+        bool pending;
+        bool shutdown;
+        Mutex m;
+        Condition c;
+};
+
+/* 
+ * Prefetch window: how many output frames ahead of each reader to read,
+ * and limits on the window size in buffer frames.
+ */
+#define PREFETCH_LOOKAHEAD 30
+#define PREFETCH_MIN_FRAMES 4
+#define PREFETCH_MAX_FRAMES 240
+
+/* largest single readahead( ) request after coalescing */
+#define PREFETCH_MAX_REQUEST (8 * 1024 * 1024)
+
+/*
+ * Reads frames into the page cache ahead of the readers that will need
+ * them. Each reader cursor has a position and a velocity; the thread 
+ * works out the window of frames the reader will touch in the next 
+ * PREFETCH_LOOKAHEAD output frames, merges adjacent frames into large
+ * readahead( ) calls issued nearest-first, and drops the rest of a 
+ * window as soon as the reader has moved away from it.
+ */
+class ReplayBuffer::ReadaheadThread : public Thread {
+    public:
+        ReadaheadThread(ReplayBuffer *buf) {
+            buf_ = buf;
+            generation = 0;
+            shutdown = false;
+            start_thread( );
+        }
+
+        ~ReadaheadThread( ) {
+            { MutexLock l(m);
+                shutdown = true;
+                c.signal( );
+            }
+
+            join_thread( );
+        }
+
+        void update(const void *key, timecode_t tc, float velocity) {
+            MutexLock l(m);
+            Cursor &cursor = cursors[key];
+            cursor.tc = tc;
+            cursor.velocity = velocity;
+            generation++;
+            c.signal( );
+        }
+
+        void remove(const void *key) {
+            MutexLock l(m);
+            cursors.erase(key);
+            generation++;
+        }
+
+    protected:
+        struct Cursor {
+            Cursor( ) : tc(0), velocity(0), done_start(0), done_end(0) { }
+
+            timecode_t tc;
+            float velocity;
+            /* frames known to be read, within the current window */
+            timecode_t done_start, done_end;
+        };
+
+        struct Job {
+            const void *key;
+            timecode_t start, end;
+            bool reverse;
+        };
+
+        typedef std::map<const void *, Cursor> CursorMap;
+
+        static void window(const Cursor &cursor, 
+                timecode_t &start, timecode_t &end) {
+            int n = (int) ceilf(fabsf(cursor.velocity) * PREFETCH_LOOKAHEAD);
+
+            if (n < PREFETCH_MIN_FRAMES) {
+                n = PREFETCH_MIN_FRAMES;
+            } else if (n > PREFETCH_MAX_FRAMES) {
+                n = PREFETCH_MAX_FRAMES;
+            }
+
+            if (cursor.velocity > 0) {
+                start = cursor.tc;
+                end = cursor.tc + n;
+            } else if (cursor.velocity < 0) {
+                start = cursor.tc - n + 1;
+                end = cursor.tc + 1;
+            } else {
+                /* paused or jogging: could go either way */
+                start = cursor.tc - n;
+                end = cursor.tc + n + 1;
+            }
+        }
+
+        /* true if key still exists and tc is still in its window */
+        bool wanted(const void *key, timecode_t tc) {
+            MutexLock l(m);
+            timecode_t start, end;
+            CursorMap::iterator i = cursors.find(key);
+
+            if (i == cursors.end( )) {
+                return false;
+            }
+
+            window(i->second, start, end);
+            return tc >= start && tc < end;
+        }
+
+        void run_thread( ) {
+            unsigned int seen = 0;
+            std::vector<Job> jobs;
+            CursorMap::iterator i;
+            timecode_t start, end;
+            Job job;
+
+            for (;;) {
+                jobs.clear( );
+
+                { MutexLock l(m);
+                    while (generation == seen && !shutdown) {
+                        c.wait(m);
+                    }
+
+                    if (shutdown) {
+                        return;
+                    }
+                    seen = generation;
+
+                    /* work out what is missing from each cursor's window */
+                    for (i = cursors.begin( ); i != cursors.end( ); ++i) {
+                        window(i->second, start, end);
+                        job.key = i->first;
+                        job.reverse = (i->second.velocity < 0);
+                        job.start = start;
+                        job.end = end;
+
+                        if (start < i->second.done_end 
+                                && end > i->second.done_start) {
+                            if (job.reverse) {
+                                job.end = i->second.done_start;
+                            } else {
+                                job.start = i->second.done_end;
+                            }
+                        }
+
+                        if (job.start < job.end) {
+                            jobs.push_back(job);
+                        }
+                    }
+                }
+
+                for (size_t j = 0; j < jobs.size( ); j++) {
+                    if (run_job(jobs[j])) {
+                        MutexLock l(m);
+                        i = cursors.find(jobs[j].key);
+                        if (i != cursors.end( )) {
+                            mark_done(i->second, jobs[j]);
+                        }
+                    }
+                }
+            }
+        }
+
+        /*
+         * Add what a job read to the cursor's done range. The two only
+         * merge if they touch; otherwise the frames in between were 
+         * never read. Either way the result is trimmed to the cursor's
+         * window as it is now.
+         */
+        static void mark_done(Cursor &cursor, const Job &job) {
+            timecode_t start, end;
+
+            if (job.start >= job.end) {
+                return;
+            }
+
+            if (cursor.done_start < cursor.done_end 
+                    && job.start <= cursor.done_end 
+                    && job.end >= cursor.done_start) {
+                if (job.start < cursor.done_start) {
+                    cursor.done_start = job.start;
+                }
+                if (job.end > cursor.done_end) {
+                    cursor.done_end = job.end;
+                }
+            } else {
+                cursor.done_start = job.start;
+                cursor.done_end = job.end;
+            }
+
+            window(cursor, start, end);
+            if (cursor.done_start < start) {
+                cursor.done_start = start;
+            }
+            if (cursor.done_end > end) {
+                cursor.done_end = end;
+            }
+            if (cursor.done_start >= cursor.done_end) {
+                cursor.done_start = 0;
+                cursor.done_end = 0;
+            }
+        }
+
+        /* 
+         * Issue the frames of one job nearest-first, coalescing runs of 
+         * adjacent frames. Returns false if the job went stale; otherwise
+         * the job is narrowed to the frames that exist to be read.
+         */
+        bool run_job(Job &job) {
+            timecode_t start = job.start, end = job.end, tc;
+            off64_t run_offset = 0, offset;
+            size_t run_length = 0, length;
+            int step = job.reverse ? -1 : 1;
+
+            if (start < buf_->oldest_frame( )) {
+                start = buf_->oldest_frame( );
+            }
+
+            if (end > buf_->current_frame( )) {
+                end = buf_->current_frame( );
+            }
+
+            if (start < 0) {
+                start = 0;
+            }
+
+            job.start = start;
+            job.end = end;
+
+            for (tc = job.reverse ? end - 1 : start; 
+                    tc >= start && tc < end; tc += step) {
+                buf_->locate_frame(tc, offset, length);
+
+                if (run_length > 0 && run_length < PREFETCH_MAX_REQUEST
+                        && offset + (off64_t) length == run_offset) {
+                    /* extends the run backwards */
+                    run_offset = offset;
+                    run_length += length;
+                } else if (run_length > 0 
+                        && run_length < PREFETCH_MAX_REQUEST
+                        && run_offset + (off64_t) run_length == offset) {
+                    /* extends the run forwards */
+                    run_length += length;
+                } else {
+                    if (run_length > 0) {
+                        issue(run_offset, run_length);
+                        if (!wanted(job.key, tc)) {
+                            return false;
+                        }
+                    }
+                    run_offset = offset;
+                    run_length = length;
+                }
+            }
+
+            if (run_length > 0) {
+                issue(run_offset, run_length);
+            }
+
+            return true;
+        }
+
+        void issue(off64_t offset, size_t length) {
+            if (readahead(buf_->fd, buf_->data_offset + offset, length) 
+                    != 0) {
+                perror("readahead");
+            }
+        }
+
+        ReplayBuffer *buf_;
+        CursorMap cursors;
+        unsigned int generation;
+        bool shutdown;
+        Mutex m;
+        Condition c;
+};
+
+ReplayBuffer::ReplayBuffer(const char *path, size_t buffer_size, 
+        size_t frame_size, const char *name, map_mode_t map_mode,
+        layout_t layout, write_mode_t write_mode, 
+        unsigned int max_writes_in_flight) {
+    int error;
+    struct stat stat;
+    
+    init(name, map_mode, layout, write_mode);
+
+    /* open and allocate (if necessary) buffer file */
+    fd = open(path, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        throw POSIXError("open");
+    }
+
+    if (fstat(fd, &stat) != 0) {
+        throw POSIXError("fstat");
+    }
+
+    if (S_ISREG(stat.st_mode)) {
+        error = posix_fallocate(fd, 0, buffer_size);
+        if (error != 0) {
+            throw POSIXError("posix_fallocate", error);
+        }
+    } else if (S_ISBLK(stat.st_mode)) {
+        __u64 disk_size;
+        ioctl(fd, BLKGETSIZE64, &disk_size);
+        buffer_size = disk_size;
+        fprintf(stderr, "using raw disk io (buffer size %zu)\n", buffer_size);
+    } else {
+        throw std::runtime_error("cannot use this thing as a buffer");
+    }
+
+    this->buffer_size = buffer_size;
+
+    if (write_mode == WRITE_DIRECT && layout == LAYOUT_SLOTS) {
+        /* O_DIRECT needs every slot to start on an aligned offset */
+        frame_size = (frame_size + ReplayWriter::DIRECT_ALIGN - 1)
+                / ReplayWriter::DIRECT_ALIGN * ReplayWriter::DIRECT_ALIGN;
+    }
+
+    if (buffer_size <= SUPERBLOCK_SIZE) {
+        throw std::runtime_error("buffer too small");
+    }
+
+    if (layout == LAYOUT_PACKED) {
+        this->frame_size = (frame_size + PACKED_ALIGN - 1) 
+                / PACKED_ALIGN * PACKED_ALIGN;
+        this->n_frames = (buffer_size - SUPERBLOCK_SIZE) / PACKED_MIN_RECORD;
+        this->index_size = (n_frames * sizeof(index_entry) 
+                + PACKED_ALIGN - 1) / PACKED_ALIGN * PACKED_ALIGN;
+        this->data_offset = SUPERBLOCK_SIZE + index_size;
+        this->data_size = (buffer_size - data_offset) 
+                / PACKED_ALIGN * PACKED_ALIGN;
+
+        if (this->frame_size > data_size) {
+            throw std::runtime_error("buffer smaller than one frame");
+        }
+
+        map_index( );
+
+        if (write_mode != WRITE_DIRECT) {
+            staging = (uint8_t *) xmalloc(this->frame_size, 
+                    "ReplayBuffer", "staging");
+        }
+    } else {
+        this->frame_size = frame_size;
+        this->data_offset = SUPERBLOCK_SIZE;
+        this->n_frames = (buffer_size - data_offset) / frame_size;
+        this->data_size = n_frames * frame_size;
+
+        if (n_frames == 0) {
+            throw std::runtime_error("buffer smaller than one frame");
+        }
+    }
+
+    if (map_mode == MAP_PERSISTENT) {
+        map_buffer( );
+    }
+
+    /* pick up where we left off if the superblock matches, else start over */
+    superblock sb;
+    if (read_superblock(sb)) {
+        recover(sb, write_mode == WRITE_DIRECT ? max_writes_in_flight : 0);
+        read_jpeg_tables( );
+    } else {
+        format_buffer( );
+    }
+
+    readahead_thread = new ReadaheadThread(this);
+    superblock_thread = new SuperblockThread(this);
+
+    if (write_mode == WRITE_DIRECT) {
+        if (max_writes_in_flight == 0) {
+            throw std::runtime_error("need at least one write in flight");
+        }
+
+        direct_fd = open(path, O_WRONLY | O_DIRECT);
+        if (direct_fd < 0) {
+            throw POSIXError("open with O_DIRECT");
+        }
+
+        max_in_flight = max_writes_in_flight;
+
+        error = posix_memalign((void **) &write_buffers, 
+                ReplayWriter::DIRECT_ALIGN, max_in_flight * this->frame_size);
+        if (error != 0) {
+            throw POSIXError("posix_memalign", error);
+        }
+
+        write_complete = new bool[max_in_flight];
+        memset(write_complete, 0, max_in_flight * sizeof(bool));
+
+        writer = ReplayWriter::create(direct_fd, this, max_in_flight);
+        fprintf(stderr, "%s: direct writes using %s engine\n", 
+                this->name, writer->engine_name( ));
+    }
+}
+
+/* For subclasses that keep their frames elsewhere. */
+ReplayBuffer::ReplayBuffer(const char *name, map_mode_t map_mode,
+        layout_t layout, write_mode_t write_mode) {
+    init(name, map_mode, layout, write_mode);
+}
+
+/* Put every member into a state the destructor can clean up. */
+void ReplayBuffer::init(const char *name, map_mode_t map_mode,
+        layout_t layout, write_mode_t write_mode) {
+    _field_dominance = RawFrame::UNKNOWN;
+
+    fd = -1;
+    data = NULL;
+    data_offset = 0;
+    data_size = 0;
+    buffer_size = 0;
+    frame_size = 0;
+    n_frames = 0;
+    epoch = 0;
+    sb_generation = 0;
+    tables_size = 0;
+    readahead_thread = NULL;
+    superblock_thread = NULL;
+
+    tc_current = 0;
+    tc_write = 0;
+    this->map_mode = map_mode;
+    this->layout = layout;
+    this->write_mode = write_mode;
+    this->name = strdup(name);
+
+    if (this->name == NULL) {
+        throw std::runtime_error("allocation failure");
+    }
+
+    index = NULL;
+    index_size = 0;
+    staging = NULL;
+    tc_oldest = 0;
+    tc_lap_start = 0;
+    write_offset = 0;
+
+    direct_fd = -1;
+    writer = NULL;
+    max_in_flight = 0;
+    write_buffers = NULL;
+    write_complete = NULL;
+    writes_pending = 0;
+    write_error = 0;
+}
+
+ReplayBuffer::~ReplayBuffer( ) {
+    superblock sb;
+
+    ReplayFrameCache::shared( )->flush(this);
+    ReplayBufferLocker::detach_all(this);
+
+    delete readahead_thread;
+
+    if (writer != NULL) {
+        /* let outstanding writes land, failed or not */
+        { MutexLock l(write_m);
+            while (writes_pending > 0) {
+                write_c.wait(write_m);
+            }
+        }
+
+        delete writer;
+    }
+
+    if (superblock_thread != NULL) {
+        delete superblock_thread;
+
+        /* a clean shutdown loses nothing on the next start */
+        try {
+            next_superblock(sb);
+            sync_superblock(sb);
+        } catch (std::exception &e) {
+            fprintf(stderr, "%s: final superblock sync failed: %s\n",
+                    name, e.what( ));
+        }
+    }
+
+    if (direct_fd >= 0) {
+        close(direct_fd);
+    }
+
+    /* pins may be inside the persistent mapping */
+    while (!pins.empty( )) {
+        pins.begin( )->second.refs = 1;
+        unlock_frame(pins.begin( )->first);
+    }
+
+    unmap_buffer( );
+
+    if (index != NULL && munmap(index, index_size) != 0) {
+        perror("munmap");
+    }
+
+    if (fd >= 0 && close(fd) != 0) {
+        throw POSIXError("close");
+    }
+
+    free(name);
+
+    free(staging);
+    delete [] write_complete;
+    free(write_buffers);
+}
+
+/*
+ * Map the whole buffer into one contiguous range of address space.
+ * The range is reserved first, then the file is mapped over it one
+ * window at a time so no single mapping gets unreasonably large.
+ */
+void ReplayBuffer::map_buffer( ) {
+    size_t window, offset, length;
+    void *ret;
+
+    window = (MAP_WINDOW_SIZE / frame_size) * frame_size;
+    if (window == 0) {
+        window = frame_size;
+    }
+
+    ret = mmap(NULL, data_size, PROT_NONE, 
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ret == MAP_FAILED) {
+        throw POSIXError("mmap failed reserving buffer address space");
+    }
+
+    data = (uint8_t *) ret;
+
+    for (offset = 0; offset < data_size; offset += window) {
+        length = data_size - offset;
+        if (length > window) {
+            length = window;
+        }
+
+        ret = mmap(data + offset, length, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_FIXED, fd, data_offset + offset);
+        if (ret == MAP_FAILED) {
+            unmap_buffer( );
+            throw POSIXError("mmap failed mapping buffer window");
+        }
+    }
+}
+
+void ReplayBuffer::unmap_buffer( ) {
+    if (data != NULL) {
+        if (munmap(data, data_size) != 0) {
+            perror("munmap");
+        }
+        data = NULL;
+    }
+}
+
+/*
+ * The packed index lives in the file so it survives a restart; it is
+ * mapped rather than read in, so startup does not have to load it.
+ */
+void ReplayBuffer::map_index( ) {
+    void *ret = mmap(NULL, index_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+            fd, SUPERBLOCK_SIZE);
+
+    if (ret == MAP_FAILED) {
+        throw POSIXError("mmap failed mapping index");
+    }
+
+    index = (index_entry *) ret;
+}
+
+/*
+ * Load the newer valid copy of the superblock. Returns false if there
+ * is none, or if it describes a different geometry than we were asked
+ * to use.
+ */
+bool ReplayBuffer::read_superblock(superblock &sb) {
+    uint8_t block[2 * SUPERBLOCK_COPY_SIZE];
+    bool found = false;
+    superblock copy;
+
+    if (pread(fd, block, sizeof(block), 0) != (ssize_t) sizeof(block)) {
+        return false;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        memcpy(&copy, block + i * SUPERBLOCK_COPY_SIZE, sizeof(copy));
+
+        if (copy.magic != SUPERBLOCK_MAGIC 
+                || copy.version != SUPERBLOCK_VERSION
+                || copy.checksum != superblock_checksum(&copy, 
+                    offsetof(superblock, checksum))) {
+            continue;
+        }
+
+        if (!found || copy.generation > sb.generation) {
+            sb = copy;
+            found = true;
+        }
+    }
+
+    if (!found) {
+        return false;
+    }
+
+    if (sb.layout != (uint32_t) layout || sb.frame_size != frame_size
+            || sb.n_frames != (uint64_t) n_frames 
+            || sb.data_offset != (uint64_t) data_offset 
+            || sb.data_size != data_size) {
+        fprintf(stderr, "%s: buffer geometry changed\n", name);
+        return false;
+    }
+
+    return true;
+}
+
+/* 
+ * Write the caller's generation and timecodes, plus our geometry, into 
+ * the copy slot chosen by the generation.
+ */
+void ReplayBuffer::write_superblock(superblock &sb) {
+    uint8_t block[SUPERBLOCK_COPY_SIZE];
+    off64_t offset = (sb.generation % 2) * SUPERBLOCK_COPY_SIZE;
+
+    sb.magic = SUPERBLOCK_MAGIC;
+    sb.version = SUPERBLOCK_VERSION;
+    sb.epoch = epoch;
+    sb.layout = layout;
+    sb.frame_size = frame_size;
+    sb.n_frames = n_frames;
+    sb.data_offset = data_offset;
+    sb.data_size = data_size;
+    sb.checksum = superblock_checksum(&sb, offsetof(superblock, checksum));
+
+    memset(block, 0, sizeof(block));
+    memcpy(block, &sb, sizeof(sb));
+
+    if (pwrite(fd, block, sizeof(block), offset) != (ssize_t) sizeof(block)) {
+        throw POSIXError("pwrite failed writing superblock");
+    }
+}
+
+/*
+ * Make everything up to sb.tc_current durable (frames and packed index), 
+ * then the superblock that points at it.
+ */
+void ReplayBuffer::sync_superblock(superblock &sb) {
+    if (fdatasync(fd) != 0) {
+        throw POSIXError("fdatasync");
+    }
+
+    write_superblock(sb);
+
+    if (fdatasync(fd) != 0) {
+        throw POSIXError("fdatasync");
+    }
+}
+
+/* the next generation of the superblock, describing the buffer now */
+void ReplayBuffer::next_superblock(superblock &sb) {
+    memset(&sb, 0, sizeof(sb));
+    sb.generation = ++sb_generation;
+    sb.tc_current = current_frame( );
+    sb.tc_oldest = oldest_frame( );
+    sb.tc_lap_start = tc_lap_start;
+}
+
+void ReplayBuffer::request_sync( ) {
+    superblock sb;
+
+    next_superblock(sb);
+    superblock_thread->request(sb);
+}
+
+/* Start an empty buffer with a new epoch, so old frames are ignored. */
+void ReplayBuffer::format_buffer( ) {
+    struct timespec ts;
+    superblock sb;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    epoch = (uint32_t) (ts.tv_sec ^ ts.tv_nsec ^ (getpid( ) << 16));
+    if (epoch == 0) {
+        epoch = 1;
+    }
+
+    fprintf(stderr, "%s: formatting buffer\n", name);
+
+    memset(&sb, 0, sizeof(sb));
+    sb.generation = ++sb_generation;
+    sync_superblock(sb);
+}
+
+/* pick up the JPEG tables written in this epoch, if any */
+void ReplayBuffer::read_jpeg_tables( ) {
+    jpeg_tables_header th;
+    uint8_t data[JPEG_TABLES_MAX];
+
+    tables_size = 0;
+
+    if (pread(fd, &th, sizeof(th), JPEG_TABLES_OFFSET) 
+            != (ssize_t) sizeof(th)) {
+        return;
+    }
+
+    if (th.magic != JPEG_TABLES_MAGIC || th.epoch != epoch 
+            || th.length == 0 || th.length > JPEG_TABLES_MAX) {
+        return;
+    }
+
+    if (pread(fd, data, th.length, JPEG_TABLES_OFFSET + sizeof(th))
+            != (ssize_t) th.length) {
+        return;
+    }
+
+    if (superblock_checksum(data, th.length) != th.checksum) {
+        fprintf(stderr, "%s: bad JPEG tables checksum\n", name);
+        return;
+    }
+
+    memcpy(tables_data, data, th.length);
+    tables_size = th.length;
+}
+
+/*
+ * The buffer can take new tables if they are the same as the old ones,
+ * if there were none (all frames so far carry their own), or if there 
+ * are no frames yet.
+ */
+bool ReplayBuffer::jpeg_tables_compatible(const void *tables, size_t size) {
+    if (tables_size == 0 || tc_write == 0) {
+        return true;
+    }
+
+    return size == tables_size && memcmp(tables, tables_data, size) == 0;
+}
+
+bool ReplayBuffer::set_jpeg_tables(const void *tables, size_t size) {
+    uint8_t block[sizeof(jpeg_tables_header) + JPEG_TABLES_MAX];
+    jpeg_tables_header th;
+
+    if (size == 0 || size > JPEG_TABLES_MAX) {
+        throw std::runtime_error("JPEG tables too large");
+    }
+
+    if (!jpeg_tables_compatible(tables, size)) {
+        return false;
+    }
+
+    if (size == tables_size && memcmp(tables, tables_data, size) == 0) {
+        return true;
+    }
+
+    th.magic = JPEG_TABLES_MAGIC;
+    th.epoch = epoch;
+    th.length = size;
+    th.checksum = superblock_checksum(tables, size);
+
+    memcpy(block, &th, sizeof(th));
+    memcpy(block + sizeof(th), tables, size);
+
+    /* on disk before any frame that needs them */
+    if (pwrite(fd, block, sizeof(th) + size, JPEG_TABLES_OFFSET) 
+            != (ssize_t) (sizeof(th) + size)) {
+        throw POSIXError("pwrite failed writing JPEG tables");
+    }
+
+    if (fdatasync(fd) != 0) {
+        throw POSIXError("fdatasync");
+    }
+
+    memcpy(tables_data, tables, size);
+    tables_size = size;
+    return true;
+}
+
+/*
+ * Restart from a superblock. Frames written after it was synced are 
+ * found from their stamps: by binary search over the slots (the slots 
+ * after the last frame hold older timecodes), or for packed buffers by 
+ * following the chain of records from the last synced one. The chain
+ * only holds up if less than a lap of the disk was written after the
+ * superblock, which the sync interval makes sure of in practice.
+ *
+ * Nothing after the superblock was synced, so a stamp may have reached
+ * the disk without the rest of its frame. Those frames are checked 
+ * against their checksums too, and recovery stops at the first that 
+ * does not match. Only frames within a sync interval plus in_flight 
+ * writes of the end can be unsynced; older ones are taken as intact.
+ */
+void ReplayBuffer::recover(const superblock &sb, unsigned int in_flight) {
+    off64_t offset;
+    size_t length, extent;
+    int64_t sequence;
+    timecode_t lo, hi, mid, tc;
+    uint8_t *scratch;
+
+    scratch = (uint8_t *) xmalloc(frame_size, "ReplayBuffer", "scratch");
+
+    epoch = sb.epoch;
+    sb_generation = sb.generation;
+    tc_write = sb.tc_current;
+    tc_oldest = sb.tc_oldest;
+    tc_lap_start = sb.tc_lap_start;
+
+    if (layout == LAYOUT_PACKED) {
+        if (tc_write > 0) {
+            const index_entry &last = index[(tc_write - 1) % n_frames];
+            write_offset = last.offset + last.length;
+        }
 
-class ReplayBuffer::ReadaheadThread : public Thread {
-    public:
-        ReadaheadThread(int fd) : request_queue(1024) {
-            fd_ = fd;
-            start_thread( );
+        for (;;) {
+            begin_packed_write( );
+            if (!read_stamp(write_offset, sequence, extent) 
+                    || sequence != tc_write
+                    || !frame_intact(write_offset, extent, scratch)) {
+                break;
+            }
+
+            index[tc_write % n_frames].offset = write_offset;
+            index[tc_write % n_frames].length = extent;
+            write_offset += extent;
+            tc_write++;
         }
+    } else {
+        lo = tc_write;
 
-        void request(off64_t offset, size_t count) {
-            ReadaheadRequest req;
-            req.offset = offset;
-            req.count = count;
-            request_queue.put(req);
+        /* skip whole laps written since the superblock was synced */
+        for (;;) {
+            locate_frame(lo, offset, length);
+            if (read_stamp(offset, sequence, extent) && sequence > lo
+                    && (sequence - lo) % n_frames == 0) {
+                lo = sequence;
+            } else {
+                break;
+            }
         }
-    protected:
-        struct ReadaheadRequest {
-            off64_t offset;
-            size_t count;
-        };
 
-        void run_thread( ) {
-            struct ReadaheadRequest req;
+        /* slots hold their own timecode up to the last frame written */
+        hi = lo + n_frames;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            locate_frame(mid, offset, length);
+            if (read_stamp(offset, sequence, extent) && sequence == mid) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
 
-            for (;;) {
-                req = request_queue.get( );
-                if (readahead(fd_, req.offset, req.count) != 0) {
-                    perror("readahead");
-                }
+        /* 
+         * the stamps say frames before lo are there; check the data of
+         * those that could still have been unsynced when we stopped. 
+         * That is at most a sync interval plus the writes in flight, 
+         * however stale the superblock is, so startup stays quick.
+         */
+        tc = lo - (SUPERBLOCK_INTERVAL + in_flight);
+        if (tc < sb.tc_current) {
+            tc = sb.tc_current;
+        }
+        if (lo - tc > n_frames) {
+            tc = lo - n_frames;
+        }
+
+        for (; tc < lo; tc++) {
+            locate_frame(tc, offset, length);
+            if (!read_stamp(offset, sequence, extent) 
+                    || !frame_intact(offset, extent, scratch)) {
+                fprintf(stderr, "%s: frame %d is torn\n", name, (int) tc);
+                break;
             }
         }
 
-        Pipe<ReadaheadRequest> request_queue;
-        int fd_;
-};
+        tc_write = tc;
+        tc_oldest = tc_write > n_frames ? tc_write - n_frames : 0;
+    }
 
-ReplayBuffer::ReplayBuffer(const char *path, size_t buffer_size, 
-        size_t frame_size, const char *name) {
-    int error;
-    struct stat stat;
-    
-    _field_dominance = RawFrame::UNKNOWN;
+    free(scratch);
 
-    /* open and allocate (if necessary) buffer file */
-    fd = open(path, O_CREAT | O_RDWR, 0644);
-    if (fd < 0) {
-        throw POSIXError("open");
+    tc_current = tc_write;
+
+    if (tc_lap_start > tc_current) {
+        /* the wrap it refers to was never written */
+        tc_lap_start = tc_oldest;
     }
 
-    if (fstat(fd, &stat) != 0) {
-        throw POSIXError("fstat");
+    fprintf(stderr, "%s: recovered, resuming at timecode %d\n", 
+            name, (int) tc_current);
+}
+
+/*
+ * Forget frames from tc onwards, so the next write goes to tc. Only used 
+ * at startup, before anything has been written.
+ */
+void ReplayBuffer::truncate(timecode_t tc) {
+    if (tc >= tc_write) {
+        return;
     }
 
-    if (S_ISREG(stat.st_mode)) {
-        error = posix_fallocate(fd, 0, buffer_size);
-        if (error != 0) {
-            throw POSIXError("posix_fallocate", error);
+    if (layout == LAYOUT_PACKED) {
+        if (tc > 0) {
+            const index_entry &last = index[(tc - 1) % n_frames];
+            write_offset = last.offset + last.length;
+        } else {
+            write_offset = 0;
+        }
+
+        if (tc_lap_start > tc) {
+            tc_lap_start = tc_oldest < tc ? tc_oldest : tc;
         }
-    } else if (S_ISBLK(stat.st_mode)) {
-        __u64 disk_size;
-        ioctl(fd, BLKGETSIZE64, &disk_size);
-        buffer_size = disk_size;
-        fprintf(stderr, "using raw disk io (buffer size %zu)\n", buffer_size);
-    } else {
-        throw std::runtime_error("cannot use this thing as a buffer");
     }
 
-    readahead_thread = new ReadaheadThread(fd);
+    if (tc_oldest > tc) {
+        tc_oldest = tc;
+    }
 
-    data = NULL;
+    tc_write = tc;
+    tc_current = tc;
+}
 
-    tc_current = 0;
-    this->buffer_size = buffer_size;
-    this->frame_size = frame_size;
-    this->n_frames = buffer_size / frame_size;
-    this->name = strdup(name);
+/*
+ * Check the data of the frame at offset (extent bytes long, as found by
+ * read_stamp( )) against the checksum in its stamp. scratch must hold
+ * frame_size bytes.
+ */
+bool ReplayBuffer::frame_intact(off64_t offset, size_t extent, 
+        uint8_t *scratch) {
+    ReplayFrameData rfd;
 
-    if (this->name == NULL) {
-        throw std::runtime_error("allocation failure");
+    if (pread(fd, scratch, extent, data_offset + offset) 
+            != (ssize_t) extent) {
+        return false;
     }
 
-    this->locks = new int[this->n_frames];
-    memset(locks, 0, this->n_frames * sizeof(int));
+    rfd.data_ptr = scratch;
+    rfd.data_size = extent;
+    return rfd.hdr( )->checksum == rfd.payload_checksum( );
 }
 
-ReplayBuffer::~ReplayBuffer( ) {
-    if (close(fd) != 0) {
-        throw POSIXError("close");
+/*
+ * Check that the frame at offset is completely written and belongs to
+ * this epoch. Fills in the timecode it was written at and the aligned 
+ * length of the record.
+ */
+bool ReplayBuffer::read_stamp(off64_t offset, int64_t &sequence,
+        size_t &extent) {
+    ReplayFrameData::header h;
+    size_t end;
+
+    if (pread(fd, &h, sizeof(h), data_offset + offset) 
+            != (ssize_t) sizeof(h)) {
+        return false;
     }
 
-    free(name);
+    if (h.magic != ReplayFrameData::HEADER_MAGIC || h.epoch != epoch) {
+        return false;
+    }
+
+    sequence = h.sequence;
+
+    end = sizeof(h) + h.main_jpeg_length;
+    if (h.thumb_jpeg_offset + h.thumb_jpeg_length > end) {
+        end = h.thumb_jpeg_offset + h.thumb_jpeg_length;
+    }
+    if (h.audio_offset + h.audio_length > end) {
+        end = h.audio_offset + h.audio_length;
+    }
 
-    delete locks;
+    extent = (end + PACKED_ALIGN - 1) / PACKED_ALIGN * PACKED_ALIGN;
+    return extent <= frame_size;
 }
 
 ReplayShot *ReplayBuffer::make_shot(timecode_t offset, whence_t whence) {
@@ -138,17 +1167,19 @@ ReplayShot *ReplayBuffer::make_shot(timecode_t offset, whence_t whence) {
             shot->start = offset;
             break;
         case START:
-            if (tc_current < n_frames) {
+            if (layout == LAYOUT_PACKED) {
+                /* first frame written at the start of the disk */
+                start_offset = tc_lap_start;
+            } else if (current_frame( ) < n_frames) {
                 start_offset = 0;
             } else {
-                /* may break if optimizer is really dumb?? */
-                start_offset = (tc_current / n_frames) * n_frames;
+                start_offset = (current_frame( ) / n_frames) * n_frames;
             }
 
             shot->start = start_offset + offset;
             break;
         case END:
-            shot->start = tc_current - 1 + offset;
+            shot->start = current_frame( ) - 1 + offset;
             break;
     }
     shot->length = 0;
@@ -157,242 +1188,647 @@ ReplayShot *ReplayBuffer::make_shot(timecode_t offset, whence_t whence) {
 }
 
 void ReplayBuffer::get_writable_frame(ReplayFrameData &frame_data) {
-    unsigned int frame_index = tc_current % n_frames;
+    unsigned int frame_index = tc_write % n_frames;
 
     frame_data.source = this;
-    frame_data.pos = tc_current + 1;
+    frame_data.pos = tc_write + 1;
     frame_data.data_size = frame_size;
-    frame_data.data_ptr = mmap(
-        NULL, frame_size, PROT_WRITE, MAP_SHARED, 
-        fd, frame_index * frame_size
-    );
 
-    if (frame_data.data_ptr == MAP_FAILED) {
-        throw POSIXError("mmap failed in get_writable_frame");
+    if (write_mode == WRITE_DIRECT) {
+        begin_direct_write( );
+    }
+
+    if (layout == LAYOUT_PACKED) {
+        begin_packed_write( );
+    } else {
+        /* the slot still holds frame tc_write - n_frames */
+        retire_frames(tc_write - n_frames + 1);
+    }
+
+    if (write_mode == WRITE_DIRECT) {
+        /* encode into one of the aligned write buffers */
+        frame_data.data_ptr = write_buffers 
+                + (tc_write % max_in_flight) * frame_size;
+    } else if (layout == LAYOUT_PACKED) {
+        /* encode into the staging area, it gets copied in compacted */
+        frame_data.data_ptr = staging;
+    } else if (data != NULL) {
+        frame_data.data_ptr = data + frame_index * frame_size;
+    } else {
+        frame_data.data_ptr = mmap(
+            NULL, frame_size, PROT_READ | PROT_WRITE, MAP_SHARED, 
+            fd, data_offset + (off64_t) frame_index * frame_size
+        );
+
+        if (frame_data.data_ptr == MAP_FAILED) {
+            throw POSIXError("mmap failed in get_writable_frame");
+        }
     }
+
+    frame_data.begin_write(epoch, tc_write);
 }
 
 void ReplayBuffer::finish_frame_write(ReplayFrameData &rfd) {
-    if (munmap(rfd.data_ptr, rfd.data_size) != 0) {
+    timecode_t tc = tc_write;
+    off64_t offset;
+    size_t length;
+
+    rfd.end_write( );
+
+    if (layout == LAYOUT_PACKED) {
+        length = rfd.compact(PACKED_ALIGN);
+        offset = write_offset;
+        write_offset += length;
+
+        /* readers cannot see this entry until tc_current passes it */
+        index[tc % n_frames].offset = offset;
+        index[tc % n_frames].length = length;
+    } else {
+        offset = (off64_t) (tc % n_frames) * frame_size;
+        length = rfd.data_size;
+    }
+
+    if (write_mode == WRITE_DIRECT) {
+        if (layout == LAYOUT_SLOTS) {
+            /* no need to write the unused part of the slot */
+            length = rfd.compact(ReplayWriter::DIRECT_ALIGN);
+        }
+
+        { MutexLock l(write_m);
+            tc_write++;
+            writes_pending++;
+        }
+
+        /* tc_current advances in write_done( ) */
+        writer->write(tc, rfd.data_ptr, length, data_offset + offset);
+
+        if (tc_write % SUPERBLOCK_INTERVAL == 0) {
+            request_sync( );
+        }
+        return;
+    }
+
+    if (layout == LAYOUT_PACKED) {
+        if (data != NULL) {
+            memcpy(data + offset, rfd.data_ptr, length);
+        } else if (pwrite(fd, rfd.data_ptr, length, data_offset + offset) 
+                != (ssize_t) length) {
+            throw POSIXError("pwrite failed in finish_frame_write");
+        }
+    } else if (data == NULL && munmap(rfd.data_ptr, rfd.data_size) != 0) {
         throw std::runtime_error("munmap failed in finish_frame_write");
     }
     
-    tc_current++;
+    tc_write++;
+    store_tc(&tc_current, tc_write);
+
+    if (tc_write % SUPERBLOCK_INTERVAL == 0) {
+        request_sync( );
+    }
 }
 
+/*
+ * Readers do not take any lock. Instead the writer retires a frame 
+ * (advances tc_oldest) before it starts reusing its space, and every 
+ * frame carries a stamp with its timecode. A reader checks the stamp 
+ * here, and checks that the frame was not retired in finish_frame_read( ),
+ * after it is done with the data. If both pass, the writer cannot have
+ * touched the frame in between, much like a seqlock.
+ */
 void ReplayBuffer::get_readable_frame(timecode_t tc, 
-        ReplayFrameData &frame_data, bool readahead) {
-    if (tc >= tc_current) {
+        ReplayFrameData &frame_data) {
+    timecode_t current = current_frame( );
+
+    if (tc >= current) {
         fprintf(stderr, "past the end: tc=%d tc_current=%d\n",
-                (int) tc, (int) tc_current);
+                (int) tc, (int) current);
+        if (write_mode == WRITE_DIRECT) {
+            MutexLock l(write_m);
+            if (write_error != 0) {
+                throw ReplayBufferFailedException( );
+            }
+        }
         throw ReplayFrameNotFoundException( );
-    } else if (tc < tc_current - n_frames || tc < 0) { 
+    } else if (tc < oldest_frame( ) || tc < 0) { 
         fprintf(stderr, "past the beginning: tc=%d tc_current=%d\n", 
-                (int) tc, (int) tc_current);
+                (int) tc, (int) current);
         throw ReplayFrameNotFoundException( );
     }
 
-    unsigned int frame_index = tc % n_frames;
+    off64_t offset;
+    size_t length;
+
+    locate_frame(tc, offset, length);
     
     frame_data.source = this;
     frame_data.pos = tc;
 
-    void *dp = mmap(
-        NULL, frame_size, PROT_READ, MAP_SHARED, 
-        fd, frame_index * frame_size
-    );
+    void *dp;
+    
+    if (data != NULL) {
+        dp = data + offset;
+    } else {
+        dp = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 
+                data_offset + offset);
 
-    if (dp == MAP_FAILED) {
-        throw POSIXError("mmap failed in get_readable_frame");
+        if (dp == MAP_FAILED) {
+            throw POSIXError("mmap failed in get_readable_frame");
+        }
     }
 
     frame_data.data_ptr = dp;
-    frame_data.data_size = frame_size;
+    frame_data.data_size = length;
 
-    if (readahead) {
-        try_readahead(tc, 30);
+    if (!frame_data.stamp_valid(epoch, tc)) {
+        /* retired and reused between the check above and now */
+        finish_frame_read(frame_data);
+        throw ReplayFrameNotFoundException( );
     }
 }
 
 void ReplayBuffer::finish_frame_read(ReplayFrameData &frame_data) {
-    if (munmap(frame_data.data_ptr, frame_data.data_size) != 0) {
+    bool overwritten;
+
+    /* order our reads of the frame before the check */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    overwritten = (frame_data.pos < oldest_frame( ));
+
+    if (data == NULL 
+            && munmap(frame_data.data_ptr, frame_data.data_size) != 0) {
         throw POSIXError("munmap failed in finish_frame_read");
     }
+
+    if (overwritten) {
+        throw ReplayFrameOverwrittenException( );
+    }
 }
 
 const char *ReplayBuffer::get_name( ) {
     return name;
 }
 
-void ReplayBuffer::lock_frame(timecode_t frame) {
-#ifdef ENABLE_MLOCK
-    bool flag;
-    unsigned int frame_offset = frame % n_frames;
+/*
+ * Mark frames before tc as gone. Only the writer calls this, and must do
+ * so before it overwrites any part of them.
+ */
+void ReplayBuffer::retire_frames(timecode_t tc) {
+    if (tc > tc_oldest) {
+        store_tc(&tc_oldest, tc);
+        /* keep the stores that reuse the space from moving above this */
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+}
 
-    if (frame_offset >= n_frames) {
-        return; 
+void ReplayBuffer::locate_frame(timecode_t tc, off64_t &offset, 
+        size_t &length) {
+    if (layout == LAYOUT_PACKED) {
+        const index_entry &entry = index[tc % n_frames];
+        offset = entry.offset;
+        length = entry.length;
+    } else {
+        offset = (off64_t) (tc % n_frames) * frame_size;
+        length = frame_size;
     }
+}
 
-    { MutexLock l(m);
-        if (locks[frame_offset] == 0) {
-            flag = true;
+/*
+ * Find room for up to frame_size bytes at the write head, wrapping to
+ * the start of the disk if needed, and retire the frames that are about
+ * to be overwritten.
+ */
+void ReplayBuffer::begin_packed_write( ) {
+    timecode_t oldest;
+    off64_t offset;
+    size_t length;
+
+    if (write_offset + frame_size > data_size) {
+        write_offset = 0;
+        tc_lap_start = tc_write;
+    }
+
+    oldest = tc_oldest;
+    while (oldest < tc_write) {
+        locate_frame(oldest, offset, length);
+
+        if (tc_write - oldest >= n_frames) {
+            /* index is full (frames smaller than PACKED_MIN_RECORD) */
+            oldest++;
+        } else if (offset < write_offset + (off64_t) frame_size
+                && offset + (off64_t) length > write_offset) {
+            /* frame overlaps the region we are about to write */
+            oldest++;
         } else {
-            flag = false;
+            break;
+        }
+    }
+
+    retire_frames(oldest);
+}
+
+/*
+ * Wait until a write buffer is free. Once an asynchronous write has 
+ * failed, every further write reports it.
+ */
+void ReplayBuffer::begin_direct_write( ) {
+    MutexLock l(write_m);
+
+    while (write_error == 0 
+            && tc_write - tc_current >= (timecode_t) max_in_flight) {
+        write_c.wait(write_m);
+    }
+
+    if (write_error != 0) {
+        throw POSIXError("asynchronous frame write failed", write_error);
+    }
+}
+
+/*
+ * Called by the writer as each frame lands on disk. Writes may complete
+ * out of order; tc_current only moves past contiguous completed frames,
+ * so it never gets past a frame whose write failed.
+ */
+void ReplayBuffer::write_done(timecode_t tc, int error) {
+    timecode_t current;
+    MutexLock l(write_m);
+
+    writes_pending--;
+
+    if (error != 0) {
+        if (write_error == 0) {
+            fprintf(stderr, "%s: write of frame %d failed: %s\n", 
+                    name, (int) tc, strerror(error));
+            write_error = error;
+        }
+    } else {
+        write_complete[tc % max_in_flight] = true;
+    }
+
+    current = tc_current;
+    while (current < tc_write 
+            && write_complete[current % max_in_flight]) {
+        write_complete[current % max_in_flight] = false;
+        current++;
+    }
+    store_tc(&tc_current, current);
+
+    write_c.broadcast( );
+}
+
+/*
+ * With MAP_PERSISTENT the frame is locked where it already is mapped.
+ * Otherwise each pinned frame gets a mapping of its own, so pins on 
+ * frames that share a page do not undo each other.
+ */
+bool ReplayBuffer::lock_frame(timecode_t frame) {
+    std::map<timecode_t, pinned_frame>::iterator i;
+    pinned_frame pin;
+    off64_t offset, start;
+    size_t length;
+    uintptr_t page_mask = sysconf(_SC_PAGESIZE) - 1;
+    static bool warned = false;
+
+    MutexLock l(m);
+
+    i = pins.find(frame);
+    if (i != pins.end( )) {
+        i->second.refs++;
+        return true;
+    }
+
+    if (!pinnable(frame)) {
+        return false;
+    }
+
+    locate_frame(frame, offset, length);
+    pin.refs = 1;
+
+    if (data != NULL) {
+        pin.addr = (void *) ((uintptr_t) (data + offset) & ~page_mask);
+        pin.length = length + ((data + offset) - (uint8_t *) pin.addr);
+        pin.mapped = false;
+    } else {
+        start = (data_offset + offset) & ~(off64_t) page_mask;
+        pin.length = length + (data_offset + offset - start);
+        pin.mapped = true;
+    }
+
+    if (!ReplayBufferLocker::reserve_memory(pin.length)) {
+        return false;
+    }
+
+    if (pin.mapped) {
+        pin.addr = mmap(NULL, pin.length, PROT_READ, MAP_SHARED, fd, start);
+        if (pin.addr == MAP_FAILED) {
+            perror("mmap failed in lock_frame");
+            ReplayBufferLocker::release_memory(pin.length);
+            return false;
         }
-        locks[frame_offset]++;
     }
 
-    if (flag) {
-        if (mlock(data + frame_offset * frame_size, frame_size) != 0) {
-            perror("mlock");
+    if (mlock(pin.addr, pin.length) != 0) {
+        if (!warned) {
+            perror("mlock (check RLIMIT_MEMLOCK)");
+            warned = true;
+        }
+        if (pin.mapped) {
+            munmap(pin.addr, pin.length);
+        } else {
+            unlock_range(frame, pin);
         }
+        ReplayBufferLocker::release_memory(pin.length);
+        return false;
     }
-#else
-    (void) frame;
-#endif
+
+    pins[frame] = pin;
+    return true;
 }
 
 void ReplayBuffer::unlock_frame(timecode_t frame) {
-#ifdef ENABLE_MLOCK
-    bool flag;
-    unsigned int frame_offset = frame % n_frames;
+    std::map<timecode_t, pinned_frame>::iterator i;
+
+    MutexLock l(m);
 
-    if (frame_offset >= n_frames) {
-        return; 
+    i = pins.find(frame);
+    if (i == pins.end( )) {
+        return;
     }
 
-    { MutexLock l(m);
-        locks[frame_offset]--;
-        if (locks[frame_offset] == 0) {
-            flag = true;
-        } else {
-            flag = false;
+    if (--i->second.refs == 0) {
+        if (!i->second.mapped) {
+            unlock_range(frame, i->second);
+        } else if (munmap(i->second.addr, i->second.length) != 0) {
+            /* unmapping drops the lock */
+            perror("munmap failed in unlock_frame");
+        }
+        ReplayBufferLocker::release_memory(i->second.length);
+        pins.erase(i);
+    }
+}
+
+/*
+ * Unlock a pin made inside the persistent mapping. mlock( ) does not 
+ * count, so leave locked the end pages it shares with a neighbor that 
+ * is still pinned (only frames next to each other share pages). Caller
+ * must hold m.
+ */
+void ReplayBuffer::unlock_range(timecode_t frame, const pinned_frame &pin) {
+    std::map<timecode_t, pinned_frame>::iterator i;
+    uintptr_t page_mask = sysconf(_SC_PAGESIZE) - 1;
+    uintptr_t lo, hi, other_lo, other_hi;
+    timecode_t neighbor;
+
+    lo = (uintptr_t) pin.addr;
+    hi = (lo + pin.length + page_mask) & ~page_mask;
+
+    for (neighbor = frame - 1; neighbor <= frame + 1; neighbor += 2) {
+        i = pins.find(neighbor);
+        if (i == pins.end( )) {
+            continue;
+        }
+
+        other_lo = (uintptr_t) i->second.addr;
+        other_hi = (other_lo + i->second.length + page_mask) & ~page_mask;
+
+        if (other_lo < lo + page_mask + 1 && other_hi > lo) {
+            lo += page_mask + 1;
+        }
+        if (other_lo < hi && other_hi > hi - page_mask - 1) {
+            hi -= page_mask + 1;
         }
     }
 
-    if (flag) {
-        munlock(data + frame_offset * frame_size, frame_size);
+    if (hi > lo && munlock((void *) lo, hi - lo) != 0) {
+        perror("munlock failed in unlock_frame");
+    }
+}
+
+/*
+ * Frames close to the oldest end are not worth pinning, and they must
+ * be unpinned before the writer gets to them: a direct write cannot 
+ * replace pages that are locked in the page cache.
+ */
+bool ReplayBuffer::pinnable(timecode_t frame) {
+    timecode_t margin = PIN_RETIRE_MARGIN;
+
+    if (margin > n_frames / 4) {
+        margin = n_frames / 4;
     }
-#else
-    (void) frame;
-#endif
+
+    return frame >= 0 && frame >= oldest_frame( ) + margin 
+            && frame < current_frame( );
 }
 
+static Mutex pin_budget_m;
+static size_t pin_budget = PIN_DEFAULT_BUDGET;
+static size_t pin_total = 0;
+
+/* every live locker, so a buffer can take itself away from them */
+static Mutex lockers_m;
+static std::set<ReplayBufferLocker *> lockers;
+
 ReplayBufferLocker::ReplayBufferLocker( ) {
     buf = NULL;
-    start = end = 0;
+    pos = 0;
+    velocity = 0.0f;
+    changed = false;
+    shutdown = false;
+    pinned_buf = NULL;
+    next_buf = NULL;
+
+    { MutexLock l(lockers_m);
+        lockers.insert(this);
+    }
 
     start_thread( );
 }
 
 ReplayBufferLocker::~ReplayBufferLocker( ) {
-    
+    { MutexLock l(lockers_m);
+        lockers.erase(this);
+    }
+
+    { MutexLock l(m);
+        shutdown = true;
+        c.signal( );
+    }
+
+    join_thread( );
+    unpin_all( );
+}
+
+void ReplayBufferLocker::detach(ReplayBuffer *gone) {
+    MutexLock l(m);
+
+    if (buf == gone) {
+        buf = NULL;
+        changed = true;
+        c.signal( );
+    }
+
+    while (pinned_buf == gone || next_buf == gone) {
+        pinned_c.wait(m);
+    }
+}
+
+void ReplayBufferLocker::detach_all(ReplayBuffer *gone) {
+    std::set<ReplayBufferLocker *>::iterator i;
+    MutexLock l(lockers_m);
+
+    for (i = lockers.begin( ); i != lockers.end( ); i++) {
+        (*i)->detach(gone);
+    }
+}
+
+void ReplayBufferLocker::set_memory_budget(size_t bytes) {
+    MutexLock l(pin_budget_m);
+    pin_budget = bytes;
+}
+
+size_t ReplayBufferLocker::memory_budget( ) {
+    MutexLock l(pin_budget_m);
+    return pin_budget;
+}
+
+size_t ReplayBufferLocker::pinned_bytes( ) {
+    MutexLock l(pin_budget_m);
+    return pin_total;
+}
+
+bool ReplayBufferLocker::reserve_memory(size_t bytes) {
+    MutexLock l(pin_budget_m);
+
+    if (pin_total + bytes > pin_budget) {
+        return false;
+    }
+
+    pin_total += bytes;
+    return true;
+}
+
+void ReplayBufferLocker::release_memory(size_t bytes) {
+    MutexLock l(pin_budget_m);
+    pin_total -= bytes;
 }
 
+/*
+ * The window is rechecked every PIN_RECHECK_MSEC even if the position
+ * does not change, so frames are let go as the writer approaches them.
+ */
 void ReplayBufferLocker::run_thread( ) {
-    timecode_t current_start = 0, current_end = 0;
-    ReplayBuffer *current_buf = NULL;
-    
-    timecode_t next_start = 0, next_end = 0;
-    ReplayBuffer *next_buf = NULL;
+    timecode_t next_pos;
+    float next_velocity;
 
     for (;;) {
         { MutexLock l(m);
-            if (start == current_start && end == current_end 
-                    && buf == current_buf) {
-                c.wait(m);
-                continue;
-            } else {
-                next_start = start;
-                next_end = end;
-                next_buf = buf;
+            if (!changed && !shutdown) {
+                c.timed_wait(m, PIN_RECHECK_MSEC);
+            }
+
+            if (shutdown) {
+                return;
             }
+            changed = false;
+
+            next_buf = buf;
+            next_pos = pos;
+            next_velocity = velocity;
+            pinned_c.broadcast( );
         }
 
-        /* something has changed if we fall through here */
-        if (next_buf != NULL) {
-            if (next_buf != current_buf) {
-                /* we changed buffers so we have to unlock everything */
-                /* (but only if it's not NULL) */
-                if (current_buf != NULL) {
-                    unlock_all_frames(current_buf, current_start, current_end);
-                }
-                current_buf = next_buf;
-                current_start = next_start;
-                current_end = next_end;
-                lock_all_frames(current_buf, current_start, current_end);
-            } else {
-                /* check for overlap and move the range if possible */
-                move_range(current_buf, current_start, current_end, 
-                        next_start, next_end);
-                current_start = next_start;
-                current_end = next_end;
+        if (next_buf != pinned_buf) {
+            unpin_all( );
+
+            { MutexLock l(m);
+                pinned_buf = next_buf;
+                pinned_c.broadcast( );
             }
         }
-    }
 
+        if (pinned_buf != NULL) {
+            update_pins(next_pos, next_velocity);
+        }
+    }
 }
 
-void ReplayBufferLocker::set_position(ReplayBuffer *buf, timecode_t tc) {
+void ReplayBufferLocker::set_position(ReplayBuffer *buf, timecode_t tc,
+        float velocity) {
     MutexLock l(m);
 
     this->buf = buf;
-    start = tc - 10;
-    end = tc + 10;
+    pos = tc;
+    this->velocity = velocity;
+    changed = true;
 
     c.signal( );
 }
 
-void ReplayBufferLocker::lock_all_frames(ReplayBuffer *buf, timecode_t start, 
-        timecode_t end) {
-    for (timecode_t i = start; i < end; i++) {
-        buf->lock_frame(i);
-    }
+void ReplayBufferLocker::clear( ) {
+    set_position(NULL, 0);
 }
 
-void ReplayBufferLocker::unlock_all_frames(ReplayBuffer *buf, 
-        timecode_t start, timecode_t end) {
-    for (timecode_t i = start; i < end; i++) {
-        buf->unlock_frame(i);
+/* Pin the window around pos nearest-first, and unpin what left it. */
+void ReplayBufferLocker::update_pins(timecode_t pos, float velocity) {
+    std::set<timecode_t>::iterator i, next;
+    timecode_t start, end, ahead, tc;
+    float speed = fabsf(velocity);
+
+    ahead = (timecode_t) ceilf(speed * PIN_AHEAD);
+    if (ahead < PIN_BEHIND) {
+        ahead = PIN_BEHIND;
+    } else if (ahead > PIN_MAX_AHEAD) {
+        ahead = PIN_MAX_AHEAD;
     }
-}
 
-void ReplayBufferLocker::move_range(ReplayBuffer *buf,
-        timecode_t s1, timecode_t e1, 
-        timecode_t s2, timecode_t e2) {
-    if (s1 > e2 || s2 > e1) {
-        /* no overlap */
-        unlock_all_frames(buf, s1, e1);
-        lock_all_frames(buf, s2, e2);
+    if (velocity >= 0.0f) {
+        start = pos - PIN_BEHIND;
+        end = pos + ahead + 1;
     } else {
-        if (s1 < s2) {
-            /* unlock all frames from s1 up to s2 */
-            unlock_all_frames(buf, s1, s2);
-        } else {
-            /* lock all frames from s2 to s1 */
-            lock_all_frames(buf, s2, s1);
+        start = pos - ahead;
+        end = pos + PIN_BEHIND + 1;
+    }
+
+    for (i = pinned.begin( ); i != pinned.end( ); i = next) {
+        next = i;
+        next++;
+
+        if (*i < start || *i >= end || !pinned_buf->pinnable(*i)) {
+            pinned_buf->unlock_frame(*i);
+            pinned.erase(i);
         }
+    }
 
-        if (e1 < e2) {
-            /* lock all frames from e1 to e2 */
-            lock_all_frames(buf, e1, e2);
-        } else {
-            /* unlock all frames from e2 to e1 */
-            unlock_all_frames(buf, e2, e1);
+    for (timecode_t d = 0; pos + d < end || pos - d >= start; d++) {
+        tc = pos + d;
+        if (tc < end && pinned.count(tc) == 0 
+                && pinned_buf->lock_frame(tc)) {
+            pinned.insert(tc);
         }
 
+        tc = pos - d - 1;
+        if (tc >= start && pinned.count(tc) == 0 
+                && pinned_buf->lock_frame(tc)) {
+            pinned.insert(tc);
+        }
     }
 }
 
-void ReplayBuffer::try_readahead(timecode_t tc, unsigned int n) {
-    for (unsigned int i = 1; i < n; i++) {
-        try_readahead(tc + i);
+void ReplayBufferLocker::unpin_all( ) {
+    std::set<timecode_t>::iterator i;
+
+    if (pinned_buf != NULL) {
+        for (i = pinned.begin( ); i != pinned.end( ); i++) {
+            pinned_buf->unlock_frame(*i);
+        }
     }
+
+    pinned.clear( );
 }
 
-void ReplayBuffer::try_readahead(timecode_t tc) {
-    unsigned int frame_index = tc % n_frames;
-    if (readahead_thread != NULL) {
-        readahead_thread->request(frame_index * frame_size, frame_size);
-    }
+void ReplayBuffer::update_cursor(const void *cursor, timecode_t tc,
+        float velocity) {
+    readahead_thread->update(cursor, tc, velocity);
+}
+
+void ReplayBuffer::remove_cursor(const void *cursor) {
+    readahead_thread->remove(cursor);
 }
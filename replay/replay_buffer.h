@@ -21,73 +21,209 @@
 #define _REPLAY_BUFFER_H
 
 #include "replay_data.h"
+#include "replay_writer.h"
 #include "mutex.h"
 #include "thread.h"
 #include "condition.h"
 
 #include <stdexcept>
+#include <map>
+#include <set>
 
 class ReplayFrameNotFoundException : public virtual std::exception {
     const char *what() const throw() { return "Frame off ends of buffer"; }
 };
 
+/*
+ * Thrown by finish_frame_read( ) when the writer wrapped around and
+ * reused the frame while it was being read. Anything derived from the
+ * frame data must be thrown away.
+ */
+class ReplayFrameOverwrittenException : public ReplayFrameNotFoundException {
+    const char *what() const throw() { return "Frame overwritten during read"; }
+};
+
+/*
+ * Thrown by get_readable_frame( ) for frames past the end of a buffer
+ * whose asynchronous writes failed: nothing after the failed frame will
+ * ever become readable.
+ */
+class ReplayBufferFailedException : public ReplayFrameNotFoundException {
+    const char *what() const throw() { return "Buffer write failed"; }
+};
+
 class ReplayBuffer;
 
+/*
+ * Keeps the frames around one reader's position pinned in memory, so
+ * jogging around it never waits for the disk. The window reaches 
+ * PIN_BEHIND frames back from the position and, in the direction of 
+ * play, far enough for PIN_AHEAD output frames at the reader's velocity
+ * (buffer frames per output frame, as for update_cursor( )). Frames 
+ * nearest the position are pinned first.
+ *
+ * All lockers together pin at most memory_budget( ) bytes; a budget of
+ * zero turns pinning off.
+ */
 class ReplayBufferLocker : public Thread {
     public:
         ReplayBufferLocker( );
         ~ReplayBufferLocker( );
 
-        void set_position(ReplayBuffer *buf, timecode_t tc);
+        void set_position(ReplayBuffer *buf, timecode_t tc, 
+                float velocity = 0.0f);
+        /* unpin everything */
+        void clear( );
+
+        static void set_memory_budget(size_t bytes);
+        static size_t memory_budget( );
+        static size_t pinned_bytes( );
 
     protected:
-        timecode_t start, end;
         ReplayBuffer *buf;        
+        timecode_t pos;
+        float velocity;
+        bool changed;
+        bool shutdown;
 
         Mutex m;
         Condition c;
+        /* signaled when the thread moves pinned_buf or next_buf */
+        Condition pinned_c;
+
+        /* 
+         * what the locker thread has pinned, and what it is about to 
+         * pin; both changed under m
+         */
+        ReplayBuffer *pinned_buf;
+        ReplayBuffer *next_buf;
+        std::set<timecode_t> pinned;
 
         void run_thread( );
+        void update_pins(timecode_t pos, float velocity);
+        void unpin_all( );
 
-        void lock_all_frames(ReplayBuffer *buf, timecode_t start, 
-                timecode_t end);
-        
-        void unlock_all_frames(ReplayBuffer *buf, timecode_t start, 
-                timecode_t end);
+        /* stop using buf, and wait until nothing is pinned in it */
+        void detach(ReplayBuffer *buf);
+        /* detach every locker from a buffer about to go away */
+        static void detach_all(ReplayBuffer *buf);
 
-        void move_range(ReplayBuffer *buf, timecode_t s1, timecode_t e1,
-                timecode_t s2, timecode_t e2);
+        /* global budget accounting, used by ReplayBuffer::lock_frame( ) */
+        static bool reserve_memory(size_t bytes);
+        static void release_memory(size_t bytes);
+        friend class ReplayBuffer;
 };
 
-class ReplayBuffer {
+class ReplayBuffer : private ReplayWriteClient {
     public:
         enum whence_t { ZERO, START, END };
 
+        /*
+         * MAP_PER_FRAME maps and unmaps each frame as it is accessed.
+         * MAP_PERSISTENT maps the whole buffer once (in windows of
+         * MAP_WINDOW_SIZE bytes) and hands out pointers into that mapping.
+         */
+        enum map_mode_t { MAP_PER_FRAME, MAP_PERSISTENT };
+
+        /*
+         * LAYOUT_SLOTS gives every frame a fixed frame_size slot.
+         * LAYOUT_PACKED appends frames back to back (frame_size is then
+         * the largest frame that can be written) and keeps an in-memory
+         * index from timecode to location.
+         */
+        enum layout_t { LAYOUT_SLOTS, LAYOUT_PACKED };
+
+        /*
+         * WRITE_MMAP writes frames through the page cache (directly into
+         * a shared mapping, or with pwrite( ) for packed buffers).
+         * WRITE_DIRECT encodes into private aligned buffers and writes
+         * them asynchronously with O_DIRECT (see ReplayWriter), with at
+         * most max_writes_in_flight outstanding. Frames become readable
+         * once their write completes. If a write fails, the buffer stops
+         * at that frame: writers get the error from then on, and readers
+         * get ReplayBufferFailedException past the end.
+         */
+        enum write_mode_t { WRITE_MMAP, WRITE_DIRECT };
+
+        /* room for JPEG tables, in the superblock region */
+        enum { JPEG_TABLES_MAX = 3056 };
+
         ReplayBuffer(const char *path, size_t buffer_size, size_t frame_size,
-                const char *name="(unnamed)");
-        ~ReplayBuffer( );
+                const char *name="(unnamed)", 
+                map_mode_t map_mode = MAP_PER_FRAME,
+                layout_t layout = LAYOUT_SLOTS,
+                write_mode_t write_mode = WRITE_MMAP,
+                unsigned int max_writes_in_flight = 8);
+        virtual ~ReplayBuffer( );
+
+        virtual ReplayShot *make_shot(timecode_t offset, 
+                whence_t whence = END);
 
-        ReplayShot *make_shot(timecode_t offset, whence_t whence = END);
+        virtual void get_writable_frame(ReplayFrameData &frame_data);
+        virtual void finish_frame_write(ReplayFrameData &frame_data);
 
-        void get_writable_frame(ReplayFrameData &frame_data);
-        void finish_frame_write(ReplayFrameData &frame_data);
+        /*
+         * Reads are lock-free and may race with the writer reusing the
+         * frame. finish_frame_read( ) must be called once the reader is 
+         * done with the data (even with a persistent mapping), and throws
+         * ReplayFrameOverwrittenException if the frame was reused 
+         * meanwhile.
+         */
+        virtual void get_readable_frame(timecode_t tc, 
+                ReplayFrameData &frame_data);
+        virtual void finish_frame_read(ReplayFrameData &frame_data);
 
-        void get_readable_frame(timecode_t tc, ReplayFrameData &frame_data, 
-            bool readahead = false);
-        void finish_frame_read(ReplayFrameData &frame_data);
+        /*
+         * Reader cursors drive prefetching. A reader reports its position
+         * and velocity (buffer frames per output frame; negative in 
+         * reverse, zero while paused or jogging) under a key of its own,
+         * usually its this pointer, and removes the cursor when it stops
+         * reading from this buffer.
+         */
+        virtual void update_cursor(const void *cursor, timecode_t tc, 
+                float velocity);
+        virtual void remove_cursor(const void *cursor);
 
         RawFrame::FieldDominance field_dominance( ) { return _field_dominance; }
         void set_field_dominance(RawFrame::FieldDominance dom) { _field_dominance = dom; }
 
         const char *get_name( );
 
-        void lock_frame(timecode_t frame);
-        void unlock_frame(timecode_t frame);
+        /*
+         * JPEG tables (a tables-only JPEG) shared by the abbreviated 
+         * frames of this buffer (see Mjpeg422Encoder::set_abbreviated),
+         * stored on disk with the superblock. Returns false and changes
+         * nothing if the buffer already holds frames that were made with
+         * different tables; new frames must then carry their own.
+         */
+        virtual bool set_jpeg_tables(const void *tables, size_t size);
+        virtual const uint8_t *jpeg_tables( ) { return tables_data; }
+        virtual size_t jpeg_tables_size( ) { return tables_size; }
+
+        /* 
+         * Pin a frame's pages in memory (nested calls are counted).
+         * Returns false if the frame is not pinnable( ) or the memory
+         * budget is used up; don't unlock_frame( ) it in that case.
+         */
+        virtual bool lock_frame(timecode_t frame);
+        virtual void unlock_frame(timecode_t frame);
+        /* false for frames not written yet or about to be overwritten */
+        virtual bool pinnable(timecode_t frame);
+
+    protected:
+        ReplayBuffer(const char *name, map_mode_t map_mode, 
+                layout_t layout, write_mode_t write_mode);
 
     private:
+        friend class StripedReplayBuffer;
+
         class ReadaheadThread;
         ReadaheadThread *readahead_thread;
 
+        class SuperblockThread;
+        SuperblockThread *superblock_thread;
+        struct superblock;
+
         RawFrame::FieldDominance _field_dominance;
 
         char *name;
@@ -97,18 +233,109 @@ class ReplayBuffer {
         size_t frame_size;
         timecode_t n_frames;
 
+        map_mode_t map_mode;
+        layout_t layout;
+        write_mode_t write_mode;
+
+        /* base of the persistent mapping (NULL in MAP_PER_FRAME mode) */
         uint8_t *data;
+        /* where the frames start in the file, and how many bytes they use */
+        off64_t data_offset;
+        size_t data_size;
+
+        /* changes each time the buffer is formatted */
+        uint32_t epoch;
+
+        /* JPEG tables of this epoch (tables_size 0 if none) */
+        uint8_t tables_data[JPEG_TABLES_MAX];
+        size_t tables_size;
+        uint64_t sb_generation;
 
-        volatile timecode_t tc_current;
+        /*
+         * Frames before tc_current are completely written; frames before 
+         * tc_oldest may be overwritten at any moment. Both are shared with
+         * lock-free readers: use load_tc( ) and store_tc( ).
+         */
+        timecode_t tc_current;
+        timecode_t tc_oldest;
+        /* next frame to be written (ahead of tc_current in WRITE_DIRECT) */
+        timecode_t tc_write;
 
-        int *locks;
+        /* packed layout state */
+        struct index_entry {
+            off64_t offset;
+            size_t length;
+        };
 
-        ReplayBufferLocker write_lock;
+        /* mapped from the file, just after the superblock */
+        index_entry *index;
+        size_t index_size;
+        timecode_t tc_lap_start;
+        off64_t write_offset;
+        uint8_t *staging;
+
+        /* WRITE_DIRECT state */
+        int direct_fd;
+        ReplayWriter *writer;
+        unsigned int max_in_flight;
+        uint8_t *write_buffers;
+        bool *write_complete;
+        unsigned int writes_pending;
+        int write_error;
+        Mutex write_m;
+        Condition write_c;
+
+        /* 
+         * frames pinned by lock_frame( ): locked in the persistent 
+         * mapping, or each in a locked mapping of its own (mapped)
+         */
+        struct pinned_frame {
+            void *addr;
+            size_t length;
+            unsigned int refs;
+            bool mapped;
+        };
+        std::map<timecode_t, pinned_frame> pins;
+        void unlock_range(timecode_t frame, const pinned_frame &pin);
 
         Mutex m;
 
-        void try_readahead(timecode_t tc);
-        void try_readahead(timecode_t tc, unsigned int n);
+        void init(const char *name, map_mode_t map_mode, layout_t layout,
+                write_mode_t write_mode);
+        void truncate(timecode_t tc);
+
+        void map_buffer( );
+        void unmap_buffer( );
+        void map_index( );
+
+        bool read_superblock(superblock &sb);
+        void write_superblock(superblock &sb);
+        void sync_superblock(superblock &sb);
+        void next_superblock(superblock &sb);
+        void request_sync( );
+        void format_buffer( );
+        void recover(const superblock &sb, unsigned int in_flight);
+        void read_jpeg_tables( );
+        bool jpeg_tables_compatible(const void *tables, size_t size);
+        bool read_stamp(off64_t offset, int64_t &sequence, size_t &extent);
+        bool frame_intact(off64_t offset, size_t extent, uint8_t *scratch);
+
+        static timecode_t load_tc(const timecode_t *tc) {
+            return __atomic_load_n(tc, __ATOMIC_ACQUIRE);
+        }
+
+        static void store_tc(timecode_t *tc, timecode_t value) {
+            __atomic_store_n(tc, value, __ATOMIC_RELEASE);
+        }
+
+        timecode_t current_frame( ) { return load_tc(&tc_current); }
+        timecode_t oldest_frame( ) { return load_tc(&tc_oldest); }
+        void retire_frames(timecode_t tc);
+        void locate_frame(timecode_t tc, off64_t &offset, size_t &length);
+        void begin_packed_write( );
+        void begin_direct_write( );
+        void write_done(timecode_t tc, int error);
+
 };
 
 #endif
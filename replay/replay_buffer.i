@@ -23,7 +23,13 @@
 
 class ReplayBuffer {
     public:
-        ReplayBuffer(const char *, size_t, size_t, const char * = "(unnamed)");
+        enum map_mode_t { MAP_PER_FRAME, MAP_PERSISTENT };
+        enum layout_t { LAYOUT_SLOTS, LAYOUT_PACKED };
+        enum write_mode_t { WRITE_MMAP, WRITE_DIRECT };
+
+        ReplayBuffer(const char *, size_t, size_t, const char * = "(unnamed)",
+                map_mode_t = MAP_PER_FRAME, layout_t = LAYOUT_SLOTS,
+                write_mode_t = WRITE_MMAP, unsigned int = 8);
         ~ReplayBuffer( );
 
         enum whence_t { ZERO, START, END };
@@ -33,3 +39,26 @@ class ReplayBuffer {
         const char *get_name( );
 };
 
+%{
+    #include "replay_striped_buffer.h"
+%}
+
+class StripedReplayBuffer : public ReplayBuffer {
+    public:
+        StripedReplayBuffer(const char *, size_t, size_t, 
+                const char * = "(unnamed)",
+                map_mode_t = MAP_PER_FRAME, layout_t = LAYOUT_SLOTS,
+                write_mode_t = WRITE_MMAP, unsigned int = 8);
+        ~StripedReplayBuffer( );
+};
+
+/* only the global pinning budget is of interest from Ruby */
+class ReplayBufferLocker {
+    public:
+        static void set_memory_budget(size_t);
+        static size_t memory_budget( );
+        static size_t pinned_bytes( );
+
+    private:
+        ReplayBufferLocker( );
+};
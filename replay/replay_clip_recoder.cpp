@@ -0,0 +1,159 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ * 
+ * This file is part of openreplay.
+ * 
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "replay_clip_recoder.h"
+#include "libjpeg_glue.h"
+
+#include <stdio.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stdexcept>
+
+ReplayClipRecoder::ReplayClipRecoder( ) {
+    busy = false;
+    shutdown = false;
+    saved = 0;
+
+    start_thread( );
+    /* only take time nobody else wants */
+    priority(SCHED_IDLE, 0);
+}
+
+ReplayClipRecoder::~ReplayClipRecoder( ) {
+    { MutexLock l(m);
+        shutdown = true;
+        c.signal( );
+    }
+
+    join_thread( );
+}
+
+void ReplayClipRecoder::recode_file(const char *path) {
+    MutexLock l(m);
+    queue.push_back(path);
+    c.signal( );
+}
+
+unsigned int ReplayClipRecoder::pending( ) {
+    MutexLock l(m);
+    return queue.size( ) + (busy ? 1 : 0);
+}
+
+uint64_t ReplayClipRecoder::bytes_saved( ) {
+    MutexLock l(m);
+    return saved;
+}
+
+void ReplayClipRecoder::run_thread( ) {
+    std::string path;
+
+    for (;;) {
+        { MutexLock l(m);
+            busy = false;
+            while (!shutdown && queue.empty( )) {
+                c.wait(m);
+            }
+
+            if (shutdown) {
+                return;
+            }
+
+            path = queue.front( );
+            queue.pop_front( );
+            busy = true;
+        }
+
+        try {
+            recode(path);
+        } catch (std::exception &e) {
+            /* the original file is still there, so just say so */
+            fprintf(stderr, "ReplayClipRecoder: %s: %s\n", 
+                    path.c_str( ), e.what( ));
+        }
+    }
+}
+
+static void read_file(const std::string &path, std::string &data) {
+    FILE *f;
+    char buf[65536];
+    size_t n;
+
+    f = fopen(path.c_str( ), "rb");
+    if (f == NULL) {
+        throw std::runtime_error("cannot open clip");
+    }
+
+    data.clear( );
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        data.append(buf, n);
+    }
+
+    if (ferror(f)) {
+        fclose(f);
+        throw std::runtime_error("error reading clip");
+    }
+
+    fclose(f);
+}
+
+void ReplayClipRecoder::recode(const std::string &path) {
+    std::string in, out, frame;
+    std::string tmp_path = path + ".recode";
+    const uint8_t *data;
+    size_t pos, length;
+    FILE *f;
+
+    read_file(path, in);
+    data = (const uint8_t *) in.data( );
+
+    /* each frame is recoded on its own */
+    for (pos = 0; pos < in.size( ); pos += length) {
+        length = jpeg_image_length(data + pos, in.size( ) - pos);
+        recoder.recode(data + pos, length, frame);
+        out.append(frame);
+    }
+
+    if (out.size( ) >= in.size( )) {
+        /* nothing to gain */
+        return;
+    }
+
+    f = fopen(tmp_path.c_str( ), "wb");
+    if (f == NULL) {
+        throw std::runtime_error("cannot create recoded clip");
+    }
+
+    if (fwrite(out.data( ), 1, out.size( ), f) != out.size( ) 
+            || fflush(f) != 0 || fsync(fileno(f)) != 0) {
+        fclose(f);
+        remove(tmp_path.c_str( ));
+        throw std::runtime_error("error writing recoded clip");
+    }
+
+    fclose(f);
+
+    if (rename(tmp_path.c_str( ), path.c_str( )) != 0) {
+        remove(tmp_path.c_str( ));
+        throw std::runtime_error("cannot replace clip");
+    }
+
+    { MutexLock l(m);
+        saved += in.size( ) - out.size( );
+    }
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ * 
+ * This file is part of openreplay.
+ * 
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _REPLAY_CLIP_RECODER_H
+#define _REPLAY_CLIP_RECODER_H
+
+#include "thread.h"
+#include "mutex.h"
+#include "condition.h"
+#include "mjpeg_codec.h"
+
+#include <deque>
+#include <string>
+#include <stdint.h>
+
+/*
+ * Shrinks saved clips (M-JPEG files of back-to-back JPEG frames) by
+ * giving every frame optimized Huffman tables. The picture is not 
+ * changed. This runs on its own idle-priority thread, a file at a time,
+ * so it stays out of the way of ingest and playout. Each file is 
+ * replaced only once its recoded copy is completely written.
+ */
+class ReplayClipRecoder : public Thread {
+    public:
+        ReplayClipRecoder( );
+        ~ReplayClipRecoder( );
+
+        /* queue a file to be recoded in place */
+        void recode_file(const char *path);
+
+        /* files queued or in progress */
+        unsigned int pending( );
+        /* total shrinkage of the files done so far */
+        uint64_t bytes_saved( );
+
+    protected:
+        void run_thread( );
+        void recode(const std::string &path);
+
+        MjpegRecoder recoder;
+
+        Mutex m;
+        Condition c;
+        std::deque<std::string> queue;
+        bool busy;
+        bool shutdown;
+        uint64_t saved;
+};
+
+#endif
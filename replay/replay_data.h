@@ -22,6 +22,8 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
+#include <stdexcept>
 
 #include "raw_frame.h"
 #include "rational.h"
@@ -41,6 +43,14 @@ struct ReplayShot {
 
 /*
  * Data representing a compressed M-JPEG frame in a buffer.
+ *
+ * Each frame starts with a small fixed header recording where the 
+ * main JPEG, thumbnail JPEG and audio are and exactly how long they are.
+ * The main JPEG may instead be two JPEGs back to back, one per field
+ * (see has_fields( )), so a field can be decoded without the other.
+ * While writing, the thumbnail and audio live in a fixed-size aux area
+ * at the end of the frame; packed buffers squeeze them down behind the
+ * main JPEG when the write is finished (see compact( )).
  */
 struct ReplayFrameData {
     ReplayBuffer *source;
@@ -63,65 +73,266 @@ struct ReplayFrameData {
         return *this;
     }
 
+    /* 
+     * Readers: these return the exact extents of what was stored.
+     * Sizes are clipped to the frame, so a header the writer is 
+     * overwriting under us cannot send a reader outside it.
+     */
     void *main_jpeg( ) {
-        return data_ptr;    
+        return (uint8_t *)data_ptr + sizeof(header);
     }
 
     size_t main_jpeg_size( ) {
-        return data_size - sizeof(aux_data);
+        return extent(sizeof(header), hdr( )->main_jpeg_length);
     }
 
     void *thumb_jpeg( ) {
-        return aux( )->thumbnail;
+        return (uint8_t *)data_ptr + hdr( )->thumb_jpeg_offset;
     }
 
     size_t thumb_jpeg_size( ) {
-        return sizeof(aux( )->thumbnail);
+        const header *h = hdr( );
+        return extent(h->thumb_jpeg_offset, h->thumb_jpeg_length);
     }
 
     void *audio( ) {
-        return aux( )->audio;
+        return (uint8_t *)data_ptr + hdr( )->audio_offset;
     }
 
     size_t audio_size( ) {
-        return sizeof(aux( )->audio);
+        const header *h = hdr( );
+        return extent(h->audio_offset, h->audio_length);
     }
 
     bool has_audio( ) {
-        return aux( )->has_audio;
+        return (hdr( )->flags & FLAG_AUDIO) != 0;
+    }
+
+    /* 
+     * True if the main JPEG area holds the fields as separate images.
+     * Field 0 is the top field (lines 0, 2, 4...), field 1 the bottom.
+     */
+    bool has_fields( ) {
+        return (hdr( )->flags & FLAG_FIELDS) != 0;
     }
 
-    void enable_audio( ) {
-        aux( )->has_audio = true;
+    void *field_jpeg(int field) {
+        if (field == 0) {
+            return main_jpeg( );
+        } else {
+            return (uint8_t *)main_jpeg( ) + field_jpeg_size(0);
+        }
+    }
+
+    size_t field_jpeg_size(int field) {
+        size_t total = main_jpeg_size( );
+        size_t top = hdr( )->top_field_length;
+
+        if (top > total) {
+            top = total;
+        }
+
+        return (field == 0) ? top : total - top;
+    }
+
+    /* 
+     * Writers: fill in up to *_capacity( ) bytes, then record how many
+     * bytes were actually used.
+     */
+    size_t main_jpeg_capacity( ) {
+        return data_size - sizeof(header) - sizeof(aux_data);
+    }
+
+    size_t thumb_jpeg_capacity( ) {
+        return sizeof(aux( )->thumbnail);
+    }
+
+    size_t audio_capacity( ) {
+        return sizeof(aux( )->audio);
+    }
+
+    void set_main_jpeg_length(size_t length) {
+        hdr( )->main_jpeg_length = length;
+    }
+
+    /* store the main JPEG area as the two fields, top field first */
+    void set_field_jpeg_lengths(size_t top, size_t bottom) {
+        hdr( )->flags |= FLAG_FIELDS;
+        hdr( )->top_field_length = top;
+        hdr( )->main_jpeg_length = top + bottom;
+    }
+
+    void set_thumb_jpeg_length(size_t length) {
+        hdr( )->thumb_jpeg_length = length;
+    }
+
+    void enable_audio(size_t length) {
+        hdr( )->flags |= FLAG_AUDIO;
+        hdr( )->audio_length = length;
     }
 
     void no_audio( ) {
-        aux( )->has_audio = false;
+        hdr( )->flags &= ~FLAG_AUDIO;
+        hdr( )->audio_length = 0;
     }
 
     bool valid( ) {
         return (data_ptr != NULL);
     }
 
+    /* true if the frame has been completely written */
+    bool complete( ) {
+        return hdr( )->magic == HEADER_MAGIC;
+    }
+
+    /* true if this is the complete frame written at sequence in epoch */
+    bool stamp_valid(uint32_t epoch, int64_t sequence) {
+        const header *h = hdr( );
+        return h->magic == HEADER_MAGIC && h->epoch == epoch 
+                && h->sequence == sequence;
+    }
+
     void clear( ) {
         data_ptr = NULL;
     }
 
+    static size_t aux_size( ) {
+        return sizeof(header) + sizeof(aux_data);
+    }
+
     friend class ReplayBuffer;
 protected:
+    enum { 
+        HEADER_MAGIC = 0x4a52504f, /* "OPRJ" */
+        FLAG_AUDIO = 0x1,
+        FLAG_FIELDS = 0x2
+    };
+
+    struct header {
+        uint32_t magic;
+        uint32_t flags;
+        uint32_t main_jpeg_length;
+        uint32_t thumb_jpeg_offset;
+        uint32_t thumb_jpeg_length;
+        uint32_t audio_offset;
+        uint32_t audio_length;
+        /* which formatting of the buffer wrote this frame */
+        uint32_t epoch;
+        /* timecode the frame was written at */
+        int64_t sequence;
+        /* with FLAG_FIELDS: bytes of main JPEG area holding field 0 */
+        uint32_t top_field_length;
+        /* payload_checksum( ) when the write finished */
+        uint32_t checksum;
+        uint8_t reserved[16];
+    };
+
+    /* thumbnail must come first, compact( ) relies on it */
     struct aux_data {
-        bool has_audio;
-        uint8_t audio[8192];
         uint8_t thumbnail[81920];
+        uint8_t audio[8192];
         uint8_t game_data[4096];
     };
 
+    header *hdr( ) {
+        return (header *) data_ptr;
+    }
+
+    size_t extent(size_t offset, size_t length) {
+        if (offset > data_size) {
+            return 0;
+        } else if (length > data_size - offset) {
+            return data_size - offset;
+        } else {
+            return length;
+        }
+    }
+
     struct aux_data *aux( ) {
-        /* FIXME: maybe nonportable due to alignment? */
         return (aux_data *)
                 ((uint8_t *)data_ptr + data_size - sizeof(aux_data));
     }
 
+    /* Set up an empty header pointing into the aux area. */
+    void begin_write(uint32_t epoch, int64_t sequence) {
+        header *h = hdr( );
+        memset(h, 0, sizeof(header));
+        h->epoch = epoch;
+        h->sequence = sequence;
+        h->thumb_jpeg_offset = (uint8_t *)aux( )->thumbnail 
+                - (uint8_t *)data_ptr;
+        h->audio_offset = (uint8_t *)aux( )->audio - (uint8_t *)data_ptr;
+    }
+
+    /* Mark the frame as completely written. */
+    void end_write( ) {
+        hdr( )->checksum = payload_checksum( );
+        hdr( )->magic = HEADER_MAGIC;
+    }
+
+    /*
+     * Position-dependent sum over the main JPEG, thumbnail and audio, 
+     * in that order (so compact( ) does not change it). Cheap enough to
+     * run on every write; it is there to catch a frame whose header
+     * reached the disk but whose data did not, not to catch tampering.
+     */
+    uint32_t payload_checksum( ) {
+        uint64_t a = 1, b = 0;
+
+        checksum_bytes(main_jpeg( ), main_jpeg_size( ), a, b);
+        checksum_bytes(thumb_jpeg( ), thumb_jpeg_size( ), a, b);
+        checksum_bytes(audio( ), audio_size( ), a, b);
+
+        return (uint32_t) (a ^ (a >> 32) ^ b ^ (b >> 32));
+    }
+
+    static void checksum_bytes(const void *data, size_t size, 
+            uint64_t &a, uint64_t &b) {
+        const uint8_t *p = (const uint8_t *) data;
+        uint64_t word;
+
+        for (; size >= sizeof(word); size -= sizeof(word)) {
+            memcpy(&word, p, sizeof(word));
+            a += word;
+            b += a;
+            p += sizeof(word);
+        }
+
+        for (; size > 0; size--) {
+            a += *p++;
+            b += a;
+        }
+    }
+
+    /*
+     * Move the thumbnail and audio down behind the main JPEG so the frame
+     * takes up only as many bytes (rounded up to align) as it needs.
+     * Returns the new frame size.
+     */
+    size_t compact(size_t align) {
+        header *h = hdr( );
+        uint8_t *base = (uint8_t *)data_ptr;
+        size_t end = sizeof(header) + h->main_jpeg_length;
+
+        if (h->main_jpeg_length > main_jpeg_capacity( )
+                || h->thumb_jpeg_length > thumb_jpeg_capacity( )
+                || h->audio_length > audio_capacity( )) {
+            throw std::runtime_error("frame data overran its space");
+        }
+
+        memmove(base + end, base + h->thumb_jpeg_offset, 
+                h->thumb_jpeg_length);
+        h->thumb_jpeg_offset = end;
+        end += h->thumb_jpeg_length;
+
+        memmove(base + end, base + h->audio_offset, h->audio_length);
+        h->audio_offset = end;
+        end += h->audio_length;
+
+        data_size = (end + align - 1) / align * align;
+        return data_size;
+    }
+
     void *data_ptr;
     size_t data_size;
 };
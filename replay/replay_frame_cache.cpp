@@ -0,0 +1,397 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ *
+ * This file is part of openreplay.
+ *
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "replay_frame_cache.h"
+#include "replay_buffer.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <stdexcept>
+
+ReplayFrameCache::ReplayFrameCache(size_t max_size) {
+    _max_size = max_size;
+    _size = 0;
+    _hits = 0;
+    _misses = 0;
+}
+
+ReplayFrameCache::~ReplayFrameCache( ) {
+    while (!lru.empty( )) {
+        remove(lru.back( ));
+    }
+}
+
+ReplayFrameCache *ReplayFrameCache::shared( ) {
+    static ReplayFrameCache cache;
+    return &cache;
+}
+
+RawFrame *ReplayFrameCache::get_frame(ReplayBuffer *source, timecode_t tc,
+        int scale_down, Mjpeg422Decoder &dec, int field) {
+    key k;
+
+    k.source = source;
+    k.tc = tc;
+    k.scale_down = scale_down;
+    k.field = field;
+
+    return fetch(k, dec, NULL);
+}
+
+RawFrame *ReplayFrameCache::get_field_or_frame(ReplayBuffer *source, 
+        timecode_t tc, int scale_down, Mjpeg422Decoder &dec, int field) {
+    ReplayFrameData rfd;
+    RawFrame *frame;
+    key k;
+
+    k.source = source;
+    k.tc = tc;
+    k.scale_down = scale_down;
+
+    /* whichever is already decoded will do */
+    { MutexLock l(m);
+        k.field = field;
+        if ((frame = find(k)) != NULL) {
+            return frame;
+        }
+
+        k.field = FRAME;
+        if ((frame = find(k)) != NULL) {
+            return frame;
+        }
+    }
+
+    /* decoding one is going to read the frame anyway */
+    source->get_readable_frame(tc, rfd);
+    if (rfd.has_fields( )) {
+        k.field = field;
+    }
+
+    return fetch(k, dec, &rfd);
+}
+
+/* 
+ * Take a reference to the decoded frame for k, if there is one. Caller 
+ * must hold the lock.
+ */
+RawFrame *ReplayFrameCache::find(const key &k) {
+    entry_map::iterator i;
+    entry *e;
+
+    i = entries.find(k);
+    if (i == entries.end( ) || i->second->frame == NULL) {
+        return NULL;
+    }
+
+    e = i->second;
+    e->refs++;
+    lru.splice(lru.begin( ), lru, e->lru_pos);
+    _hits++;
+    return e->frame;
+}
+
+/* 
+ * Look up k, decoding it on a miss. If read is not NULL, it is the 
+ * frame at k.tc already read from k.source; it is finished either way.
+ */
+RawFrame *ReplayFrameCache::fetch(const key &k, Mjpeg422Decoder &dec,
+        ReplayFrameData *read) {
+    ReplayFrameData rfd;
+    entry_map::iterator i;
+    RawFrame *frame;
+    entry *e;
+
+    { MutexLock l(m);
+        for (;;) {
+            i = entries.find(k);
+            if (i == entries.end( )) {
+                e = insert(k);
+                _misses++;
+                break;
+            } else if (i->second->frame != NULL) {
+                e = i->second;
+                e->refs++;
+                lru.splice(lru.begin( ), lru, e->lru_pos);
+                _hits++;
+                frame = e->frame;
+                e = NULL;
+                break;
+            }
+
+            /* someone else is decoding it, wait for them */
+            decoded.wait(m);
+        }
+    }
+
+    if (e == NULL) {
+        /* a hit after all */
+        if (read != NULL) {
+            try {
+                k.source->finish_frame_read(*read);
+            } catch (...) {
+                release_frame(frame);
+                throw;
+            }
+        }
+        return frame;
+    }
+
+    /* decode without holding the lock */
+    try {
+        if (read == NULL) {
+            k.source->get_readable_frame(k.tc, rfd);
+            read = &rfd;
+        }
+
+        try {
+            frame = decode(*read, k.scale_down, dec, k.field);
+        } catch (...) {
+            /* a torn frame may fail to decode; report that instead */
+            k.source->finish_frame_read(*read);
+            throw;
+        }
+
+        try {
+            k.source->finish_frame_read(*read);
+        } catch (...) {
+            delete frame;
+            throw;
+        }
+    } catch (...) {
+        MutexLock l(m);
+        remove(e);
+        decoded.broadcast( );
+        throw;
+    }
+
+    { MutexLock l(m);
+        e->frame = frame;
+        frames[frame] = e;
+
+        if (e->cached) {
+            _size += frame->size( );
+            evict( );
+        }
+
+        decoded.broadcast( );
+    }
+
+    return frame;
+}
+
+void ReplayFrameCache::release_frame(RawFrame *frame) {
+    std::map<RawFrame *, entry *>::iterator i;
+    entry *e;
+
+    MutexLock l(m);
+
+    i = frames.find(frame);
+    if (i == frames.end( )) {
+        throw std::runtime_error("release of a frame not in the cache");
+    }
+
+    e = i->second;
+    e->refs--;
+
+    if (e->refs == 0) {
+        if (e->cached) {
+            evict( );
+        } else {
+            remove(e);
+        }
+    }
+}
+
+void ReplayFrameCache::flush(ReplayBuffer *source) {
+    entry_map::iterator i, next;
+    key k;
+
+    k.source = source;
+    k.tc = INT64_MIN;
+    k.scale_down = 0;
+    k.field = FRAME;
+
+    MutexLock l(m);
+
+    i = entries.lower_bound(k);
+    while (i != entries.end( ) && i->first.source == source) {
+        next = i;
+        next++;
+
+        if (i->second->refs == 0) {
+            remove(i->second);
+        } else {
+            /* still held, deleted by the last release_frame( ) */
+            lru.erase(i->second->lru_pos);
+            if (i->second->frame != NULL) {
+                _size -= i->second->frame->size( );
+            }
+            i->second->cached = false;
+            entries.erase(i);
+        }
+
+        i = next;
+    }
+}
+
+size_t ReplayFrameCache::max_size( ) {
+    MutexLock l(m);
+    return _max_size;
+}
+
+void ReplayFrameCache::set_max_size(size_t max_size) {
+    MutexLock l(m);
+    _max_size = max_size;
+    evict( );
+}
+
+size_t ReplayFrameCache::size( ) {
+    MutexLock l(m);
+    return _size;
+}
+
+unsigned long ReplayFrameCache::hits( ) {
+    MutexLock l(m);
+    return _hits;
+}
+
+unsigned long ReplayFrameCache::misses( ) {
+    MutexLock l(m);
+    return _misses;
+}
+
+/* 
+ * Decode a frame or one field of it, whichever way it was stored. 
+ * Splitting or weaving fields copies lines, but only happens when the
+ * storage and the request don't match.
+ */
+RawFrame *ReplayFrameCache::decode(ReplayFrameData &rfd, int scale_down,
+        Mjpeg422Decoder &dec, int field) {
+    RawFrame *whole, *fields[2], *ret;
+    coord_t i;
+
+    /* for abbreviated frames */
+    if (rfd.source->jpeg_tables_size( ) != 0) {
+        dec.set_tables(rfd.source->jpeg_tables( ), 
+                rfd.source->jpeg_tables_size( ));
+    }
+
+    if (!rfd.has_fields( )) {
+        whole = dec.decode(rfd.main_jpeg( ), rfd.main_jpeg_size( ),
+                scale_down);
+
+        if (field == FRAME) {
+            return whole;
+        }
+
+        ret = new RawFrame(whole->w( ), whole->h( ) / 2, 
+                whole->pixel_format( ));
+        for (i = 0; i < ret->h( ); i++) {
+            memcpy(ret->scanline(i), whole->scanline(2 * i + field),
+                    ret->pitch( ));
+        }
+
+        delete whole;
+        return ret;
+    }
+
+    if (field != FRAME) {
+        return dec.decode(rfd.field_jpeg(field), rfd.field_jpeg_size(field),
+                scale_down);
+    }
+
+    fields[0] = dec.decode(rfd.field_jpeg(0), rfd.field_jpeg_size(0),
+            scale_down);
+    try {
+        fields[1] = dec.decode(rfd.field_jpeg(1), rfd.field_jpeg_size(1),
+                scale_down);
+    } catch (...) {
+        delete fields[0];
+        throw;
+    }
+
+    if (fields[0]->w( ) != fields[1]->w( ) 
+            || fields[0]->h( ) != fields[1]->h( )) {
+        delete fields[0];
+        delete fields[1];
+        throw std::runtime_error("fields of a frame differ in size");
+    }
+
+    ret = new RawFrame(fields[0]->w( ), fields[0]->h( ) * 2,
+            fields[0]->pixel_format( ));
+    for (i = 0; i < ret->h( ); i++) {
+        memcpy(ret->scanline(i), fields[i % 2]->scanline(i / 2), 
+                ret->pitch( ));
+    }
+
+    delete fields[0];
+    delete fields[1];
+    return ret;
+}
+
+/* Add an empty entry, held by the caller who is about to decode it. */
+ReplayFrameCache::entry *ReplayFrameCache::insert(const key &k) {
+    entry *e = new entry;
+
+    e->k = k;
+    e->frame = NULL;
+    e->refs = 1;
+    e->cached = true;
+
+    lru.push_front(e);
+    e->lru_pos = lru.begin( );
+    entries[k] = e;
+
+    return e;
+}
+
+/* Delete an entry and its frame. Caller must hold the lock. */
+void ReplayFrameCache::remove(entry *e) {
+    if (e->cached) {
+        lru.erase(e->lru_pos);
+        entries.erase(e->k);
+    }
+
+    if (e->frame != NULL) {
+        if (e->cached) {
+            _size -= e->frame->size( );
+        }
+        frames.erase(e->frame);
+        delete e->frame;
+    }
+
+    delete e;
+}
+
+/*
+ * Drop least recently used frames nobody holds until we fit.
+ * Caller must hold the lock.
+ */
+void ReplayFrameCache::evict( ) {
+    lru_list::iterator i = lru.end( ), victim;
+
+    while (_size > _max_size && i != lru.begin( )) {
+        i--;
+        if ((*i)->refs == 0) {
+            victim = i;
+            i++;
+            remove(*victim);
+        }
+    }
+}
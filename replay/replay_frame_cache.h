@@ -0,0 +1,151 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ *
+ * This file is part of openreplay.
+ *
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _REPLAY_FRAME_CACHE_H
+#define _REPLAY_FRAME_CACHE_H
+
+#include "replay_data.h"
+#include "mjpeg_codec.h"
+#include "mutex.h"
+#include "condition.h"
+
+#include <map>
+#include <list>
+
+class ReplayBuffer;
+
+/*
+ * Decoded frames, keyed by (buffer, timecode, scale_down, field) and shared
+ * between everything that decodes from the replay buffers. Entries are
+ * reference counted: get_frame( ) returns a frame the caller must not
+ * modify, and must hand back with release_frame( ) when done. Frames
+ * nobody holds are evicted least recently used first once the cache
+ * grows past max_size( ) bytes.
+ *
+ * A decoded frame never goes stale: if the buffer overwrites the
+ * timecode, the entry is simply never asked for again and ages out.
+ */
+class ReplayFrameCache {
+    public:
+        enum { DEFAULT_MAX_SIZE = 256 * 1024 * 1024 };
+
+        /* the field argument: a whole frame, or one field (0 = top) */
+        enum { FRAME = -1, TOP_FIELD = 0, BOTTOM_FIELD = 1 };
+
+        ReplayFrameCache(size_t max_size = DEFAULT_MAX_SIZE);
+        ~ReplayFrameCache( );
+
+        /* the process-wide cache */
+        static ReplayFrameCache *shared( );
+
+        /*
+         * Return the frame at tc decoded with the given scale_down (as
+         * passed to Mjpeg422Decoder::decode), decoding it with dec on a
+         * miss. Throws like ReplayBuffer::get_readable_frame( ) and
+         * finish_frame_read( ), or whatever the decoder throws.
+         *
+         * Asking for a field returns a half-height frame of just its
+         * lines. Frames stored as separate field JPEGs (see
+         * ReplayFrameData::has_fields( )) only decode that field; 
+         * whole frames asked for from them are woven from both. A field
+         * of a frame stored whole costs a full decode that the other 
+         * field does not share; see get_field_or_frame( ).
+         */
+        RawFrame *get_frame(ReplayBuffer *source, timecode_t tc,
+                int scale_down, Mjpeg422Decoder &dec, int field = FRAME);
+
+        /*
+         * For callers that can use either: the field alone if the frame
+         * is stored as fields, otherwise the whole frame, so both of 
+         * its fields share one decode. A whole frame already decoded 
+         * is returned either way. Tell which came back by its height.
+         */
+        RawFrame *get_field_or_frame(ReplayBuffer *source, timecode_t tc,
+                int scale_down, Mjpeg422Decoder &dec, int field);
+        void release_frame(RawFrame *frame);
+
+        /* forget all frames from source, e.g. when it goes away */
+        void flush(ReplayBuffer *source);
+
+        size_t max_size( );
+        void set_max_size(size_t max_size);
+
+        size_t size( );
+        unsigned long hits( );
+        unsigned long misses( );
+
+    protected:
+        struct key {
+            ReplayBuffer *source;
+            timecode_t tc;
+            int scale_down;
+            int field;
+
+            bool operator<(const key &other) const {
+                if (source != other.source) {
+                    return source < other.source;
+                } else if (tc != other.tc) {
+                    return tc < other.tc;
+                } else if (scale_down != other.scale_down) {
+                    return scale_down < other.scale_down;
+                } else {
+                    return field < other.field;
+                }
+            }
+        };
+
+        struct entry;
+        typedef std::map<key, entry *> entry_map;
+        typedef std::list<entry *> lru_list;
+
+        struct entry {
+            key k;
+            /* NULL while being decoded */
+            RawFrame *frame;
+            unsigned int refs;
+            /* false once flushed; deleted on the last release */
+            bool cached;
+            lru_list::iterator lru_pos;
+        };
+
+        static RawFrame *decode(ReplayFrameData &rfd, int scale_down,
+                Mjpeg422Decoder &dec, int field);
+
+        RawFrame *find(const key &k);
+        RawFrame *fetch(const key &k, Mjpeg422Decoder &dec, 
+                ReplayFrameData *read);
+
+        entry *insert(const key &k);
+        void remove(entry *e);
+        void evict( );
+
+        entry_map entries;
+        std::map<RawFrame *, entry *> frames;
+        /* most recently used first */
+        lru_list lru;
+
+        size_t _max_size;
+        size_t _size;
+        unsigned long _hits, _misses;
+
+        Mutex m;
+        Condition decoded;
+};
+
+#endif
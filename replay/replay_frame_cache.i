@@ -1,5 +1,5 @@
 /*
- * Copyright 2011 Andrew H. Armenia.
+ * Copyright 2011 Exavideo LLC.
  * 
  * This file is part of openreplay.
  * 
@@ -17,32 +17,23 @@
  * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
+%{
+    #include "replay_frame_cache.h"
+%}
 
-#include "mjpeg_codec.h"
-#include "raw_frame.h"
-#include "posix_util.h"
-#include "cpu_dispatch.h"
+%rename("max_size=") ReplayFrameCache::set_max_size(size_t);
 
-int main(int argc, char **argv) {
-    if (argc > 1 && strcmp(argv[1], "-n") == 0) {
-        cpu_force_no_simd( );
-    }
+class ReplayFrameCache {
+    public:
+        static ReplayFrameCache *shared( );
 
-    RawFrame frame(1920, 1080, RawFrame::CbYCrY8422);
-    Mjpeg422Encoder enc(1920, 1080);
-    ssize_t ret;
-    
-    ret = frame.read_from_fd(STDIN_FILENO);
+        size_t max_size( );
+        void set_max_size(size_t);
 
-    if (ret <= 0) {
-        perror("read_from_fd");
-        exit(1);
-    }
+        size_t size( );
+        unsigned long hits( );
+        unsigned long misses( );
 
-    for (int j = 0; j < 1000; j++) {
-        enc.encode(&frame);
-    }
-}
+    private:
+        ReplayFrameCache( );
+};
@@ -19,9 +19,81 @@
 
 #include "replay_frame_extractor.h"
 #include "replay_buffer.h"
+#include "replay_frame_cache.h"
+#include "audio_packet.h"
+#include "libjpeg_glue.h"
+
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+/* lays decoded frames out in a grid as they come in */
+class ContactSheetSink : public ReplayBatchDecoder::Sink {
+    public:
+        ContactSheetSink(unsigned int columns_, unsigned int rows_) {
+            columns = columns_;
+            rows = rows_;
+            sheet = NULL;
+        }
+
+        ~ContactSheetSink( ) {
+            delete sheet;
+        }
+
+        void frame_decoded(unsigned int n, RawFrame *frame) {
+            coord_t y, lines, bytes;
+            uint8_t *dst;
+
+            try {
+                if (sheet == NULL) {
+                    make_sheet(frame->w( ), frame->h( ));
+                }
+
+                lines = std::min(frame->h( ), tile_h);
+                bytes = 2 * std::min(frame->w( ), tile_w);
+                for (y = 0; y < lines; y++) {
+                    dst = sheet->scanline((n / columns) * tile_h + y)
+                            + 2 * (n % columns) * tile_w;
+                    memcpy(dst, frame->scanline(y), bytes);
+                }
+            } catch (...) {
+                ReplayFrameCache::shared( )->release_frame(frame);
+                throw;
+            }
+
+            ReplayFrameCache::shared( )->release_frame(frame);
+        }
+
+        RawFrame *sheet;
+
+    protected:
+        /* all the tiles are the size of the first frame to come in */
+        void make_sheet(coord_t w, coord_t h) {
+            coord_t sheet_w;
+            uint8_t *p;
+
+            tile_w = w & ~1;
+            tile_h = h;
+            /* the encoder wants whole 16-pixel blocks across */
+            sheet_w = (tile_w * columns + 15) & ~15;
+
+            sheet = new RawFrame(sheet_w, tile_h * rows, 
+                    RawFrame::CbYCrY8422);
+
+            /* black */
+            for (p = sheet->data( ); p < sheet->data( ) + sheet->size( ); 
+                    p += 2) {
+                p[0] = 0x80;
+                p[1] = 0x10;
+            }
+        }
 
-ReplayFrameExtractor::ReplayFrameExtractor( ) 
-        : dec(1920, 1080), enc(1920, 1080) {
+        unsigned int columns, rows;
+        coord_t tile_w, tile_h;
+};
+
+ReplayFrameExtractor::ReplayFrameExtractor(unsigned int batch_threads) 
+        : dec(1920, 1080), enc(1920, 1080), batch(batch_threads) {
 
 }
 
@@ -33,49 +105,72 @@ void ReplayFrameExtractor::extract_raw_jpeg(const ReplayShot &shot,
         timecode_t offset, std::string &jpeg) {
     ReplayFrameData rfd;
 
+    lock.set_position(shot.source, shot.start + offset);
     shot.source->get_readable_frame(shot.start + offset, rfd);
-    uint8_t *data = (uint8_t *) rfd.main_jpeg( );
-    size_t size = rfd.main_jpeg_size( );
-    for (size_t i = 0; i < size - 1; i++) {
-        if (data[i] == 0xff && data[i + 1] == 0xd9) {
-            jpeg.assign((char *)data, i + 2);
-            return;
+    
+    if (!rfd.complete( ) || rfd.main_jpeg_size( ) == 0) {
+        shot.source->finish_frame_read(rfd);
+        throw std::runtime_error("no valid JPEG frame found");
+    }
+
+    if (rfd.has_fields( )) {
+        /* stored as two field JPEGs; weave and re-encode a frame */
+        shot.source->finish_frame_read(rfd);
+        extract_scaled_jpeg(shot, offset, jpeg, 1);
+        return;
+    }
+
+    try {
+        if (jpeg_has_tables((uint8_t *) rfd.main_jpeg( ), 
+                rfd.main_jpeg_size( ))) {
+            jpeg.assign((char *) rfd.main_jpeg( ), rfd.main_jpeg_size( ));
+        } else {
+            /* abbreviated; put the buffer's tables back in */
+            jpeg_add_tables(shot.source->jpeg_tables( ), 
+                    shot.source->jpeg_tables_size( ),
+                    (uint8_t *) rfd.main_jpeg( ), rfd.main_jpeg_size( ),
+                    jpeg);
         }
+    } catch (...) {
+        shot.source->finish_frame_read(rfd);
+        throw;
     }
-    shot.source->finish_frame_read(rfd);
 
-    throw std::runtime_error("no valid JPEG frame found");
+    shot.source->finish_frame_read(rfd);
 }
 
 void ReplayFrameExtractor::extract_thumbnail_jpeg(const ReplayShot &shot,
         timecode_t offset, std::string &jpeg) {
     ReplayFrameData rfd;
     shot.source->get_readable_frame(shot.start + offset, rfd);
-    uint8_t *data = (uint8_t *) rfd.thumb_jpeg( );
-    size_t size = rfd.thumb_jpeg_size( );
-    for (size_t i = 0; i < size - 1; i++) {
-        if (data[i] == 0xff && data[i + 1] == 0xd9) {
-            jpeg.assign((char *) data, i + 2);
-            return;
-        }
+
+    if (!rfd.complete( ) || rfd.thumb_jpeg_size( ) == 0) {
+        shot.source->finish_frame_read(rfd);
+        throw std::runtime_error("no valid thumbnail JPEG found");
     }
+
+    jpeg.assign((char *) rfd.thumb_jpeg( ), rfd.thumb_jpeg_size( ));
     shot.source->finish_frame_read(rfd);
 }
 
 void ReplayFrameExtractor::extract_scaled_jpeg(const ReplayShot &shot,
         timecode_t offset, std::string &jpeg, int scale_down) {
     
-    ReplayFrameData rfd;
-    shot.source->get_readable_frame(shot.start + offset, rfd);
+    ReplayFrameCache *cache = ReplayFrameCache::shared( );
+    RawFrame *rf;
 
-    RawFrame *rf = dec.decode(rfd.main_jpeg( ), 
-            rfd.main_jpeg_size( ), scale_down);
-    enc.encode(rf);
-    delete rf;
+    lock.set_position(shot.source, shot.start + offset);
+    rf = cache->get_frame(shot.source, shot.start + offset, scale_down, dec);
 
-    jpeg.assign((char *)enc.get_data( ), enc.get_data_size( ));
+    try {
+        enc.encode(rf);
+    } catch (...) {
+        cache->release_frame(rf);
+        throw;
+    }
+    cache->release_frame(rf);
 
-    shot.source->finish_frame_read(rfd);
+    jpeg.assign((char *)enc.get_data( ), enc.get_data_size( ));
 }
 
 void ReplayFrameExtractor::extract_raw_audio(const ReplayShot &shot,
@@ -83,10 +178,52 @@ void ReplayFrameExtractor::extract_raw_audio(const ReplayShot &shot,
     ReplayFrameData rfd;
     shot.source->get_readable_frame(shot.start + offset, rfd);
 
-    if (rfd.has_audio( )) {
-        AudioPacket apkt(rfd.audio( ), rfd.audio_size( ));
-        data.assign(apkt.data( ), apkt.size( ));
+    try {
+        if (rfd.has_audio( )) {
+            AudioPacket apkt(rfd.audio( ), rfd.audio_size( ));
+            data.assign((char *) apkt.data( ), apkt.size( ));
+        }
+    } catch (...) {
+        shot.source->finish_frame_read(rfd);
+        throw;
     }
 
     shot.source->finish_frame_read(rfd);
 }
+
+void ReplayFrameExtractor::extract_contact_sheet(const ReplayShot &shot,
+        unsigned int columns, unsigned int rows, std::string &jpeg) {
+    std::vector<ReplayBatchDecoder::request> requests;
+    ReplayBatchDecoder::request r;
+    ContactSheetSink sink(columns, rows);
+    unsigned int i, n = columns * rows;
+
+    if (columns < 1 || columns > 8 || rows < 1 || rows > 8) {
+        throw std::runtime_error("contact sheet must be 1x1 to 8x8");
+    }
+
+    /* scale down far enough that the grid fits in one frame */
+    r.source = shot.source;
+    r.scale_down = 1;
+    while (r.scale_down < (int) columns || r.scale_down < (int) rows) {
+        r.scale_down *= 2;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (shot.length >= (timecode_t) n) {
+            r.tc = shot.start + i * shot.length / n;
+        } else {
+            r.tc = shot.start + i;
+        }
+        requests.push_back(r);
+    }
+
+    batch.decode(requests, &sink);
+
+    if (sink.sheet == NULL) {
+        throw std::runtime_error("no frames for contact sheet");
+    }
+
+    enc.encode(sink.sheet);
+    jpeg.assign((char *)enc.get_data( ), enc.get_data_size( ));
+}
@@ -21,13 +21,15 @@
 #define _REPLAY_FRAME_EXTRACTOR_H
 
 #include "replay_data.h"
+#include "replay_buffer.h"
+#include "replay_batch_decoder.h"
 #include "mjpeg_codec.h"
 #include <string>
 
 /* I am NOT thread safe at all! Be careful! */
 class ReplayFrameExtractor {
     public:
-        ReplayFrameExtractor( );
+        ReplayFrameExtractor(unsigned int batch_threads = 4);
         ~ReplayFrameExtractor( );
 
         void extract_scaled_jpeg(const ReplayShot &shot, timecode_t offset, 
@@ -41,9 +43,23 @@ class ReplayFrameExtractor {
 
         void extract_raw_audio(const ReplayShot &shot, timecode_t offset,
                 std::string &data);
+
+        /*
+         * A grid of columns x rows (up to 8 x 8) frames spread evenly
+         * over the shot, or consecutive frames if the shot is shorter,
+         * as one JPEG no bigger than a source frame. The frames are 
+         * decoded in one parallel pass; any that can't be read are left
+         * black. One row makes a filmstrip for scrubbing.
+         */
+        void extract_contact_sheet(const ReplayShot &shot, 
+                unsigned int columns, unsigned int rows, std::string &jpeg);
     protected:
         Mjpeg422Decoder dec;
         Mjpeg422Encoder enc;
+        ReplayBatchDecoder batch;
+
+        /* keeps the frames around the last one scrubbed to in memory */
+        ReplayBufferLocker lock;
 };
 
 #endif
@@ -36,4 +36,6 @@ class ReplayFrameExtractor {
                 std::string &OUTPUT);
         void extract_raw_audio(const ReplayShot &, timecode_t, 
                 std::string &OUTPUT);
+        void extract_contact_sheet(const ReplayShot &, unsigned int,
+                unsigned int, std::string &OUTPUT);
 };
@@ -22,11 +22,17 @@
 #include <assert.h>
 
 ReplayIngest::ReplayIngest(InputAdapter *iadp_, ReplayBuffer *buf_,
-        ReplayGameData *gds) {
+        ReplayGameData *gds, unsigned int encode_threads_, 
+        bool encode_fields_, size_t target_frame_size_, 
+        bool share_tables_) {
     iadp = iadp_;
     buf = buf_;
     gd = gds;
     encode_suspended = false;
+    encode_threads = encode_threads_;
+    encode_fields = encode_fields_;
+    target_frame_size = target_frame_size_;
+    share_tables = share_tables_;
     start_thread( );
 }
 
@@ -45,8 +51,27 @@ void ReplayIngest::run_thread( ) {
     ReplayRawFrame *monitor_frame;
     ReplayFrameData dest;
     std::string com;
-    Mjpeg422Encoder enc(1920, 1080, 70); /* FIXME: hard coded frame size */
-    Mjpeg422Encoder thumb_enc(480, 272, 30);
+    /* FIXME: hard coded frame size */
+    Mjpeg422Encoder enc(1920, 1080, 70, 524288, encode_threads);
+
+    /* the thumbnail is sampled as the main encode unpacks the frame */
+    enc.enable_thumbnail(4, 30);
+
+    if (target_frame_size != 0) {
+        enc.set_rate_control(target_frame_size);
+    }
+
+    if (share_tables) {
+        uint8_t tables[ReplayBuffer::JPEG_TABLES_MAX];
+        size_t size = enc.write_tables_to(tables, sizeof(tables));
+
+        if (buf->set_jpeg_tables(tables, size)) {
+            enc.set_abbreviated(true);
+        } else {
+            fprintf(stderr, "%s: buffer has frames with other JPEG tables, "
+                    "not sharing tables\n", buf->get_name( ));
+        }
+    }
 
     iadp->start( );
 
@@ -80,18 +105,29 @@ void ReplayIngest::run_thread( ) {
             }
 
             /* encode to M-JPEG */
-            enc.encode_to(input, dest.main_jpeg( ), dest.main_jpeg_size( ));
+            if (encode_fields) {
+                enc.encode_fields_to(input, dest.main_jpeg( ),
+                        dest.main_jpeg_capacity( ));
+                dest.set_field_jpeg_lengths(enc.get_field_data_size(0),
+                        enc.get_field_data_size(1));
+            } else {
+                enc.encode_to(input, dest.main_jpeg( ), 
+                        dest.main_jpeg_capacity( ));
+                dest.set_main_jpeg_length(enc.get_data_size( ));
+            }
 
-            /* scale input and make JPEG thumbnail */
-            thumb = input->convert->CbYCrY8422_scaled(480, 270);
-            thumb_enc.encode_to(thumb, dest.thumb_jpeg( ), dest.thumb_jpeg_size( ));
+            /* make JPEG thumbnail */
+            enc.encode_thumbnail_to(dest.thumb_jpeg( ), 
+                    dest.thumb_jpeg_capacity( ));
+            dest.set_thumb_jpeg_length(enc.get_thumbnail_size( ));
+            thumb = enc.get_thumbnail( );
 
             /* store audio (if we have it) */
             if (input_audio) {
-                input_audio->serialize(dest.audio( ), dest.audio_size( ));
-                dest.enable_audio( );
+                input_audio->serialize(dest.audio( ), 
+                        dest.audio_capacity( ));
+                dest.enable_audio(input_audio->serialized_size( ));
             } else {
-                memset(dest.audio( ), 0, dest.audio_size( ));
                 dest.no_audio( );
             }
 
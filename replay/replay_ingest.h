@@ -30,8 +30,22 @@
 
 class ReplayIngest : public Thread {
     public:
+        /* 
+         * encode_threads > 1 compresses each frame in slices on that 
+         * many threads, cutting per-frame encode latency.
+         * encode_fields stores each field as its own JPEG, so playout
+         * can decode just the field it needs.
+         * target_frame_size != 0 varies the JPEG quality to keep frames
+         * near that many bytes.
+         * share_tables stores the JPEG tables once in the buffer rather
+         * than in every frame (not together with target_frame_size).
+         */
         ReplayIngest(InputAdapter *iadp_, ReplayBuffer *buf_, 
-                ReplayGameData *gds = NULL);
+                ReplayGameData *gds = NULL, 
+                unsigned int encode_threads = 1,
+                bool encode_fields = false,
+                size_t target_frame_size = 0,
+                bool share_tables = false);
         ~ReplayIngest( );
 
         AsyncPort<ReplayRawFrame> monitor;
@@ -56,6 +70,11 @@ class ReplayIngest : public Thread {
 
         Mutex m;
         bool encode_suspended;
+
+        unsigned int encode_threads;
+        bool encode_fields;
+        size_t target_frame_size;
+        bool share_tables;
 };
 
 #endif
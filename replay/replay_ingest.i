@@ -26,7 +26,9 @@
 class ReplayIngest : public Thread {
     public:
         ReplayIngest(InputAdapter *INPUT, ReplayBuffer *INPUT,
-            ReplayGameData *INPUT = NULL);
+            ReplayGameData *INPUT = NULL, unsigned int encode_threads = 1,
+            bool encode_fields = false, size_t target_frame_size = 0,
+            bool share_tables = false);
         ~ReplayIngest( );
         AsyncPort<ReplayRawFrame> *get_monitor( );
 
@@ -103,7 +103,9 @@ void ReplayMjpegIngest::run_thread( ) {
         
         /* encode thumbnail */
         thm_enc.encode_to(decoded_monitor, dest.thumb_jpeg( ),
-                dest.thumb_jpeg_size( ));
+                dest.thumb_jpeg_capacity( ));
+        dest.set_thumb_jpeg_length(thm_enc.get_data_size( ));
+        dest.no_audio( );
 
         buf->finish_frame_write(dest);
 
@@ -148,10 +150,12 @@ int ReplayMjpegIngest::read_mjpeg_data(ReplayFrameData &dest) {
                 
                 success_flag = false;
 
-                if (jpgstart != (size_t) -1) {
+                if (jpgstart != (size_t) -1 
+                        && jpgend - jpgstart <= dest.main_jpeg_capacity( )) {
                     /* copy JPEG data to frame buffer */
                     memcpy(dest.main_jpeg( ), jpegbuf+jpgstart, 
                             jpgend-jpgstart);
+                    dest.set_main_jpeg_length(jpgend-jpgstart);
                     success_flag = true;
                 }
 
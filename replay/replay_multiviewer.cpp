@@ -123,7 +123,8 @@ void ReplayMultiviewer::render_vector(ReplayRawFrame *f) {
         vector->scanline(255 - cb)[4*cr+2] = 0xff;
     }
 
-    f->bgra_data->draw->alpha_key(112, 7, vector, 255);
+    /* Cairo drew the graticule premultiplied; the dots just add white */
+    f->bgra_data->draw->alpha_key_premultiplied(112, 7, vector, 255);
     delete vector;
 }
 
@@ -153,7 +154,7 @@ void ReplayMultiviewer::render_waveform(ReplayRawFrame *f) {
         }
     }
 
-    f->bgra_data->draw->alpha_key(112, 72, wfm, 255);
+    f->bgra_data->draw->alpha_key_premultiplied(112, 72, wfm, 255);
     delete wfm;
 }
 
@@ -18,6 +18,7 @@
  */
 
 #include "replay_playout.h"
+#include "replay_frame_cache.h"
 #include "raw_frame.h"
 #include "rsvg_frame.h"
 #include "mjpeg_codec.h"
@@ -28,16 +29,23 @@
 #include <fcntl.h>
 
 /* FIXME hardcoded 1920x1080 decoding */
-ReplayPlayout::ReplayPlayout(OutputAdapter *oadp_) : 
-        current_pos(0), field_rate(0), dec(1920, 1080) {
+ReplayPlayout::ReplayPlayout(OutputAdapter *oadp_, 
+        unsigned int decode_threads) : current_pos(0), field_rate(0), 
+        dec(1920, 1080, decode_threads) {
     oadp = oadp_;
     current_source = NULL;
+    next_shot_source = NULL;
     next_avspipe = NULL;
     running = false;
 
     render_clock = false;
     clock_x = 0;
     clock_y = 0;
+    clock_key = NULL;
+    clock_key_xoffset = 0;
+    clock_key_yoffset = 0;
+
+    sd_source = NULL;
 
     start_thread( );
     //priority(SCHED_FIFO, 20);
@@ -49,7 +57,7 @@ ReplayPlayout::~ReplayPlayout( ) {
 
 void ReplayPlayout::roll_shot(const ReplayShot &shot) {
     MutexLock l(m);
-    current_source = shot.source;
+    change_source(shot.source);
     
     /* this translates to 3/4 of realtime playback */
     field_rate = Rational(3, 8);
@@ -64,7 +72,7 @@ void ReplayPlayout::roll_next_shot( ) {
     /* no mutex lock, so only call this when mutex is already locked */
     if (!next_shots.empty( )) {
         const ReplayShot &shot = next_shots.front( );
-        current_source = shot.source;
+        change_source(shot.source);
         current_pos = Rational((int) shot.start);
         shot_end = shot.start + shot.length;
         next_shots.pop_front( );
@@ -73,6 +81,47 @@ void ReplayPlayout::roll_next_shot( ) {
     }
 }
 
+/* 
+ * Move the playout cursor to a new buffer and drop the next shot's
+ * prefetch cursor. Call with the mutex locked.
+ */
+void ReplayPlayout::change_source(ReplayBuffer *source) {
+    if (current_source != NULL && current_source != source) {
+        current_source->remove_cursor(this);
+    }
+
+    if (next_shot_source != NULL) {
+        next_shot_source->remove_cursor(&next_shots);
+        next_shot_source = NULL;
+    }
+
+    current_source = source;
+}
+
+/*
+ * Tell the buffers where playout is headed: the current position at the
+ * current speed, and the start of the next queued shot so the cut to it
+ * does not stall. Call with the mutex locked.
+ */
+void ReplayPlayout::update_prefetch( ) {
+    float velocity = (field_rate * Rational(2)).to_float( );
+
+    current_source->update_cursor(this, current_pos.integer_part( ), 
+            velocity);
+    lock.set_position(current_source, current_pos.integer_part( ), velocity);
+
+    if (!next_shots.empty( )) {
+        const ReplayShot &next = next_shots.front( );
+
+        if (next_shot_source != NULL && next_shot_source != next.source) {
+            next_shot_source->remove_cursor(&next_shots);
+        }
+
+        next_shot_source = next.source;
+        next_shot_source->update_cursor(&next_shots, next.start, velocity);
+    }
+}
+
 void ReplayPlayout::queue_shot(const ReplayShot &shot) {
     MutexLock l(m);
     next_shots.push_back(shot);
@@ -96,10 +145,14 @@ unsigned int ReplayPlayout::add_svg_dsk(const std::string &svg,
     MutexLock l(dskm);
 
     struct dsk the_dsk;
+    RawFrame *key;
 
     the_dsk.x = xoffset;
     the_dsk.y = yoffset;
-    the_dsk.key = RsvgFrame::render_svg(svg.c_str( ), svg.size( ));
+
+    key = RsvgFrame::render_svg(svg.c_str( ), svg.size( ));
+    the_dsk.key = new PreparedKey(key);
+    delete key;
 
     dsks.push_back(the_dsk);
     return dsks.size( ) - 1;
@@ -109,10 +162,14 @@ unsigned int ReplayPlayout::add_png_file_dsk(const std::string &pngpath,
         coord_t xoffset, coord_t yoffset) {
     MutexLock l(dskm);
     struct dsk the_dsk;
+    RawFrame *key;
 
     the_dsk.x = xoffset;
     the_dsk.y = yoffset;
-    the_dsk.key = RawFrame::from_png_file(pngpath.c_str());
+
+    key = RawFrame::from_png_file(pngpath.c_str());
+    the_dsk.key = new PreparedKey(key);
+    delete key;
 
     dsks.push_back(the_dsk);
     return dsks.size( ) - 1;
@@ -150,6 +207,7 @@ void ReplayPlayout::run_thread( ) {
     AvspipeInputAdapter *current_avspipe = NULL;
 
     timecode_t avs_tc = 0;
+    bool playing;
 
     barsfd = open("../files/1080p_bars.uyvy", O_RDONLY);
 
@@ -173,7 +231,7 @@ void ReplayPlayout::run_thread( ) {
 
 
         if (current_avspipe == NULL) {
-            get_and_advance_current_fields(rfd1, rfd2, pos);
+            playing = get_and_advance_current_fields(rfd1, rfd2, pos);
             out = new RawFrame(1920, 1080, RawFrame::CbYCrY8422);
     
             try {
@@ -193,7 +251,7 @@ void ReplayPlayout::run_thread( ) {
 
             /* fill in timecode and other goodies for monitor */
             monitor_frame->source_name = "Program";
-            if (rfd1.valid( )) {
+            if (playing) {
                 monitor_frame->source_name2 = rfd1.source->get_name( );
                 monitor_frame->tc = pos.integer_part( );
                 monitor_frame->fractional_tc = pos.fractional_part( );
@@ -271,7 +329,11 @@ void ReplayPlayout::add_clock(RawFrame *target) {
         _render = render_clock;
     }
 
-    if (_render && clock.length( ) > 0) {
+    if (!_render || clock.length( ) == 0) {
+        return;
+    }
+
+    if (clock_key == NULL || clock != clock_text) {
         /* Render font with Cairo - freetype is brain dead?? */
         /* FIXME: kind of arbitrary numbers */
         crf = new CairoFrame(400, 400); 
@@ -293,12 +355,17 @@ void ReplayPlayout::add_clock(RawFrame *target) {
 
         cairo_destroy(cr);
 
-        /* center text about provided point */
-        target->draw->alpha_key(_x - (coord_t)(extents.width / 2), 
-                _y - (coord_t)(extents.height / 2), crf, 255);
+        delete clock_key;
+        clock_key = new PreparedKey(crf);
         delete crf;
+
+        clock_text = clock;
+        clock_key_xoffset = (coord_t)(extents.width / 2);
+        clock_key_yoffset = (coord_t)(extents.height / 2);
     }
 
+    /* center text about provided point */
+    clock_key->apply(target, _x - clock_key_xoffset, _y - clock_key_yoffset);
 }
 
 void ReplayPlayout::apply_dsks(RawFrame *target) {
@@ -306,7 +373,7 @@ void ReplayPlayout::apply_dsks(RawFrame *target) {
     MutexLock l(dskm);
 
     for (i = 0; i < dsks.size( ); i++) {
-        target->draw->alpha_key(dsks[i].x, dsks[i].y, dsks[i].key, 255);
+        dsks[i].key->apply(target, dsks[i].x, dsks[i].y);
     }
 }
 
@@ -314,7 +381,7 @@ void ReplayPlayout::apply_dsks(RawFrame *target) {
  * Note, this only fills in timecode and source data for f1 and f2,
  * it does not call get_readable_frame().
  */
-void ReplayPlayout::get_and_advance_current_fields(ReplayFrameData &f1,
+bool ReplayPlayout::get_and_advance_current_fields(ReplayFrameData &f1,
         ReplayFrameData &f2, Rational &pos) {
     MutexLock l(m);
     timecode_t tc;
@@ -353,10 +420,14 @@ void ReplayPlayout::get_and_advance_current_fields(ReplayFrameData &f1,
                 && shot_end > 0) {
             roll_next_shot( );
         }
+
+        update_prefetch( );
+        return true;
     } else {
         f1.clear( );
         f2.clear( );
         tc = 0;
+        return false;
     }
 }
 
@@ -376,43 +447,79 @@ void ReplayPlayout::decode_field(RawFrame *out, ReplayFrameData &field,
         ReplayFrameData &cache_data, RawFrame *&cache_frame,
         bool is_first_field) {
 
-    coord_t srcline, dstline;
-    RawFrame *tmp;
+    coord_t srcline, dstline, srcstep;
+    RawFrame *src, *scaled = NULL;
+    ReplayFrameCache *cache = ReplayFrameCache::shared( );
     std::string com;
 
     if (field.source == NULL) {
         throw ReplayFrameNotFoundException();
     }
 
-    /* check if we have moved to a different frame; if so, decode it. */
-    if (field.pos != cache_data.pos || field.source != cache_data.source) {
-        delete cache_frame;
-        field.source->get_readable_frame(field.pos, field, true);
-        cache_frame = dec.decode(field.main_jpeg( ), field.main_jpeg_size( ));
+    /* figure which lines we're taking and where they're going */
+    srcline = field_start_scan(field.use_first_field, 
+            field.source->field_dominance( ));
+    dstline = field_start_scan(is_first_field, oadp->output_dominance( ));
 
-        cache_data.source = field.source;
-        cache_data.pos = field.pos;
+    /* 
+     * check if we have moved to a different field; if so, get it from
+     * the frame cache (cache_frame is held until we move on again).
+     * The cache decodes just our field if the frame is stored as 
+     * fields, and otherwise the whole frame, which both fields share.
+     * SD is scaled up as a whole frame, so it is always fetched whole.
+     */
+    if (field.pos != cache_data.pos || field.source != cache_data.source
+            || field.use_first_field != cache_data.use_first_field) {
+        if (cache_frame != NULL) {
+            cache->release_frame(cache_frame);
+            cache_frame = NULL;
+        }
+        cache_data.source = NULL;
 
-        field.source->finish_frame_read(field);
+        if (field.source == sd_source) {
+            cache_frame = cache->get_frame(field.source, field.pos, 1, dec);
+        } else {
+            cache_frame = cache->get_field_or_frame(field.source, 
+                    field.pos, 1, dec, srcline);
+        }
 
-        /* scale to 1080i if needed */
-        if (cache_frame->w() < 1920) {
-            tmp = cache_frame->convert->CbYCrY8422_1080( );
-            delete cache_frame;
-            cache_frame = tmp;
+        if (cache_frame->w( ) < 1920 && field.source != sd_source) {
+            /* 
+             * don't ask this source for fields again; this frame may
+             * have been a field, so get it whole (a hit if it wasn't)
+             */
+            sd_source = field.source;
+            cache->release_frame(cache_frame);
+            cache_frame = NULL;
+            cache_frame = cache->get_frame(field.source, field.pos, 1, dec);
         }
+
+        cache_data.source = field.source;
+        cache_data.pos = field.pos;
+        cache_data.use_first_field = field.use_first_field;
     }
 
-    /* figure which lines we're taking and where they're going */
-    srcline = field_start_scan(field.use_first_field, 
-            field.source->field_dominance( ));
-    dstline = field_start_scan(is_first_field, oadp->output_dominance( ));
+    src = cache_frame;
+    if (src->w( ) < 1920) {
+        /* scale to 1080i (the cached frame is shared, so copy) */
+        scaled = src->convert->CbYCrY8422_1080( );
+        src = scaled;
+        srcstep = 2;
+    } else if (src->h( ) < out->h( )) {
+        /* the cached frame is just the field */
+        srcline = 0;
+        srcstep = 1;
+    } else {
+        srcstep = 2;
+    }
 
     /* copy the scanlines to the destination frame */
-    while (srcline < cache_frame->h( ) && dstline < out->h( )) {
-        memcpy(out->scanline(dstline), cache_frame->scanline(srcline),
-                cache_frame->pitch( ));
+    while (srcline < src->h( ) && dstline < out->h( )) {
+        memcpy(out->scanline(dstline), src->scanline(srcline),
+                src->pitch( ));
         dstline += 2;
-        srcline += 2;
+        srcline += srcstep;
     }
+
+    delete scaled;
 }       
@@ -31,13 +31,18 @@
 #include "mjpeg_codec.h"
 #include "avspipe_allocators.h"
 #include "avspipe_input_adapter.h"
+#include "prepared_key.h"
 
 #include <list>
 #include <vector>
 
 class ReplayPlayout : public Thread {
     public:
-        ReplayPlayout(OutputAdapter *oadp_);
+        /* 
+         * decode_threads > 1 decodes frames encoded in slices (see
+         * Mjpeg422Encoder) in parallel, for fast shuttle playback.
+         */
+        ReplayPlayout(OutputAdapter *oadp_, unsigned int decode_threads = 1);
         ~ReplayPlayout( );
 
         /* Roll a shot and clear the queue of shots to follow. */
@@ -67,7 +72,8 @@ class ReplayPlayout : public Thread {
 
     protected:
         void run_thread( );
-        void get_and_advance_current_fields(ReplayFrameData &f1, 
+        /* returns false if there is no shot rolling */
+        bool get_and_advance_current_fields(ReplayFrameData &f1, 
                 ReplayFrameData &f2, Rational &pos);
 
         void decode_field(RawFrame *out, ReplayFrameData &field, 
@@ -75,6 +81,8 @@ class ReplayPlayout : public Thread {
                 bool is_first_field);
 
         void roll_next_shot( );
+        void change_source(ReplayBuffer *source);
+        void update_prefetch( );
 
         void apply_dsks(RawFrame *target);
         void add_clock(RawFrame *target);
@@ -84,6 +92,8 @@ class ReplayPlayout : public Thread {
         OutputAdapter *oadp;
 
         ReplayBuffer *current_source;
+        /* buffer holding the prefetch cursor for the next queued shot */
+        ReplayBuffer *next_shot_source;
         AvspipeInputAdapter *next_avspipe;
 
         ReplayBufferLocker lock;
@@ -93,7 +103,7 @@ class ReplayPlayout : public Thread {
         timecode_t shot_end;
 
         struct dsk {
-            RawFrame *key;
+            PreparedKey *key;
             coord_t x;
             coord_t y;
         };
@@ -106,11 +116,22 @@ class ReplayPlayout : public Thread {
         Mutex clockm;
 
         Mjpeg422Decoder dec;
+        /* last source found to be SD; decode_field gets whole frames */
+        ReplayBuffer *sd_source;
 
         bool render_clock;
         coord_t clock_x;
         coord_t clock_y;
 
+        /* 
+         * the clock as last rendered; only touched by the playout thread,
+         * and only rendered again when the text changes
+         */
+        std::string clock_text;
+        PreparedKey *clock_key;
+        coord_t clock_key_xoffset;
+        coord_t clock_key_yoffset;
+
         ReplayGameData game_data;
 
         AvspipeNTSCSyncAudioAllocator apkt_allocator;
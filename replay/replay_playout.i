@@ -28,7 +28,7 @@
 
 class ReplayPlayout : public Thread {
     public:
-        ReplayPlayout(OutputAdapter *INPUT);
+        ReplayPlayout(OutputAdapter *INPUT, unsigned int decode_threads = 1);
         ~ReplayPlayout( );
 
         unsigned int add_svg_dsk(const std::string &INPUT,
@@ -19,11 +19,13 @@
 
 #include "replay_preview.h"
 #include "replay_buffer.h"
+#include "replay_frame_cache.h"
 #include "mjpeg_codec.h"
 #include <stdio.h>
 
 ReplayPreview::ReplayPreview( ) {
     current_shot.source = NULL;
+    current_pos = 0;
     start_thread( );
 }
 
@@ -33,6 +35,9 @@ ReplayPreview::~ReplayPreview( ) {
 
 void ReplayPreview::change_shot(const ReplayShot &shot) {
     MutexLock l(m);
+    if (current_shot.source != NULL && current_shot.source != shot.source) {
+        current_shot.source->remove_cursor(this);
+    }
     current_shot = shot;
     current_pos = shot.start;
     update_monitor = true;
@@ -71,17 +76,18 @@ void ReplayPreview::run_thread( ) {
     Mjpeg422Decoder dec(1920, 1080);
     ReplayFrameData rfd;
     ReplayRawFrame *monitor_frame;
-    RawFrame *new_frame;
+    RawFrame *new_frame, *cached_frame;
 
     for (;;) {
         try {
             /* wait for some work to do */
             wait_update(rfd);
 
-            /* decode at 960 max width */
-            new_frame = dec.decode(rfd.main_jpeg( ), 
-                    rfd.main_jpeg_size( ), 960);
-            rfd.source->finish_frame_read(rfd);
+            /* decode at 960 max width (the monitor gets its own copy) */
+            cached_frame = ReplayFrameCache::shared( )->get_frame(
+                    rfd.source, rfd.pos, 960, dec);
+            new_frame = cached_frame->copy( );
+            ReplayFrameCache::shared( )->release_frame(cached_frame);
 
             /* send to multiview */
             monitor_frame = new ReplayRawFrame(new_frame);
@@ -122,8 +128,14 @@ void ReplayPreview::wait_update(ReplayFrameData &rfd) {
 
     update_monitor = false;
 
-    /* grab the frame from the buffer */
-    current_shot.source->get_readable_frame(current_pos, rfd);
+    /* the caller fetches the frame itself, through the frame cache */
+    rfd.source = current_shot.source;
+    rfd.pos = current_pos;
 
-    lock.set_position(current_shot.source, current_pos);
+    /* 
+     * jogging goes either way and stops without telling us, so report
+     * zero velocity: the cursor's window then covers both sides
+     */
+    lock.set_position(current_shot.source, current_pos, 0.0f);
+    current_shot.source->update_cursor(this, current_pos, 0.0f);
 }
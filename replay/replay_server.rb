@@ -197,6 +197,9 @@ class ReplayLocalControl < ShuttleProInput
                 file.write shot.frame(frame)
             end
         end
+
+        # optimized Huffman tables, off the live path
+        @app.clip_recoder.recode_file(path)
     end
 
     def tag_current_event(tag)
@@ -381,6 +384,16 @@ class ReplayServer < Patchbay
         render :mjpg => MjpegIterator.new(source, start, length)
     end
 
+    # A grid of frames from a stretch of a source (one row for a filmstrip).
+    get '/sources/:id/:start/:length/:columns/:rows/contact_sheet.jpg' do
+        srcid = params[:id].to_i
+        shot = replay_app.source(srcid).make_shot_at(params[:start].to_i)
+        shot.length = params[:length].to_i
+
+        render :jpg => shot.contact_sheet(params[:columns].to_i, 
+                params[:rows].to_i)
+    end
+
     get '/sources/:id/:start/:length/audio_2ch_48khz.raw' do
         srcid = params[:id].to_i
         source = replay_app.source(srcid)
@@ -0,0 +1,219 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ *
+ * This file is part of openreplay.
+ *
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "replay_striped_buffer.h"
+
+#include <stdio.h>
+#include <string>
+#include <stdexcept>
+
+StripedReplayBuffer::StripedReplayBuffer(const char *paths,
+        size_t buffer_size, size_t frame_size, const char *name,
+        map_mode_t map_mode, layout_t layout, write_mode_t write_mode,
+        unsigned int max_writes_in_flight)
+        : ReplayBuffer(name, map_mode, layout, write_mode) {
+    std::string list(paths), path;
+    size_t start = 0, end;
+    char stripe_name[256];
+    timecode_t next, n;
+    unsigned int i;
+
+    while (start <= list.size( )) {
+        end = list.find(':', start);
+        if (end == std::string::npos) {
+            end = list.size( );
+        }
+
+        path = list.substr(start, end - start);
+        if (!path.empty( )) {
+            snprintf(stripe_name, sizeof(stripe_name), "%s/%u",
+                    name, (unsigned int) stripes.size( ));
+            stripes.push_back(new ReplayBuffer(path.c_str( ), buffer_size,
+                    frame_size, stripe_name, map_mode, layout,
+                    write_mode, max_writes_in_flight));
+        }
+
+        start = end + 1;
+    }
+
+    if (stripes.empty( )) {
+        throw std::runtime_error("striped buffer needs at least one path");
+    }
+
+    /*
+     * Each stripe recovers on its own. If we went down partway through
+     * a round, some stripes are one frame ahead: drop those frames so
+     * the round robin lines up again.
+     */
+    n = stripes.size( );
+    next = current( );
+    for (i = 0; i < stripes.size( ); i++) {
+        stripes[i]->truncate((next - i + n - 1) / n);
+    }
+
+    tc_write = next;
+}
+
+StripedReplayBuffer::~StripedReplayBuffer( ) {
+    for (unsigned int i = 0; i < stripes.size( ); i++) {
+        delete stripes[i];
+    }
+}
+
+/* first timecode that is not yet readable from every stripe */
+timecode_t StripedReplayBuffer::current( ) {
+    timecode_t n = stripes.size( ), tc, ret = 0;
+
+    for (unsigned int i = 0; i < stripes.size( ); i++) {
+        tc = stripes[i]->current_frame( ) * n + i;
+        if (i == 0 || tc < ret) {
+            ret = tc;
+        }
+    }
+
+    return ret;
+}
+
+/* first timecode from which every stripe still has frames */
+timecode_t StripedReplayBuffer::oldest( ) {
+    timecode_t n = stripes.size( ), tc, ret = 0;
+
+    for (unsigned int i = 0; i < stripes.size( ); i++) {
+        /* just past the last frame stripe i no longer has */
+        tc = (stripes[i]->oldest_frame( ) - 1) * n + i + 1;
+        if (i == 0 || tc > ret) {
+            ret = tc;
+        }
+    }
+
+    return ret;
+}
+
+ReplayShot *StripedReplayBuffer::make_shot(timecode_t offset,
+        whence_t whence) {
+    ReplayShot *shot;
+
+    if (whence == START) {
+        /* the first stripe decides where the current lap started */
+        shot = stripes[0]->make_shot(0, START);
+        shot->start = shot->start * (timecode_t) stripes.size( ) + offset;
+    } else {
+        shot = new ReplayShot;
+        if (whence == ZERO) {
+            shot->start = offset;
+        } else {
+            shot->start = current( ) - 1 + offset;
+        }
+    }
+
+    shot->source = this;
+    shot->length = 0;
+
+    return shot;
+}
+
+void StripedReplayBuffer::get_writable_frame(ReplayFrameData &frame_data) {
+    stripe(tc_write)->get_writable_frame(frame_data);
+    frame_data.source = this;
+    frame_data.pos = tc_write + 1;
+}
+
+void StripedReplayBuffer::finish_frame_write(ReplayFrameData &frame_data) {
+    stripe(tc_write)->finish_frame_write(frame_data);
+    tc_write++;
+}
+
+void StripedReplayBuffer::get_readable_frame(timecode_t tc,
+        ReplayFrameData &frame_data) {
+    if (tc < 0 || tc >= current( ) || tc < oldest( )) {
+        throw ReplayFrameNotFoundException( );
+    }
+
+    stripe(tc)->get_readable_frame(local(tc), frame_data);
+    frame_data.source = this;
+    frame_data.pos = tc;
+}
+
+void StripedReplayBuffer::finish_frame_read(ReplayFrameData &frame_data) {
+    timecode_t tc = frame_data.pos;
+
+    /* the stripe checks for overwrites against its own timecode */
+    frame_data.pos = local(tc);
+    try {
+        stripe(tc)->finish_frame_read(frame_data);
+    } catch (...) {
+        frame_data.pos = tc;
+        throw;
+    }
+    frame_data.pos = tc;
+}
+
+void StripedReplayBuffer::update_cursor(const void *cursor, timecode_t tc,
+        float velocity) {
+    float n = stripes.size( );
+
+    if (tc < 0) {
+        tc = 0;
+    }
+
+    for (unsigned int i = 0; i < stripes.size( ); i++) {
+        stripes[i]->update_cursor(cursor, local(tc), velocity / n);
+    }
+}
+
+void StripedReplayBuffer::remove_cursor(const void *cursor) {
+    for (unsigned int i = 0; i < stripes.size( ); i++) {
+        stripes[i]->remove_cursor(cursor);
+    }
+}
+
+/* all the stripes take the tables, or none of them */
+bool StripedReplayBuffer::set_jpeg_tables(const void *tables, size_t size) {
+    unsigned int i;
+
+    for (i = 0; i < stripes.size( ); i++) {
+        if (!stripes[i]->jpeg_tables_compatible(tables, size)) {
+            return false;
+        }
+    }
+
+    for (i = 0; i < stripes.size( ); i++) {
+        stripes[i]->set_jpeg_tables(tables, size);
+    }
+
+    return true;
+}
+
+bool StripedReplayBuffer::lock_frame(timecode_t frame) {
+    if (frame >= 0) {
+        return stripe(frame)->lock_frame(local(frame));
+    } else {
+        return false;
+    }
+}
+
+void StripedReplayBuffer::unlock_frame(timecode_t frame) {
+    if (frame >= 0) {
+        stripe(frame)->unlock_frame(local(frame));
+    }
+}
+
+bool StripedReplayBuffer::pinnable(timecode_t frame) {
+    return frame >= 0 && stripe(frame)->pinnable(local(frame));
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ *
+ * This file is part of openreplay.
+ *
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _REPLAY_STRIPED_BUFFER_H
+#define _REPLAY_STRIPED_BUFFER_H
+
+#include "replay_buffer.h"
+
+#include <vector>
+
+/*
+ * A ReplayBuffer spread round-robin over several files or devices.
+ * Frame tc lives in stripe tc % N at local timecode tc / N. Each stripe
+ * is an ordinary ReplayBuffer with its own superblock, write engine and
+ * prefetch thread, so every disk gets its own I/O queue.
+ *
+ * paths is a colon-separated list; buffer_size applies to each stripe.
+ */
+class StripedReplayBuffer : public ReplayBuffer {
+    public:
+        StripedReplayBuffer(const char *paths, size_t buffer_size,
+                size_t frame_size, const char *name="(unnamed)",
+                map_mode_t map_mode = MAP_PER_FRAME,
+                layout_t layout = LAYOUT_SLOTS,
+                write_mode_t write_mode = WRITE_MMAP,
+                unsigned int max_writes_in_flight = 8);
+        ~StripedReplayBuffer( );
+
+        ReplayShot *make_shot(timecode_t offset, whence_t whence = END);
+
+        void get_writable_frame(ReplayFrameData &frame_data);
+        void finish_frame_write(ReplayFrameData &frame_data);
+
+        void get_readable_frame(timecode_t tc, ReplayFrameData &frame_data);
+        void finish_frame_read(ReplayFrameData &frame_data);
+
+        void update_cursor(const void *cursor, timecode_t tc, float velocity);
+        void remove_cursor(const void *cursor);
+
+        bool set_jpeg_tables(const void *tables, size_t size);
+        const uint8_t *jpeg_tables( ) { return stripes[0]->jpeg_tables( ); }
+        size_t jpeg_tables_size( ) { return stripes[0]->jpeg_tables_size( ); }
+
+        bool lock_frame(timecode_t frame);
+        void unlock_frame(timecode_t frame);
+        bool pinnable(timecode_t frame);
+
+    protected:
+        std::vector<ReplayBuffer *> stripes;
+
+        ReplayBuffer *stripe(timecode_t tc) {
+            return stripes[tc % stripes.size( )];
+        }
+
+        timecode_t local(timecode_t tc) {
+            return tc / (timecode_t) stripes.size( );
+        }
+
+        timecode_t current( );
+        timecode_t oldest( );
+};
+
+#endif
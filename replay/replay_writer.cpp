@@ -0,0 +1,343 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ *
+ * This file is part of openreplay.
+ *
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "replay_writer.h"
+#include "posix_util.h"
+#include "thread.h"
+#include "pipe.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <map>
+
+#ifdef ENABLE_IO_URING
+#include <liburing.h>
+#endif
+
+/* most pwrite( ) threads to start, regardless of max_in_flight */
+#define MAX_PWRITE_THREADS 4
+
+/*
+ * Fallback engine: a small pool of threads each doing blocking pwrite( ).
+ */
+class PwriteReplayWriter : public ReplayWriter {
+    public:
+        PwriteReplayWriter(int fd, ReplayWriteClient *client,
+                unsigned int max_in_flight) : requests(max_in_flight) {
+            unsigned int n_threads;
+
+            fd_ = fd;
+            client_ = client;
+
+            n_threads = max_in_flight;
+            if (n_threads > MAX_PWRITE_THREADS) {
+                n_threads = MAX_PWRITE_THREADS;
+            }
+
+            for (unsigned int i = 0; i < n_threads; i++) {
+                workers.push_back(new WorkerThread(this));
+            }
+        }
+
+        /* a request with no buffer tells one worker to exit */
+        ~PwriteReplayWriter( ) {
+            WriteRequest req;
+
+            memset(&req, 0, sizeof(req));
+            for (size_t i = 0; i < workers.size( ); i++) {
+                requests.put(req);
+            }
+
+            for (size_t i = 0; i < workers.size( ); i++) {
+                workers[i]->join( );
+                delete workers[i];
+            }
+        }
+
+        void write(timecode_t tc, const void *buf, size_t length,
+                off64_t offset) {
+            WriteRequest req;
+            req.tc = tc;
+            req.buf = buf;
+            req.length = length;
+            req.offset = offset;
+            requests.put(req);
+        }
+
+        const char *engine_name( ) { return "pwrite"; }
+
+    protected:
+        struct WriteRequest {
+            timecode_t tc;
+            const void *buf;
+            size_t length;
+            off64_t offset;
+        };
+
+        class WorkerThread : public Thread {
+            public:
+                WorkerThread(PwriteReplayWriter *writer) {
+                    writer_ = writer;
+                    start_thread( );
+                }
+
+                void join( ) {
+                    join_thread( );
+                }
+
+            protected:
+                void run_thread( ) {
+                    writer_->run_worker( );
+                }
+
+                PwriteReplayWriter *writer_;
+        };
+
+        void run_worker( ) {
+            WriteRequest req;
+            ssize_t ret;
+            size_t done;
+            int error;
+
+            for (;;) {
+                req = requests.get( );
+                if (req.buf == NULL) {
+                    return;
+                }
+
+                done = 0;
+                error = 0;
+
+                while (done < req.length) {
+                    ret = pwrite(fd_, (const uint8_t *) req.buf + done,
+                            req.length - done, req.offset + done);
+                    if (ret < 0 && errno == EINTR) {
+                        continue;
+                    } else if (ret < 0) {
+                        error = errno;
+                        break;
+                    } else if (ret == 0) {
+                        error = EIO;
+                        break;
+                    }
+                    done += ret;
+                }
+
+                client_->write_done(req.tc, error);
+            }
+        }
+
+        Pipe<WriteRequest> requests;
+        std::vector<WorkerThread *> workers;
+        int fd_;
+        ReplayWriteClient *client_;
+};
+
+#ifdef ENABLE_IO_URING
+/*
+ * io_uring engine: the caller's thread queues and submits writes,
+ * a reaper thread waits for completions.
+ */
+class IoUringReplayWriter : public ReplayWriter, public Thread {
+    public:
+        IoUringReplayWriter(int fd, ReplayWriteClient *client,
+                unsigned int max_in_flight) {
+            int ret;
+
+            fd_ = fd;
+            client_ = client;
+            reaper_error = 0;
+
+            ret = io_uring_queue_init(max_in_flight, &ring, 0);
+            if (ret < 0) {
+                throw POSIXError("io_uring_queue_init", -ret);
+            }
+
+            start_thread( );
+        }
+
+        /* 
+         * A no-op tagged STOP_TC tells the reaper to exit. Queueing it
+         * only fails while the rings are backed up, which the reaper 
+         * clears, so keep trying until it goes in or the reaper has
+         * stopped on its own.
+         */
+        ~IoUringReplayWriter( ) {
+            struct io_uring_sqe *sqe;
+            bool queued = false, reported = false;
+            int ret;
+
+            for (;;) {
+                { MutexLock l(m);
+                    if (reaper_error != 0) {
+                        break;
+                    }
+
+                    if (!queued) {
+                        sqe = io_uring_get_sqe(&ring);
+                        if (sqe != NULL) {
+                            io_uring_prep_nop(sqe);
+                            io_uring_sqe_set_data(sqe, 
+                                    (void *) (intptr_t) STOP_TC);
+                            queued = true;
+                        }
+                    }
+
+                    /* this also pushes out anything left queued */
+                    ret = io_uring_submit(&ring);
+                }
+
+                if (queued && ret >= 0) {
+                    break;
+                }
+
+                if (ret < 0 && !reported) {
+                    fprintf(stderr, "io_uring: cannot stop reaper yet: %s\n",
+                            strerror(-ret));
+                    reported = true;
+                }
+                usleep(1000);
+            }
+
+            join_thread( );
+            io_uring_queue_exit(&ring);
+        }
+
+        void write(timecode_t tc, const void *buf, size_t length,
+                off64_t offset) {
+            struct io_uring_sqe *sqe;
+            int ret, error;
+
+            { MutexLock l(m);
+                error = reaper_error;
+                if (error == 0) {
+                    sqe = io_uring_get_sqe(&ring);
+                    if (sqe == NULL) {
+                        throw std::runtime_error(
+                                "io_uring submission queue full");
+                    }
+
+                    io_uring_prep_write(sqe, fd_, buf, length, offset);
+                    io_uring_sqe_set_data(sqe, (void *) (intptr_t) tc);
+                    /* keep the length so short writes can be caught */
+                    in_flight[tc] = length;
+
+                    ret = io_uring_submit(&ring);
+                    if (ret < 0) {
+                        in_flight.erase(tc);
+                        throw POSIXError("io_uring_submit", -ret);
+                    }
+                }
+            }
+
+            /* nothing is reaping completions any more */
+            if (error != 0) {
+                client_->write_done(tc, error);
+            }
+        }
+
+        const char *engine_name( ) { return "io_uring"; }
+
+    protected:
+        /* timecodes of real frames are never negative */
+        enum { STOP_TC = -1 };
+
+        void run_thread( ) {
+            struct io_uring_cqe *cqe;
+            std::map<timecode_t, size_t>::iterator i;
+            std::map<timecode_t, size_t> lost;
+            timecode_t tc;
+            size_t length;
+            int ret, error;
+
+            for (;;) {
+                ret = io_uring_wait_cqe(&ring, &cqe);
+                if (ret == -EINTR) {
+                    continue;
+                } else if (ret < 0) {
+                    /* 
+                     * we can't tell which writes finished; fail them 
+                     * all, and any that come later
+                     */
+                    fprintf(stderr, "io_uring_wait_cqe: %s\n", 
+                            strerror(-ret));
+
+                    { MutexLock l(m);
+                        reaper_error = -ret;
+                        lost.swap(in_flight);
+                    }
+
+                    for (i = lost.begin( ); i != lost.end( ); i++) {
+                        client_->write_done(i->first, -ret);
+                    }
+                    return;
+                }
+
+                tc = (timecode_t) (intptr_t) io_uring_cqe_get_data(cqe);
+                if (tc == STOP_TC) {
+                    io_uring_cqe_seen(&ring, cqe);
+                    return;
+                }
+
+                { MutexLock l(m);
+                    length = in_flight[tc];
+                    in_flight.erase(tc);
+                }
+
+                if (cqe->res < 0) {
+                    error = -cqe->res;
+                } else if ((size_t) cqe->res != length) {
+                    error = EIO;
+                } else {
+                    error = 0;
+                }
+
+                io_uring_cqe_seen(&ring, cqe);
+                client_->write_done(tc, error);
+            }
+        }
+
+        struct io_uring ring;
+        /* lengths of the writes submitted and not yet reaped */
+        std::map<timecode_t, size_t> in_flight;
+        /* set if the reaper gave up; writes fail from then on */
+        int reaper_error;
+        Mutex m;
+        int fd_;
+        ReplayWriteClient *client_;
+};
+#endif
+
+ReplayWriter *ReplayWriter::create(int fd, ReplayWriteClient *client,
+        unsigned int max_in_flight) {
+#ifdef ENABLE_IO_URING
+    if (max_in_flight <= 1024) {
+        try {
+            return new IoUringReplayWriter(fd, client, max_in_flight);
+        } catch (POSIXError &e) {
+            fprintf(stderr, "io_uring unavailable, using pwrite threads\n");
+        }
+    }
+#endif
+
+    return new PwriteReplayWriter(fd, client, max_in_flight);
+}
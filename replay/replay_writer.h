@@ -0,0 +1,65 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ *
+ * This file is part of openreplay.
+ *
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _REPLAY_WRITER_H
+#define _REPLAY_WRITER_H
+
+#include "replay_data.h"
+
+#include <sys/types.h>
+
+/*
+ * Receives completion notices from a ReplayWriter.
+ * write_done( ) is called from one of the writer's threads.
+ */
+class ReplayWriteClient {
+    public:
+        virtual ~ReplayWriteClient( ) { }
+
+        /* error is zero on success, or an errno value */
+        virtual void write_done(timecode_t tc, int error) = 0;
+};
+
+/*
+ * Asynchronous write engine for ReplayBuffer's WRITE_DIRECT mode.
+ *
+ * Writes go to a file descriptor opened with O_DIRECT, so buffers,
+ * offsets and lengths must all be aligned to DIRECT_ALIGN bytes.
+ * The caller is responsible for bounding the number of writes in
+ * flight; write( ) itself does not block for long.
+ *
+ * If built with ENABLE_IO_URING, create( ) tries io_uring first and falls
+ * back to a pool of threads calling pwrite( ) if the kernel lacks it.
+ */
+class ReplayWriter {
+    public:
+        enum { DIRECT_ALIGN = 4096 };
+
+        static ReplayWriter *create(int fd, ReplayWriteClient *client,
+                unsigned int max_in_flight);
+
+        virtual ~ReplayWriter( ) { }
+
+        virtual void write(timecode_t tc, const void *buf, size_t length,
+                off64_t offset) = 0;
+
+        virtual const char *engine_name( ) = 0;
+};
+
+#endif
@@ -10,6 +10,9 @@ replay_replay_test_OBJECTS = \
     $(display_surface_OBJECTS) \
     $(graphics_OBJECTS) \
     replay/replay_buffer.o \
+    replay/replay_writer.o \
+    replay/replay_striped_buffer.o \
+    replay/replay_frame_cache.o \
     replay/replay_ingest.o \
     replay/replay_mjpeg_ingest.o \
     replay/replay_preview.o \
@@ -28,17 +31,28 @@ replay_replay_so_OBJECTS = \
 	$(graphics_OBJECTS) \
         $(avspipe_OBJECTS) \
 	replay/replay_buffer.o \
+	replay/replay_writer.o \
+	replay/replay_striped_buffer.o \
+	replay/replay_frame_cache.o \
 	replay/replay_ingest.o \
         replay/replay_mjpeg_ingest.o \
 	replay/replay_preview.o \
 	replay/replay_playout.o \
 	replay/replay_multiviewer.o \
 	replay/replay_frame_extractor.o \
+	replay/replay_batch_decoder.o \
+	replay/replay_clip_recoder.o \
         replay/replay_gamedata.o \
 	replay/replay_global.rbo 
 
+# set ENABLE_IO_URING=1 in local.mk to build the io_uring write engine
+ifeq ($(ENABLE_IO_URING),1)
+CXXFLAGS += -DENABLE_IO_URING
+replay_LIBS += -luring
+endif
+
 replay/replay.so: $(replay_replay_so_OBJECTS)
 	# maybe???
-	$(CXX) $(LDFLAGS) -shared -o $@ $^ -ljpeg -ldl -pthread $(graphics_LIBS)
+	$(CXX) $(LDFLAGS) -shared -o $@ $^ -ljpeg -ldl -pthread $(graphics_LIBS) $(replay_LIBS)
 
 all_TARGETS += replay/replay.so
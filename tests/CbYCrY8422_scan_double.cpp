@@ -20,14 +20,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "raw_frame.h"
 #include "posix_util.h"
 #include "cpu_dispatch.h"
 
+/* usage: CbYCrY8422_scan_double [-n (no SIMD)] [-l (interpolate)] */
 int main(int argc, char **argv) {
-    if (argc > 1 && strcmp(argv[1], "-n") == 0) {
-        cpu_force_no_simd( );
+    bool linear = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0) {
+            cpu_force_no_simd( );
+        } else if (strcmp(argv[i], "-l") == 0) {
+            linear = true;
+        }
     }
 
     /* Read 540p frames on stdin; dump 1080p frames on stdout... */
@@ -43,7 +51,9 @@ int main(int argc, char **argv) {
         } else if (ret == 0) {
             break;
         } else {
-            RawFrame *out = frame.convert->CbYCrY8422_scan_double( );
+            RawFrame *out = linear 
+                ? frame.convert->CbYCrY8422_scan_double_linear( )
+                : frame.convert->CbYCrY8422_scan_double( );
 
             if (out->write_to_fd(STDOUT_FILENO) < 0) {
                 perror("write_to_fd");
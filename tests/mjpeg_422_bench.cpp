@@ -0,0 +1,356 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ *
+ * This file is part of openreplay.
+ *
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Codec benchmark. Encodes and decodes a 1080p UYVY frame (scaled to
+ * each resolution) across qualities, thread counts, decode scales and
+ * with SIMD on and off (or at each SIMD level the CPU has, with -m
+ * tiers), and prints the results as JSON on stdout:
+ * frames per second, median and 99th percentile latency, bytes per
+ * frame and PSNR against the source.
+ *
+ * usage: mjpeg_422_bench [-i iterations] [-r 1920x1080,1280x720,...]
+ *          [-q 50,70,90] [-t 1,2,4] [-s 1,2,4] 
+ *          [-m both|simd|nosimd|tiers]
+ *          < frame.uyvy
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "mjpeg_codec.h"
+#include "raw_frame.h"
+#include "cpu_dispatch.h"
+
+struct resolution {
+    coord_t w, h;
+};
+
+struct timing {
+    double fps, p50_ms, p99_ms;
+};
+
+static double now_ms( ) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static const char *simd_level_name(cpu_simd_level level) {
+    switch (level) {
+        case CPU_SIMD_SSE2:
+            return "sse2";
+        case CPU_SIMD_AVX2:
+            return "avx2";
+        case CPU_SIMD_AVX512:
+            return "avx512";
+        default:
+            return "none";
+    }
+}
+
+static void usage( ) {
+    fprintf(stderr, "usage: mjpeg_422_bench [-i iterations] "
+            "[-r WxH,...] [-q quality,...] [-t threads,...] "
+            "[-s scale_down,...] [-m both|simd|nosimd|tiers] "
+            "< frame.uyvy\n");
+    exit(1);
+}
+
+static void parse_list(const char *arg, std::vector<int> &out) {
+    char *end;
+
+    out.clear( );
+    for (;;) {
+        out.push_back(strtol(arg, &end, 10));
+        if (end == arg || out.back( ) <= 0) {
+            usage( );
+        } else if (*end == ',') {
+            arg = end + 1;
+        } else if (*end == '\0') {
+            return;
+        } else {
+            usage( );
+        }
+    }
+}
+
+static void parse_resolutions(const char *arg,
+        std::vector<resolution> &out) {
+    resolution r;
+    int w, h, n;
+
+    out.clear( );
+    for (;;) {
+        if (sscanf(arg, "%dx%d%n", &w, &h, &n) != 2 || w <= 0 || h <= 0) {
+            usage( );
+        }
+
+        /* the codec needs whole 16x8 blocks */
+        if (w % 16 != 0 || h % 8 != 0 || w > 1920 || h > 1080) {
+            fprintf(stderr, "%dx%d: width must be a multiple of 16, "
+                    "height a multiple of 8, and no more than "
+                    "1920x1080\n", w, h);
+            exit(1);
+        }
+
+        r.w = w;
+        r.h = h;
+        out.push_back(r);
+        arg += n;
+
+        if (*arg == ',') {
+            arg++;
+        } else if (*arg == '\0') {
+            return;
+        } else {
+            usage( );
+        }
+    }
+}
+
+/*
+ * Nearest-neighbor resample of a CbYCrY frame, a pixel pair at a time
+ * so chroma stays with its luma.
+ */
+static RawFrame *resample(RawFrame *src, coord_t w, coord_t h) {
+    RawFrame *out = new RawFrame(w, h, RawFrame::CbYCrY8422);
+    uint8_t *dst, *s;
+
+    for (coord_t y = 0; y < h; y++) {
+        s = src->scanline(y * src->h( ) / h);
+        dst = out->scanline(y);
+        for (coord_t x = 0; x < w / 2; x++) {
+            memcpy(dst + 4 * x, s + 4 * (x * src->w( ) / w), 4);
+        }
+    }
+
+    return out;
+}
+
+static void psnr(RawFrame *a, RawFrame *b, double &luma, double &chroma) {
+    double se[2] = { 0, 0 }, mse, *out[2] = { &chroma, &luma };
+    size_t n[2] = { 0, 0 };
+    int d;
+
+    for (coord_t y = 0; y < a->h( ); y++) {
+        uint8_t *pa = a->scanline(y), *pb = b->scanline(y);
+        /* CbYCrY: odd bytes are luma */
+        for (coord_t x = 0; x < 2 * a->w( ); x++) {
+            d = pa[x] - pb[x];
+            se[x & 1] += d * d;
+            n[x & 1]++;
+        }
+    }
+
+    for (int i = 0; i < 2; i++) {
+        mse = se[i] / n[i];
+        /* identical planes would be infinite; JSON has no infinity */
+        *out[i] = (mse == 0) ? 100.0 : 10.0 * log10(255.0 * 255.0 / mse);
+    }
+}
+
+static void summarize(std::vector<double> &times, timing &t) {
+    double total = 0;
+
+    for (size_t i = 0; i < times.size( ); i++) {
+        total += times[i];
+    }
+
+    std::sort(times.begin( ), times.end( ));
+    t.fps = times.size( ) * 1000.0 / total;
+    t.p50_ms = times[times.size( ) / 2];
+    t.p99_ms = times[(times.size( ) * 99 - 1) / 100];
+}
+
+static void print_timing(const timing &t) {
+    printf("\"fps\": %.2f, \"p50_ms\": %.3f, \"p99_ms\": %.3f",
+            t.fps, t.p50_ms, t.p99_ms);
+}
+
+/* print one result object for a resolution, quality and thread count */
+static void run_config(RawFrame *frame, int quality, int threads,
+        cpu_simd_level simd, const std::vector<int> &scales, 
+        int iterations) {
+    Mjpeg422Encoder enc(frame->w( ), frame->h( ), quality,
+            4 * frame->w( ) * frame->h( ), threads);
+    Mjpeg422Decoder dec(frame->w( ), frame->h( ), threads);
+    std::vector<double> times(iterations);
+    double start, psnr_y, psnr_c;
+    RawFrame *decoded;
+    timing t;
+
+    /* warm up, and keep the image for the decode runs */
+    enc.encode(frame);
+    for (int i = 0; i < iterations; i++) {
+        start = now_ms( );
+        enc.encode(frame);
+        times[i] = now_ms( ) - start;
+    }
+    summarize(times, t);
+
+    decoded = dec.decode(enc.get_data( ), enc.get_data_size( ));
+    psnr(frame, decoded, psnr_y, psnr_c);
+    delete decoded;
+
+    printf("\n    {\n      \"width\": %d, \"height\": %d, "
+            "\"quality\": %d, \"threads\": %d, \"simd\": %s, "
+            "\"simd_level\": \"%s\",\n",
+            frame->w( ), frame->h( ), quality, threads,
+            simd != CPU_SIMD_NONE ? "true" : "false", 
+            simd_level_name(simd));
+    printf("      \"bytes_per_frame\": %lu, \"psnr_y\": %.2f, "
+            "\"psnr_c\": %.2f,\n", (unsigned long) enc.get_data_size( ),
+            psnr_y, psnr_c);
+    printf("      \"encode\": { ");
+    print_timing(t);
+    printf(" },\n      \"decode\": [");
+
+    for (size_t ci = 0; ci < scales.size( ); ci++) {
+        for (int i = 0; i < iterations; i++) {
+            start = now_ms( );
+            delete dec.decode(enc.get_data( ), enc.get_data_size( ),
+                    scales[ci]);
+            times[i] = now_ms( ) - start;
+        }
+        summarize(times, t);
+
+        printf("%s\n        { \"scale_down\": %d, ",
+                ci == 0 ? "" : ",", scales[ci]);
+        print_timing(t);
+        printf(" }");
+    }
+
+    printf("\n      ]\n    }");
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    int iterations = 100;
+    std::vector<resolution> resolutions;
+    std::vector<int> qualities, threads, scales;
+    std::vector<cpu_simd_level> simd_modes;
+    cpu_simd_level level, last_level = CPU_SIMD_NONE;
+    resolution r;
+    bool first = true;
+    int opt;
+
+    r.w = 1920; r.h = 1080; resolutions.push_back(r);
+    r.w = 1280; r.h = 720; resolutions.push_back(r);
+    r.w = 720; r.h = 480; resolutions.push_back(r);
+    qualities.push_back(50);
+    qualities.push_back(70);
+    qualities.push_back(90);
+    threads.push_back(1);
+    threads.push_back(2);
+    threads.push_back(4);
+    scales.push_back(1);
+    scales.push_back(2);
+    scales.push_back(4);
+    simd_modes.push_back(CPU_SIMD_AVX512);
+    simd_modes.push_back(CPU_SIMD_NONE);
+
+    while ((opt = getopt(argc, argv, "i:r:q:t:s:m:")) != -1) {
+        switch (opt) {
+            case 'i':
+                iterations = atoi(optarg);
+                if (iterations <= 0) {
+                    usage( );
+                }
+                break;
+            case 'r':
+                parse_resolutions(optarg, resolutions);
+                break;
+            case 'q':
+                parse_list(optarg, qualities);
+                break;
+            case 't':
+                parse_list(optarg, threads);
+                break;
+            case 's':
+                parse_list(optarg, scales);
+                break;
+            case 'm':
+                simd_modes.clear( );
+                if (strcmp(optarg, "both") == 0) {
+                    simd_modes.push_back(CPU_SIMD_AVX512);
+                    simd_modes.push_back(CPU_SIMD_NONE);
+                } else if (strcmp(optarg, "simd") == 0) {
+                    simd_modes.push_back(CPU_SIMD_AVX512);
+                } else if (strcmp(optarg, "nosimd") == 0) {
+                    simd_modes.push_back(CPU_SIMD_NONE);
+                } else if (strcmp(optarg, "tiers") == 0) {
+                    simd_modes.push_back(CPU_SIMD_AVX512);
+                    simd_modes.push_back(CPU_SIMD_AVX2);
+                    simd_modes.push_back(CPU_SIMD_SSE2);
+                    simd_modes.push_back(CPU_SIMD_NONE);
+                } else {
+                    usage( );
+                }
+                break;
+            default:
+                usage( );
+        }
+    }
+
+    RawFrame source(1920, 1080, RawFrame::CbYCrY8422);
+    if (source.read_from_fd(STDIN_FILENO) <= 0) {
+        perror("read_from_fd");
+        exit(1);
+    }
+
+    printf("{\n  \"iterations\": %d,\n  \"results\": [", iterations);
+
+    for (size_t si = 0; si < simd_modes.size( ); si++) {
+        /* frames made from here on get the routines for this mode */
+        cpu_limit_simd(simd_modes[si]);
+        level = cpu_best_simd( );
+
+        /* the CPU tops out below this tier, so it was just run */
+        if (si > 0 && level == last_level) {
+            continue;
+        }
+        last_level = level;
+
+        for (size_t ri = 0; ri < resolutions.size( ); ri++) {
+            r = resolutions[ri];
+            RawFrame *frame = resample(&source, r.w, r.h);
+
+            for (size_t ti = 0; ti < threads.size( ); ti++) {
+                for (size_t qi = 0; qi < qualities.size( ); qi++) {
+                    printf("%s", first ? "" : ",");
+                    run_config(frame, qualities[qi], threads[ti],
+                            level, scales, iterations);
+                    first = false;
+                }
+            }
+
+            delete frame;
+        }
+    }
+
+    printf("\n  ]\n}\n");
+}
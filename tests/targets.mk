@@ -5,32 +5,35 @@ test_mjpeg_422_encode_OBJECTS = \
 	$(common_OBJECTS) \
 	$(mjpeg_OBJECTS) \
 	$(raw_frame_OBJECTS) \
+	$(thread_OBJECTS) \
 	tests/mjpeg_422_encode.o
 
 tests/mjpeg_422_encode: $(test_mjpeg_422_encode_OBJECTS)
-	$(CXX) $(LDFLAGS) -o $@ $^ -ljpeg
+	$(CXX) $(LDFLAGS) -o $@ $^ -ljpeg -pthread
 
 all_TARGETS += tests/mjpeg_422_encode    
 
-test_mjpeg_422_encode_bench_OBJECTS = \
+test_mjpeg_422_bench_OBJECTS = \
 	$(common_OBJECTS) \
 	$(mjpeg_OBJECTS) \
 	$(raw_frame_OBJECTS) \
-	tests/mjpeg_422_encode_bench.o
+	$(thread_OBJECTS) \
+	tests/mjpeg_422_bench.o
 
-tests/mjpeg_422_encode_bench: $(test_mjpeg_422_encode_bench_OBJECTS)
-	$(CXX) $(LDFLAGS) -o $@ $^ -ljpeg
+tests/mjpeg_422_bench: $(test_mjpeg_422_bench_OBJECTS)
+	$(CXX) $(LDFLAGS) -o $@ $^ -ljpeg -pthread
 
-all_TARGETS += tests/mjpeg_422_encode_bench
+all_TARGETS += tests/mjpeg_422_bench
 
 test_mjpeg_422_decode_OBJECTS = \
 	$(common_OBJECTS) \
 	$(mjpeg_OBJECTS) \
 	$(raw_frame_OBJECTS) \
+	$(thread_OBJECTS) \
 	tests/mjpeg_422_decode.o
 
 tests/mjpeg_422_decode: $(test_mjpeg_422_decode_OBJECTS)
-	$(CXX) $(LDFLAGS) -o $@ $^ -ljpeg
+	$(CXX) $(LDFLAGS) -o $@ $^ -ljpeg -pthread
 
 all_TARGETS += tests/mjpeg_422_decode_scaled    
 
@@ -38,91 +41,88 @@ test_mjpeg_422_decode_scaled_OBJECTS = \
 	$(common_OBJECTS) \
 	$(mjpeg_OBJECTS) \
 	$(raw_frame_OBJECTS) \
+	$(thread_OBJECTS) \
 	tests/mjpeg_422_decode_scaled.o
 
 tests/mjpeg_422_decode_scaled: $(test_mjpeg_422_decode_scaled_OBJECTS)
-	$(CXX) $(LDFLAGS) -o $@ $^ -ljpeg
+	$(CXX) $(LDFLAGS) -o $@ $^ -ljpeg -pthread
 
 all_TARGETS += tests/mjpeg_422_decode_scaled    
 
-test_mjpeg_422_decode_bench_OBJECTS = \
-	$(common_OBJECTS) \
-	$(mjpeg_OBJECTS) \
-	$(raw_frame_OBJECTS) \
-	tests/mjpeg_422_decode_bench.o
-
-tests/mjpeg_422_decode_bench: $(test_mjpeg_422_decode_bench_OBJECTS)
-	$(CXX) $(LDFLAGS) -o $@ $^ -ljpeg
-
-all_TARGETS += tests/mjpeg_422_decode_bench
-
 test_CbYCrY8422_scan_double_OBJECTS = \
 	$(common_OBJECTS) \
 	$(raw_frame_OBJECTS) \
+	$(thread_OBJECTS) \
 	tests/CbYCrY8422_scan_double.o
 
 tests/CbYCrY8422_scan_double: $(test_CbYCrY8422_scan_double_OBJECTS)
-	$(CXX) $(LDFLAGS) -o $@ $^
+	$(CXX) $(LDFLAGS) -o $@ $^ -pthread
 
 all_TARGETS += tests/CbYCrY8422_scan_double    
 
 test_CbYCrY8422_alpha_BGRAn8_OBJECTS = \
 	$(common_OBJECTS) \
 	$(raw_frame_OBJECTS) \
+	$(thread_OBJECTS) \
 	tests/CbYCrY8422_alpha_BGRAn8.o
 
 tests/CbYCrY8422_alpha_BGRAn8: $(test_CbYCrY8422_alpha_BGRAn8_OBJECTS)
-	$(CXX) $(LDFLAGS) -o $@ $^
+	$(CXX) $(LDFLAGS) -o $@ $^ -pthread
 
 all_TARGETS += tests/CbYCrY8422_alpha_BGRAn8    
 
 test_CbYCrY8422_BGRAn8_OBJECTS = \
 	$(common_OBJECTS) \
 	$(raw_frame_OBJECTS) \
+	$(thread_OBJECTS) \
 	tests/CbYCrY8422_BGRAn8.o
 
 tests/CbYCrY8422_BGRAn8: $(test_CbYCrY8422_BGRAn8_OBJECTS)
-	$(CXX) $(LDFLAGS) -o $@ $^
+	$(CXX) $(LDFLAGS) -o $@ $^ -pthread
 
 all_TARGETS += tests/CbYCrY8422_BGRAn8
 
 test_CbYCrY8422_BGRAn8_scale_1_4_OBJECTS = \
 	$(common_OBJECTS) \
 	$(raw_frame_OBJECTS) \
+	$(thread_OBJECTS) \
 	tests/CbYCrY8422_BGRAn8_scale_1_4.o
 
 tests/CbYCrY8422_BGRAn8_scale_1_4: $(test_CbYCrY8422_BGRAn8_scale_1_4_OBJECTS)
-	$(CXX) $(LDFLAGS) -o $@ $^
+	$(CXX) $(LDFLAGS) -o $@ $^ -pthread
 
 all_TARGETS += tests/CbYCrY8422_BGRAn8_scale_1_4
 
 test_CbYCrY8422_BGRAn8_scale_1_2_OBJECTS = \
 	$(common_OBJECTS) \
 	$(raw_frame_OBJECTS) \
+	$(thread_OBJECTS) \
 	tests/CbYCrY8422_BGRAn8_scale_1_2.o
 
 tests/CbYCrY8422_BGRAn8_scale_1_2: $(test_CbYCrY8422_BGRAn8_scale_1_2_OBJECTS)
-	$(CXX) $(LDFLAGS) -o $@ $^
+	$(CXX) $(LDFLAGS) -o $@ $^ -pthread
 
 all_TARGETS += tests/CbYCrY8422_BGRAn8_scale_1_2
 
 test_stretch_OBJECTS = \
 	$(common_OBJECTS) \
 	$(raw_frame_OBJECTS) \
+	$(thread_OBJECTS) \
 	tests/stretch.o
 
 tests/stretch: $(test_stretch_OBJECTS)
-	$(CXX) $(LDFLAGS) -o $@ $^
+	$(CXX) $(LDFLAGS) -o $@ $^ -pthread
 
 all_TARGETS += tests/stretch    
 
 test_scan_triple_OBJECTS = \
 	$(common_OBJECTS) \
 	$(raw_frame_OBJECTS) \
+	$(thread_OBJECTS) \
 	tests/scan_triple.o
 
 tests/scan_triple: $(test_scan_triple_OBJECTS)
-	$(CXX) $(LDFLAGS) -o $@ $^
+	$(CXX) $(LDFLAGS) -o $@ $^ -pthread
 
 all_TARGETS += tests/scan_triple    
 
@@ -198,6 +198,7 @@ all_TARGETS += tests/decklink_key
 test_rsvg_frame_OBJECTS = \
 	$(common_OBJECTS) \
 	$(raw_frame_OBJECTS) \
+	$(thread_OBJECTS) \
 	$(graphics_OBJECTS) \
 	tests/test_rsvg_frame.o
 
@@ -19,6 +19,8 @@
 
 #include "condition.h"
 #include <stdexcept>
+#include <errno.h>
+#include <time.h>
 
 Condition::Condition( ) {
     if (pthread_cond_init(&cond, NULL) != 0) {
@@ -40,6 +42,31 @@ void Condition::wait(Mutex &mut) {
     mut.thread_acquired( );
 }
 
+bool Condition::timed_wait(Mutex &mut, unsigned int msec) {
+    struct timespec deadline;
+    int ret;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += msec / 1000;
+    deadline.tv_nsec += (msec % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    mut.thread_released( );
+    ret = pthread_cond_timedwait(&cond, &mut.mut, &deadline);
+    mut.thread_acquired( );
+
+    if (ret == ETIMEDOUT) {
+        return false;
+    } else if (ret != 0) {
+        throw std::runtime_error("Failed to wait on condition variable");
+    }
+
+    return true;
+}
+
 void Condition::signal( ) {
     if (pthread_cond_signal(&cond) != 0) {
         throw std::runtime_error("Failed to signal condition variable");
@@ -29,6 +29,8 @@ class Condition {
         ~Condition( );
 
         void wait(Mutex &mut);
+        /* returns false if msec passed without a signal */
+        bool timed_wait(Mutex &mut, unsigned int msec);
         void signal( );
         void broadcast( );
 
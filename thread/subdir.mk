@@ -2,4 +2,5 @@ thread_OBJECTS = \
 	thread/mutex.o \
 	thread/condition.o \
     thread/thread.o \
+	thread/worker_pool.o \
 
@@ -0,0 +1,155 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ *
+ * This file is part of openreplay.
+ *
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "worker_pool.h"
+#include <stdexcept>
+
+class WorkerPool::Worker : public Thread {
+    public:
+        Worker(WorkerPool *pool_, unsigned int thread_) {
+            pool = pool_;
+            thread = thread_;
+            start_thread( );
+        }
+
+        void join( ) {
+            join_thread( );
+        }
+
+    protected:
+        void run_thread( ) {
+            pool->worker_loop(thread);
+        }
+
+        WorkerPool *pool;
+        unsigned int thread;
+};
+
+WorkerPool::WorkerPool(unsigned int n_threads) {
+    job = NULL;
+    n_items = 0;
+    next_item = 0;
+    items_done = 0;
+    generation = 0;
+    shutdown = false;
+    failed = false;
+
+    for (unsigned int i = 1; i < n_threads; i++) {
+        workers.push_back(new Worker(this, i));
+    }
+}
+
+WorkerPool::~WorkerPool( ) {
+    { MutexLock l(m);
+        shutdown = true;
+        start_c.broadcast( );
+    }
+
+    for (unsigned int i = 0; i < workers.size( ); i++) {
+        workers[i]->join( );
+        delete workers[i];
+    }
+}
+
+void WorkerPool::run(Job *job_, unsigned int n_items_) {
+    MutexLock rl(run_m);
+
+    { MutexLock l(m);
+        job = job_;
+        n_items = n_items_;
+        next_item = 0;
+        items_done = 0;
+        failed = false;
+        generation++;
+        start_c.broadcast( );
+    }
+
+    run_items(0);
+
+    { MutexLock l(m);
+        while (items_done < n_items) {
+            done_c.wait(m);
+        }
+
+        job = NULL;
+
+        if (failed) {
+            throw std::runtime_error(error);
+        }
+    }
+}
+
+void WorkerPool::worker_loop(unsigned int thread) {
+    unsigned long seen = 0;
+
+    for (;;) {
+        { MutexLock l(m);
+            while (!shutdown && generation == seen) {
+                start_c.wait(m);
+            }
+
+            if (shutdown) {
+                return;
+            }
+
+            seen = generation;
+        }
+
+        run_items(thread);
+    }
+}
+
+/* take items off the current job until there are none left */
+void WorkerPool::run_items(unsigned int thread) {
+    unsigned int item;
+    Job *j;
+
+    for (;;) {
+        { MutexLock l(m);
+            if (job == NULL || next_item >= n_items) {
+                return;
+            }
+            item = next_item++;
+            j = job;
+        }
+
+        try {
+            j->run_item(item, thread);
+        } catch (std::exception &e) {
+            MutexLock l(m);
+            if (!failed) {
+                failed = true;
+                error = e.what( );
+            }
+        } catch (...) {
+            MutexLock l(m);
+            if (!failed) {
+                failed = true;
+                error = "unknown exception in worker thread";
+            }
+        }
+
+        { MutexLock l(m);
+            items_done++;
+            if (items_done == n_items) {
+                done_c.broadcast( );
+            }
+        }
+    }
+}
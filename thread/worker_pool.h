@@ -0,0 +1,78 @@
+/*
+ * Copyright 2011 Exavideo LLC.
+ *
+ * This file is part of openreplay.
+ *
+ * openreplay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * openreplay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openreplay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WORKER_POOL_H
+#define _WORKER_POOL_H
+
+#include "thread.h"
+#include "mutex.h"
+#include "condition.h"
+
+#include <vector>
+#include <string>
+
+/*
+ * A fixed set of threads that split up the items of a job. The thread
+ * calling run( ) does items too, so a pool of n threads starts n - 1 of
+ * its own. Jobs get the number of the thread running each item (0 for
+ * the caller) so they can keep per-thread state.
+ */
+class WorkerPool {
+    public:
+        class Job {
+            public:
+                virtual ~Job( ) { }
+                virtual void run_item(unsigned int item,
+                        unsigned int thread) = 0;
+        };
+
+        WorkerPool(unsigned int n_threads);
+        ~WorkerPool( );
+
+        unsigned int n_threads( ) { return workers.size( ) + 1; }
+
+        /*
+         * Run items 0 to n_items - 1 of job and wait for all of them.
+         * If any item throws, the rest are still run, then the first
+         * error is rethrown as a std::runtime_error.
+         */
+        void run(Job *job, unsigned int n_items);
+
+    protected:
+        class Worker;
+        std::vector<Worker *> workers;
+
+        void worker_loop(unsigned int thread);
+        void run_items(unsigned int thread);
+
+        /* one job at a time */
+        Mutex run_m;
+
+        Mutex m;
+        Condition start_c, done_c;
+
+        Job *job;
+        unsigned int n_items, next_item, items_done;
+        unsigned long generation;
+        bool shutdown;
+        bool failed;
+        std::string error;
+};
+
+#endif